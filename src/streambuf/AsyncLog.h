@@ -0,0 +1,449 @@
+/*!\file AsyncLog.h
+  \brief Asynchronous dmsg logging: lock free ring and background writer
+
+  \par Purpose:
+  Threads writing to std::cout share one stream lock and their output
+  interleaves. With AsyncLog every thread writes into its own
+  asyncDmsg (a buffered dmsg, see dmsg.h). Each std::endl / flush
+  publishes what the thread wrote since the last one as a single record
+  into a lock free multi producer / single consumer ring. One background
+  writer thread drains the ring into a large buffer and writes it out
+  with as few write() calls as it can.
+
+  When the ring is full the overflow policy decides:
+  <ul>
+  <li>OVERFLOW_BLOCK - the producer waits for room (nothing is lost)</li>
+  <li>OVERFLOW_DROP - the record is dropped and counted</li>
+  <li>OVERFLOW_COUNT - dropped and counted, and the writer puts a
+  "[AsyncLog: N records dropped]" line into the output where they
+  went missing</li>
+  </ul>
+  AsyncLog::flush() is a barrier: it returns once everything published
+  before the call has been written.
+
+  \par Example:
+  AsyncLog log(STDOUT_FILENO);<br>
+  (in each thread)<br>
+  asyncDmsg d(log);<br>
+  std::ostream out(&d);<br>
+  out << "task " << n << " done" << std::endl;<br>
+*/
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "dmsg.h"
+
+///Lock free MPSC record ring drained by a background writer
+class AsyncLog
+{
+public:
+  ///what publish() does when the ring is full
+  enum overflow_policy
+  {
+    OVERFLOW_BLOCK = 0,
+    OVERFLOW_DROP,
+    OVERFLOW_COUNT
+  };
+
+  ///observable counters (see getStats())
+  struct log_stats
+  {
+    unsigned long records;
+    unsigned long bytes;
+    unsigned long dropped;
+
+    ///times a producer had to wait for room (OVERFLOW_BLOCK)
+    unsigned long blocked;
+
+    ///write() calls made by the writer and the largest one
+    unsigned long writes;
+    unsigned long max_write;
+  };
+
+private:
+  ///ring slot: a record takes one or more consecutive slots
+  struct slot
+  {
+    ///position + 1 once the producer has filled the slot
+    std::atomic<unsigned long> seq;
+
+    ///bytes used in data
+    unsigned int len;
+
+    unsigned int pad;
+
+    char data[112];
+  };
+
+public:
+  ///constructor -starts the writer thread
+  AsyncLog(int fd = STDOUT_FILENO, size_t slots = 16384,
+	   overflow_policy policy = OVERFLOW_BLOCK, size_t batch = 256 * 1024)
+    : m_fd(fd), m_policy(policy), m_head(0), m_tail(0), m_written(0),
+      m_stop(false), m_sleeping(false), m_flush_waiters(0),
+      m_records(0), m_bytes(0), m_dropped(0), m_unreported(0), m_blocked(0),
+      m_writes(0), m_max_write(0)
+  {
+    /**
+       \param fd where the output goes
+       \param slots ring size in 112 byte slots (rounded up to a power of 2)
+       \param policy what happens when the ring is full
+       \param batch writer buffer size (bytes per write() at most)
+    */
+    m_capacity = 2;
+    while(m_capacity < slots)
+      m_capacity <<= 1;
+    m_mask = m_capacity - 1;
+
+    m_slots = new slot[m_capacity];
+    for(size_t n = 0; n < m_capacity; n++)
+      m_slots[n].seq.store(0, std::memory_order_relaxed);
+
+    m_batch_size = batch < 4096 ? 4096 : batch;
+    m_batch = new char[m_batch_size];
+
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_writer_cond, NULL);
+    pthread_cond_init(&m_flush_cond, NULL);
+
+    pthread_create(&m_writer, NULL, writerMain, (void *)this);
+  }
+
+  ///destructor -writes everything published, stops the writer
+  ~AsyncLog()
+  {
+    pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    pthread_cond_signal(&m_writer_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_writer, NULL);
+
+    pthread_cond_destroy(&m_flush_cond);
+    pthread_cond_destroy(&m_writer_cond);
+    pthread_mutex_destroy(&m_mutex);
+
+    delete [] m_batch;
+    delete [] m_slots;
+  }
+
+  ///publish one record (the pieces are kept together)
+  bool publish(const struct iovec *iov, int cnt)
+  {
+    /**
+       \return false if the record was dropped (ring full and the
+       policy is not OVERFLOW_BLOCK)
+
+       \note a record larger than the whole ring is cut to fit
+    */
+    size_t len = 0;
+    for(int k = 0; k < cnt; k++)
+      len += iov[k].iov_len;
+    if(len == 0)
+      return true;
+
+    size_t payload = sizeof(m_slots[0].data);
+    size_t n = (len + payload - 1) / payload;
+    if(n > m_capacity)
+      {
+	n = m_capacity;
+	len = n * payload;
+      }
+
+    //reserve n consecutive positions
+    unsigned long pos = m_tail.load(std::memory_order_relaxed);
+    bool waited = false;
+    for(;;)
+      {
+	unsigned long head = m_head.load(std::memory_order_acquire);
+	if(pos + n - head > m_capacity)
+	  {
+	    if(m_policy != OVERFLOW_BLOCK)
+	      {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		if(m_policy == OVERFLOW_COUNT)
+		  m_unreported.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	      }
+
+	    //full: make sure the writer is draining, then wait a bit
+	    if(!waited)
+	      m_blocked.fetch_add(1, std::memory_order_relaxed);
+	    waited = true;
+	    wakeWriter();
+	    sched_yield();
+	    pos = m_tail.load(std::memory_order_relaxed);
+	    continue;
+	  }
+
+	if(m_tail.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+	  break;
+      }
+
+    //copy the pieces into the slots, publishing each slot as it fills
+    int k = 0;
+    size_t off = 0;
+    size_t left = len;
+    for(size_t s = 0; s < n; s++)
+      {
+	slot &sl = m_slots[(pos + s) & m_mask];
+	size_t fill = 0;
+	while(fill < payload && left > 0)
+	  {
+	    size_t take = iov[k].iov_len - off;
+	    if(take > payload - fill)
+	      take = payload - fill;
+	    if(take > left)
+	      take = left;
+	    memcpy(sl.data + fill, (const char *)iov[k].iov_base + off, take);
+	    fill += take;
+	    off += take;
+	    left -= take;
+	    if(off == iov[k].iov_len)
+	      {
+		k++;
+		off = 0;
+	      }
+	  }
+	sl.len = fill;
+	sl.seq.store(pos + s + 1, std::memory_order_release);
+      }
+
+    m_records.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(len, std::memory_order_relaxed);
+
+    //only a parked writer needs a signal
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleeping.load(std::memory_order_relaxed))
+      wakeWriter();
+
+    return true;
+  }
+
+  ///barrier: wait until everything published so far is written
+  void flush()
+  {
+    /** \note flush the calling thread's asyncDmsg first (std::flush)
+	or its buffered part is not "published so far".
+    */
+    unsigned long target = m_tail.load(std::memory_order_acquire);
+
+    pthread_mutex_lock(&m_mutex);
+    m_flush_waiters++;
+    pthread_cond_signal(&m_writer_cond);
+    while(m_written.load(std::memory_order_acquire) < target)
+      pthread_cond_wait(&m_flush_cond, &m_mutex);
+    m_flush_waiters--;
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  ///copy out the counters
+  void getStats(log_stats *out)
+  {
+    out->records = m_records.load(std::memory_order_relaxed);
+    out->bytes = m_bytes.load(std::memory_order_relaxed);
+    out->dropped = m_dropped.load(std::memory_order_relaxed);
+    out->blocked = m_blocked.load(std::memory_order_relaxed);
+    out->writes = m_writes.load(std::memory_order_relaxed);
+    out->max_write = m_max_write.load(std::memory_order_relaxed);
+  }
+
+private:
+  ///signal the writer thread
+  void wakeWriter()
+  {
+    pthread_mutex_lock(&m_mutex);
+    pthread_cond_signal(&m_writer_cond);
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  ///move published slots into the batch buffer, return bytes taken
+  size_t drain()
+  {
+    size_t used = 0;
+    unsigned long head = m_head.load(std::memory_order_relaxed);
+
+    //COUNT policy: say where records went missing
+    unsigned long lost = m_unreported.exchange(0, std::memory_order_relaxed);
+    if(lost != 0)
+      used = snprintf(m_batch, m_batch_size, "[AsyncLog: %lu records dropped]\n", lost);
+
+    while(used + sizeof(m_slots[0].data) <= m_batch_size)
+      {
+	slot &sl = m_slots[head & m_mask];
+	if(sl.seq.load(std::memory_order_acquire) != head + 1)
+	  break;
+
+	memcpy(m_batch + used, sl.data, sl.len);
+	used += sl.len;
+	head++;
+
+	//the slot may be reused as soon as head moves past it
+	m_head.store(head, std::memory_order_release);
+      }
+
+    return used;
+  }
+
+  ///write() the whole batch
+  void writeBatch(size_t len)
+  {
+    size_t off = 0;
+    while(off < len)
+      {
+	ssize_t w = write(m_fd, m_batch + off, len - off);
+	if(w < 0)
+	  {
+	    if(errno == EINTR)
+	      continue;
+	    break;	//nowhere to report it: drop the batch
+	  }
+	off += w;
+      }
+
+    m_writes.fetch_add(1, std::memory_order_relaxed);
+    if(len > m_max_write.load(std::memory_order_relaxed))
+      m_max_write.store(len, std::memory_order_relaxed);
+  }
+
+  ///background writer: drain, write, park when idle
+  static void *writerMain(void *arg)
+  {
+    AsyncLog *log = (AsyncLog *)arg;
+
+    for(;;)
+      {
+	size_t len = log->drain();
+	if(len > 0)
+	  {
+	    log->writeBatch(len);
+
+	    //everything up to head is on its way to the fd now
+	    log->m_written.store(log->m_head.load(std::memory_order_relaxed),
+				 std::memory_order_release);
+
+	    pthread_mutex_lock(&log->m_mutex);
+	    if(log->m_flush_waiters > 0)
+	      pthread_cond_broadcast(&log->m_flush_cond);
+	    pthread_mutex_unlock(&log->m_mutex);
+	    continue;
+	  }
+
+	pthread_mutex_lock(&log->m_mutex);
+
+	//nothing published: done if stopping and nothing is reserved
+	if(log->m_stop && log->m_head.load() == log->m_tail.load())
+	  {
+	    pthread_mutex_unlock(&log->m_mutex);
+	    break;
+	  }
+
+	if(log->m_flush_waiters > 0)
+	  {
+	    //a flush target may already be reached (nothing to write)
+	    pthread_cond_broadcast(&log->m_flush_cond);
+	  }
+
+	//park (recheck after announcing it, see publish())
+	log->m_sleeping.store(true, std::memory_order_seq_cst);
+	slot &next = log->m_slots[log->m_head.load(std::memory_order_relaxed) & log->m_mask];
+	if(next.seq.load(std::memory_order_seq_cst) != log->m_head.load(std::memory_order_relaxed) + 1
+	   && !log->m_stop)
+	  {
+	    struct timespec ts;
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    ts.tv_nsec += 10000000L;
+	    ts.tv_sec += ts.tv_nsec / 1000000000L;
+	    ts.tv_nsec %= 1000000000L;
+	    pthread_cond_timedwait(&log->m_writer_cond, &log->m_mutex, &ts);
+	  }
+	log->m_sleeping.store(false, std::memory_order_relaxed);
+
+	pthread_mutex_unlock(&log->m_mutex);
+      }
+
+    return NULL;
+  }
+
+private:
+  ///output and policy
+  int m_fd;
+  overflow_policy m_policy;
+
+  ///the ring
+  slot *m_slots;
+  size_t m_capacity;
+  size_t m_mask;
+
+  ///consumer position, next free position, last position written
+  alignas(64) std::atomic<unsigned long> m_head;
+  alignas(64) std::atomic<unsigned long> m_tail;
+  alignas(64) std::atomic<unsigned long> m_written;
+
+  ///writer buffer
+  char *m_batch;
+  size_t m_batch_size;
+
+  ///writer thread, parking and flush barrier
+  pthread_t m_writer;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_writer_cond;
+  pthread_cond_t m_flush_cond;
+  bool m_stop;
+  std::atomic<bool> m_sleeping;
+  int m_flush_waiters;
+
+  ///counters
+  std::atomic<unsigned long> m_records;
+  std::atomic<unsigned long> m_bytes;
+  std::atomic<unsigned long> m_dropped;
+  std::atomic<unsigned long> m_unreported;
+  std::atomic<unsigned long> m_blocked;
+  std::atomic<unsigned long> m_writes;
+  std::atomic<unsigned long> m_max_write;
+};
+
+/**
+   \brief A thread's stream into an AsyncLog
+
+   \note
+   One per thread (it is not thread safe itself). Everything between
+   two flushes (std::endl, std::flush) is one record, as long as it
+   fits the buffer; longer output is published a buffer at a time.
+*/
+class asyncDmsg : public dmsg
+{
+public:
+  asyncDmsg(AsyncLog &log, size_t size = 4096) : m_log(log)
+  {
+    buffered(size, false, -1);
+  }
+
+  ///publish what is left (before dmsg's destructor could try the fd)
+  virtual ~asyncDmsg() { sync(); }
+
+protected:
+  ///records go to the ring instead of the file descriptor
+  virtual int emit(struct iovec *iov, int cnt)
+  {
+    //a dropped record is the policy at work, not a stream error
+    m_log.publish(iov, cnt);
+    return 0;
+  }
+
+private:
+  AsyncLog &m_log;
+};
+
+#endif //ASYNCLOG_H
@@ -0,0 +1,179 @@
+/*!\file asyncLog.cc
+  \brief AsyncLog example and timing
+
+  \par Purpose:
+  A number of threads each write log lines, first through the shared
+  std::cout and then through their own asyncDmsg into one AsyncLog
+  (see AsyncLog.h). The lines go to a file; afterwards every line is
+  checked to be whole (not torn by another thread's output). The time
+  per line of both and the AsyncLog counters go to stdout.
+
+  A last run uses a tiny ring with the OVERFLOW_COUNT policy to show
+  the drop accounting.
+
+  \par Usage:
+  asyncLog [threads] [lines per thread] [output file]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <fcntl.h>
+
+#include "AsyncLog.h"
+
+///what each writer thread gets
+struct writer_args
+{
+  AsyncLog *log;	//NULL: use std::cout
+  int id;
+  long lines;
+};
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///write the log lines
+void *writer(void *arg)
+{
+  writer_args *a = (writer_args *)arg;
+
+  if(a->log == NULL)
+    {
+      for(long n = 0; n < a->lines; n++)
+	std::cout << "thread " << a->id << " line " << n
+		  << " status=ok payload=abcdefghijklmnopqrstuvwxyz" << std::endl;
+      return NULL;
+    }
+
+  asyncDmsg d(*a->log);
+  std::ostream out(&d);
+  for(long n = 0; n < a->lines; n++)
+    out << "thread " << a->id << " line " << n
+	<< " status=ok payload=abcdefghijklmnopqrstuvwxyz" << std::endl;
+  return NULL;
+}
+
+///run threads writers, return elapsed ns
+long long run(int threads, long lines, AsyncLog *log)
+{
+  pthread_t *tids = new pthread_t[threads];
+  writer_args *args = new writer_args[threads];
+
+  long long start = now();
+  for(int t = 0; t < threads; t++)
+    {
+      args[t].log = log;
+      args[t].id = t;
+      args[t].lines = lines;
+      pthread_create(&tids[t], NULL, writer, (void *)&args[t]);
+    }
+  for(int t = 0; t < threads; t++)
+    pthread_join(tids[t], NULL);
+  if(log != NULL)
+    log->flush();
+  else
+    std::cout.flush();
+  long long ns = now() - start;
+
+  delete [] args;
+  delete [] tids;
+  return ns;
+}
+
+///count whole and torn lines in file
+void check(const char *file, long *whole, long *torn, long *notes)
+{
+  std::ifstream in(file);
+  std::string line;
+  *whole = *torn = *notes = 0;
+  while(std::getline(in, line))
+    {
+      if(line.compare(0, 10, "[AsyncLog:") == 0)
+	(*notes)++;
+      else if(line.compare(0, 7, "thread ") == 0 &&
+	      line.size() > 26 &&
+	      line.compare(line.size() - 26, 26, "abcdefghijklmnopqrstuvwxyz") == 0 &&
+	      line.find("thread ", 1) == std::string::npos)
+	(*whole)++;
+      else
+	(*torn)++;
+    }
+}
+
+///print the AsyncLog counters
+void showStats(AsyncLog &log)
+{
+  AsyncLog::log_stats s;
+  log.getStats(&s);
+  std::cout << "  records=" << s.records << "|bytes=" << s.bytes
+	    << "|dropped=" << s.dropped << "|blocked=" << s.blocked
+	    << "|writes=" << s.writes << "|max_write=" << s.max_write << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  int threads = (argc > 1) ? atoi(argv[1]) : 8;
+  long lines = (argc > 2) ? atol(argv[2]) : 20000;
+  const char *file = (argc > 3) ? argv[3] : "/tmp/asyncLog.out";
+  long whole, torn, notes;
+  long long ns;
+
+  std::cout << threads << " threads x " << lines << " lines -> " << file << std::endl;
+
+  //std::cout redirected to the file
+  {
+    int saved = dup(STDOUT_FILENO);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::cout.flush();
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    ns = run(threads, lines, NULL);
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+  }
+  check(file, &whole, &torn, &notes);
+  std::cout << "std::cout: ns/line=" << (double)ns / (threads * lines)
+	    << "|whole=" << whole << "|torn=" << torn << std::endl;
+  long long base = ns;
+
+  //AsyncLog, blocking when full
+  {
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    {
+      AsyncLog log(fd);
+      ns = run(threads, lines, &log);
+      showStats(log);
+    }
+    close(fd);
+  }
+  check(file, &whole, &torn, &notes);
+  std::cout << "AsyncLog (block): ns/line=" << (double)ns / (threads * lines)
+	    << "|speedup=" << (double)base / ns << "x"
+	    << "|whole=" << whole << "|torn=" << torn << std::endl;
+
+  //tiny ring that counts its drops
+  {
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    {
+      AsyncLog log(fd, 16, AsyncLog::OVERFLOW_COUNT);
+      ns = run(threads, lines, &log);
+      showStats(log);
+    }
+    close(fd);
+  }
+  check(file, &whole, &torn, &notes);
+  std::cout << "AsyncLog (16 slots, count): ns/line=" << (double)ns / (threads * lines)
+	    << "|whole=" << whole << "|torn=" << torn
+	    << "|drop notes=" << notes << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,598 @@
+/*!\file binLog.h
+  \brief Binary log records with deferred formatting
+
+  \par Purpose:
+  out << "xxx " << 123 << " yyy" converts every argument to text while
+  the program is busy. BINLOG() instead writes a small format id and
+  the raw bytes of its arguments into a streambuf (a buffered dmsg, an
+  mmapBuf, a std::filebuf ...). The text is produced later, offline,
+  by binLogDecode (or binLogReader).
+
+  Every call site registers its printf style format string once, while
+  static objects are initialized, so a record is a couple of memcpy()s
+  into the put area. Format strings registered at run time (dlopen())
+  still work: the writer notices new ids and puts their definitions
+  into the stream before the first record that uses them.
+
+  \par Stream layout (native byte order):
+  <ul>
+  <li>header: "DMSGBIN1", uint32 0x01020304 (byte order check)</li>
+  <li>definition: uint32 0, uint32 id, uint16 length + argument type
+  codes, uint16 length + format string, uint16 length + file, uint32 line</li>
+  <li>record: uint32 id, arguments (strings: uint16 length + bytes)</li>
+  </ul>
+
+  \par Example:
+  dmsg d;<br>
+  d.buffered(65536, false, fd);<br>
+  binLog log(&d);<br>
+  BINLOG(log, "task %d finished: status=%u elapsed=%.1fus", n, status, us);<br>
+*/
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <type_traits>
+#include <pthread.h>
+
+///Process wide table of registered format strings
+class binLogFormats
+{
+public:
+  ///one registered call site
+  struct format
+  {
+    const char *fmt;
+
+    ///argument type codes (see binLogCode())
+    const char *sig;
+
+    const char *file;
+    unsigned int line;
+  };
+
+  ///add a call site, return its id (1, 2, ...)
+  static unsigned int add(const char *fmt, const char *sig, const char *file, unsigned int line)
+  {
+    pthread_mutex_lock(&lock());
+    table().push_back(format{fmt, sig, file, line});
+    unsigned int id = (unsigned int)table().size();
+    pthread_mutex_unlock(&lock());
+    return id;
+  }
+
+  ///number of registered formats
+  static unsigned int count()
+  {
+    pthread_mutex_lock(&lock());
+    unsigned int n = (unsigned int)table().size();
+    pthread_mutex_unlock(&lock());
+    return n;
+  }
+
+  ///copy of format id (false if unknown)
+  static bool get(unsigned int id, format *out)
+  {
+    pthread_mutex_lock(&lock());
+    bool ok = id >= 1 && id <= table().size();
+    if(ok)
+      *out = table()[id - 1];
+    pthread_mutex_unlock(&lock());
+    return ok;
+  }
+
+private:
+  //function local statics: usable from any static initializer
+  static std::vector<format> &table()
+  {
+    static std::vector<format> t;
+    return t;
+  }
+
+  static pthread_mutex_t &lock()
+  {
+    static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    return m;
+  }
+};
+
+///type code of a loggable argument type
+template<typename T>
+constexpr char binLogCode()
+{
+  /** \note an unsupported type does not compile (see the static_assert) */
+  typedef typename std::decay<T>::type U;
+  if constexpr(std::is_same<U, char>::value)
+    return 'c';
+  else if constexpr(std::is_same<U, bool>::value)
+    return 'B';
+  else if constexpr(std::is_same<U, const char *>::value || std::is_same<U, char *>::value
+		    || std::is_same<U, std::string>::value)
+    return 's';
+  else if constexpr(std::is_pointer<U>::value)
+    return 'p';
+  else if constexpr(std::is_floating_point<U>::value)
+    return 'd';	//stored as double
+  else if constexpr(std::is_enum<U>::value)
+    return binLogCode<typename std::underlying_type<U>::type>();	//is_signed is false for enums
+  else if constexpr(std::is_integral<U>::value)
+    return std::is_signed<U>::value ? "?bh?i???l"[sizeof(U)] : "?BH?I???L"[sizeof(U)];
+  else
+    {
+      static_assert(std::is_integral<U>::value, "BINLOG: unsupported argument type");
+      return '?';
+    }
+}
+
+///bytes a fixed size type code takes in a record (0: string)
+inline size_t binLogSize(char code)
+{
+  switch(code)
+    {
+    case 'c': case 'b': case 'B': return 1;
+    case 'h': case 'H': return 2;
+    case 'i': case 'I': return 4;
+    case 'l': case 'L': case 'd': case 'p': return 8;
+    default: return 0;
+    }
+}
+
+///argument signature of a call site, a compile time string
+template<typename... Args>
+struct binLogSig
+{
+  static constexpr char str[] = {binLogCode<Args>()..., 0};
+};
+
+/**
+   \brief the id of call site Site with arguments Args
+
+   \note
+   A static data member of a class template: it is initialized (the
+   format registered) with the other static objects, before main().
+   A record written from another static initializer that happens to
+   run first still sees 0 and registers the site itself (see
+   binLog::record()).
+*/
+template<typename Site, typename... Args>
+struct binLogSite
+{
+  static const unsigned int id;
+};
+
+template<typename Site, typename... Args>
+const unsigned int binLogSite<Site, Args...>::id =
+  binLogFormats::add(Site::fmt(), binLogSig<Args...>::str, Site::file(), Site::line());
+
+///Writes binary log records into a streambuf
+class binLog
+{
+public:
+  ///constructor -writes the header and the formats known so far
+  binLog(std::streambuf *sb) : m_sb(sb), m_defined(0)
+  {
+    uint32_t order = 0x01020304;
+    m_sb->sputn("DMSGBIN1", 8);
+    m_sb->sputn((const char *)&order, 4);
+    define();
+  }
+
+  ///write one record (use BINLOG())
+  template<typename Site, typename... Args>
+  void record(const Args &... args)
+  {
+    unsigned int id = binLogSite<Site, typename std::decay<Args>::type...>::id;
+    if(id == 0)
+      {
+	//used before static initialization got to it
+	static const unsigned int late =
+	  binLogFormats::add(Site::fmt(), binLogSig<typename std::decay<Args>::type...>::str,
+			     Site::file(), Site::line());
+	id = late;
+      }
+    if(id > m_defined)
+      define();
+
+    //fixed size arguments are staged, so a plain record is one sputn()
+    char stage[256];
+    char *p = stage;
+    uint32_t id32 = id;
+    memcpy(p, &id32, 4);
+    p += 4;
+    (put(stage, p, args), ...);
+    m_sb->sputn(stage, p - stage);
+  }
+
+  ///the streambuf written to
+  std::streambuf *rdbuf() { return m_sb; }
+
+private:
+  ///write the definitions of formats not written yet
+  void define()
+  {
+    binLogFormats::format f;
+    unsigned int n = binLogFormats::count();
+    for(unsigned int id = m_defined + 1; id <= n; id++)
+      {
+	if(!binLogFormats::get(id, &f))
+	  break;
+	uint32_t zero = 0, id32 = id, line = f.line;
+	m_sb->sputn((const char *)&zero, 4);
+	m_sb->sputn((const char *)&id32, 4);
+	putString(f.sig);
+	putString(f.fmt);
+	putString(f.file);
+	m_sb->sputn((const char *)&line, 4);
+      }
+    m_defined = n;
+  }
+
+  ///uint16 length and the bytes
+  void putString(const char *s, size_t len = (size_t)-1)
+  {
+    if(len == (size_t)-1)
+      len = s ? strlen(s) : 0;
+    uint16_t n = len > 0xffff ? 0xffff : (uint16_t)len;
+    m_sb->sputn((const char *)&n, 2);
+    m_sb->sputn(s, n);
+  }
+
+  ///stage a fixed size argument
+  template<typename T>
+  void put(char *stage, char *&p, const T &v)
+  {
+    typedef typename std::decay<T>::type U;
+    if constexpr(binLogCode<U>() == 's')
+      {
+	//strings leave straight from the caller's memory
+	m_sb->sputn(stage, p - stage);
+	p = stage;
+	if constexpr(std::is_same<U, std::string>::value)
+	  putString(v.data(), v.size());
+	else
+	  putString(v);
+      }
+    else
+      {
+	if(p + 8 > stage + 256)
+	  {
+	    m_sb->sputn(stage, p - stage);
+	    p = stage;
+	  }
+	if constexpr(binLogCode<U>() == 'd')
+	  {
+	    double d = v;
+	    memcpy(p, &d, 8);
+	    p += 8;
+	  }
+	else if constexpr(binLogCode<U>() == 'p')
+	  {
+	    uint64_t a = (uintptr_t)v;
+	    memcpy(p, &a, 8);
+	    p += 8;
+	  }
+	else
+	  {
+	    memcpy(p, &v, sizeof(U));
+	    p += sizeof(U);
+	  }
+      }
+  }
+
+private:
+  std::streambuf *m_sb;
+
+  ///highest format id already in the stream
+  unsigned int m_defined;
+};
+
+/**
+   \brief log text (a printf format) and the arguments to log (a binLog)
+
+   \note
+   The local struct gives every call site its own binLogSite and so
+   its own format id. text must be a string literal.
+*/
+#define BINLOG(log, text, ...)						\
+  do									\
+    {									\
+      struct binlog_site						\
+      {									\
+	static const char *fmt() { return text; }			\
+	static const char *file() { return __FILE__; }			\
+	static unsigned int line() { return __LINE__; }			\
+      };								\
+      (log).template record<binlog_site>(__VA_ARGS__);				\
+    } while(0)
+
+///Reads a binary log stream back and renders the records as text
+class binLogReader
+{
+public:
+  binLogReader(std::istream &in) : m_in(in), m_bad(false) {}
+
+  ///check the header
+  bool start()
+  {
+    /** \return false if this is not a binary log of this byte order */
+    char magic[8];
+    uint32_t order;
+    if(!read(magic, 8) || memcmp(magic, "DMSGBIN1", 8) != 0)
+      return false;
+    if(!read(&order, 4) || order != 0x01020304)
+      return false;
+    return true;
+  }
+
+  ///render the next record into line (definitions are absorbed)
+  bool next(std::string &line)
+  {
+    /** \return false at the end of the stream (or if it is damaged,
+	see damaged())
+    */
+    for(;;)
+      {
+	uint32_t id;
+	if(!read(&id, 4))
+	  return false;
+
+	if(id == 0)
+	  {
+	    if(!readDefinition())
+	      return false;
+	    continue;
+	  }
+
+	if(id > m_formats.size() || m_formats[id - 1].fmt.empty())
+	  {
+	    //without the definition the record length is unknown
+	    m_bad = true;
+	    return false;
+	  }
+	return render(m_formats[id - 1], line);
+      }
+  }
+
+  ///true if the stream ended inside a record or had an unknown or bad id
+  bool damaged() const { return m_bad; }
+
+private:
+  ///a definition as read from the stream
+  struct definition
+  {
+    std::string sig;
+    std::string fmt;
+    std::string file;
+    uint32_t line;
+  };
+
+  bool read(void *p, size_t n)
+  {
+    m_in.read((char *)p, n);
+    if((size_t)m_in.gcount() == n)
+      return true;
+    if(m_in.gcount() != 0)
+      m_bad = true;
+    return false;
+  }
+
+  bool readString(std::string &s)
+  {
+    uint16_t n;
+    if(!read(&n, 2))
+      return false;
+    s.resize(n);
+    return n == 0 || read(&s[0], n);
+  }
+
+  bool readDefinition()
+  {
+    uint32_t id;
+    definition d;
+    if(!read(&id, 4) || !readString(d.sig) || !readString(d.fmt) ||
+       !readString(d.file) || !read(&d.line, 4))
+      {
+	m_bad = true;
+	return false;
+      }
+    if(id == 0)
+      {
+	m_bad = true;
+	return false;
+      }
+    if(id > m_formats.size())
+      m_formats.resize(id);
+    m_formats[id - 1] = d;
+    return true;
+  }
+
+  ///printf the format with the record's arguments
+  bool render(const definition &d, std::string &line)
+  {
+    char buf[512];
+    size_t arg = 0;
+    line.clear();
+
+    for(size_t k = 0; k < d.fmt.size(); k++)
+      {
+	if(d.fmt[k] != '%')
+	  {
+	    line += d.fmt[k];
+	    continue;
+	  }
+	if(k + 1 < d.fmt.size() && d.fmt[k + 1] == '%')
+	  {
+	    line += '%';
+	    k++;
+	    continue;
+	  }
+
+	//flags, width and precision are kept; length and conversion follow the argument
+	std::string spec = "%";
+	size_t j = k + 1;
+	bool missing = false;
+	for(; j < d.fmt.size() && strchr("-+ #0123456789.*", d.fmt[j]); j++)
+	  {
+	    if(d.fmt[j] != '*')
+	      {
+		spec += d.fmt[j];
+		continue;
+	      }
+
+	    //a '*' width or precision is the next argument, printed into spec
+	    long long v;
+	    if(arg >= d.sig.size())
+	      {
+		missing = true;
+		continue;
+	      }
+	    if(!readStar(d.sig[arg++], &v))
+	      {
+		m_bad = true;
+		return false;
+	      }
+	    if(spec[spec.size() - 1] == '.' && v < 0)
+	      spec.erase(spec.size() - 1);	//negative precision: none
+	    else
+	      spec += std::to_string(v);
+	  }
+	while(j < d.fmt.size() && strchr("hlLqjzt", d.fmt[j]))
+	  j++;
+	char conv = j < d.fmt.size() ? d.fmt[j] : 'd';
+	k = j;
+
+	if(missing || arg >= d.sig.size())
+	  {
+	    line += "<missing>";
+	    continue;
+	  }
+	if(!renderArg(d.sig[arg++], spec, conv, buf, sizeof(buf)))
+	  {
+	    m_bad = true;
+	    return false;
+	  }
+	line += buf;
+      }
+
+    //arguments the format did not use still have to be read past
+    while(arg < d.sig.size())
+      if(!renderArg(d.sig[arg++], "%", 'd', buf, sizeof(buf)))
+	{
+	  m_bad = true;
+	  return false;
+	}
+    return true;
+  }
+
+  ///read the argument a '*' stands for (0 if it is not an integer)
+  bool readStar(char code, long long *v)
+  {
+    char buf[32];
+    if(!renderArg(code, "%", 'd', buf, sizeof(buf)))
+      return false;
+    *v = (code == 's' || code == 'd') ? 0 : strtoll(buf, NULL, 10);
+
+    //the output is cut to 512 bytes anyway
+    if(*v > 511)
+      *v = 511;
+    else if(*v < -511)
+      *v = -511;
+    return true;
+  }
+
+  ///read one argument of type code and print it per spec / conv
+  bool renderArg(char code, std::string spec, char conv, char *buf, size_t size)
+  {
+    if(code == 's')
+      {
+	std::string s;
+	if(!readString(s))
+	  return false;
+	spec += 's';
+	snprintf(buf, size, spec.c_str(), s.c_str());
+	return true;
+      }
+
+    unsigned char raw[8];
+    size_t n = binLogSize(code);
+    if(n == 0 || !read(raw, n))
+      return false;
+
+    if(code == 'd')
+      {
+	double v;
+	memcpy(&v, raw, 8);
+	spec += strchr("eEfFgGaA", conv) ? conv : 'g';
+	snprintf(buf, size, spec.c_str(), v);
+	return true;
+      }
+
+    //integers: widen to 64 bits
+    long long sv = 0;
+    unsigned long long uv = 0;
+    switch(code)
+      {
+      case 'c': sv = (char)raw[0]; break;
+      case 'b': { int8_t v; memcpy(&v, raw, 1); sv = v; } break;
+      case 'B': uv = raw[0]; break;
+      case 'h': { int16_t v; memcpy(&v, raw, 2); sv = v; } break;
+      case 'H': { uint16_t v; memcpy(&v, raw, 2); uv = v; } break;
+      case 'i': { int32_t v; memcpy(&v, raw, 4); sv = v; } break;
+      case 'I': { uint32_t v; memcpy(&v, raw, 4); uv = v; } break;
+      case 'l': { int64_t v; memcpy(&v, raw, 8); sv = v; } break;
+      case 'L': case 'p': { uint64_t v; memcpy(&v, raw, 8); uv = v; } break;
+      }
+    bool is_signed = strchr("cbhil", code) != NULL;
+
+    if(conv == 'c')
+      {
+	spec += 'c';
+	snprintf(buf, size, spec.c_str(), (int)(is_signed ? sv : uv));
+      }
+    else if(code == 'p' || conv == 'p')
+      {
+	spec += "llx";
+	snprintf(buf, size, ("0x" + spec).c_str(), is_signed ? (unsigned long long)sv : uv);
+      }
+    else if(strchr("xXou", conv))
+      {
+	spec += "ll";
+	spec += conv;
+	snprintf(buf, size, spec.c_str(), is_signed ? (unsigned long long)sv : uv);
+      }
+    else if(strchr("eEfFgGaA", conv))
+      {
+	spec += conv;
+	snprintf(buf, size, spec.c_str(), is_signed ? (double)sv : (double)uv);
+      }
+    else if(is_signed)
+      {
+	spec += "lld";
+	snprintf(buf, size, spec.c_str(), sv);
+      }
+    else
+      {
+	spec += "llu";
+	snprintf(buf, size, spec.c_str(), uv);
+      }
+    return true;
+  }
+
+private:
+  std::istream &m_in;
+
+  ///definitions by id - 1
+  std::vector<definition> m_formats;
+
+  ///stream ended early or had an unknown id
+  bool m_bad;
+};
+
+#endif //BINLOG_H
@@ -0,0 +1,46 @@
+/*!\file binLogDecode.cc
+  \brief Renders a binary log (see binLog.h) as text
+
+  \par Usage:
+  binLogDecode [file] (standard input without one)
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "binLog.h"
+
+int main(int argc, char **argv)
+{
+  std::ifstream file;
+  if(argc > 1)
+    {
+      file.open(argv[1], std::ios::in | std::ios::binary);
+      if(!file)
+	{
+	  std::cerr << argv[1] << ": cannot open" << std::endl;
+	  return 1;
+	}
+    }
+  std::istream &in = (argc > 1) ? file : std::cin;
+
+  binLogReader reader(in);
+  if(!reader.start())
+    {
+      std::cerr << "not a binary log (or written with another byte order)" << std::endl;
+      return 1;
+    }
+
+  std::string line;
+  while(reader.next(line))
+    std::cout << line << '\n';
+  std::cout.flush();
+
+  if(reader.damaged())
+    {
+      std::cerr << "binary log is truncated or damaged" << std::endl;
+      return 1;
+    }
+  return 0;
+}
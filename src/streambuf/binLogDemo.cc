@@ -0,0 +1,90 @@
+/*!\file binLogDemo.cc
+  \brief Binary log records against formatted text
+
+  \par Purpose:
+  Writes the same log lines as formatted text (out << ...) and as
+  BINLOG() records (see binLog.h), both through a buffered dmsg, and
+  prints the time per line of each. The binary log is left in a file
+  for binLogDecode; the first lines are decoded here as a check.
+
+  \par Usage:
+  binLogDemo [lines] [binary log file]
+*/
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <fstream>
+#include <fcntl.h>
+#include <time.h>
+
+#include "dmsg.h"
+#include "binLog.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+  long lines = (argc > 1) ? atol(argv[1]) : 1000000;
+  const char *path = (argc > 2) ? argv[2] : "/tmp/binLogDemo.bin";
+  std::string worker = "worker-3";
+  long long text, bin;
+
+  //formatted text, thrown away
+  {
+    int fd = open("/dev/null", O_WRONLY);
+    dmsg d;
+    d.buffered(65536, false, fd);
+    std::ostream out(&d);
+
+    long long start = now();
+    for(long n = 0; n < lines; n++)
+      out << "task " << n << " finished: status=" << (n & 7)
+	  << " elapsed=" << n * 0.25 << "us\n";
+    out.flush();
+    text = now() - start;
+    close(fd);
+  }
+
+  //binary records into the file
+  {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dmsg d;
+    d.buffered(65536, false, fd);
+    binLog log(&d);
+
+    BINLOG(log, "log of %ld lines written by %s", lines, worker);
+
+    long long start = now();
+    for(long n = 0; n < lines; n++)
+      BINLOG(log, "task %ld finished: status=%d elapsed=%gus", n, (int)(n & 7), n * 0.25);
+    d.pubsync();
+    bin = now() - start;
+    close(fd);
+  }
+
+  std::cout << "text: ns/line=" << (double)text / lines << std::endl;
+  std::cout << "binary: ns/line=" << (double)bin / lines
+	    << "|speedup=" << (double)text / bin << "x" << std::endl;
+
+  //decode the start again
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  binLogReader reader(in);
+  std::string line;
+  if(!reader.start())
+    {
+      std::cout << path << ": bad header" << std::endl;
+      return 1;
+    }
+  for(int k = 0; k < 4 && reader.next(line); k++)
+    std::cout << "  " << line << std::endl;
+  std::cout << "(binLogDecode " << path << " renders the rest)" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,253 @@
+/*!\file dmsg.h
+  \brief The dmsg streambuf (see streambuf.cc)
+
+  \par Purpose:
+  dmsg started out as the chapter 13 example of "The C++ Standard
+  Library" (Josuttis): a streambuf without a buffer whose overflow()
+  prints every character followed by a "|". That is still what a
+  plain dmsg does.
+
+  Calling buffered() switches it to a put area of a given size. Whole
+  strings then go through xsputn() in one pass, the "|" decoration
+  (if kept) is applied to a full buffer at a time and every buffer
+  reaches the file descriptor with a single write() / writev().
+*/
+
+#ifndef DMSG_H
+#define DMSG_H
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/uio.h>
+
+///Demonstration of streambuf inheritance
+class dmsg : public std::streambuf
+{
+public:
+  int i;
+  int *p;
+
+  /* no user provided constructor: "new dmsg()" still zero fills i and
+     p (see the variable demonstration in streambuf.cc)
+  */
+
+  ///flushes a buffered dmsg
+  virtual ~dmsg()
+  {
+    if(m_buf != NULL)
+      sync();
+    delete [] m_buf;
+    delete [] m_out;
+  }
+
+  ///switch to buffered output
+  bool buffered(size_t size = 8192, bool decorate = true, int fd = STDOUT_FILENO)
+  {
+    /**
+       \param size put area size in characters
+       \param decorate keep the "|" after every character
+       \param fd where buffers are written
+       \return false if size is 0 (the dmsg stays as it was)
+    */
+    if(size == 0)
+      return false;
+
+    if(m_buf != NULL)
+      sync();
+    delete [] m_buf;
+    delete [] m_out;
+
+    m_buf = new char[size];
+    m_size = size;
+    m_decorate = decorate;
+    m_fd = fd;
+
+    //decorated output is twice as long: expand into a second buffer
+    m_out = decorate ? new char[2 * size] : NULL;
+
+    //anything already in stdio must come out first
+    fflush(stdout);
+
+    setp(m_buf, m_buf + m_size);
+    return true;
+  }
+
+protected:
+  /**
+     \param c character from input (<<)
+
+     \par
+     Function override that evaluates each character the stream
+     operator (<<) recieves. This is a necessary function to print to
+     the output
+  */
+  virtual int_type overflow(int_type c)
+  {
+    if(m_buf != NULL)
+      {
+	//buffered: the put area is full
+	if(flush() < 0)
+	  return EOF;
+	if(c != EOF)
+	  {
+	    *pptr() = (char)c;
+	    pbump(1);
+	  }
+	return traits_type::not_eof(c);
+      }
+
+    if(c != EOF)
+      {
+	//! uses C function putchar() for output
+	if(putchar(c) == EOF)
+	  return EOF;
+
+	std::cout << "|";
+      }
+    return c;
+  }
+
+  ///bulk output: a whole string at once
+  virtual std::streamsize xsputn(const char *s, std::streamsize n)
+  {
+    if(m_buf == NULL)
+      return std::streambuf::xsputn(s, n);	//one overflow() per character
+
+    //fits: just copy
+    if(n <= epptr() - pptr())
+      {
+	memcpy(pptr(), s, n);
+	pbump((int)n);
+	return n;
+      }
+
+    /* bigger than what is left: the buffered part and the new string
+       leave together (undecorated: one writev(), no copy)
+    */
+    if(!m_decorate)
+      {
+	struct iovec iov[2];
+	iov[0].iov_base = pbase();
+	iov[0].iov_len = pptr() - pbase();
+	iov[1].iov_base = (void *)s;
+	iov[1].iov_len = n;
+	if(emit(iov, 2) < 0)
+	  return 0;
+	setp(m_buf, m_buf + m_size);
+	return n;
+      }
+
+    //decorated: fill, flush, repeat
+    std::streamsize done = 0;
+    while(done < n)
+      {
+	std::streamsize room = epptr() - pptr();
+	std::streamsize chunk = (n - done < room) ? n - done : room;
+	memcpy(pptr(), s + done, chunk);
+	pbump((int)chunk);
+	done += chunk;
+
+	if(pptr() == epptr() && flush() < 0)
+	  return done;
+      }
+    return n;
+  }
+
+  ///std::flush / std::endl: write out the put area
+  virtual int sync()
+  {
+    if(m_buf == NULL)
+      return 0;
+    return flush() < 0 ? -1 : 0;
+  }
+
+private:
+  ///write the put area (decorated if asked) and empty it
+  int flush()
+  {
+    size_t n = pptr() - pbase();
+    if(n == 0)
+      return 0;
+
+    struct iovec iov;
+    if(m_decorate)
+      {
+	//the per character "|" of the unbuffered dmsg, a buffer at a time
+	char *o = m_out;
+	for(size_t k = 0; k < n; k++)
+	  {
+	    *o++ = m_buf[k];
+	    *o++ = '|';
+	  }
+	iov.iov_base = m_out;
+	iov.iov_len = 2 * n;
+      }
+    else
+      {
+	iov.iov_base = m_buf;
+	iov.iov_len = n;
+      }
+
+    int ret = emit(&iov, 1);
+    setp(m_buf, m_buf + m_size);
+    return ret;
+  }
+
+protected:
+  ///hand finished output on (default: writev() it all to the fd)
+  virtual int emit(struct iovec *iov, int cnt)
+  {
+    /** \note the pieces are one unit: a subclass sending output
+	somewhere else must keep them together.
+    */
+    return writeAll(iov, cnt);
+  }
+
+  ///writev() until everything is out (short writes, EINTR)
+  int writeAll(struct iovec *iov, int cnt)
+  {
+    while(cnt > 0)
+      {
+	ssize_t w = writev(m_fd, iov, cnt);
+	if(w < 0)
+	  {
+	    if(errno == EINTR)
+	      continue;
+	    return -1;
+	  }
+
+	//drop what was written
+	while(cnt > 0 && (size_t)w >= iov->iov_len)
+	  {
+	    w -= iov->iov_len;
+	    iov++;
+	    cnt--;
+	  }
+	if(cnt > 0)
+	  {
+	    iov->iov_base = (char *)iov->iov_base + w;
+	    iov->iov_len -= w;
+	  }
+      }
+    return 0;
+  }
+
+private:
+  ///put area (NULL: unbuffered, the original behavior)
+  char *m_buf = NULL;
+  size_t m_size = 0;
+
+  ///expansion buffer for the decoration
+  char *m_out = NULL;
+
+  ///add "|" after every character
+  bool m_decorate = true;
+
+  ///output file descriptor
+  int m_fd = STDOUT_FILENO;
+};
+
+#endif //DMSG_H
@@ -0,0 +1,90 @@
+/*!\file dmsgBench.cc
+  \brief dmsg output benchmark
+
+  \par Purpose:
+  Writes the same log lines through an unbuffered dmsg (one virtual
+  overflow(), putchar() and std::cout << "|" per character), a
+  buffered decorated dmsg and a buffered plain dmsg, and prints the
+  time per line of each to stderr. The output itself goes to stdout;
+  redirect it to /dev/null (or a file) when running.
+
+  \par Usage:
+  dmsgBench [lines] > /dev/null
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <time.h>
+
+#include "dmsg.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///write lines log lines, ending each with std::endl or '\n'
+long long run(std::ostream &out, long lines, bool endl)
+{
+  long long start = now();
+  for(long n = 0; n < lines; n++)
+    {
+      out << "task " << n << " finished: status=" << (n & 7)
+	  << " elapsed=" << n * 3 << "us";
+      if(endl)
+	out << std::endl;
+      else
+	out << '\n';
+    }
+  out.flush();
+  return now() - start;
+}
+
+///print one result line
+void show(const char *label, long long ns, long lines, long long base)
+{
+  std::cerr << label << ": ns/line=" << (double)ns / lines;
+  if(base != 0)
+    std::cerr << "|speedup=" << (double)base / ns << "x";
+  std::cerr << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  long lines = (argc > 1) ? atol(argv[1]) : 100000;
+  long long base;
+
+  {
+    dmsg d;
+    std::ostream out(&d);
+    base = run(out, lines, true);
+    std::cout.flush();
+    show("unbuffered (original)", base, lines, 0);
+  }
+
+  {
+    dmsg d;
+    d.buffered(8192, true);
+    std::ostream out(&d);
+    show("buffered, decorated, endl", run(out, lines, true), lines, base);
+  }
+
+  {
+    dmsg d;
+    d.buffered(8192, true);
+    std::ostream out(&d);
+    show("buffered, decorated, \\n", run(out, lines, false), lines, base);
+  }
+
+  {
+    dmsg d;
+    d.buffered(65536, false);
+    std::ostream out(&d);
+    show("buffered, plain, \\n", run(out, lines, false), lines, base);
+  }
+
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*!\file filterBench.cc
+  \brief Compression filter chain throughput at different buffer sizes
+
+  \par Purpose:
+  Builds log-like text in memory and pushes it through
+  checksumBuf -> lzBuf -> memory, then the result back through
+  unlzBuf -> checksumBuf -> memory (see filterBuf.h and lzBuf.h) for a
+  range of filter buffer sizes. Prints the compression ratio, the
+  compress and decompress throughput, and whether the round trip
+  reproduced the input (CRC-32 and bytes).
+
+  \par Usage:
+  filterBench [megabytes]
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <time.h>
+
+#include "lzBuf.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///Sink that appends everything to a string
+class stringSink : public std::streambuf
+{
+public:
+  std::string data;
+
+protected:
+  virtual int_type overflow(int_type c)
+  {
+    if(!traits_type::eq_int_type(c, traits_type::eof()))
+      data += traits_type::to_char_type(c);
+    return traits_type::not_eof(c);
+  }
+
+  virtual std::streamsize xsputn(const char *s, std::streamsize n)
+  {
+    data.append(s, n);
+    return n;
+  }
+};
+
+///about bytes of log lines
+std::string makeLog(long long bytes)
+{
+  static const char *state[] = {"queued", "running", "finished", "stalled"};
+  std::ostringstream out;
+  unsigned long x = 88172645463325252UL;
+  for(long n = 0; (long long)out.tellp() < bytes; n++)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      out << "2024-05-" << 10 + n / 1000000 % 20 << " 12:" << n / 60000 % 60 << ':'
+	  << n / 1000 % 60 << " worker-" << (x & 15) << " task " << n
+	  << ' ' << state[x >> 62] << " elapsed=" << (x >> 40) % 100000 << "us\n";
+    }
+  return out.str();
+}
+
+///write data in 4KB pieces (as a program logging would)
+void push(std::ostream &out, const std::string &data)
+{
+  for(size_t off = 0; off < data.size(); off += 4096)
+    out.write(data.data() + off, data.size() - off < 4096 ? data.size() - off : 4096);
+}
+
+int main(int argc, char **argv)
+{
+  long long mb = (argc > 1) ? atol(argv[1]) : 256;
+  std::string input = makeLog(mb << 20);
+  double size_mb = (double)input.size() / (1 << 20);
+
+  uint32_t expect = crc32::update(0, input.data(), input.size());
+  std::cout << input.size() << " bytes of log text, crc32=" << std::hex << expect
+	    << std::dec << std::endl;
+
+  size_t sizes[] = {4096, 16384, 65536, 262144, 1048576};
+  for(size_t size : sizes)
+    {
+      stringSink packed, restored;
+      long long t0, t1, t2;
+      packed.data.reserve(input.size());
+      restored.data.reserve(input.size());
+
+      //compress
+      t0 = now();
+      {
+	lzBuf lz(&packed, size);
+	checksumBuf sum(&lz, size);
+	std::ostream out(&sum);
+	push(out, input);
+	sum.close();
+      }
+      t1 = now();
+
+      //decompress
+      uint32_t got;
+      bool ok;
+      {
+	checksumBuf sum(&restored, size);
+	unlzBuf unlz(&sum, size);
+	std::ostream out(&unlz);
+	push(out, packed.data);
+	ok = unlz.close() == 0 && unlz.complete();
+	got = sum.value();
+      }
+      t2 = now();
+
+      std::cout << "buffer=" << size / 1024 << "KB: ratio="
+		<< (double)input.size() / packed.data.size()
+		<< "|compress MB/s=" << size_mb / ((t1 - t0) / 1e9)
+		<< "|decompress MB/s=" << size_mb / ((t2 - t1) / 1e9)
+		<< "|round trip=" << ((ok && got == expect && restored.data == input) ? "ok" : "FAILED")
+		<< std::endl;
+    }
+
+  //the checksum stage alone
+  {
+    stringSink out;
+    out.data.reserve(input.size());
+    long long t0 = now();
+    checksumBuf sum(&out);
+    std::ostream os(&sum);
+    push(os, input);
+    sum.close();
+    std::cout << "checksumBuf alone: MB/s=" << size_mb / ((now() - t0) / 1e9)
+	      << "|crc32 " << (sum.value() == expect ? "ok" : "WRONG") << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,270 @@
+/*!\file filterBuf.h
+  \brief Stackable filter streambufs (and a checksum stage)
+
+  \par Purpose:
+  dmsg transforms what is written through it. filterBuf makes that a
+  building block: a filter collects output in its own put area and
+  hands it, a whole buffer at a time, to filter(), which transforms it
+  and passes the result to the next streambuf. That one may be another
+  filter, so stages stack: checksum -> compress -> file.
+
+  Nothing is forwarded a character at a time. Strings at least a
+  buffer long go to filter() in buffer sized pieces straight from the
+  caller's memory.
+
+  close() on the first stage finishes the whole chain: every filter
+  writes out what it holds plus its trailer (finish()) and closes the
+  filter behind it; the last streambuf is synced.
+
+  \par Example:
+  lzBuf lz(&file);<br>
+  checksumBuf sum(&lz);<br>
+  std::ostream out(&sum);<br>
+  out << ... ;<br>
+  sum.close();<br>
+*/
+
+#ifndef FILTERBUF_H
+#define FILTERBUF_H
+
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+
+///Base class of a filter stage
+class filterBuf : public std::streambuf
+{
+public:
+  ///constructor
+  filterBuf(std::streambuf *next, size_t size = 65536)
+    : m_next(next), m_size(size < 64 ? 64 : size), m_closed(false), m_failed(false)
+  {
+    m_buf = new char[m_size];
+    setp(m_buf, m_buf + m_size);
+  }
+
+  /**
+     \note filter() is gone by the time this runs: a derived class
+     calls close() in its own destructor.
+  */
+  virtual ~filterBuf() { delete [] m_buf; }
+
+  ///write out everything (with trailers) and close the chain behind
+  int close()
+  {
+    /** \return 0, -1 if any stage failed */
+    if(m_closed)
+      return m_failed ? -1 : 0;
+    m_closed = true;
+
+    if(drain() < 0 || finish() < 0)
+      m_failed = true;
+    setp(NULL, NULL);
+
+    filterBuf *f = dynamic_cast<filterBuf *>(m_next);
+    if(f != NULL)
+      {
+	if(f->close() < 0)
+	  m_failed = true;
+      }
+    else if(m_next->pubsync() < 0)
+      m_failed = true;
+
+    return m_failed ? -1 : 0;
+  }
+
+  ///true if anything could not be filtered or forwarded
+  bool failed() const { return m_failed; }
+
+  ///the streambuf behind this stage
+  std::streambuf *next() const { return m_next; }
+
+  ///the put area size (the unit filter() gets)
+  size_t bufferSize() const { return m_size; }
+
+protected:
+  ///transform len bytes and forward() the result
+  virtual int filter(const char *data, size_t len) = 0;
+
+  ///write a trailer at close() (nothing by default)
+  virtual int finish() { return 0; }
+
+  ///pass bytes to the next stage (all or fail)
+  int forward(const char *data, size_t len)
+  {
+    if(len > 0 && m_next->sputn(data, len) != (std::streamsize)len)
+      {
+	m_failed = true;
+	return -1;
+      }
+    return 0;
+  }
+
+  ///the put area is full
+  virtual int_type overflow(int_type c)
+  {
+    if(m_closed || drain() < 0)
+      return traits_type::eof();
+    if(!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+      }
+    return traits_type::not_eof(c);
+  }
+
+  ///bulk output: whole buffers go to filter() without a copy
+  virtual std::streamsize xsputn(const char *s, std::streamsize n)
+  {
+    if(m_closed)
+      return 0;
+
+    std::streamsize done = 0;
+    while(done < n)
+      {
+	std::streamsize left = n - done;
+	if(pptr() == pbase() && left >= (std::streamsize)m_size)
+	  {
+	    if(filter(s + done, m_size) < 0)
+	      {
+		m_failed = true;
+		return done;
+	      }
+	    done += m_size;
+	    continue;
+	  }
+
+	std::streamsize room = epptr() - pptr();
+	std::streamsize chunk = left < room ? left : room;
+	memcpy(pptr(), s + done, chunk);
+	pbump((int)chunk);
+	done += chunk;
+	if(pptr() == epptr() && drain() < 0)
+	  return done;
+      }
+    return n;
+  }
+
+  ///std::flush: filter what is buffered and flush the next stage
+  virtual int sync()
+  {
+    if(m_closed)
+      return m_failed ? -1 : 0;
+    if(drain() < 0)
+      return -1;
+    return m_next->pubsync();
+  }
+
+private:
+  ///run the put area through filter() and empty it
+  int drain()
+  {
+    size_t n = pptr() - pbase();
+    setp(m_buf, m_buf + m_size);
+    if(n > 0 && filter(m_buf, n) < 0)
+      {
+	m_failed = true;
+	return -1;
+      }
+    return 0;
+  }
+
+private:
+  std::streambuf *m_next;
+
+  ///put area
+  char *m_buf;
+  size_t m_size;
+
+  bool m_closed;
+  bool m_failed;
+};
+
+///CRC-32 (the zlib / Ethernet one), 8 bytes per step
+class crc32
+{
+public:
+  static uint32_t update(uint32_t crc, const void *data, size_t len)
+  {
+    const uint32_t (*t)[256] = tables();
+    const unsigned char *p = (const unsigned char *)data;
+    crc = ~crc;
+
+    while(len >= 8)
+      {
+	uint32_t lo, hi;
+	memcpy(&lo, p, 4);
+	memcpy(&hi, p + 4, 4);
+	lo ^= crc;	//little endian
+	crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+	  ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	p += 8;
+	len -= 8;
+      }
+    while(len-- > 0)
+      crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+  }
+
+private:
+  ///slicing tables, built on first use
+  static const uint32_t (*tables())[256]
+  {
+    static uint32_t t[8][256];
+    static bool built = build(t);
+    (void)built;
+    return t;
+  }
+
+  static bool build(uint32_t t[8][256])
+  {
+    for(uint32_t n = 0; n < 256; n++)
+      {
+	uint32_t c = n;
+	for(int k = 0; k < 8; k++)
+	  c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+	t[0][n] = c;
+      }
+    for(uint32_t n = 0; n < 256; n++)
+      for(int k = 1; k < 8; k++)
+	t[k][n] = t[0][t[k - 1][n] & 0xff] ^ (t[k - 1][n] >> 8);
+    return true;
+  }
+};
+
+/**
+   \brief Pass-through stage that keeps a CRC-32 of what went by
+
+   \note
+   Put one in front of a compressor and one behind the decompressor
+   and compare value() to check a round trip.
+*/
+class checksumBuf : public filterBuf
+{
+public:
+  checksumBuf(std::streambuf *next, size_t size = 65536)
+    : filterBuf(next, size), m_crc(0), m_bytes(0) {}
+
+  virtual ~checksumBuf() { close(); }
+
+  ///CRC-32 of everything filtered so far
+  uint32_t value() const { return m_crc; }
+
+  ///bytes filtered so far
+  unsigned long long bytes() const { return m_bytes; }
+
+protected:
+  virtual int filter(const char *data, size_t len)
+  {
+    m_crc = crc32::update(m_crc, data, len);
+    m_bytes += len;
+    return forward(data, len);
+  }
+
+private:
+  uint32_t m_crc;
+  unsigned long long m_bytes;
+};
+
+#endif //FILTERBUF_H
@@ -0,0 +1,419 @@
+/*!\file lzBuf.h
+  \brief LZ77 compressor and decompressor filter stages (see filterBuf.h)
+
+  \par Purpose:
+  A small, fast LZ77 coder in the LZ4 style, with no library needed:
+  matches of 4 or more bytes are found through a hash of the next 4
+  bytes and written as (literal run, 16 bit offset, match length)
+  sequences. Every put area of lzBuf becomes one independent block, so
+  the filter's buffer size is also the compression window: bigger
+  buffers compress better.
+
+  unlzBuf is the reverse stage: compressed bytes in (in any pieces),
+  the original bytes out to the next streambuf.
+
+  \par Stream layout (little endian):
+  <ul>
+  <li>"DLZ1"</li>
+  <li>block: uint32 raw length, uint32 stored length (top bit set: the
+  block is stored uncompressed), data</li>
+  <li>end: uint32 0 (written by close())</li>
+  </ul>
+
+  \par Sequence:
+  token (high nibble literal count, low nibble match length - 4; 15
+  means more in following bytes, each adding up to 255), literals,
+  uint16 offset, extra length bytes. The last sequence of a block has
+  literals only.
+*/
+
+#ifndef LZBUF_H
+#define LZBUF_H
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include "filterBuf.h"
+
+///The block coder used by lzBuf / unlzBuf
+class lz77
+{
+public:
+  ///largest output compress() can produce for len input bytes
+  static size_t bound(size_t len) { return len + len / 255 + 16; }
+
+  ///compress src into dst (bound(len) bytes), return the length
+  static size_t compress(const unsigned char *src, size_t len, unsigned char *dst,
+			 uint32_t *table, int bits)
+  {
+    /**
+       \param table 1 << bits entries of scratch space
+    */
+    unsigned char *op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    memset(table, 0, sizeof(uint32_t) << bits);
+
+    if(len > 12)
+      {
+	size_t limit = len - 12;	//leave room for the 8 byte compares
+	ip = 1;
+	while(ip < limit)
+	  {
+	    uint32_t seq = read32(src + ip);
+	    uint32_t h = (seq * 2654435761u) >> (32 - bits);
+	    size_t ref = table[h];
+	    table[h] = (uint32_t)ip;
+
+	    if(ip - ref > 65535 || read32(src + ref) != seq)
+	      {
+		//skip faster through data that does not compress
+		ip += 1 + ((ip - anchor) >> 6);
+		continue;
+	      }
+
+	    //extend backward over equal literals, then forward
+	    while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+	      {
+		ip--;
+		ref--;
+	      }
+	    size_t mlen = 4;
+	    while(ip + mlen + 8 <= len)
+	      {
+		uint64_t a, b;
+		memcpy(&a, src + ip + mlen, 8);
+		memcpy(&b, src + ref + mlen, 8);
+		if(a != b)
+		  {
+		    mlen += __builtin_ctzll(a ^ b) >> 3;	//little endian
+		    goto found;
+		  }
+		mlen += 8;
+	      }
+	    while(ip + mlen < len && src[ip + mlen] == src[ref + mlen])
+	      mlen++;
+	  found:
+	    op = sequence(op, src + anchor, ip - anchor, ip - ref, mlen);
+	    ip += mlen;
+	    anchor = ip;
+
+	    //the position just before the next search point
+	    if(ip - 2 < limit)
+	      table[(read32(src + ip - 2) * 2654435761u) >> (32 - bits)] = (uint32_t)(ip - 2);
+	  }
+      }
+
+    //trailing literals
+    size_t lit = len - anchor;
+    *op++ = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    op = length(op, lit);
+    memcpy(op, src + anchor, lit);
+    op += lit;
+    return op - dst;
+  }
+
+  ///expand a block of clen bytes into exactly raw bytes
+  static bool decompress(const unsigned char *src, size_t clen, unsigned char *dst, size_t raw)
+  {
+    /** \return false if the block is damaged */
+    const unsigned char *ip = src, *iend = src + clen;
+    unsigned char *op = dst, *oend = dst + raw;
+
+    while(ip < iend)
+      {
+	unsigned int token = *ip++;
+
+	size_t lit = token >> 4;
+	if(lit == 15 && !more(&ip, iend, &lit))
+	  return false;
+	if(lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+	  return false;
+	memcpy(op, ip, lit);
+	ip += lit;
+	op += lit;
+
+	if(ip == iend)
+	  break;	//the last sequence
+
+	if(iend - ip < 2)
+	  return false;
+	size_t off = ip[0] | (ip[1] << 8);
+	ip += 2;
+	size_t mlen = token & 15;
+	if(mlen == 15 && !more(&ip, iend, &mlen))
+	  return false;
+	mlen += 4;
+	if(off == 0 || off > (size_t)(op - dst) || mlen > (size_t)(oend - op))
+	  return false;
+
+	const unsigned char *ref = op - off;
+	if(off >= mlen)
+	  memcpy(op, ref, mlen);
+	else
+	  for(size_t k = 0; k < mlen; k++)	//overlapping: a repeated pattern
+	    op[k] = ref[k];
+	op += mlen;
+      }
+    return op == oend;
+  }
+
+private:
+  static uint32_t read32(const unsigned char *p)
+  {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+
+  ///the extra length bytes of a count >= 15
+  static unsigned char *length(unsigned char *op, size_t n)
+  {
+    if(n < 15)
+      return op;
+    n -= 15;
+    while(n >= 255)
+      {
+	*op++ = 255;
+	n -= 255;
+      }
+    *op++ = (unsigned char)n;
+    return op;
+  }
+
+  ///read extra length bytes
+  static bool more(const unsigned char **ip, const unsigned char *iend, size_t *n)
+  {
+    unsigned int b;
+    do
+      {
+	if(*ip >= iend)
+	  return false;
+	b = *(*ip)++;
+	*n += b;
+      }
+    while(b == 255);
+    return true;
+  }
+
+  ///write one sequence
+  static unsigned char *sequence(unsigned char *op, const unsigned char *lit, size_t nlit,
+				 size_t off, size_t mlen)
+  {
+    size_t m = mlen - 4;
+    *op++ = (unsigned char)(((nlit >= 15 ? 15 : nlit) << 4) | (m >= 15 ? 15 : m));
+    op = length(op, nlit);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    *op++ = (unsigned char)off;
+    *op++ = (unsigned char)(off >> 8);
+    return length(op, m);
+  }
+};
+
+///Compressor stage: every buffer becomes one lz77 block
+class lzBuf : public filterBuf
+{
+public:
+  lzBuf(std::streambuf *next, size_t size = 65536)
+    : filterBuf(next, size), m_started(false), m_raw(0), m_packed(0)
+  {
+    //hash table: about a quarter of the block, 256 to 16K entries
+    m_bits = 8;
+    while(m_bits < 14 && ((size_t)4 << m_bits) < size)
+      m_bits++;
+    m_table = new uint32_t[(size_t)1 << m_bits];
+    m_out = new unsigned char[8 + lz77::bound(bufferSize())];
+  }
+
+  virtual ~lzBuf()
+  {
+    close();
+    delete [] m_out;
+    delete [] m_table;
+  }
+
+  ///bytes taken in and bytes written out so far
+  unsigned long long rawBytes() const { return m_raw; }
+  unsigned long long packedBytes() const { return m_packed; }
+
+protected:
+  virtual int filter(const char *data, size_t len)
+  {
+    if(!start())
+      return -1;
+
+    uint32_t clen = (uint32_t)lz77::compress((const unsigned char *)data, len, m_out + 8,
+					     m_table, m_bits);
+    uint32_t raw = (uint32_t)len;
+    m_raw += len;
+
+    if(clen >= len)
+      {
+	//did not shrink: store it
+	uint32_t stored = raw | 0x80000000u;
+	memcpy(m_out, &raw, 4);
+	memcpy(m_out + 4, &stored, 4);
+	m_packed += 8 + len;
+	if(forward((const char *)m_out, 8) < 0)
+	  return -1;
+	return forward(data, len);
+      }
+
+    memcpy(m_out, &raw, 4);
+    memcpy(m_out + 4, &clen, 4);
+    m_packed += 8 + clen;
+    return forward((const char *)m_out, 8 + clen);
+  }
+
+  ///end marker
+  virtual int finish()
+  {
+    uint32_t zero = 0;
+    if(!start())
+      return -1;
+    m_packed += 4;
+    return forward((const char *)&zero, 4);
+  }
+
+private:
+  ///stream header before the first block
+  bool start()
+  {
+    if(m_started)
+      return true;
+    m_started = true;
+    m_packed += 4;
+    return forward("DLZ1", 4) == 0;
+  }
+
+private:
+  ///hash table and its size (1 << m_bits)
+  uint32_t *m_table;
+  int m_bits;
+
+  ///block header and compressed data
+  unsigned char *m_out;
+
+  bool m_started;
+  unsigned long long m_raw;
+  unsigned long long m_packed;
+};
+
+///Decompressor stage: lzBuf's stream in, the original bytes out
+class unlzBuf : public filterBuf
+{
+public:
+  unlzBuf(std::streambuf *next, size_t size = 65536)
+    : filterBuf(next, size), m_state(HEADER), m_ended(false) {}
+
+  virtual ~unlzBuf() { close(); }
+
+  ///true once the end marker was seen (the stream was complete)
+  bool complete() const { return m_ended; }
+
+protected:
+  virtual int filter(const char *data, size_t len)
+  {
+    //whole blocks are decoded in place, only a partial one is kept
+    if(m_in.empty())
+      {
+	size_t used = parse((const unsigned char *)data, len);
+	if(used == (size_t)-1)
+	  return -1;
+	m_in.assign(data + used, data + len);
+	return 0;
+      }
+
+    m_in.insert(m_in.end(), data, data + len);
+    size_t used = parse(m_in.data(), m_in.size());
+    if(used == (size_t)-1)
+      return -1;
+    m_in.erase(m_in.begin(), m_in.begin() + used);
+    return 0;
+  }
+
+  ///a stream without its end marker was cut short
+  virtual int finish()
+  {
+    return (m_ended && m_in.empty()) ? 0 : -1;
+  }
+
+private:
+  ///decode the complete pieces in p, return the bytes used (-1: damaged)
+  size_t parse(const unsigned char *p, size_t len)
+  {
+    size_t pos = 0;
+    for(;;)
+      {
+	size_t avail = len - pos;
+	const unsigned char *b = p + pos;
+
+	if(m_state == HEADER)
+	  {
+	    if(avail < 4)
+	      break;
+	    if(memcmp(b, "DLZ1", 4) != 0)
+	      return (size_t)-1;
+	    pos += 4;
+	    m_state = BLOCK;
+	    continue;
+	  }
+	if(m_state == END)
+	  {
+	    if(avail > 0)
+	      return (size_t)-1;	//data after the end marker
+	    break;
+	  }
+
+	if(avail < 4)
+	  break;
+	uint32_t raw, stored;
+	memcpy(&raw, b, 4);
+	if(raw == 0)
+	  {
+	    pos += 4;
+	    m_state = END;
+	    m_ended = true;
+	    continue;
+	  }
+	if(avail < 8)
+	  break;
+	memcpy(&stored, b + 4, 4);
+	size_t clen = stored & 0x7fffffffu;
+	if(avail < 8 + clen)
+	  break;	//wait for the rest of the block
+
+	if(stored & 0x80000000u)
+	  {
+	    if(clen != raw || forward((const char *)b + 8, raw) < 0)
+	      return (size_t)-1;
+	  }
+	else
+	  {
+	    if(m_out.size() < raw)
+	      m_out.resize(raw);
+	    if(!lz77::decompress(b + 8, clen, m_out.data(), raw))
+	      return (size_t)-1;
+	    if(forward((const char *)m_out.data(), raw) < 0)
+	      return (size_t)-1;
+	  }
+	pos += 8 + clen;
+      }
+    return pos;
+  }
+
+private:
+  enum { HEADER, BLOCK, END } m_state;
+  bool m_ended;
+
+  ///partial block carried to the next filter() call
+  std::vector<unsigned char> m_in;
+
+  ///decompressed block
+  std::vector<unsigned char> m_out;
+};
+
+#endif //LZBUF_H
@@ -0,0 +1,123 @@
+/*!\file mmapBench.cc
+  \brief mmapBuf against std::ofstream
+
+  \par Purpose:
+  Writes the same data to a file through std::ofstream and through
+  mmapBuf (see mmapBuf.h) under each sync policy, checks the file size
+  and prints the throughput. Two shapes of output are written: 64KB
+  blocks (a result dump) and formatted text lines (a trace).
+
+  \par Usage:
+  mmapBench [megabytes] [file]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#include <time.h>
+
+#include "mmapBuf.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///bytes bytes of output: 64KB blocks or text lines
+void produce(std::ostream &out, long long bytes, bool lines)
+{
+  static char block[65536];
+  if(block[0] == 0)
+    for(size_t k = 0; k < sizeof(block); k++)
+      block[k] = 'a' + k % 26;
+
+  long long done = 0;
+  if(!lines)
+    {
+      while(done < bytes)
+	{
+	  out.write(block, sizeof(block));
+	  done += sizeof(block);
+	}
+      return;
+    }
+
+  long n = 0;
+  std::streampos start = out.tellp();
+  while(done < bytes)
+    {
+      //check the position only now and then
+      for(int k = 0; k < 1000; k++, n++)
+	out << "task " << n << " finished: status=" << (n & 7)
+	    << " elapsed=" << n * 3 << "us\n";
+      done = out.tellp() - start;
+    }
+}
+
+///size of path
+long long fileSize(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) < 0 ? -1 : (long long)st.st_size;
+}
+
+///print one result line
+void show(const char *label, long long bytes, long long ns, long long size)
+{
+  std::cout << label << ": MB/s=" << (double)bytes / (1 << 20) / (ns / 1e9)
+	    << "|file=" << size << std::endl;
+}
+
+///one std::ofstream run
+void runOfstream(const char *path, long long bytes, bool lines)
+{
+  long long start = now();
+  {
+    std::ofstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    produce(out, bytes, lines);
+  }
+  show("  std::ofstream", bytes, now() - start, fileSize(path));
+}
+
+///one mmapBuf run
+void runMmap(const char *label, const char *path, long long bytes, bool lines,
+	     mmapBuf::sync_policy policy)
+{
+  long long start = now();
+  mmapBuf mb;
+  if(!mb.open(path, 64 << 20, policy))
+    {
+      std::cout << label << ": open failed: " << strerror(mb.lastError()) << std::endl;
+      return;
+    }
+  {
+    std::ostream out(&mb);
+    produce(out, bytes, lines);
+  }
+  if(mb.close() < 0)
+    std::cout << label << ": close failed: " << strerror(mb.lastError()) << std::endl;
+  show(label, bytes, now() - start, fileSize(path));
+}
+
+int main(int argc, char **argv)
+{
+  long long mb = (argc > 1) ? atol(argv[1]) : 1024;
+  const char *path = (argc > 2) ? argv[2] : "/tmp/mmapBench.out";
+  long long bytes = mb << 20;
+
+  for(int lines = 0; lines < 2; lines++)
+    {
+      std::cout << mb << "MB of " << (lines ? "text lines" : "64KB blocks") << std::endl;
+      runOfstream(path, bytes, lines);
+      runMmap("  mmapBuf SYNC_NONE", path, bytes, lines, mmapBuf::SYNC_NONE);
+      runMmap("  mmapBuf SYNC_ASYNC", path, bytes, lines, mmapBuf::SYNC_ASYNC);
+      runMmap("  mmapBuf SYNC_CLOSE", path, bytes, lines, mmapBuf::SYNC_CLOSE);
+    }
+
+  unlink(path);
+  return 0;
+}
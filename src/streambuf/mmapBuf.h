@@ -0,0 +1,323 @@
+/*!\file mmapBuf.h
+  \brief Output streambuf writing straight into a memory mapped file
+
+  \par Purpose:
+  A buffered dmsg still copies every buffer into the kernel with a
+  write(). mmapBuf has no buffer of its own: its put area is a window
+  of the output file mapped into memory, so what the stream operators
+  write lands in the page cache directly. When the window fills,
+  overflow() slides the mapping forward, growing the file ahead of it
+  with fallocate() (ftruncate() where the filesystem cannot).
+
+  close() (or the destructor) cuts the file back to the bytes actually
+  written. How hard the data is pushed to the disk is a policy:
+  <ul>
+  <li>SYNC_NONE - leave it to the kernel's writeback</li>
+  <li>SYNC_ASYNC - start writeback (msync MS_ASYNC) of every finished window</li>
+  <li>SYNC_WINDOW - wait for every finished window (msync MS_SYNC)</li>
+  <li>SYNC_CLOSE - one fsync() at close()</li>
+  </ul>
+
+  \par Example:
+  mmapBuf mb;<br>
+  mb.open("trace.out");<br>
+  std::ostream out(&mb);<br>
+  out << ... ;<br>
+  mb.close();<br>
+*/
+
+#ifndef MMAPBUF_H
+#define MMAPBUF_H
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+///Output streambuf over a sliding mmap() window of a file
+class mmapBuf : public std::streambuf
+{
+public:
+  ///how finished data is pushed to the disk
+  enum sync_policy
+  {
+    SYNC_NONE = 0,
+    SYNC_ASYNC,
+    SYNC_WINDOW,
+    SYNC_CLOSE
+  };
+
+  mmapBuf() : m_fd(-1), m_map(NULL), m_window(0), m_offset(0),
+	      m_allocated(0), m_policy(SYNC_NONE), m_error(0), m_unsynced(false) {}
+
+  ///closes the file
+  virtual ~mmapBuf() { close(); }
+
+  ///create / truncate path and map the first window
+  bool open(const char *path, size_t window = 64 << 20,
+	    sync_policy policy = SYNC_NONE, mode_t mode = 0644)
+  {
+    /**
+       \param path output file (truncated)
+       \param window mapping size in bytes (rounded up to whole pages)
+       \param policy see sync_policy
+       \return false on error (see lastError())
+    */
+    if(m_fd >= 0)
+      close();
+
+    long page = sysconf(_SC_PAGESIZE);
+    if(window < (size_t)page)
+      window = page;
+    m_window = (window + page - 1) / page * page;
+    m_policy = policy;
+    m_offset = 0;
+    m_allocated = 0;
+    m_error = 0;
+    m_unsynced = false;
+
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, mode);
+    if(m_fd < 0)
+      {
+	m_error = errno;
+	return false;
+      }
+
+    if(!mapWindow())
+      {
+	::close(m_fd);
+	m_fd = -1;
+	return false;
+      }
+    return true;
+  }
+
+  ///unmap, truncate to the bytes written, sync per policy and close
+  int close()
+  {
+    /** \return 0, or -1 if anything failed (see lastError()) */
+    if(m_fd < 0)
+      return 0;
+
+    int ret = 0;
+    off_t size = m_offset + (pptr() - pbase());
+    if(!unmapWindow() || m_unsynced)
+      ret = -1;
+    setp(NULL, NULL);
+
+    if(ftruncate(m_fd, size) < 0)
+      {
+	m_error = errno;
+	ret = -1;
+      }
+    if(m_policy == SYNC_CLOSE && fsync(m_fd) < 0)
+      {
+	m_error = errno;
+	ret = -1;
+      }
+    if(::close(m_fd) < 0)
+      {
+	m_error = errno;
+	ret = -1;
+      }
+    m_fd = -1;
+    return ret;
+  }
+
+  ///true between a successful open() and close()
+  bool isOpen() const { return m_fd >= 0; }
+
+  ///bytes written so far
+  off_t size() const
+  {
+    return m_fd < 0 ? 0 : m_offset + (pptr() - pbase());
+  }
+
+  ///errno of the last failure (0: none)
+  int lastError() const { return m_error; }
+
+protected:
+  ///the window is full: slide it forward
+  virtual int_type overflow(int_type c)
+  {
+    if(m_fd < 0)
+      return traits_type::eof();
+
+    if(!nextWindow())
+      return traits_type::eof();
+
+    if(!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+      }
+    return traits_type::not_eof(c);
+  }
+
+  ///bulk output: copy window by window
+  virtual std::streamsize xsputn(const char *s, std::streamsize n)
+  {
+    std::streamsize done = 0;
+    while(done < n)
+      {
+	std::streamsize room = epptr() - pptr();
+	if(room == 0)
+	  {
+	    if(m_fd < 0 || !nextWindow())
+	      break;
+	    continue;
+	  }
+	std::streamsize chunk = (n - done < room) ? n - done : room;
+	memcpy(pptr(), s + done, chunk);
+	pbump((int)chunk);
+	done += chunk;
+      }
+    return done;
+  }
+
+  ///std::flush: the data is already in the page cache
+  virtual int sync()
+  {
+    /** \note only SYNC_WINDOW waits here: a flush there means "on the
+	disk", as it does for a finished window.
+    */
+    if(m_fd < 0 || m_policy != SYNC_WINDOW)
+      return 0;
+
+    //an earlier window that did not reach the disk
+    if(m_unsynced)
+      return -1;
+
+    //msync() wants a page aligned start: the window always is
+    size_t used = pptr() - pbase();
+    if(used > 0 && msync(m_map, used, MS_SYNC) < 0)
+      {
+	m_error = errno;
+	return -1;
+      }
+    return 0;
+  }
+
+  ///tellp()
+  virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+			   std::ios_base::openmode which)
+  {
+    //only the current position can be asked for (no seeking)
+    if(off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+      return pos_type(off_type(-1));
+    return pos_type(size());
+  }
+
+private:
+  ///grow the file so the window at m_offset is backed
+  bool extend()
+  {
+    off_t want = m_offset + m_window;
+    if(want <= m_allocated)
+      return true;
+
+    //reserve the blocks now: stores into a hole would allocate page by page
+    int err = posix_fallocate(m_fd, m_allocated, want - m_allocated);
+    if(err == EOPNOTSUPP || err == EINVAL)
+      err = ftruncate(m_fd, want) < 0 ? errno : 0;
+    if(err != 0)
+      {
+	m_error = err;
+	return false;
+      }
+    m_allocated = want;
+    return true;
+  }
+
+  ///map the window at m_offset and point the put area at it
+  bool mapWindow()
+  {
+    if(!extend())
+      return false;
+
+    //populate: one call maps the whole window instead of a fault per page
+    void *p = mmap(NULL, m_window, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, m_fd, m_offset);
+    if(p == MAP_FAILED)
+      {
+	m_error = errno;
+	m_map = NULL;
+	setp(NULL, NULL);
+	return false;
+      }
+    m_map = (char *)p;
+
+    //written front to back, never read back
+    madvise(m_map, m_window, MADV_SEQUENTIAL);
+
+    setp(m_map, m_map + m_window);
+    return true;
+  }
+
+  ///sync (per policy) and drop the current window
+  bool unmapWindow()
+  {
+    if(m_map == NULL)
+      return true;
+
+    bool ok = true;
+    size_t used = pptr() - pbase();
+    if(used > 0 && (m_policy == SYNC_ASYNC || m_policy == SYNC_WINDOW))
+      {
+	if(msync(m_map, used, m_policy == SYNC_WINDOW ? MS_SYNC : MS_ASYNC) < 0)
+	  {
+	    m_error = errno;
+	    m_unsynced = true;
+	    ok = false;
+	  }
+      }
+    if(munmap(m_map, m_window) < 0)
+      {
+	m_error = errno;
+	ok = false;
+      }
+    m_map = NULL;
+    return ok;
+  }
+
+  ///finish the full window and map the next one
+  bool nextWindow()
+  {
+    /** \return false if the finished window could not be synced or
+	unmapped (its bytes are in the file all the same), or the next
+	one mapped. With no window mapped (a failed mapWindow()) the
+	same offset is tried again, leaving no gap in the file.
+    */
+    bool ok = true;
+    if(m_map != NULL)
+      {
+	ok = unmapWindow();
+	m_offset += m_window;
+	setp(NULL, NULL);
+      }
+    return mapWindow() && ok;
+  }
+
+private:
+  ///output file
+  int m_fd;
+
+  ///current mapping, its size and file offset
+  char *m_map;
+  size_t m_window;
+  off_t m_offset;
+
+  ///file length reserved so far
+  off_t m_allocated;
+
+  sync_policy m_policy;
+  int m_error;
+
+  ///a finished window's msync() failed (sync() / close() report it)
+  bool m_unsynced;
+};
+
+#endif //MMAPBUF_H
@@ -0,0 +1,166 @@
+/*!\file scanBench.cc
+  \brief scanBuf / scanner against std::cin and std::ifstream extraction
+
+  \par Purpose:
+  Generates a numeric text file (lines of "id value name") and reads
+  it back with operator>> through std::cin (the file on standard
+  input) and std::ifstream, and with scanner (see scanBuf.h) over an
+  mmap()ed scanBuf and over a read-ahead scanBuf. Every reader must
+  arrive at the same checksum. Throughput goes to stdout.
+
+  \par Usage:
+  scanBench [megabytes] [file]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <time.h>
+
+#include "scanBuf.h"
+#include "mmapBuf.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///what every reader adds up
+struct totals
+{
+  long lines;
+  long long ids;
+  double values;
+  long long names;
+};
+
+///write about bytes of "id value name" lines
+void generate(const char *path, long long bytes)
+{
+  mmapBuf mb;
+  mb.open(path);
+  std::ostream out(&mb);
+  unsigned long x = 88172645463325252UL;
+  for(long n = 0; mb.size() < bytes; n++)
+    {
+      //xorshift: cheap varied numbers
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      out << (long)(x % 100000000) - 50000000 << ' '
+	  << (double)(x % 1000000) / 1000 << "\t"
+	  << "name" << (x & 0xfff) << '\n';
+    }
+  mb.close();
+}
+
+///operator>> on any istream
+totals extract(std::istream &in)
+{
+  totals t = {0, 0, 0, 0};
+  long id;
+  double v;
+  std::string name;
+  while(in >> id >> v >> name)
+    {
+      t.lines++;
+      t.ids += id;
+      t.values += v;
+      t.names += name.size();
+    }
+  return t;
+}
+
+///scanner on a scanBuf
+totals scan(scanBuf &sb)
+{
+  totals t = {0, 0, 0, 0};
+  scanner in(sb);
+  long id;
+  double v;
+  std::string_view name;
+  while(in.next(id) && in.next(v) && in.next(name))
+    {
+      t.lines++;
+      t.ids += id;
+      t.values += v;
+      t.names += name.size();
+    }
+  return t;
+}
+
+///print one result line
+void show(const char *label, long long bytes, long long ns, const totals &t, long long base)
+{
+  std::cout << label << ": MB/s=" << (double)bytes / (1 << 20) / (ns / 1e9);
+  if(base != 0)
+    std::cout << "|speedup=" << (double)base / ns << "x";
+  std::cout << "|lines=" << t.lines << "|ids=" << t.ids
+	    << "|names=" << t.names << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  long long mb = (argc > 1) ? atol(argv[1]) : 1024;
+  const char *path = (argc > 2) ? argv[2] : "/tmp/scanBench.txt";
+  long long start, ns, base;
+  totals t;
+
+  generate(path, mb << 20);
+  struct stat st;
+  stat(path, &st);
+  long long bytes = st.st_size;
+  std::cout << path << ": " << bytes << " bytes" << std::endl;
+
+  //std::cin with the file as standard input
+  {
+    int fd = open(path, O_RDONLY);
+    dup2(fd, STDIN_FILENO);
+    ::close(fd);
+    start = now();
+    t = extract(std::cin);
+    base = now() - start;
+    show("std::cin >>", bytes, base, t, 0);
+  }
+
+  {
+    start = now();
+    std::ifstream in(path);
+    t = extract(in);
+    show("std::ifstream >>", bytes, now() - start, t, base);
+  }
+
+  {
+    start = now();
+    scanBuf sb;
+    sb.open(path, false);
+    std::istream in(&sb);
+    t = extract(in);
+    show("scanBuf (read) >>", bytes, now() - start, t, base);
+  }
+
+  {
+    start = now();
+    scanBuf sb;
+    sb.open(path, false);
+    t = scan(sb);
+    show("scanner (read)", bytes, now() - start, t, base);
+  }
+
+  {
+    start = now();
+    scanBuf sb;
+    sb.open(path, true);
+    t = scan(sb);
+    ns = now() - start;
+    show(sb.mapped() ? "scanner (mmap)" : "scanner (mmap failed, read)", bytes, ns, t, base);
+  }
+
+  unlink(path);
+  return 0;
+}
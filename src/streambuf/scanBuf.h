@@ -0,0 +1,404 @@
+/*!\file scanBuf.h
+  \brief Zero copy input streambuf and a number / token scanner
+
+  \par Purpose:
+  std::cin >> i >> ch goes through the locale, a sentry and a virtual
+  call or two per character. For large numeric text files that is most
+  of the run time. scanBuf is the input side counterpart of the
+  buffered dmsg: a regular file is mmap()ed whole and the get area is
+  the mapping; anything else (a pipe, a terminal) is read into a large
+  read-ahead buffer. It works under a std::istream like any streambuf.
+
+  scanner reads straight out of the get area: delimiters are found 16
+  bytes at a time (SSE2) and integers and floats are converted by
+  std::from_chars() (no locale, no copy). Like operator>> it skips
+  leading white space and then takes as much as forms a number, so
+  "2xx4y" still gives 2 and then 'x'.
+
+  \par Example:
+  scanBuf sb;<br>
+  sb.open("data.txt");<br>
+  scanner in(sb);<br>
+  long id; double v; std::string_view name;<br>
+  while(in.next(id) && in.next(v) && in.next(name))<br>
+  &nbsp;&nbsp;...<br>
+*/
+
+#ifndef SCANBUF_H
+#define SCANBUF_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+///first byte in [b, e) that is not white space (any byte <= ' ')
+inline const char *scanSpace(const char *b, const char *e)
+{
+#ifdef __SSE2__
+  const __m128i space = _mm_set1_epi8(' ');
+  while(e - b >= 16)
+    {
+      //unsigned x <= ' ' is max(x, ' ') == ' '
+      __m128i x = _mm_loadu_si128((const __m128i *)b);
+      int ws = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(x, space), space));
+      if(ws != 0xffff)
+	return b + __builtin_ctz(~ws);
+      b += 16;
+    }
+#endif
+  while(b < e && (unsigned char)*b <= ' ')
+    b++;
+  return b;
+}
+
+///first white space byte in [b, e) (e if none)
+inline const char *scanToken(const char *b, const char *e)
+{
+#ifdef __SSE2__
+  const __m128i space = _mm_set1_epi8(' ');
+  while(e - b >= 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *)b);
+      int ws = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(x, space), space));
+      if(ws != 0)
+	return b + __builtin_ctz(ws);
+      b += 16;
+    }
+#endif
+  while(b < e && (unsigned char)*b > ' ')
+    b++;
+  return b;
+}
+
+///Input streambuf over an mmap()ed file or a large read-ahead buffer
+class scanBuf : public std::streambuf
+{
+public:
+  scanBuf() : m_fd(-1), m_own(false), m_map(NULL), m_map_size(0),
+	      m_buf(NULL), m_buf_size(0), m_eof(false), m_error(0) {}
+
+  virtual ~scanBuf() { close(); }
+
+  ///open path for reading
+  bool open(const char *path, bool map = true, size_t buffer = 1 << 20)
+  {
+    /**
+       \param path input file
+       \param map mmap() it if it is a regular file
+       \param buffer read-ahead buffer size when it is not mapped
+       \return false on error (see lastError())
+    */
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+      {
+	m_error = errno;
+	return false;
+      }
+    if(!attach(fd, map, buffer))
+      {
+	::close(fd);
+	return false;
+      }
+    m_own = true;
+    return true;
+  }
+
+  ///read from an open descriptor (not closed by close())
+  bool attach(int fd, bool map = true, size_t buffer = 1 << 20)
+  {
+    close();
+    m_fd = fd;
+    m_own = false;
+    m_eof = false;
+    m_error = 0;
+
+    struct stat st;
+    if(map && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+      {
+	//map from the current offset to the end (page aligned start)
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+	if(pos < 0)
+	  pos = 0;
+	long page = sysconf(_SC_PAGESIZE);
+	off_t base = pos / page * page;
+	if(pos < st.st_size)
+	  {
+	    void *p = mmap(NULL, st.st_size - base, PROT_READ, MAP_PRIVATE, fd, base);
+	    if(p != MAP_FAILED)
+	      {
+		m_map = (char *)p;
+		m_map_size = st.st_size - base;
+		madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+		setg(m_map, m_map + (pos - base), m_map + m_map_size);
+		m_eof = true;	//nothing more to come
+		return true;
+	      }
+	  }
+      }
+
+    //pipes, terminals, empty or unmappable files
+    m_buf_size = buffer < 4096 ? 4096 : buffer;
+    m_buf = new char[m_buf_size];
+    setg(m_buf, m_buf, m_buf);
+    return true;
+  }
+
+  ///release the mapping / buffer (and the file if open() opened it)
+  void close()
+  {
+    if(m_map != NULL)
+      munmap(m_map, m_map_size);
+    delete [] m_buf;
+    if(m_own && m_fd >= 0)
+      ::close(m_fd);
+    m_map = NULL;
+    m_map_size = 0;
+    m_buf = NULL;
+    m_buf_size = 0;
+    m_fd = -1;
+    m_own = false;
+    setg(NULL, NULL, NULL);
+  }
+
+  ///true if the whole input is mapped
+  bool mapped() const { return m_map != NULL; }
+
+  ///errno of the last failure (0: none)
+  int lastError() const { return m_error; }
+
+  ///unread input (zero copy access for scanner)
+  const char *data() const { return gptr(); }
+  const char *dataEnd() const { return egptr(); }
+
+  ///mark everything before p as read
+  void consume(const char *p) { setg(eback(), (char *)p, egptr()); }
+
+  ///read more input behind what is unread
+  bool more()
+  {
+    /**
+       \return false at the end of the input (or on an error)
+
+       \note the unread part moves to the front of the buffer: pointers
+       into the get area are stale afterwards
+    */
+    if(m_eof || m_buf == NULL)
+      return false;
+
+    std::ptrdiff_t left = egptr() - gptr();
+    size_t keep = left > 0 ? left : 0;
+    if(keep == m_buf_size)
+      {
+	//a single token fills the buffer: grow it
+	char *bigger = new char[2 * m_buf_size];
+	memcpy(bigger, gptr(), keep);
+	delete [] m_buf;
+	m_buf = bigger;
+	m_buf_size *= 2;
+      }
+    else if(keep > 0)
+      memmove(m_buf, gptr(), keep);
+
+    ssize_t n;
+    do
+      n = read(m_fd, m_buf + keep, m_buf_size - keep);
+    while(n < 0 && errno == EINTR);
+    if(n <= 0)
+      {
+	if(n < 0)
+	  m_error = errno;
+	m_eof = true;
+	setg(m_buf, m_buf, m_buf + keep);
+	return false;
+      }
+    setg(m_buf, m_buf, m_buf + keep + n);
+    return true;
+  }
+
+protected:
+  ///get area empty: refill (read mode) or end of input (mapped)
+  virtual int_type underflow()
+  {
+    if(gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    if(!more() && gptr() == egptr())
+      return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+  }
+
+  ///how much can be read without blocking
+  virtual std::streamsize showmanyc()
+  {
+    return (m_eof && gptr() == egptr()) ? -1 : egptr() - gptr();
+  }
+
+private:
+  int m_fd;
+
+  ///close m_fd in close()
+  bool m_own;
+
+  ///the mapping (mapped mode)
+  char *m_map;
+  size_t m_map_size;
+
+  ///read-ahead buffer (read mode)
+  char *m_buf;
+  size_t m_buf_size;
+
+  ///no more input behind the get area
+  bool m_eof;
+
+  int m_error;
+};
+
+///Pulls numbers and tokens straight out of a scanBuf
+class scanner
+{
+public:
+  scanner(scanBuf &sb) : m_sb(sb), m_fail(false) {}
+
+  ///next integer or floating point number
+  template<typename T>
+  bool next(T &v)
+  {
+    /**
+       \return false at the end of input or if no number starts there
+       (nothing is consumed then, see failed())
+    */
+    static_assert(std::is_arithmetic<T>::value, "scanner::next(): not a number");
+    const char *b, *e;
+    if(!token(&b, &e))
+      return false;
+
+    //from_chars() takes no '+'
+    const char *s = b;
+    if(*s == '+' && s + 1 < e && s[1] != '-')
+      s++;
+
+    std::from_chars_result r;
+    if constexpr(std::is_floating_point<T>::value)
+      r = std::from_chars(s, e, v);
+    else
+      r = std::from_chars(s, e, v, 10);
+    if(r.ec != std::errc())
+      {
+	m_fail = true;
+	return false;
+      }
+    m_sb.consume(r.ptr);
+    return true;
+  }
+
+  ///next white space delimited token
+  bool next(std::string_view &tok)
+  {
+    /** \note zero copy: valid until the next call (mapped input: until
+	the scanBuf is closed)
+    */
+    const char *b, *e;
+    if(!token(&b, &e))
+      return false;
+    tok = std::string_view(b, e - b);
+    m_sb.consume(e);
+    return true;
+  }
+
+  ///next token, copied
+  bool next(std::string &tok)
+  {
+    std::string_view v;
+    if(!next(v))
+      return false;
+    tok.assign(v.data(), v.size());
+    return true;
+  }
+
+  ///next character that is not white space
+  bool next(char &c)
+  {
+    const char *b, *e;
+    if(!token(&b, &e))
+      return false;
+    c = *b;
+    m_sb.consume(b + 1);
+    return true;
+  }
+
+  ///drop the rest of the line
+  bool skipLine()
+  {
+    for(;;)
+      {
+	const char *b = m_sb.data();
+	const char *nl = (const char *)memchr(b, '\n', m_sb.dataEnd() - b);
+	if(nl != NULL)
+	  {
+	    m_sb.consume(nl + 1);
+	    return true;
+	  }
+	m_sb.consume(m_sb.dataEnd());
+	if(!m_sb.more())
+	  return false;
+      }
+  }
+
+  ///a next() found something that was not a number
+  bool failed() const { return m_fail; }
+
+  ///nothing left but white space
+  bool eof()
+  {
+    const char *b, *e;
+    return !token(&b, &e);
+  }
+
+private:
+  ///skip white space and find the whole token after it
+  bool token(const char **b, const char **e)
+  {
+    //leading white space
+    for(;;)
+      {
+	const char *p = scanSpace(m_sb.data(), m_sb.dataEnd());
+	m_sb.consume(p);
+	if(p < m_sb.dataEnd())
+	  break;
+	if(!m_sb.more())
+	  return false;
+      }
+
+    //the token must be whole in the buffer (read mode)
+    for(;;)
+      {
+	*b = m_sb.data();
+	*e = scanToken(*b, m_sb.dataEnd());
+	if(*e < m_sb.dataEnd())
+	  return true;
+	if(!m_sb.more())
+	  {
+	    //the last token: more() may have moved it
+	    *b = m_sb.data();
+	    *e = m_sb.dataEnd();
+	    return true;
+	  }
+      }
+  }
+
+private:
+  scanBuf &m_sb;
+  bool m_fail;
+};
+
+#endif //SCANBUF_H
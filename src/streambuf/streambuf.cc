@@ -8,41 +8,15 @@
   
   Also demonstrates the values of various types of variables when
   instantiated.
+
+  The dmsg class itself lives in dmsg.h (see dmsgBench.cc for the
+  buffered mode against the original).
 */
 
 #include <iostream>
 #include <cstdio>
 
-///Demonstration of streambuf inheritance
-class dmsg : public std::streambuf
-{
-public:
-  int i;
-  int *p;
-public:
-protected:
-  /**
-     \param c character from input (<<)
-
-     \par 
-     Function override that evaluates each character the stream
-     operator (<<) recieves. This is a necessary function to print to
-     the output
-  */
-  virtual int_type overflow(int_type c)
-  {
-    if(c != EOF)
-      {
-	//! uses C function putchar() for output
-	if(putchar(c) == EOF)
-	  return EOF;
-
-	std::cout << "|";
-      }
-    return c;
-  }
-};
-
+#include "dmsg.h"
 
 int main(int argc, char **argv)
 {
@@ -56,6 +30,20 @@ int main(int argc, char **argv)
 
   std::cout << "blah" << std::endl;
 
+  /* the same through a buffered dmsg: one write() per buffer (here
+     per std::endl) instead of one overflow() per character
+  */
+  {
+    dmsg B;
+    B.buffered(4096);
+    std::ostream bout(&B);
+
+    bout << "xxx "
+	 << 123
+	 << " yyy"
+	 << std::endl;
+  }
+
 
   /* demonstrate compound input from a stream
      (for example type "2xx4y [enter]" at the prompt)
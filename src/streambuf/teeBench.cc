@@ -0,0 +1,171 @@
+/*!\file teeBench.cc
+  \brief teeBuf against formatting the same output three times
+
+  \par Purpose:
+  Writes the same diagnostic lines to a "console" (/dev/null), a file
+  and an in-memory ring, first the usual way (three streams: a buffered
+  dmsg, a std::ofstream and a std::ostringstream, so every line is
+  formatted three times) and then once through a teeBuf (see teeBuf.h)
+  with an fdSink, a FLUSH_FULL fdSink and a ringSink. Prints the time
+  per line of both.
+
+  A last run adds a sink on a pipe that nobody reads. It is made
+  non-blocking with a small queue limit: it stalls and drops while the
+  file still gets every byte, at full speed.
+
+  \par Usage:
+  teeBench [lines] [file]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "dmsg.h"
+#include "teeBuf.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///one diagnostic line
+inline void line(std::ostream &out, long n)
+{
+  out << "diag " << n << ": queue=" << (n * 7) % 113 << " rate=" << n * 0.5
+      << " state=" << ((n & 1) ? "busy" : "idle") << '\n';
+}
+
+///size of path
+long long fileSize(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) < 0 ? -1 : (long long)st.st_size;
+}
+
+///print a sink's counters
+void showSink(const char *label, teeSink &s)
+{
+  teeSink::sink_stats st;
+  s.getStats(&st);
+  std::cout << "  " << label << ": written=" << st.written << "|dropped=" << st.dropped
+	    << "|writes=" << st.writes << "|stalls=" << st.stalls
+	    << "|queued=" << st.queued << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  long lines = (argc > 1) ? atol(argv[1]) : 1000000;
+  const char *path = (argc > 2) ? argv[2] : "/tmp/teeBench.out";
+  long long three, once, t0;
+
+  //three streams, three times the formatting
+  {
+    int null = open("/dev/null", O_WRONLY);
+    dmsg console;
+    console.buffered(65536, false, null);
+    std::ostream con(&console);
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    std::ostringstream ring;
+
+    t0 = now();
+    for(long n = 0; n < lines; n++)
+      {
+	line(con, n);
+	line(file, n);
+	line(ring, n);
+	if((n & 63) == 63)
+	  {
+	    con.flush();
+	    file.flush();
+	  }
+      }
+    con.flush();
+    file.flush();
+    three = now() - t0;
+    close(null);
+  }
+  long long size3 = fileSize(path);
+
+  //one teeBuf
+  {
+    int null = open("/dev/null", O_WRONLY);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    fdSink console(null);
+    fdSink file(fd, teeSink::FLUSH_FULL);
+    ringSink ring(64 * 1024);
+    {
+      teeBuf tee;
+      tee.add(&console);
+      tee.add(&file);
+      tee.add(&ring);
+      std::ostream out(&tee);
+
+      t0 = now();
+      for(long n = 0; n < lines; n++)
+	{
+	  line(out, n);
+	  if((n & 63) == 63)
+	    out.flush();
+	}
+      tee.close();
+      once = now() - t0;
+    }
+    close(fd);
+    close(null);
+
+    std::string recent = ring.contents();
+    std::cout << "three streams: ns/line=" << (double)three / lines
+	      << "|file=" << size3 << std::endl;
+    std::cout << "teeBuf: ns/line=" << (double)once / lines
+	      << "|speedup=" << (double)three / once << "x"
+	      << "|file=" << fileSize(path) << "|ring=" << recent.size() << " bytes" << std::endl;
+    showSink("console", console);
+    showSink("file", file);
+    showSink("ring", ring);
+  }
+
+  //a sink nobody reads
+  {
+    int pfd[2];
+    if(pipe(pfd) < 0)
+      return 1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    fdSink file(fd, teeSink::FLUSH_FULL);
+    fdSink stuck(pfd[1], teeSink::FLUSH_SYNC, 256 * 1024, true);
+    {
+      teeBuf tee;
+      tee.add(&file);
+      tee.add(&stuck);
+      std::ostream out(&tee);
+
+      t0 = now();
+      for(long n = 0; n < lines; n++)
+	{
+	  line(out, n);
+	  if((n & 63) == 63)
+	    out.flush();
+	}
+      tee.close();
+      once = now() - t0;
+    }
+    close(fd);
+
+    std::cout << "with a stuck pipe sink: ns/line=" << (double)once / lines
+	      << "|file=" << fileSize(path) << std::endl;
+    showSink("file", file);
+    showSink("stuck pipe", stuck);
+    close(pfd[0]);
+    close(pfd[1]);
+  }
+
+  unlink(path);
+  return 0;
+}
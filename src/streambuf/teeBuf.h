@@ -0,0 +1,446 @@
+/*!\file teeBuf.h
+  \brief Output streambuf that formats once and fans out to many sinks
+
+  \par Purpose:
+  Sending one diagnostic stream to the console, a file and a ring
+  buffer used to mean three streams and formatting everything three
+  times. teeBuf is a buffered dmsg with several outputs: the stream
+  operators format into one shared chunk, and every std::endl / flush
+  (or full chunk) hands each sink a reference to the new bytes. Nothing
+  is copied per sink: fdSink writev()s straight out of the shared
+  chunks, ringSink just keeps the references. A chunk is freed when the
+  last sink lets go of it.
+
+  Each sink has its own flush policy and its own queue with a limit.
+  An fdSink made with nonblock (its descriptor set O_NONBLOCK) takes
+  what the descriptor accepts and keeps the rest queued, so a slow
+  reader does not stall the other sinks; when its queue goes over the
+  limit its oldest output is dropped (and counted) instead. The
+  default is a blocking descriptor, left as it is: then a slow reader
+  (a terminal, a pipe) blocks every std::endl / flush of the stream,
+  for all the sinks.
+
+  \par Example:
+  fdSink console(STDOUT_FILENO);&nbsp;&nbsp;//blocking: may stall the stream<br>
+  fdSink file(fd, teeSink::FLUSH_FULL);<br>
+  fdSink remote(sock, teeSink::FLUSH_SYNC, 1 << 20, true);&nbsp;&nbsp;//never stalls<br>
+  ringSink recent(64 * 1024);<br>
+  teeBuf tee;<br>
+  tee.add(&console); tee.add(&file); tee.add(&remote); tee.add(&recent);<br>
+  std::ostream out(&tee);<br>
+*/
+
+#ifndef TEEBUF_H
+#define TEEBUF_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+///A shared, reference counted block of formatted output
+struct teeChunk
+{
+  int refs;
+  char *data;
+
+  teeChunk(size_t size) : refs(1) { data = new char[size]; }
+  ~teeChunk() { delete [] data; }
+
+  void ref() { refs++; }
+  void unref()
+  {
+    if(--refs == 0)
+      delete this;
+  }
+};
+
+///Base class of a teeBuf output
+class teeSink
+{
+public:
+  ///when the sink writes what it was handed
+  enum flush_policy
+  {
+    ///at every std::endl / std::flush (and full chunk)
+    FLUSH_SYNC = 0,
+
+    ///only when a chunk fills up (and at close)
+    FLUSH_FULL
+  };
+
+  ///per sink counters
+  struct sink_stats
+  {
+    unsigned long long written;
+    unsigned long long dropped;
+    unsigned long writes;
+
+    ///writes that found the sink not ready (would block)
+    unsigned long stalls;
+
+    ///bytes waiting right now
+    unsigned long long queued;
+  };
+
+  teeSink(flush_policy policy = FLUSH_SYNC, size_t max_queued = 1 << 20)
+    : m_policy(policy), m_max_queued(max_queued), m_queued(0), m_front_done(0)
+  {
+    memset(&m_stats, 0, sizeof(m_stats));
+  }
+
+  ///lets go of whatever is still queued
+  virtual ~teeSink()
+  {
+    for(size_t i = 0; i < m_queue.size(); i++)
+      m_queue[i].chunk->unref();
+  }
+
+  flush_policy policy() const { return m_policy; }
+
+  ///copy out the counters
+  void getStats(sink_stats *out) const
+  {
+    *out = m_stats;
+    out->queued = m_queued;
+  }
+
+protected:
+  ///a reference to part of a chunk
+  struct piece
+  {
+    teeChunk *chunk;
+    size_t off;
+    size_t len;
+  };
+
+  ///write what can be written of iov, return the bytes taken
+  virtual ssize_t write(const struct iovec *iov, int cnt) = 0;
+
+  ///move queued pieces out (the default writes them)
+  virtual int flush()
+  {
+    /** \return 0, -1 on a write error (the queue is kept) */
+    while(!m_queue.empty())
+      {
+	//up to 64 pieces per call, the first one maybe partly written
+	struct iovec iov[64];
+	int cnt = 0;
+	for(size_t i = 0; i < m_queue.size() && cnt < 64; i++, cnt++)
+	  {
+	    size_t skip = (i == 0) ? m_front_done : 0;
+	    iov[cnt].iov_base = m_queue[i].chunk->data + m_queue[i].off + skip;
+	    iov[cnt].iov_len = m_queue[i].len - skip;
+	  }
+
+	ssize_t w = write(iov, cnt);
+	m_stats.writes++;
+	if(w < 0)
+	  return -1;
+	if(w == 0)
+	  {
+	    //not ready: keep it for later, others go on
+	    m_stats.stalls++;
+	    return 0;
+	  }
+	m_stats.written += w;
+	consume(w);
+      }
+    return 0;
+  }
+
+  ///drop w written bytes off the front of the queue
+  void consume(size_t w)
+  {
+    m_queued -= w;
+    while(w > 0)
+      {
+	piece &p = m_queue.front();
+	size_t left = p.len - m_front_done;
+	if(w < left)
+	  {
+	    m_front_done += w;
+	    return;
+	  }
+	w -= left;
+	p.chunk->unref();
+	m_queue.pop_front();
+	m_front_done = 0;
+      }
+  }
+
+  ///the queue (for sinks that keep pieces instead of writing them)
+  std::deque<piece> &queue() { return m_queue; }
+  void dequeued(size_t bytes) { m_queued -= bytes; }
+
+  sink_stats m_stats;
+
+private:
+  friend class teeBuf;
+
+  ///take a reference to new output, drop old output past the limit
+  void push(teeChunk *chunk, size_t off, size_t len)
+  {
+    chunk->ref();
+    piece p = {chunk, off, len};
+    m_queue.push_back(p);
+    m_queued += len;
+
+    //over the limit: the oldest whole pieces go (not one being written)
+    size_t first = (m_front_done > 0) ? 1 : 0;
+    while(m_queued > m_max_queued && m_queue.size() > first + 1)
+      {
+	piece &old = m_queue[first];
+	m_queued -= old.len;
+	m_stats.dropped += old.len;
+	old.chunk->unref();
+	m_queue.erase(m_queue.begin() + first);
+      }
+  }
+
+private:
+  flush_policy m_policy;
+  size_t m_max_queued;
+
+  std::deque<piece> m_queue;
+  size_t m_queued;
+
+  ///bytes of the front piece already written
+  size_t m_front_done;
+};
+
+///Sink writing to a file descriptor with writev()
+class fdSink : public teeSink
+{
+public:
+  fdSink(int fd, flush_policy policy = FLUSH_SYNC, size_t max_queued = 1 << 20,
+	 bool nonblock = false)
+    : teeSink(policy, max_queued), m_fd(fd)
+  {
+    /**
+       \param nonblock make fd non-blocking: a slow reader then makes
+       this sink queue (and drop) instead of stalling the stream. The
+       flag is on the open file, so it is seen by everyone sharing it
+       (not set by default for that reason).
+
+       \note only a non-blocking sink is isolated from the others. On a
+       blocking descriptor writev() waits for the reader, and the whole
+       teeBuf waits with it.
+    */
+    if(nonblock)
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+protected:
+  virtual ssize_t write(const struct iovec *iov, int cnt)
+  {
+    for(;;)
+      {
+	ssize_t w = writev(m_fd, iov, cnt);
+	if(w >= 0)
+	  return w;
+	if(errno == EINTR)
+	  continue;
+	if(errno == EAGAIN || errno == EWOULDBLOCK)
+	  return 0;
+	return -1;
+      }
+  }
+
+private:
+  int m_fd;
+};
+
+///Sink keeping (references to) the most recent output
+class ringSink : public teeSink
+{
+public:
+  ringSink(size_t capacity = 64 * 1024)
+    : teeSink(FLUSH_SYNC, (size_t)-1), m_capacity(capacity), m_kept(0) {}
+
+  virtual ~ringSink()
+  {
+    for(size_t i = 0; i < m_ring.size(); i++)
+      m_ring[i].chunk->unref();
+  }
+
+  ///the last capacity bytes (at most)
+  std::string contents() const
+  {
+    std::string s;
+    size_t skip = m_kept > m_capacity ? m_kept - m_capacity : 0;
+    for(size_t i = 0; i < m_ring.size(); i++)
+      {
+	const piece &p = m_ring[i];
+	if(skip >= p.len)
+	  {
+	    skip -= p.len;
+	    continue;
+	  }
+	s.append(p.chunk->data + p.off + skip, p.len - skip);
+	skip = 0;
+      }
+    return s;
+  }
+
+protected:
+  ///never called: flush() keeps the pieces instead
+  virtual ssize_t write(const struct iovec *, int) { return -1; }
+
+  virtual int flush()
+  {
+    std::deque<piece> &q = queue();
+    while(!q.empty())
+      {
+	m_ring.push_back(q.front());
+	m_kept += q.front().len;
+	dequeued(q.front().len);
+	m_stats.written += q.front().len;
+	q.pop_front();
+      }
+
+    //forget pieces that are entirely older than the last capacity bytes
+    while(!m_ring.empty() && m_kept - m_ring.front().len >= m_capacity)
+      {
+	m_kept -= m_ring.front().len;
+	m_ring.front().chunk->unref();
+	m_ring.pop_front();
+      }
+    return 0;
+  }
+
+private:
+  size_t m_capacity;
+  std::deque<piece> m_ring;
+  size_t m_kept;
+};
+
+///Streambuf formatting once into shared chunks for several sinks
+class teeBuf : public std::streambuf
+{
+public:
+  teeBuf(size_t chunk = 65536) : m_size(chunk < 256 ? 256 : chunk), m_chunk(NULL), m_mark(NULL)
+  {
+    newChunk();
+  }
+
+  ///flushes every sink
+  virtual ~teeBuf()
+  {
+    close();
+    if(m_chunk != NULL)
+      m_chunk->unref();
+  }
+
+  ///add a sink (not owned; it must outlive the teeBuf)
+  void add(teeSink *sink) { m_sinks.push_back(sink); }
+
+  ///hand everything to every sink and flush them all
+  int close()
+  {
+    /** \note a sink that is still not ready keeps its queue */
+    publish();
+    int ret = 0;
+    for(size_t i = 0; i < m_sinks.size(); i++)
+      if(m_sinks[i]->flush() < 0)
+	ret = -1;
+    return ret;
+  }
+
+protected:
+  ///the chunk is full
+  virtual int_type overflow(int_type c)
+  {
+    publish();
+    flushSinks(true);
+    newChunk();
+    if(!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+      }
+    return traits_type::not_eof(c);
+  }
+
+  ///bulk output: whole strings, chunk by chunk
+  virtual std::streamsize xsputn(const char *s, std::streamsize n)
+  {
+    std::streamsize done = 0;
+    while(done < n)
+      {
+	std::streamsize room = epptr() - pptr();
+	if(room == 0)
+	  {
+	    overflow(traits_type::eof());
+	    continue;
+	  }
+	std::streamsize chunk = (n - done < room) ? n - done : room;
+	memcpy(pptr(), s + done, chunk);
+	pbump((int)chunk);
+	done += chunk;
+      }
+    return n;
+  }
+
+  ///std::endl / std::flush
+  virtual int sync()
+  {
+    publish();
+    return flushSinks(false);
+  }
+
+private:
+  ///give every sink a reference to the bytes since the last time
+  void publish()
+  {
+    if(pptr() == m_mark)
+      return;
+    size_t off = m_mark - m_chunk->data;
+    size_t len = pptr() - m_mark;
+    for(size_t i = 0; i < m_sinks.size(); i++)
+      m_sinks[i]->push(m_chunk, off, len);
+    m_mark = pptr();
+  }
+
+  ///flush the sinks whose policy says so
+  int flushSinks(bool full)
+  {
+    int ret = 0;
+    for(size_t i = 0; i < m_sinks.size(); i++)
+      if(full || m_sinks[i]->policy() == teeSink::FLUSH_SYNC)
+	if(m_sinks[i]->flush() < 0)
+	  ret = -1;
+    return ret;
+  }
+
+  ///start formatting into a fresh chunk
+  void newChunk()
+  {
+    //nobody else holds the old one: reuse it
+    if(m_chunk != NULL && m_chunk->refs > 1)
+      {
+	m_chunk->unref();
+	m_chunk = NULL;
+      }
+    if(m_chunk == NULL)
+      m_chunk = new teeChunk(m_size);
+    m_mark = m_chunk->data;
+    setp(m_chunk->data, m_chunk->data + m_size);
+  }
+
+private:
+  size_t m_size;
+
+  ///chunk being formatted into and the start of the unpublished part
+  teeChunk *m_chunk;
+  char *m_mark;
+
+  std::vector<teeSink *> m_sinks;
+};
+
+#endif //TEEBUF_H
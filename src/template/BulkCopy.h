@@ -0,0 +1,324 @@
+/** \file BulkCopy.h
+
+\brief Multi-threaded copy of large known-length buffers
+
+\par Purpose:
+Tmycpy and memcpy() copy on one core, and a copy of a few hundred MB
+pushes everything else the program had cached out of the caches.
+BulkCopy splits a large copy into one piece per core, runs the pieces
+as ThreadMgr threads of one TaskGroup (the calling thread takes a piece
+too), and writes with non-temporal (streaming) stores once the copy is
+larger than the last level cache, so the destination goes straight to
+memory instead of evicting the working set.
+
+Pieces are cut at page boundaries of the destination: no two threads
+ever write the same page (or cache line), and each piece starts on a
+64 byte line for the streaming stores. Starting threads costs tens of
+microseconds, so below a crossover size (see bulkBench) the copy is
+done by the calling thread alone.
+*/
+
+#ifndef BULKCOPY_H
+#define BULKCOPY_H
+
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "ThreadMgr.h"
+#include "CpuDispatch.h"
+
+/**
+   \brief Parallel, cache friendly copy of large buffers
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   ThreadMgr m;<br>
+   BulkCopy bulk(m);<br>
+   bulk.copy(dst, src, 512 << 20);<br>
+
+   \note
+   Like memcpy(), the buffers must not overlap. copy() may be called
+   from several threads at once (each call has its own TaskGroup).
+*/
+class BulkCopy {
+public:
+  ///counters (see getStats())
+  struct copy_stats
+  {
+    unsigned long copies;
+
+    ///copies split across threads
+    unsigned long parallel;
+
+    ///copies done with streaming stores
+    unsigned long streamed;
+
+    unsigned long long bytes;
+  };
+
+  ///constructor
+  BulkCopy(ThreadMgr &mgr, int threads = 0)
+    : m_mgr(&mgr), m_crossover(DEFAULT_CROSSOVER)
+  {
+    /**
+       \param threads pieces per copy (0: one per online cpu, at most
+       MAX_THREADS; memory bandwidth is saturated well before that)
+    */
+    if(threads <= 0)
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    m_threads = (threads < 1) ? 1 : (threads > MAX_THREADS ? MAX_THREADS : threads);
+
+    //stream when the copy would not fit in the last level cache
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if(llc <= 0)
+      llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    m_stream_threshold = (llc > 0) ? (size_t)llc : DEFAULT_STREAM_THRESHOLD;
+
+    m_stats.copies = 0;
+    m_stats.parallel = 0;
+    m_stats.streamed = 0;
+    m_stats.bytes = 0;
+  }
+
+  ///number of pieces a large copy is split into
+  int threads() const { return m_threads; }
+
+  ///copies smaller than this are done by the calling thread alone
+  void setCrossover(size_t bytes) { m_crossover = bytes; }
+  size_t crossover() const { return m_crossover; }
+
+  ///copies larger than this use streaming stores
+  void setStreamThreshold(size_t bytes) { m_stream_threshold = bytes; }
+  size_t streamThreshold() const { return m_stream_threshold; }
+
+  ///copy n bytes from src to dst
+  int copy(void *dst, const void *src, size_t n)
+  {
+    /** \return the number of threads that took part */
+    bool stream = n > m_stream_threshold;
+    m_stats.copies++;
+    m_stats.bytes += n;
+    if(stream)
+      m_stats.streamed++;
+
+    if(n < m_crossover || m_threads == 1)
+      {
+	piece(dst, src, n, stream);
+	return 1;
+      }
+    m_stats.parallel++;
+
+    //cut at destination page boundaries, roughly n / m_threads apart
+    char *d = (char *)dst;
+    const char *s = (const char *)src;
+    std::vector<task> tasks(m_threads);
+    size_t at = 0;
+    for(int i = 0; i < m_threads; i++)
+      {
+	size_t end = n;
+	if(i < m_threads - 1)
+	  {
+	    end = pageUp(d + n / m_threads * (i + 1)) - d;
+	    if(end > n)
+	      end = n;
+	  }
+	tasks[i].dst = d + at;
+	tasks[i].src = s + at;
+	tasks[i].n = end - at;
+	tasks[i].stream = stream;
+	at = end;
+      }
+
+    //the other pieces to new threads, the first one here
+    int used = 1;
+    {
+      TaskGroup group(*m_mgr);
+      for(int i = 1; i < m_threads; i++)
+	{
+	  if(tasks[i].n == 0)
+	    continue;
+	  if(m_mgr->createThread(worker, &tasks[i], &group) != 0)
+	    used++;
+	  else
+	    piece(tasks[i].dst, tasks[i].src, tasks[i].n, stream);
+	}
+      piece(tasks[0].dst, tasks[0].src, tasks[0].n, stream);
+      m_mgr->waitAll(&group);
+    }
+    return used;
+  }
+
+  ///copy out the counters
+  void getStats(copy_stats *out) const
+  {
+    out->copies = m_stats.copies.load(std::memory_order_relaxed);
+    out->parallel = m_stats.parallel.load(std::memory_order_relaxed);
+    out->streamed = m_stats.streamed.load(std::memory_order_relaxed);
+    out->bytes = m_stats.bytes.load(std::memory_order_relaxed);
+  }
+
+  ///single threaded copy with non-temporal stores
+  static void streamCopy(void *dst, const void *src, size_t n)
+  {
+    /**
+       \note the stores are fenced (sfence) before returning, so the
+       data is visible to whoever synchronizes with the caller next.
+       The variant (memcpy, SSE2, AVX2) is picked on the first call,
+       see CpuDispatch.h.
+    */
+    m_stream_kernel.load(std::memory_order_relaxed)(dst, src, n);
+  }
+
+  ///default crossover: a few thread starts (tens of usec each) are
+  ///worth about a MB of copying; measure it with bulkBench
+  static const size_t DEFAULT_CROSSOVER = 2 << 20;
+
+  ///streaming threshold when the cache size is unknown
+  static const size_t DEFAULT_STREAM_THRESHOLD = 8 << 20;
+
+  ///most pieces a copy is split into
+  static const int MAX_THREADS = 16;
+
+private:
+  ///one piece of a copy
+  struct task
+  {
+    void *dst;
+    const void *src;
+    size_t n;
+    bool stream;
+  };
+
+  ///counters, updated by concurrent copy() calls
+  struct shared_stats
+  {
+    std::atomic<unsigned long> copies;
+    std::atomic<unsigned long> parallel;
+    std::atomic<unsigned long> streamed;
+    std::atomic<unsigned long long> bytes;
+  };
+
+  ///a streamCopy() variant
+  typedef void (*stream_kernel)(void *, const void *, size_t);
+
+  ///pick the variant for the selected cpu level, then do the copy
+  static void resolveStream(void *dst, const void *src, size_t n)
+  {
+    CpuDispatch::level l = CpuDispatch::selected();
+    stream_kernel k = scalarStream;
+#if defined(__SSE2__)
+    if(l >= CpuDispatch::AVX2)
+      k = avx2Stream;
+    else if(l >= CpuDispatch::SSE2)
+      k = sse2Stream;
+#else
+    l = CpuDispatch::SCALAR;
+#endif
+    m_stream_kernel.store(k, std::memory_order_relaxed);
+    CpuDispatch::chosen("BulkCopy::streamCopy", l);
+    k(dst, src, n);
+  }
+
+  ///no streaming stores to be had
+  static void scalarStream(void *dst, const void *src, size_t n)
+  {
+    memcpy(dst, src, n);
+  }
+
+#if defined(__SSE2__)
+  ///up to a 64 byte line of dst the ordinary way, return the rest
+  static size_t streamHead(char *&d, const char *&s, size_t n)
+  {
+    size_t head = (size_t)(-(uintptr_t)d & 63);
+    if(head > n)
+      head = n;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    return n - head;
+  }
+
+  ///whole lines written around the caches, 16 bytes per store
+  static void sse2Stream(void *dst, const void *src, size_t n)
+  {
+    char *d = (char *)dst;
+    const char *s = (const char *)src;
+    n = streamHead(d, s, n);
+    for(; n >= 64; n -= 64, d += 64, s += 64)
+      {
+	__m128i a = _mm_loadu_si128((const __m128i *)s);
+	__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+	__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+	__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+	_mm_stream_si128((__m128i *)d, a);
+	_mm_stream_si128((__m128i *)(d + 16), b);
+	_mm_stream_si128((__m128i *)(d + 32), c);
+	_mm_stream_si128((__m128i *)(d + 48), e);
+      }
+    _mm_sfence();
+    memcpy(d, s, n);
+  }
+
+  ///32 bytes per store (only called when the cpu has AVX2)
+  __attribute__((target("avx2")))
+  static void avx2Stream(void *dst, const void *src, size_t n)
+  {
+    char *d = (char *)dst;
+    const char *s = (const char *)src;
+    n = streamHead(d, s, n);
+    for(; n >= 64; n -= 64, d += 64, s += 64)
+      {
+	__m256i a = _mm256_loadu_si256((const __m256i *)s);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+	_mm256_stream_si256((__m256i *)d, a);
+	_mm256_stream_si256((__m256i *)(d + 32), b);
+      }
+    _mm_sfence();
+    memcpy(d, s, n);
+  }
+#endif
+
+  ///the streamCopy() variant in use (the resolver until the first call)
+  static std::atomic<stream_kernel> m_stream_kernel;
+
+  ///copy one piece
+  static void piece(void *dst, const void *src, size_t n, bool stream)
+  {
+    if(stream)
+      streamCopy(dst, src, n);
+    else
+      memcpy(dst, src, n);
+  }
+
+  ///thread function: copy the piece arg points to
+  static void *worker(void *arg)
+  {
+    task *t = (task *)arg;
+    piece(t->dst, t->src, t->n, t->stream);
+    return NULL;
+  }
+
+  ///p rounded up to a page boundary
+  static char *pageUp(char *p)
+  {
+    static const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    return (char *)(((uintptr_t)p + page - 1) & ~(page - 1));
+  }
+
+  ThreadMgr *m_mgr;
+  int m_threads;
+  size_t m_crossover;
+  size_t m_stream_threshold;
+  shared_stats m_stats;
+};
+
+inline std::atomic<BulkCopy::stream_kernel> BulkCopy::m_stream_kernel{BulkCopy::resolveStream};
+
+#endif //BULKCOPY_H
@@ -0,0 +1,168 @@
+/** \file CpuDispatch.h
+
+\brief Run time choice between the scalar, SSE2 and AVX2 kernels
+
+\par Purpose:
+The vector kernels (sentinelCopy() in Tmycpy.h, BulkCopy::streamCopy())
+used to be picked when compiling: a -mavx2 binary dies with SIGILL on
+an older node, and a baseline binary never uses AVX2. Now every
+variant is compiled into the binary (the AVX2 ones under a target
+pragma) and each kernel is a function pointer that starts out at a
+resolver. The first call asks CpuDispatch for the level to use, points
+the kernel at the matching variant and calls it; every later call is a
+plain indirect call, with no test at all.
+<br>
+<br>
+The cpu is looked at once (cpuid, and xgetbv for the OS saving the
+AVX registers). CPU_DISPATCH=scalar|sse2|avx2 in the environment
+lowers the level so every path can be tested on one machine; asking
+for more than the cpu has gets what the cpu has. report() lists the
+level and what each kernel resolved to.
+
+\par Example:
+CPU_DISPATCH=sse2 ./tmycpyBench
+*/
+
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/**
+   \brief Cpu feature detection and the kernel choice record
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+*/
+class CpuDispatch {
+public:
+  ///kernel variants, each needing the ones before it
+  enum level
+  {
+    SCALAR = 0,
+    SSE2,
+    AVX2
+  };
+
+  ///what the cpu (and OS) support
+  static level detected()
+  {
+    static const level l = detect();
+    return l;
+  }
+
+  ///the level kernels resolve to (detected(), lowered by CPU_DISPATCH)
+  static level selected()
+  {
+    static const level l = select();
+    return l;
+  }
+
+  static const char *name(level l)
+  {
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    return names[l];
+  }
+
+  ///record that kernel resolved to variant l (called by the resolvers)
+  static void chosen(const char *kernel, level l)
+  {
+    state &s = st();
+    pthread_mutex_lock(&s.mutex);
+    for(int i = 0; i < s.count; i++)
+      if(strcmp(s.kernels[i].name, kernel) == 0)
+	{
+	  pthread_mutex_unlock(&s.mutex);
+	  return;
+	}
+    if(s.count < MAX_KERNELS)
+      {
+	s.kernels[s.count].name = kernel;
+	s.kernels[s.count].variant = l;
+	s.count++;
+      }
+    pthread_mutex_unlock(&s.mutex);
+  }
+
+  ///print the levels and the kernels resolved so far
+  static void report(std::ostream &out)
+  {
+    state &s = st();
+    const char *env = getenv(ENV);
+    out << "cpu: " << name(detected()) << "|selected: " << name(selected());
+    if(env != NULL && *env != '\0')
+      out << " (" << ENV << "=" << env << ")";
+    out << std::endl;
+
+    pthread_mutex_lock(&s.mutex);
+    for(int i = 0; i < s.count; i++)
+      out << "  " << s.kernels[i].name << ": " << name(s.kernels[i].variant) << std::endl;
+    pthread_mutex_unlock(&s.mutex);
+  }
+
+  ///the override variable
+  static constexpr const char *ENV = "CPU_DISPATCH";
+
+private:
+  static const int MAX_KERNELS = 32;
+
+  ///resolved kernels
+  struct state
+  {
+    pthread_mutex_t mutex;
+    int count;
+    struct
+    {
+      const char *name;
+      level variant;
+    } kernels[MAX_KERNELS];
+  };
+
+  static state &st()
+  {
+    static state s = {PTHREAD_MUTEX_INITIALIZER, 0, {}};
+    return s;
+  }
+
+  ///ask the cpu
+  static level detect()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+    if(!__get_cpuid(1, &a, &b, &c, &d) || !(d & bit_SSE2))
+      return SCALAR;
+
+    //AVX2: the instructions, and the OS saving the ymm registers
+    if((c & bit_OSXSAVE) && (c & bit_AVX))
+      {
+	unsigned lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	if((lo & 6) == 6 && __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2))
+	  return AVX2;
+      }
+    return SSE2;
+#else
+    return SCALAR;
+#endif
+  }
+
+  ///detected(), capped by the environment
+  static level select()
+  {
+    level l = detected();
+    const char *env = getenv(ENV);
+    if(env == NULL)
+      return l;
+    for(int i = SCALAR; i <= AVX2; i++)
+      if(strcmp(env, name((level)i)) == 0)
+	return (level)i < l ? (level)i : l;
+    return l;
+  }
+};
+
+#endif //CPUDISPATCH_H
@@ -0,0 +1,188 @@
+/** \file InlineString.h
+
+\brief Fixed capacity string kept inside the object
+
+\par Purpose:
+The task payloads in the demos are short strings, and each one is a
+heap round trip: myStringFunc() returns a new std::string that the
+reaper deletes (usually on another thread than the one that made it),
+the results of myfunc2() used to be a new char[10]. InlineString<N>
+holds up to N chars and the 0 inside the object. Making one allocates
+nothing, and it is trivially copyable (and standard layout): it is
+passed by value, memcpy()d into a ThreadArena result or a shared
+memory segment, and read there as is.
+<br>
+<br>
+Nothing is ever written past the capacity. assign() and append() keep
+what fits and return false when something did not, rather than
+throwing. Chars from a C string are copied with sentinelCopyN() (see
+Tmycpy.h, a vector register at a time), chars of a known count with
+one memcpy().
+
+\par Example:
+InlineString<30> name("worker-thread-");<br>
+if(!name.append(id)) ...&nbsp;&nbsp;//truncated<br>
+std::cout << name << std::endl;<br>
+*/
+
+#ifndef INLINESTRING_H
+#define INLINESTRING_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+
+#include "Tmycpy.h"
+
+/**
+   \brief String of at most N chars, with no heap storage
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \note
+   The object is the length and N + 1 chars (the length is one byte
+   up to N = 255), so InlineString<62> fills one 64 byte cache line.
+   A copy copies all of it, whatever size() is.
+*/
+template <size_t N> class InlineString {
+public:
+  static_assert(N > 0 && N < 0xffffffffUL, "InlineString capacity out of range");
+
+  ///smallest unsigned type holding N
+  typedef typename std::conditional<(N < 256), uint8_t,
+				    typename std::conditional<(N < 65536), uint16_t,
+							      uint32_t>::type>::type length_type;
+
+  ///constructor, empty
+  InlineString() : m_len(0) { m_data[0] = '\0'; }
+
+  ///constructor, the first N chars of s
+  InlineString(const char *s) : m_len(0)
+  {
+    m_data[0] = '\0';
+    append(s);
+  }
+
+  ///constructor, the first N of n chars
+  InlineString(const char *s, size_t n) : m_len(0)
+  {
+    m_data[0] = '\0';
+    append(s, n);
+  }
+
+  ///constructor, the first N chars of s
+  InlineString(std::string_view s) : m_len(0)
+  {
+    m_data[0] = '\0';
+    append(s.data(), s.size());
+  }
+
+  ///replace the contents with s
+  bool assign(const char *s)
+  {
+    /** \return false if s was cut to the capacity */
+    m_len = 0;
+    return append(s);
+  }
+
+  ///replace the contents with n chars of s
+  bool assign(const char *s, size_t n)
+  {
+    m_len = 0;
+    return append(s, n);
+  }
+
+  ///add s to the end
+  bool append(const char *s)
+  {
+    /**
+       \return false if s was cut to the capacity
+       \note s must not point into this string (use append(s, n))
+    */
+    size_t room = N - m_len;
+    size_t n = sentinelCopyN(m_data + m_len, s, room);
+    m_len += n;
+    m_data[m_len] = '\0';
+    return n < room || s[n] == '\0';
+  }
+
+  ///add n chars of s to the end
+  bool append(const char *s, size_t n)
+  {
+    size_t room = N - m_len;
+    size_t k = (n < room) ? n : room;
+    memcpy(m_data + m_len, s, k);
+    m_len += k;
+    m_data[m_len] = '\0';
+    return k == n;
+  }
+
+  bool append(std::string_view s) { return append(s.data(), s.size()); }
+
+  template <size_t M> bool append(const InlineString<M> &s) { return append(s.data(), s.size()); }
+
+  ///assign, cutting to the capacity
+  InlineString &operator=(const char *s)
+  {
+    assign(s);
+    return *this;
+  }
+
+  ///append, cutting to the capacity
+  InlineString &operator+=(const char *s)
+  {
+    append(s);
+    return *this;
+  }
+
+  InlineString &operator+=(std::string_view s)
+  {
+    append(s);
+    return *this;
+  }
+
+  void clear()
+  {
+    m_len = 0;
+    m_data[0] = '\0';
+  }
+
+  size_t size() const { return m_len; }
+  bool empty() const { return m_len == 0; }
+  bool full() const { return m_len == N; }
+  static constexpr size_t capacity() { return N; }
+
+  ///0 terminated
+  const char *c_str() const { return m_data; }
+  const char *data() const { return m_data; }
+
+  ///unchecked, like std::string
+  char operator[](size_t i) const { return m_data[i]; }
+
+  std::string_view view() const { return std::string_view(m_data, m_len); }
+  std::string str() const { return std::string(m_data, m_len); }
+
+  template <size_t M> bool operator==(const InlineString<M> &o) const { return view() == o.view(); }
+  template <size_t M> bool operator!=(const InlineString<M> &o) const { return view() != o.view(); }
+  bool operator==(const char *s) const { return view() == s; }
+  bool operator!=(const char *s) const { return view() != s; }
+
+private:
+  length_type m_len;
+  char m_data[N + 1];
+};
+
+template <size_t N> std::ostream &operator<<(std::ostream &os, const InlineString<N> &s)
+{
+  return os.write(s.data(), s.size());
+}
+
+//what makes it a by value payload
+static_assert(std::is_trivially_copyable<InlineString<62> >::value &&
+	      std::is_standard_layout<InlineString<62> >::value && sizeof(InlineString<62>) == 64,
+	      "InlineString must stay a plain 64 byte record");
+
+#endif //INLINESTRING_H
@@ -0,0 +1,514 @@
+/*!\file Tmycpy.h
+  \brief Sentinel terminated array copy, 16 / 32 bytes at a time
+
+  \par Purpose:
+  Tmycpy copies an array up to and including its first 0 element one
+  element per loop pass, whatever the element type. sentinelCopy() does
+  the same copy a vector register at a time for 1, 2, 4 and 8 byte
+  integer (and pointer) elements: each block is compared against zero
+  (pcmpeqb/w/d/q), copied whole while it holds no sentinel, and the
+  block holding the sentinel is copied up to it. Cpus with AVX2 use 32
+  byte blocks, others 16 byte blocks (the choice is made at run time,
+  see CpuDispatch.h); other element types and misaligned element
+  pointers take the scalar loop.
+
+  Like strlen() in the C library, the source is only ever read in
+  aligned blocks (the first one starting below src and ignoring the
+  bytes before it). An aligned block never straddles a page, so a read
+  never reaches a page past the one holding the sentinel. Nothing is
+  written past the sentinel in dst.
+
+  sentinelCopyN() is the bounded char variant: it copies at most max
+  chars and stops before the 0 (which it does not write), reading no
+  block that holds none of the first max chars. It is what a fixed
+  capacity string (InlineString.h) fills itself with.
+
+  The Tmycpy overloads at the end take arrays by reference (C arrays
+  and std::array), so the extents are known at compile time: a
+  destination smaller than the source does not compile, and the copy
+  never runs past the source array even when it holds no sentinel.
+  What the copy is made of depends on the element type: integers and
+  pointers are copied up to their sentinel, other trivially copyable
+  types are copied whole with one fixed size memcpy (a few vector moves
+  after inlining), anything else element by element. They are
+  constexpr and unrolled when evaluated by the compiler; unlike the
+  pointer Tmycpy they print nothing.
+
+  \par Example:
+  char name[32];<br>
+  size_t n = sentinelCopy(name, "thread-7");&nbsp;&nbsp;//9<br>
+  int m = Tmycpy("thread-7", name);&nbsp;&nbsp;//9, sizes checked<br>
+*/
+
+#ifndef TMYCPY_H
+#define TMYCPY_H
+
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <array>
+#include <atomic>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "CpuDispatch.h"
+
+//the aligned block reads go past the end of the source object (never
+//past its page), which AddressSanitizer would report
+#define SENTINEL_NO_ASAN __attribute__((no_sanitize_address))
+
+///copy src to dst up to and including the first 0, one element at a time
+template <class T> inline size_t sentinelCopyScalar(T *dst, const T *src)
+{
+  /** \return elements copied, the sentinel included */
+  size_t n = 1;
+  while((*dst++ = *src++))
+    n++;
+  return n;
+}
+
+///sentinelCopy() kernels, one per cpu level (see CpuDispatch.h)
+namespace sentinel
+{
+  ///copies W byte elements of a W aligned src, returns the count
+  typedef size_t (*kernel)(char *dst, const char *src);
+
+  ///a W byte integer that may alias any element type
+  template <size_t W> struct word;
+  template <> struct word<1> { typedef uint8_t __attribute__((may_alias)) type; };
+  template <> struct word<2> { typedef uint16_t __attribute__((may_alias)) type; };
+  template <> struct word<4> { typedef uint32_t __attribute__((may_alias)) type; };
+  template <> struct word<8> { typedef uint64_t __attribute__((may_alias)) type; };
+
+  ///one element at a time
+  template <size_t W> size_t scalar(char *dst, const char *src)
+  {
+    typedef typename word<W>::type w;
+    w *d = (w *)dst;
+    const w *s = (const w *)src;
+    size_t n = 1;
+    while((*d++ = *s++))
+      n++;
+    return n;
+  }
+
+#if defined(__SSE2__)
+  ///16 byte blocks
+  namespace sse2
+  {
+    typedef __m128i block;
+    const size_t width = 16;
+
+    SENTINEL_NO_ASAN inline block load(const char *p) { return _mm_load_si128((const block *)p); }
+    inline void store(char *p, block x) { _mm_storeu_si128((block *)p, x); }
+
+    ///one bit per byte of x, set for every byte of a zero W byte element
+    template <size_t W> inline unsigned zeros(block x);
+    template <> inline unsigned zeros<1>(block x)
+    { return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())); }
+    template <> inline unsigned zeros<2>(block x)
+    { return _mm_movemask_epi8(_mm_cmpeq_epi16(x, _mm_setzero_si128())); }
+    template <> inline unsigned zeros<4>(block x)
+    { return _mm_movemask_epi8(_mm_cmpeq_epi32(x, _mm_setzero_si128())); }
+    template <> inline unsigned zeros<8>(block x)
+    {
+      //both 32 bit halves zero
+      __m128i z = _mm_cmpeq_epi32(x, _mm_setzero_si128());
+      z = _mm_and_si128(z, _mm_shuffle_epi32(z, _MM_SHUFFLE(2, 3, 0, 1)));
+      return _mm_movemask_epi8(z);
+    }
+
+    ///copy n (1 to 16) bytes with two overlapping moves, no library call
+    inline void small(char *d, const char *s, size_t n)
+    {
+      //both moves stay inside [s, s + n)
+      if(n >= 8)
+	{
+	  uint64_t a, b;
+	  memcpy(&a, s, 8);
+	  memcpy(&b, s + n - 8, 8);
+	  memcpy(d, &a, 8);
+	  memcpy(d + n - 8, &b, 8);
+	}
+      else if(n >= 4)
+	{
+	  uint32_t a, b;
+	  memcpy(&a, s, 4);
+	  memcpy(&b, s + n - 4, 4);
+	  memcpy(d, &a, 4);
+	  memcpy(d + n - 4, &b, 4);
+	}
+      else
+	{
+	  //1 to 3 bytes
+	  char a = s[0], b = s[n / 2], c = s[n - 1];
+	  d[0] = a;
+	  d[n / 2] = b;
+	  d[n - 1] = c;
+	}
+    }
+
+    ///sentinelCopy() for W byte elements at a W aligned src
+    template <size_t W> SENTINEL_NO_ASAN size_t copy(char *dst, const char *src)
+    {
+      char *d = dst;
+      const char *s = src;
+
+      //the aligned block holding src, bytes before src ignored
+      const char *b = (const char *)((uintptr_t)s & ~(uintptr_t)(width - 1));
+      unsigned mask = zeros<W>(load(b)) >> (s - b);
+      if(mask == 0)
+	{
+	  size_t n = width - (s - b);
+	  small(d, s, n);
+	  s += n;
+	  d += n;
+
+	  //whole aligned blocks while there is no sentinel
+	  for(;;)
+	    {
+	      block x = load(s);
+	      mask = zeros<W>(x);
+	      if(mask != 0)
+		break;
+	      store(d, x);
+	      s += width;
+	      d += width;
+	    }
+	}
+
+      //up to and including the sentinel
+      size_t n = __builtin_ctz(mask) + W;
+      small(d, s, n);
+      return (d + n - dst) / W;
+    }
+
+    ///sentinelCopyN(): the chars before the 0, at most max (at least 1)
+    SENTINEL_NO_ASAN inline size_t bounded(char *dst, const char *src, size_t max)
+    {
+      char *d = dst;
+      const char *s = src;
+      const char *end = src + max;
+
+      //a block is only read when it holds a char before end
+      const char *b = (const char *)((uintptr_t)s & ~(uintptr_t)(width - 1));
+      unsigned mask = zeros<1>(load(b)) >> (s - b);
+      size_t n = width - (s - b);
+      if(mask == 0 && n < max)
+	{
+	  small(d, s, n);
+	  s += n;
+	  d += n;
+	  for(;;)
+	    {
+	      block x = load(s);
+	      mask = zeros<1>(x);
+	      if(mask != 0 || (size_t)(end - s) <= width)
+		break;
+	      store(d, x);
+	      s += width;
+	      d += width;
+	    }
+	}
+
+      //up to the 0 or end, whichever comes first
+      size_t left = end - s;
+      n = (mask != 0) ? __builtin_ctz(mask) : left;
+      if(n > left)
+	n = left;
+      if(n > 0)
+	small(d, s, n);
+      return d + n - dst;
+    }
+  }
+
+  //compiled for AVX2 whatever the build flags: only called when the
+  //cpu has it
+#pragma GCC push_options
+#pragma GCC target("avx2")
+  ///32 byte blocks
+  namespace avx2
+  {
+    typedef __m256i block;
+    const size_t width = 32;
+
+    SENTINEL_NO_ASAN inline block load(const char *p) { return _mm256_load_si256((const block *)p); }
+    inline void store(char *p, block x) { _mm256_storeu_si256((block *)p, x); }
+
+    ///one bit per byte of x, set for every byte of a zero W byte element
+    template <size_t W> inline unsigned zeros(block x);
+    template <> inline unsigned zeros<1>(block x)
+    { return _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_setzero_si256())); }
+    template <> inline unsigned zeros<2>(block x)
+    { return _mm256_movemask_epi8(_mm256_cmpeq_epi16(x, _mm256_setzero_si256())); }
+    template <> inline unsigned zeros<4>(block x)
+    { return _mm256_movemask_epi8(_mm256_cmpeq_epi32(x, _mm256_setzero_si256())); }
+    template <> inline unsigned zeros<8>(block x)
+    { return _mm256_movemask_epi8(_mm256_cmpeq_epi64(x, _mm256_setzero_si256())); }
+
+    ///copy n (1 to 32) bytes with two overlapping moves
+    inline void small(char *d, const char *s, size_t n)
+    {
+      if(n < 16)
+	{
+	  sse2::small(d, s, n);
+	  return;
+	}
+      __m128i a = _mm_loadu_si128((const __m128i *)s);
+      __m128i b = _mm_loadu_si128((const __m128i *)(s + n - 16));
+      _mm_storeu_si128((__m128i *)d, a);
+      _mm_storeu_si128((__m128i *)(d + n - 16), b);
+    }
+
+    ///sentinelCopy() for W byte elements at a W aligned src
+    template <size_t W> SENTINEL_NO_ASAN size_t copy(char *dst, const char *src)
+    {
+      char *d = dst;
+      const char *s = src;
+
+      const char *b = (const char *)((uintptr_t)s & ~(uintptr_t)(width - 1));
+      unsigned mask = zeros<W>(load(b)) >> (s - b);
+      if(mask == 0)
+	{
+	  size_t n = width - (s - b);
+	  small(d, s, n);
+	  s += n;
+	  d += n;
+
+	  for(;;)
+	    {
+	      block x = load(s);
+	      mask = zeros<W>(x);
+	      if(mask != 0)
+		break;
+	      store(d, x);
+	      s += width;
+	      d += width;
+	    }
+	}
+
+      size_t n = __builtin_ctz(mask) + W;
+      small(d, s, n);
+      return (d + n - dst) / W;
+    }
+
+    ///sentinelCopyN(): the chars before the 0, at most max (at least 1)
+    SENTINEL_NO_ASAN inline size_t bounded(char *dst, const char *src, size_t max)
+    {
+      char *d = dst;
+      const char *s = src;
+      const char *end = src + max;
+
+      const char *b = (const char *)((uintptr_t)s & ~(uintptr_t)(width - 1));
+      unsigned mask = zeros<1>(load(b)) >> (s - b);
+      size_t n = width - (s - b);
+      if(mask == 0 && n < max)
+	{
+	  small(d, s, n);
+	  s += n;
+	  d += n;
+	  for(;;)
+	    {
+	      block x = load(s);
+	      mask = zeros<1>(x);
+	      if(mask != 0 || (size_t)(end - s) <= width)
+		break;
+	      store(d, x);
+	      s += width;
+	      d += width;
+	    }
+	}
+
+      size_t left = end - s;
+      n = (mask != 0) ? __builtin_ctz(mask) : left;
+      if(n > left)
+	n = left;
+      if(n > 0)
+	small(d, s, n);
+      return d + n - dst;
+    }
+  }
+#pragma GCC pop_options
+#endif
+
+  template <size_t W> size_t resolve(char *dst, const char *src);
+
+  ///the kernel for W byte elements (the resolver until the first call)
+  template <size_t W> inline std::atomic<kernel> best(resolve<W>);
+
+  ///pick the kernel for the selected cpu level, then do the copy
+  template <size_t W> size_t resolve(char *dst, const char *src)
+  {
+    static const char *names[] = {"sentinelCopy 1 byte", "sentinelCopy 2 byte",
+				  "sentinelCopy 4 byte", "sentinelCopy 8 byte"};
+    CpuDispatch::level l = CpuDispatch::selected();
+    kernel k = scalar<W>;
+#if defined(__SSE2__)
+    if(l >= CpuDispatch::AVX2)
+      k = avx2::copy<W>;
+    else if(l >= CpuDispatch::SSE2)
+      k = sse2::copy<W>;
+#else
+    l = CpuDispatch::SCALAR;
+#endif
+    best<W>.store(k, std::memory_order_relaxed);
+    CpuDispatch::chosen(names[__builtin_ctz(W)], l);
+    return k(dst, src);
+  }
+
+  ///copies the chars of src before its 0, at most max, returns the count
+  typedef size_t (*bounded_kernel)(char *dst, const char *src, size_t max);
+
+  ///one char at a time
+  inline size_t scalarBounded(char *dst, const char *src, size_t max)
+  {
+    size_t n = 0;
+    for(; n < max && src[n] != '\0'; n++)
+      dst[n] = src[n];
+    return n;
+  }
+
+  inline size_t resolveBounded(char *dst, const char *src, size_t max);
+
+  ///the sentinelCopyN() kernel (the resolver until the first call)
+  inline std::atomic<bounded_kernel> bestBounded(resolveBounded);
+
+  ///pick the sentinelCopyN() kernel, then do the copy
+  inline size_t resolveBounded(char *dst, const char *src, size_t max)
+  {
+    CpuDispatch::level l = CpuDispatch::selected();
+    bounded_kernel k = scalarBounded;
+#if defined(__SSE2__)
+    if(l >= CpuDispatch::AVX2)
+      k = avx2::bounded;
+    else if(l >= CpuDispatch::SSE2)
+      k = sse2::bounded;
+#else
+    l = CpuDispatch::SCALAR;
+#endif
+    bestBounded.store(k, std::memory_order_relaxed);
+    CpuDispatch::chosen("sentinelCopyN", l);
+    return k(dst, src, max);
+  }
+}
+
+/**
+   \brief copy src to dst up to and including the first 0 element
+   \return elements copied, the sentinel included
+
+   \note dst must have room for them; src may end anywhere in memory.
+*/
+template <class T> inline size_t sentinelCopy(T *dst, const T *src)
+{
+  const size_t W = sizeof(T);
+  if constexpr((std::is_integral<T>::value || std::is_pointer<T>::value) &&
+	       (W == 1 || W == 2 || W == 4 || W == 8))
+    {
+      if((uintptr_t)src % W == 0)
+	return sentinel::best<W>.load(std::memory_order_relaxed)((char *)dst, (const char *)src);
+    }
+  return sentinelCopyScalar(dst, src);
+}
+
+/**
+   \brief copy the chars of src before its 0 to dst, at most max of them
+   \return chars copied (no 0 is written to dst)
+
+   \note src is read up to its 0 or max chars, whichever comes first
+   (in aligned blocks, as sentinelCopy() does); dst needs room for max.
+*/
+inline size_t sentinelCopyN(char *dst, const char *src, size_t max)
+{
+  if(max == 0)
+    return 0;
+  return sentinel::bestBounded.load(std::memory_order_relaxed)(dst, src, max);
+}
+
+///fixed extent copies behind the array Tmycpy overloads
+namespace fixedCopy
+{
+  ///element types with a 0 sentinel
+  template <class T> struct hasSentinel
+    : std::integral_constant<bool, std::is_integral<T>::value || std::is_pointer<T>::value> {};
+
+  ///b[I] = a[I] for every I, unrolled
+  template <class T, size_t... I>
+  constexpr void unrolled(T *b, const T *a, std::index_sequence<I...>)
+  {
+    ((b[I] = a[I]), ...);
+  }
+
+  ///b[I] = a[I] up to and including the first 0, unrolled
+  template <class T, size_t... I>
+  constexpr int unrolledSentinel(T *b, const T *a, std::index_sequence<I...>)
+  {
+    /** \return elements copied */
+    int n = (int)sizeof...(I);
+    (void)((((b[I] = a[I]) != 0) || (n = (int)I + 1, false)) && ...);
+    return n;
+  }
+
+  ///copy the N element array a to b
+  template <size_t N, class T> constexpr int copy(T *b, const T *a)
+  {
+    /** \return elements copied (up to and including the sentinel) */
+    if constexpr(hasSentinel<T>::value)
+      {
+	//short (a literal folds to a few stores)
+	if constexpr(N <= 16)
+	  return unrolledSentinel(b, a, std::make_index_sequence<N>());
+
+	//ending in a sentinel: no bound needed
+	if(!__builtin_is_constant_evaluated() && a[N - 1] == 0)
+	  return (int)sentinelCopy(b, a);
+
+	for(size_t i = 0; i < N; i++)
+	  if((b[i] = a[i]) == 0)
+	    return (int)i + 1;
+	return (int)N;
+      }
+    else if constexpr(std::is_trivially_copyable<T>::value)
+      {
+	if(!__builtin_is_constant_evaluated())
+	  memcpy(b, a, sizeof(T) * N);
+	else if constexpr(N <= 16)
+	  unrolled(b, a, std::make_index_sequence<N>());
+	else
+	  for(size_t i = 0; i < N; i++)
+	    b[i] = a[i];
+	return (int)N;
+      }
+    else
+      {
+	for(size_t i = 0; i < N; i++)
+	  b[i] = a[i];
+	return (int)N;
+      }
+  }
+}
+
+/**
+   \brief copy array a into array b (sizes from the types)
+   \return count of elements copied
+
+   \note b must be at least as large as a; this is checked when
+   compiling.
+*/
+template <class T, size_t N, size_t M> constexpr int Tmycpy(const T (&a)[N], T (&b)[M])
+{
+  static_assert(M >= N, "Tmycpy: destination array smaller than the source");
+  return fixedCopy::copy<N>(b, a);
+}
+
+///copy std::array a into std::array b (sizes from the types)
+template <class T, size_t N, size_t M>
+constexpr int Tmycpy(const std::array<T, N> &a, std::array<T, M> &b)
+{
+  static_assert(M >= N, "Tmycpy: destination array smaller than the source");
+  return fixedCopy::copy<N>(b.data(), a.data());
+}
+
+#endif //TMYCPY_H
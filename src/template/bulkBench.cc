@@ -0,0 +1,131 @@
+/** \file bulkBench.cc
+
+\brief BulkCopy against memcpy, and where threads start to pay
+
+\par Purpose:
+Copies buffers from 64 KB up to [max MB] with memcpy(), with
+BulkCopy::streamCopy() (one thread, non-temporal stores) and with
+BulkCopy split across threads (see BulkCopy.h), and prints GB/s for
+each. The crossover is the smallest size from which the threaded copy
+beats memcpy() for every larger size; that is the value to give
+BulkCopy::setCrossover() on this machine.
+<br>
+<br>
+Last, a 1 MB working set is read, the largest buffer is copied with
+memcpy() or with streaming stores, and the working set is read again:
+the second read shows how much of it the copy evicted.
+
+\par Usage:
+bulkBench [max MB] [threads]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+
+#include "BulkCopy.h"
+
+///GB/s of copy(n) repeated until about 1 GB has been moved
+template <class F> double rate(F copy, size_t n)
+{
+  long reps = (long)((1LL << 30) / n);
+  if(reps < 3)
+    reps = 3;
+  copy(n);
+  long long t0 = ThreadTrace::now();
+  for(long r = 0; r < reps; r++)
+    copy(n);
+  return (double)n * reps / (ThreadTrace::now() - t0);
+}
+
+///nsec to read every line of a working set
+long long readSet(const char *set, size_t n)
+{
+  long long t0 = ThreadTrace::now();
+  unsigned long sum = 0;
+  for(size_t i = 0; i < n; i += 64)
+    sum += set[i];
+  asm volatile("" : : "r"(sum));
+  return ThreadTrace::now() - t0;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t max = (size_t)((argc > 1) ? atol(argv[1]) : 256) << 20;
+  int threads = (argc > 2) ? atoi(argv[2]) : 0;
+
+  ThreadMgr m;
+  BulkCopy bulk(m, threads);
+  size_t threshold = bulk.streamThreshold();
+
+  char *src = (char *)aligned_alloc(4096, max);
+  char *dst = (char *)aligned_alloc(4096, max);
+  memset(src, 'a', max);
+  memset(dst, 'b', max);
+
+  std::cout << "threads=" << bulk.threads() << "|stream threshold=" << (threshold >> 10)
+	    << " KB" << std::endl;
+  if(bulk.threads() == 1)
+    std::cout << "one cpu: the threaded copy is the single threaded one" << std::endl;
+
+  size_t crossover = 0;
+  for(size_t n = 64 << 10; n <= max; n *= 4)
+    {
+      double mem = rate([&](size_t k) { memcpy(dst, src, k); }, n);
+      double nt = rate([&](size_t k) { BulkCopy::streamCopy(dst, src, k); }, n);
+
+      //always split here, streaming as copy() would decide
+      bulk.setCrossover(0);
+      double par = rate([&](size_t k) { bulk.copy(dst, src, k); }, n);
+
+      //a clear win (not noise), and only with threads to win with
+      if(bulk.threads() > 1 && par > mem * 1.05)
+	{
+	  if(crossover == 0)
+	    crossover = n;
+	}
+      else
+	crossover = 0;
+
+      std::cout << std::setw(8) << (n >> 10) << " KB" << std::fixed << std::setprecision(1)
+		<< ": memcpy GB/s=" << mem << "|streamCopy GB/s=" << nt
+		<< "|BulkCopy x" << bulk.threads() << (n > threshold ? " (streaming)" : "")
+		<< " GB/s=" << par << "|vs memcpy=" << par / mem << "x" << std::endl;
+    }
+
+  if(crossover != 0)
+    std::cout << "crossover: " << (crossover >> 10) << " KB (BulkCopy::setCrossover("
+	      << crossover << "))" << std::endl;
+  else
+    std::cout << "crossover: none, the threaded copy never won" << std::endl;
+
+  //how much of a working set survives a large copy
+  const size_t set_size = 1 << 20;
+  char *set = (char *)aligned_alloc(4096, set_size);
+  memset(set, 1, set_size);
+  for(int pass = 0; pass < 2; pass++)
+    {
+      readSet(set, set_size);
+      long long warm = readSet(set, set_size);
+      if(pass == 0)
+	memcpy(dst, src, max);
+      else
+	BulkCopy::streamCopy(dst, src, max);
+      long long after = readSet(set, set_size);
+      std::cout << (pass == 0 ? "memcpy" : "streamCopy") << " of " << (max >> 20)
+		<< " MB: 1 MB working set read ns=" << warm << " before|" << after
+		<< " after" << std::endl;
+    }
+
+  BulkCopy::copy_stats st;
+  bulk.getStats(&st);
+  CpuDispatch::report(std::cout);
+  std::cout << "BulkCopy: copies=" << st.copies << "|parallel=" << st.parallel
+	    << "|streamed=" << st.streamed << "|GB=" << (st.bytes >> 30) << std::endl;
+
+  free(set);
+  free(src);
+  free(dst);
+  return 0;
+}
@@ -0,0 +1,230 @@
+/** \file payloadBench.cc
+
+\brief Task payloads as std::string, as char arrays and as InlineString
+
+\par Purpose:
+A producer makes short string payloads ("task 17 from worker-thread-3")
+and a consumer appends " done" to each and drops it, the way a task
+returns a string that the reaper prints and deletes. Three kinds of
+payload:
+<ul>
+<li>std::string * made with new and deleted by the consumer (as
+myStringFunc() and reapString() in threadDeath3.cc)</li>
+<li>char * from new char[], with room left for the suffix</li>
+<li>InlineString<62> passed by value (see InlineString.h)</li>
+</ul>
+Each is timed twice: producer and consumer in one thread, then in two
+threads handing the payloads over through a ring of slots (the heap
+kinds then free on another thread than the one that allocated).
+Prints ns per payload and the speedup of InlineString over each.
+
+\par Usage:
+payloadBench [payloads in millions]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <sched.h>
+
+#include "ThreadMgr.h"
+#include "InlineString.h"
+
+///payload texts, made once
+static const int TEXTS = 64;
+static char texts[TEXTS][40];
+static size_t lengths[TEXTS];
+
+static const char SUFFIX[] = " done";
+
+///a heap std::string, as myStringFunc() returns
+struct stdString
+{
+  typedef std::string *type;
+  static const char *name() { return "std::string *"; }
+  static type make(const char *s, size_t n) { return new std::string(s, n); }
+  static size_t finish(type &p)
+  {
+    p->append(SUFFIX);
+    size_t n = p->size();
+    delete p;
+    return n;
+  }
+};
+
+///a heap char array with room for the suffix
+struct rawChars
+{
+  typedef char *type;
+  static const char *name() { return "char *"; }
+  static type make(const char *s, size_t n)
+  {
+    char *p = new char[n + sizeof(SUFFIX)];
+    memcpy(p, s, n + 1);
+    return p;
+  }
+  static size_t finish(type &p)
+  {
+    size_t n = strlen(p);
+    memcpy(p + n, SUFFIX, sizeof(SUFFIX));
+    delete[] p;
+    return n + sizeof(SUFFIX) - 1;
+  }
+};
+
+///the payload itself
+struct inlineString
+{
+  typedef InlineString<62> type;
+  static const char *name() { return "InlineString<62>"; }
+  static type make(const char *s, size_t n) { return type(s, n); }
+  static size_t finish(type &p)
+  {
+    p.append(SUFFIX, sizeof(SUFFIX) - 1);
+    return p.size();
+  }
+};
+
+///single producer / single consumer ring of payload slots
+template <class P> struct ring
+{
+  static const unsigned long SLOTS = 256;
+  typename P::type slot[SLOTS];
+
+  ///written by the producer
+  alignas(64) std::atomic<unsigned long> head;
+
+  ///written by the consumer
+  alignas(64) std::atomic<unsigned long> tail;
+
+  long count;
+};
+
+///producer thread: count payloads into the ring
+template <class P> void *produce(void *arg)
+{
+  ring<P> *r = (ring<P> *)arg;
+  unsigned long h = 0;
+  for(long i = 0; i < r->count; i++, h++)
+    {
+      //full: let the consumer run (there may be one cpu)
+      while(h - r->tail.load(std::memory_order_acquire) == ring<P>::SLOTS)
+	sched_yield();
+      r->slot[h % ring<P>::SLOTS] = P::make(texts[i % TEXTS], lengths[i % TEXTS]);
+      r->head.store(h + 1, std::memory_order_release);
+    }
+  return NULL;
+}
+
+///nsec per payload made and finished by one thread
+template <class P> double oneThread(long count, size_t *chars)
+{
+  size_t sum = 0;
+  long long t0 = ThreadTrace::now();
+  for(long i = 0; i < count; i++)
+    {
+      typename P::type p = P::make(texts[i % TEXTS], lengths[i % TEXTS]);
+      asm volatile("" : : "r"(&p) : "memory");
+      sum += P::finish(p);
+    }
+  double ns = (double)(ThreadTrace::now() - t0) / count;
+  *chars = sum;
+  return ns;
+}
+
+///nsec per payload made by a ThreadMgr thread and finished here
+template <class P> double twoThreads(ThreadMgr &m, long count, size_t *chars)
+{
+  ring<P> *r = new ring<P>;
+  r->head.store(0);
+  r->tail.store(0);
+  r->count = count;
+
+  size_t sum = 0;
+  long long t0 = ThreadTrace::now();
+  TaskGroup group(m);
+  if(m.createThread(produce<P>, r, &group) == 0)
+    {
+      delete r;
+      return -1;
+    }
+  for(unsigned long t = 0; t < (unsigned long)count; t++)
+    {
+      while(r->head.load(std::memory_order_acquire) == t)
+	sched_yield();
+      sum += P::finish(r->slot[t % ring<P>::SLOTS]);
+      r->tail.store(t + 1, std::memory_order_release);
+    }
+  m.waitAll(&group);
+  double ns = (double)(ThreadTrace::now() - t0) / count;
+  delete r;
+  *chars = sum;
+  return ns;
+}
+
+///one table row
+void show(const char *label, const char *kind, double ns, double inl)
+{
+  std::cout << std::setw(12) << label << " " << std::setw(16) << kind << std::fixed
+	    << std::setprecision(1) << ": ns=" << ns;
+  if(inl > 0)
+    std::cout << "|InlineString speedup=" << ns / inl << "x";
+  std::cout << std::endl;
+}
+
+template <class P> void row(ThreadMgr &m, long count, double inl1, double inl2, size_t expect)
+{
+  size_t c1, c2;
+  double one = oneThread<P>(count, &c1);
+  double two = twoThreads<P>(m, count, &c2);
+  if(c1 != expect || c2 != expect)
+    std::cout << "FAILED: " << P::name() << " chars=" << c1 << "|" << c2 << "|expected="
+	      << expect << std::endl;
+  show("one thread", P::name(), one, inl1);
+  show("two threads", P::name(), two, inl2);
+}
+
+int main(int argc, char *argv[])
+{
+  long count = (argc > 1 ? atol(argv[1]) : 10) * 1000000;
+  if(count < TEXTS)
+    count = TEXTS;
+  count -= count % TEXTS;
+
+  size_t expect = 0;
+  for(int i = 0; i < TEXTS; i++)
+    {
+      lengths[i] = snprintf(texts[i], sizeof(texts[i]), "task %d from worker-thread-%d",
+			    i * 37, i % 8);
+      expect += (lengths[i] + sizeof(SUFFIX) - 1) * (count / TEXTS);
+    }
+
+  //what the inline payload is
+  InlineString<62> sample(texts[1]);
+  sample += SUFFIX;
+  InlineString<16> cut;
+  bool fit = cut.assign(texts[1]);
+  std::cout << "payload: \"" << sample << "\"|sizeof=" << sizeof(sample)
+	    << "|into InlineString<16>: \"" << cut << "\" (" << (fit ? "fit" : "truncated")
+	    << ")" << std::endl;
+
+  ThreadMgr m;
+  size_t c1, c2;
+  double inl1 = oneThread<inlineString>(count, &c1);
+  double inl2 = twoThreads<inlineString>(m, count, &c2);
+  if(c1 != expect || c2 != expect)
+    {
+      std::cout << "FAILED: InlineString chars=" << c1 << "|" << c2 << std::endl;
+      return 1;
+    }
+  row<stdString>(m, count, inl1, inl2, expect);
+  row<rawChars>(m, count, inl1, inl2, expect);
+  show("one thread", inlineString::name(), inl1, 0);
+  show("two threads", inlineString::name(), inl2, 0);
+
+  CpuDispatch::report(std::cout);
+  return 0;
+}
@@ -4,6 +4,9 @@
 
 #include <iostream>
 #include <string.h>
+#include <type_traits>
+
+#include "Tmycpy.h"
 
 /** 
     \brief Template function to copy a string literal
@@ -14,6 +17,8 @@
     \param b array 2
     \param size total size of the array
     \param numElements used for printing the array contents (cheezy)
+    \param verify compare the arrays after the copy (memcmp of size
+    bytes)
 
     \return count of elements copied or -1 on error. Failure to pass an
     array to this function is undetermined.
@@ -21,6 +26,8 @@
     \par Purpose:
     Template that copies a string literal or any array upto the point
     where the contents of the array element is equal to 0 ('\0').
+    Pointers to integers are copied by sentinelCopy() (see Tmycpy.h), a
+    vector register at a time.
 
     \note
     The arrays are expected to be the same size. 
@@ -29,7 +36,8 @@
     This template has very little practical application. This is
     merely here to demonstrate a simple Template function
 */
-template <class T> int Tmycpy( T a, T b, size_t size, int numElements)
+template <class T> int Tmycpy( T a, T b, size_t size, int numElements,
+				bool verify = true)
 {
   //set the number of elements copied to the initial 1 (an unconditional
   //copy is performed later on)
@@ -55,25 +63,43 @@ template <class T> int Tmycpy( T a, T b, size_t size, int numElements)
   //if( ! sizeof(b) >= sizeof(a))
     //return -1;
 
-  //create a couple of pointers (assuming we can -if we passed a
-  //reference we might be in trouble --> type checking and
-  //specialization might be a better option for this template...)
-  T p1 =a;
-  T p2 =b; 
-
-  //do an unconditional copy until a NULL Terminator is found
-  //(inclusive) and count the elements copied
-  while(*p2++ = *p1++)
-    count++;
-
-  //compare the arrays
-  if(memcmp(static_cast<void *>(a), static_cast<void *>(b), size) != 0)
+  if constexpr(std::is_pointer<T>::value)
+    {
+      //sentinel found a block at a time (the count includes it)
+      count = (int)sentinelCopy(b, a);
+    }
+  else
+    {
+      //create a couple of pointers (assuming we can -if we passed a
+      //reference we might be in trouble --> type checking and
+      //specialization might be a better option for this template...)
+      T p1 =a;
+      T p2 =b;
+
+      //do an unconditional copy until a NULL Terminator is found
+      //(inclusive) and count the elements copied
+      while(*p2++ = *p1++)
+	count++;
+    }
+
+  //compare the arrays (the copy itself cannot fail: optional)
+  if(verify &&
+     memcmp(static_cast<void *>(a), static_cast<void *>(b), size) != 0)
     return -1;
 
   //return number of elements copied
   return count;
 }
   
+///a copy made by the compiler (see the array Tmycpy overloads in Tmycpy.h)
+constexpr std::array<int, 6> compileTimeCopy()
+{
+  std::array<int, 6> a = {5, 4, 3, 0, 1, 1};
+  std::array<int, 6> b = {};
+  Tmycpy(a, b);
+  return b;
+}
+
 int main(int argc, char *argv[])
 {
   //string literal copy to a character array
@@ -132,6 +158,25 @@ int main(int argc, char *argv[])
 
   std::cout << "#############################" << std::endl;
 
+  //array sizes known at compile time: no size arguments, and a
+  //destination that is too small does not compile
+  char name[16];
+  i = Tmycpy("thread-7", name);
+  std::cout << "SUCCESS: array overload name=" << name
+	    << "|elements copied=" << i
+	    << std::endl;
+
+  //the same copy done while compiling
+  constexpr std::array<int, 6> ic = compileTimeCopy();
+  static_assert(ic[2] == 3 && ic[3] == 0 && ic[4] == 0,
+		"compile time Tmycpy");
+  std::cout << "COMPILE TIME COPY: ic=";
+  for(int j=0; j < 6; j++)
+    std::cout << ic[j];
+  std::cout << std::endl;
+
+  std::cout << "#############################" << std::endl;
+
   //return success
   return 0;
 }
@@ -0,0 +1,309 @@
+/** \file tmycpyBench.cc
+  \brief sentinelCopy() against the element at a time Tmycpy loop
+
+  \par Purpose:
+  First checks that sentinelCopy() (see Tmycpy.h) never reads past the
+  page holding the sentinel: arrays of 1, 2, 4 and 8 byte elements are
+  placed so that their sentinel is the last element before a PROT_NONE
+  page, for every length up to 300 elements and every start and
+  destination alignment, and each copy is checked (the element after
+  the sentinel in dst must be untouched). sentinelCopyN() gets the same
+  treatment with bounds below, at and past the 0, and with no 0 at all
+  before the unreadable page.
+
+  Then times the scalar loop, sentinelCopy() and (for char) strcpy()
+  across lengths and source / destination misalignments and prints
+  ns per copy and GB/s.
+
+  Last, the array Tmycpy overloads (sizes known at compile time)
+  against the loops a pointer and a run time size give: a string
+  literal into a char[16], an array of 64 small structs and a
+  std::array of 256 ints ending in its sentinel.
+
+  \par Usage:
+  tmycpyBench [MB copied per measurement]
+
+  CPU_DISPATCH=scalar|sse2|avx2 runs (and checks) the given kernels.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <array>
+
+#include "Tmycpy.h"
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///every length and alignment ending right before an unreadable page
+template <class T> long guardCheck(char *page, size_t pagesize)
+{
+  /** \return copies checked, -1 on the first wrong one */
+  const size_t W = sizeof(T);
+  static T dst[320 + 8];
+  long checked = 0;
+
+  for(size_t len = 1; len <= 300; len++)
+    for(size_t skew = 0; skew < 64 / W; skew++)
+      for(size_t doff = 0; doff < 4; doff++)
+	{
+	  //the sentinel is the last element of the page (minus skew elements)
+	  T *src = (T *)(page + pagesize) - len - skew;
+	  for(size_t i = 0; i < len + skew; i++)
+	    src[i] = (T)(i % 100 + 1);
+	  src[len - 1] = 0;
+
+	  T *d = dst + doff;
+	  for(size_t i = 0; i < len + 4; i++)
+	    d[i] = (T)-1;
+
+	  size_t n = sentinelCopy(d, src);
+	  if(n != len || memcmp(d, src, len * W) != 0 || d[len] != (T)-1)
+	    {
+	      std::cout << "FAILED: element size=" << W << "|length=" << len
+			<< "|skew=" << skew << "|copied=" << n << std::endl;
+	      return -1;
+	    }
+	  checked++;
+	}
+  return checked;
+}
+
+///sentinelCopyN() bounds: at the 0, short of it, and at the page end with no 0
+long boundedCheck(char *page, size_t pagesize)
+{
+  /** \return copies checked, -1 on the first wrong one */
+  static char dst[400];
+  long checked = 0;
+
+  for(size_t len = 1; len <= 300; len++)
+    for(size_t skew = 0; skew < 64; skew++)
+      {
+	//len chars then a 0, or (last) len + 1 chars up to the unreadable page
+	char *src = page + pagesize - len - 1 - skew;
+	const size_t maxes[] = {0, 1, len / 2, len, len + 1, len + 40, len + 1 + skew};
+	for(size_t m = 0; m < sizeof(maxes) / sizeof(*maxes); m++)
+	  {
+	    bool terminated = m < sizeof(maxes) / sizeof(*maxes) - 1;
+	    for(size_t i = 0; i < len + 1 + skew; i++)
+	      src[i] = (char)('a' + i % 26);
+	    if(terminated)
+	      src[len] = '\0';
+	    memset(dst, '#', sizeof(dst));
+
+	    size_t expect = terminated ? (maxes[m] < len ? maxes[m] : len) : maxes[m];
+	    size_t n = sentinelCopyN(dst, src, maxes[m]);
+	    if(n != expect || memcmp(dst, src, n) != 0 || dst[n] != '#')
+	      {
+		std::cout << "FAILED: sentinelCopyN length=" << len << "|skew=" << skew
+			  << "|max=" << maxes[m] << "|copied=" << n << std::endl;
+		return -1;
+	      }
+	    checked++;
+	  }
+      }
+  return checked;
+}
+
+///nsec per copy of src (len elements) to dst, repeated reps times
+template <class T, class F> double timeCopy(F copy, T *dst, const T *src, long reps)
+{
+  long long t0 = now();
+  for(long r = 0; r < reps; r++)
+    {
+      copy(dst, src);
+      asm volatile("" : : "r"(dst) : "memory");
+    }
+  return (double)(now() - t0) / reps;
+}
+
+///element at a time, as Tmycpy does it
+template <class T> __attribute__((noinline)) size_t scalarCopy(T *dst, const T *src)
+{
+  return sentinelCopyScalar(dst, src);
+}
+
+///sentinelCopy, not inlined (like a library call)
+template <class T> __attribute__((noinline)) size_t vectorCopy(T *dst, const T *src)
+{
+  return sentinelCopy(dst, src);
+}
+
+///one table row per length and alignment
+template <class T> void bench(const char *type, long mb)
+{
+  static const size_t bytes[] = {16, 64, 256, 1024, 4096, 65536, 1 << 20};
+  static const size_t skews[][2] = {{0, 0}, {1, 0}, {0, 1}, {3, 5}};
+  const size_t W = sizeof(T);
+  T *src = (T *)aligned_alloc(64, (1 << 20) + 256);
+  T *dst = (T *)aligned_alloc(64, (1 << 20) + 256);
+
+  for(size_t b = 0; b < sizeof(bytes) / sizeof(*bytes); b++)
+    for(size_t k = 0; k < sizeof(skews) / sizeof(*skews); k++)
+      {
+	size_t len = bytes[b] / W;
+	T *s = src + skews[k][0];
+	T *d = dst + skews[k][1];
+	for(size_t i = 0; i < len; i++)
+	  s[i] = (T)(i % 100 + 1);
+	s[len - 1] = 0;
+
+	long reps = (long)mb * 1024 * 1024 / bytes[b];
+	double scalar = timeCopy(scalarCopy<T>, d, s, reps);
+	double vector = timeCopy(vectorCopy<T>, d, s, reps);
+
+	std::cout << std::setw(6) << type << " " << std::setw(8) << bytes[b] << " B"
+		  << " src+" << skews[k][0] * W << " dst+" << skews[k][1] * W
+		  << std::fixed << std::setprecision(1)
+		  << ": scalar ns=" << scalar << "|GB/s=" << bytes[b] / scalar
+		  << "|sentinelCopy ns=" << vector << "|GB/s=" << bytes[b] / vector
+		  << "|speedup=" << scalar / vector << "x";
+	if constexpr(sizeof(T) == 1)
+	  {
+	    double lib = timeCopy(strcpy, (char *)d, (const char *)s, reps);
+	    std::cout << "|strcpy GB/s=" << bytes[b] / lib;
+	  }
+	std::cout << std::endl;
+      }
+  free(src);
+  free(dst);
+}
+
+///a small trivially copyable record
+struct rec
+{
+  int id;
+  float value;
+};
+
+///the run time element count (the compiler cannot see it)
+volatile size_t recCount = 64;
+
+///literal, pointer loop
+__attribute__((noinline)) int literalLoop(char *b)
+{
+  return (int)sentinelCopyScalar(b, "worker-thread-7");
+}
+
+///literal, array overload
+__attribute__((noinline)) int literalFixed(char (&b)[16])
+{
+  return Tmycpy("worker-thread-7", b);
+}
+
+///records, pointer and run time size
+__attribute__((noinline)) int recLoop(rec *b, const rec *a)
+{
+  size_t n = recCount;
+  for(size_t i = 0; i < n; i++)
+    b[i] = a[i];
+  return (int)n;
+}
+
+///records, array overload
+__attribute__((noinline)) int recFixed(rec (&b)[64], const rec (&a)[64])
+{
+  return Tmycpy(a, b);
+}
+
+///ints, pointer loop
+__attribute__((noinline)) int intLoop(int *b, const int *a)
+{
+  return (int)sentinelCopyScalar(b, a);
+}
+
+///ints, std::array overload
+__attribute__((noinline)) int intFixed(std::array<int, 256> &b, const std::array<int, 256> &a)
+{
+  return Tmycpy(a, b);
+}
+
+///nsec per call of f
+template <class F> double timeCall(F f, long reps)
+{
+  long long t0 = now();
+  for(long r = 0; r < reps; r++)
+    {
+      f();
+      asm volatile("" : : : "memory");
+    }
+  return (double)(now() - t0) / reps;
+}
+
+///print one fixed size comparison
+void showFixed(const char *label, double loop, double fixed)
+{
+  std::cout << std::fixed << std::setprecision(2) << label
+	    << ": loop ns=" << loop << "|Tmycpy ns=" << fixed
+	    << "|speedup=" << loop / fixed << "x" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  long mb = (argc > 1) ? atol(argv[1]) : 256;
+
+  std::cout << "sentinelCopy kernels: " << CpuDispatch::name(CpuDispatch::selected())
+	    << " (" << CpuDispatch::ENV << "=scalar|sse2|avx2 to choose)" << std::endl;
+
+  //a readable page followed by one that faults on any access
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  char *pages = (char *)mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(pages == MAP_FAILED || mprotect(pages + pagesize, pagesize, PROT_NONE) < 0)
+    return 1;
+  long c1 = guardCheck<char>(pages, pagesize);
+  long c2 = guardCheck<short>(pages, pagesize);
+  long c4 = guardCheck<int>(pages, pagesize);
+  long c8 = guardCheck<long>(pages, pagesize);
+  long cn = boundedCheck(pages, pagesize);
+  munmap(pages, 2 * pagesize);
+  if(c1 < 0 || c2 < 0 || c4 < 0 || c8 < 0 || cn < 0)
+    return 1;
+  std::cout << "guard page check: " << c1 + c2 + c4 + c8 << " copies OK|sentinelCopyN: " << cn
+	    << " copies OK" << std::endl;
+
+  bench<char>("char", mb);
+  bench<short>("short", mb);
+  bench<int>("int", mb);
+  bench<long>("long", mb);
+
+  //array overloads
+  long reps = mb * 100000;
+  static char name[16];
+  static rec ra[64], rb[64];
+  static std::array<int, 256> ia, ib;
+  for(int i = 0; i < 64; i++)
+    ra[i] = {i, i * 0.5f};
+  for(int i = 0; i < 256; i++)
+    ia[i] = i + 1;
+  ia[255] = 0;
+
+  showFixed("literal -> char[16]", timeCall([] { literalLoop(name); }, reps),
+	    timeCall([] { literalFixed(name); }, reps));
+  showFixed("rec[64]", timeCall([] { recLoop(rb, ra); }, reps),
+	    timeCall([] { recFixed(rb, ra); }, reps));
+  showFixed("std::array<int, 256>", timeCall([] { intLoop(ib.data(), ia.data()); }, reps),
+	    timeCall([] { intFixed(ib, ia); }, reps));
+
+  //the kernel pointer against calling the chosen variant directly
+  static char text[64], to[64];
+  memset(text, 'x', sizeof(text) - 1);
+  sentinel::kernel chosen = sentinel::best<1>.load();
+  double direct = timeCall([&] { asm volatile("" : "+r"(chosen)); chosen(to, text); }, reps);
+  double dispatched = timeCall([] { sentinelCopy(to, text); }, reps);
+  std::cout << "64 byte sentinelCopy: direct ns=" << direct << "|through the kernel pointer ns="
+	    << dispatched << std::endl;
+
+  CpuDispatch::report(std::cout);
+  return 0;
+}
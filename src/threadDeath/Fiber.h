@@ -0,0 +1,877 @@
+/** \file Fiber.h
+
+\brief Stackful fibers (M:N user mode threads) on ThreadMgr workers
+
+\par Purpose:
+One OS thread per task (the ThreadMgr model) tops out at a few
+thousand tasks. A fiber is a user mode thread with its own small
+stack; many fibers are multiplexed onto a handful of ThreadMgr
+worker threads and switched by hand, so hundreds of thousands can be
+alive at once while still running ordinary blocking style code.
+<ul>
+<li>stacks are carved out of large mmap'd slabs with a guard page
+below each one (and recycled through a free list)</li>
+<li>switching saves only the callee saved registers (hand written
+x86-64 assembly, ucontext elsewhere)</li>
+<li>FiberMutex and FiberCond park the fiber and let the worker run
+something else instead of blocking the OS thread</li>
+<li>FiberMgr::createFiber() / condWait() / fibersActive() mirror the
+ThreadMgr calls</li>
+</ul>
+
+\warning
+A slab is one kernel memory mapping, and guard pages installed with
+MADV_GUARD_INSTALL (Linux 6.13) do not split it. Older kernels get
+an mprotect()ed page instead, which costs two mappings per stack, so
+only the first vm.max_map_count / 4 stacks of the process (16382 by
+default) are guarded that way: the rest are handed out unguarded
+(counted in FiberMgr::fiber_stats::guard_failures) and their slabs
+merge, leaving mappings for everything else.
+*/
+
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ThreadMgr.h"
+
+//guard pages that do not split the mapping (Linux 6.13, older headers lack it)
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+#if defined(__x86_64__)
+
+/* void fiber_switch_x86_64(void **save_sp, void *load_sp)
+
+   Push the callee saved registers (and the SSE / x87 control words)
+   on the current stack, store the stack pointer in *save_sp, load
+   load_sp and pop the same frame from there. Symbols are weak so
+   the header can be included by more than one translation unit.
+*/
+asm(".text\n"
+    ".weak fiber_switch_x86_64\n"
+    ".type fiber_switch_x86_64,@function\n"
+    "fiber_switch_x86_64:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".size fiber_switch_x86_64,.-fiber_switch_x86_64\n"
+
+    /* first "return" into a new fiber lands here with the fiber in
+       r12 and its entry function in r13 (see FiberMgr::prepare())
+    */
+    ".weak fiber_entry_x86_64\n"
+    ".type fiber_entry_x86_64,@function\n"
+    "fiber_entry_x86_64:\n"
+    "  movq %r12, %rdi\n"
+    "  callq *%r13\n"
+    "  ud2\n"
+    ".size fiber_entry_x86_64,.-fiber_entry_x86_64\n");
+
+extern "C" void fiber_switch_x86_64(void **save_sp, void *load_sp);
+extern "C" void fiber_entry_x86_64();
+
+#else
+#include <ucontext.h>
+#endif
+
+class FiberMgr;
+
+/**
+   \brief one fiber (user mode thread)
+*/
+struct Fiber
+{
+#if defined(__x86_64__)
+  ///saved stack pointer while switched out
+  void *sp;
+#else
+  ///saved context while switched out
+  ucontext_t ctx;
+#endif
+
+  ///start of the stack (guard page included), in a slab
+  char *map_base;
+
+  ///size of the stack (guard page included)
+  size_t map_size;
+
+  ///user function, argument and return value
+  void *(*func)(void *);
+  void *arg;
+  void *ret;
+
+  ///fiber id (submit order, starts at 1)
+  unsigned long id;
+
+  ///intrusive link (run queue, done FIFO, mutex / cond waiters)
+  Fiber *next;
+
+  ///manager running the fiber
+  FiberMgr *mgr;
+};
+
+/**
+   \brief Tiny test-and-set spinlock used for the fiber wait lists
+*/
+class FiberSpin {
+public:
+  FiberSpin() { m_flag.clear(); }
+
+  void lock()
+  {
+    while(m_flag.test_and_set(std::memory_order_acquire))
+      sched_yield();
+  }
+
+  void unlock() { m_flag.clear(std::memory_order_release); }
+
+private:
+  std::atomic_flag m_flag;
+};
+
+/**
+   \brief Fiber manager: worker threads, run queue and stack pool
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   FiberMgr fm(4);<br>
+   fm.createFiber(myfunc, arg);<br>
+   while(fm.fibersActive())<br>
+   &nbsp;&nbsp;fm.condWait(&ret);<br>
+
+   \note
+   condWait() is for ordinary threads (main() and the like). Fibers
+   wait for each other with FiberMutex / FiberCond.
+*/
+class FiberMgr {
+  friend class FiberMutex;
+  friend class FiberCond;
+
+public:
+  ///observable counters (see getStats())
+  struct fiber_stats
+  {
+    unsigned long created;
+    unsigned long finished;
+    unsigned long alive;
+    unsigned long peak_alive;
+    unsigned long stacks_mapped;
+    unsigned long guard_failures;
+    unsigned long switches;
+  };
+
+private:
+  ///what the worker does once a fiber has switched back to it
+  enum after_switch
+  {
+    AFTER_NONE = 0,
+    AFTER_REQUEUE,	///< yield(): put the fiber back on the run queue
+    AFTER_PARK,		///< parked on a wait list: release its spinlock
+    AFTER_FINISH	///< the fiber function returned
+  };
+
+  ///how guard pages are put below the stacks
+  enum guard_mode
+  {
+    GUARD_NONE = 0,	///< unguarded (not asked for, or out of mappings)
+    GUARD_MADVISE,	///< MADV_GUARD_INSTALL: no extra mapping
+    GUARD_MPROTECT	///< PROT_NONE page: splits the slab
+  };
+
+  ///stacks mapped at a time
+  static const int SLAB_STACKS = 64;
+
+  ///per worker thread state
+  struct worker
+  {
+#if defined(__x86_64__)
+    void *sched_sp;
+#else
+    ucontext_t sched_ctx;
+#endif
+    Fiber *current;
+    after_switch action;
+    FiberSpin *unlock_after;
+    FiberMgr *mgr;
+  };
+
+public:
+  ///constructor -starts the worker threads
+  FiberMgr(int workers = 0, size_t stack_size = 32 * 1024, bool guard_pages = true)
+    : m_stack_size(stack_size), m_guard(guard_pages),
+      m_guard_mode(guard_pages ? GUARD_MADVISE : GUARD_NONE), m_slab_next(NULL),
+      m_slab_left(0), m_shutdown(false),
+      m_next_id(1), m_run_head(NULL), m_run_tail(NULL),
+      m_done_head(NULL), m_done_tail(NULL), m_done_count(0), m_free_stacks(NULL), m_idle(0),
+      m_switches(0)
+  {
+    if(workers < 1)
+      workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(workers < 1)
+      workers = 1;
+
+    m_page = sysconf(_SC_PAGESIZE);
+    m_stack_size = (m_stack_size + m_page - 1) & ~(m_page - 1);
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    pthread_mutex_init(&m_run_mutex, NULL);
+    pthread_cond_init(&m_run_cond, NULL);
+    pthread_mutex_init(&m_done_mutex, NULL);
+    pthread_cond_init(&m_done_cond, NULL);
+
+    for(int i = 0; i < workers; i++)
+      m_mgr.createThread(workerMain, (void *)this);
+  }
+
+  ///destructor -finishes running fibers, stops the workers
+  ~FiberMgr()
+  {
+    pthread_mutex_lock(&m_run_mutex);
+    m_shutdown = true;
+    pthread_cond_broadcast(&m_run_cond);
+    pthread_mutex_unlock(&m_run_mutex);
+
+    void *ret;
+    while(m_mgr.threadsActive())
+      m_mgr.condWait(&ret);
+
+    //fibers nobody waited for
+    while(m_done_head != NULL)
+      {
+	Fiber *f = m_done_head;
+	m_done_head = f->next;
+	delete f;
+      }
+
+    //the stack pool, then the slabs the stacks were carved from
+    while(m_free_stacks != NULL)
+      {
+	Fiber *f = m_free_stacks;
+	m_free_stacks = f->next;
+	delete f;
+      }
+    for(size_t i = 0; i < m_slabs.size(); i++)
+      munmap(m_slabs[i], SLAB_STACKS * (m_stack_size + (m_guard ? m_page : 0)));
+
+    pthread_cond_destroy(&m_done_cond);
+    pthread_mutex_destroy(&m_done_mutex);
+    pthread_cond_destroy(&m_run_cond);
+    pthread_mutex_destroy(&m_run_mutex);
+  }
+
+  ///create a fiber and make it runnable
+  unsigned long createFiber(void *(*func)(void *), void *arg)
+  {
+    /**
+       \return fiber id (returned again by condWait()), 0 on error
+       (out of memory for a stack)
+    */
+    Fiber *f = allocFiber();
+    if(f == NULL)
+      return 0;
+
+    f->func = func;
+    f->arg = arg;
+    f->ret = NULL;
+    f->mgr = this;
+    prepare(f);
+
+    pthread_mutex_lock(&m_done_mutex);
+    f->id = m_next_id++;
+    m_stats.created++;
+    m_stats.alive++;
+    if(m_stats.alive > m_stats.peak_alive)
+      m_stats.peak_alive = m_stats.alive;
+    pthread_mutex_unlock(&m_done_mutex);
+
+    unsigned long id = f->id;
+    schedule(f);
+    return id;
+  }
+
+  ///wait for any fiber to finish (FIFO), from an ordinary thread
+  unsigned long condWait(void **fiber_return_val)
+  {
+    /**
+       \param fiber_return_val receives the fiber function's return value
+       \return id of the fiber, 0 if no fiber is alive or waiting
+    */
+    pthread_mutex_lock(&m_done_mutex);
+
+    while(m_done_head == NULL && m_stats.alive > 0)
+      pthread_cond_wait(&m_done_cond, &m_done_mutex);
+
+    unsigned long id = 0;
+    Fiber *f = m_done_head;
+    if(f != NULL)
+      {
+	m_done_head = f->next;
+	if(m_done_head == NULL)
+	  m_done_tail = NULL;
+	m_done_count--;
+
+	id = f->id;
+	if(fiber_return_val != NULL)
+	  *fiber_return_val = f->ret;
+      }
+
+    pthread_mutex_unlock(&m_done_mutex);
+
+    delete f;
+    return id;
+  }
+
+  ///fibers created and not yet handed out by condWait()
+  unsigned long fibersActive()
+  {
+    pthread_mutex_lock(&m_done_mutex);
+    unsigned long ret = m_stats.alive + m_done_count;
+    pthread_mutex_unlock(&m_done_mutex);
+    return ret;
+  }
+
+  ///copy out the counters
+  void getStats(fiber_stats *out)
+  {
+    pthread_mutex_lock(&m_done_mutex);
+    *out = m_stats;
+    pthread_mutex_unlock(&m_done_mutex);
+    out->switches = m_switches.load(std::memory_order_relaxed);
+  }
+
+  ///the calling fiber (NULL on an ordinary thread)
+  static Fiber *current()
+  {
+    worker *w = tls();
+    return w != NULL ? w->current : NULL;
+  }
+
+  ///let the other runnable fibers have the worker
+  static void yield()
+  {
+    worker *w = tls();
+    if(w == NULL || w->current == NULL)
+      {
+	sched_yield();
+	return;
+      }
+
+    w->action = AFTER_REQUEUE;
+    switchToScheduler(w);
+  }
+
+private:
+  ///storage for the thread local worker pointer
+  static __attribute__((noinline)) worker *&tls()
+  {
+    /* a fiber can resume on another worker: never let the compiler
+       cache this thread's TLS address across a switch
+    */
+    static thread_local worker *w = NULL;
+    __asm__ __volatile__("" ::: "memory");
+    return w;
+  }
+
+  ///park the calling fiber; the worker unlocks spin once we are off the stack
+  static void park(FiberSpin *spin)
+  {
+    worker *w = tls();
+    w->action = AFTER_PARK;
+    w->unlock_after = spin;
+    switchToScheduler(w);
+  }
+
+  ///switch from the running fiber back to its worker
+  static void switchToScheduler(worker *w)
+  {
+    Fiber *f = w->current;
+#if defined(__x86_64__)
+    fiber_switch_x86_64(&f->sp, w->sched_sp);
+#else
+    swapcontext(&f->ctx, &w->sched_ctx);
+#endif
+  }
+
+  ///first code run on a new fiber's stack
+  static void fiberMain(Fiber *f)
+  {
+    f->ret = f->func(f->arg);
+
+    //never comes back: the worker recycles this stack
+    worker *w = tls();
+    w->action = AFTER_FINISH;
+    switchToScheduler(w);
+  }
+
+#if !defined(__x86_64__)
+  ///makecontext() passes ints only: split the pointer
+  static void fiberMainUcontext(unsigned int hi, unsigned int lo)
+  {
+    fiberMain((Fiber *)(((uintptr_t)hi << 32) | (uintptr_t)lo));
+  }
+#endif
+
+  ///lay out the initial frame so the first switch enters fiberMain()
+  void prepare(Fiber *f)
+  {
+    char *top = f->map_base + f->map_size;
+
+#if defined(__x86_64__)
+    //matches the frame popped by fiber_switch_x86_64
+    unsigned long *sp = (unsigned long *)(((uintptr_t)top & ~(uintptr_t)15) - 64);
+    unsigned int mxcsr;
+    unsigned short fpucw;
+    __asm__ __volatile__("stmxcsr %0" : "=m"(mxcsr));
+    __asm__ __volatile__("fnstcw %0" : "=m"(fpucw));
+
+    sp[0] = (unsigned long)mxcsr | ((unsigned long)fpucw << 32);
+    sp[1] = 0;				// r15
+    sp[2] = 0;				// r14
+    sp[3] = (unsigned long)fiberMain;	// r13
+    sp[4] = (unsigned long)f;		// r12
+    sp[5] = 0;				// rbx
+    sp[6] = 0;				// rbp
+    sp[7] = (unsigned long)fiber_entry_x86_64;	// return address
+    f->sp = sp;
+#else
+    getcontext(&f->ctx);
+    f->ctx.uc_stack.ss_sp = f->map_base + (m_guard ? m_page : 0);
+    f->ctx.uc_stack.ss_size = m_stack_size;
+    f->ctx.uc_link = NULL;
+    makecontext(&f->ctx, (void (*)())fiberMainUcontext, 2,
+		(unsigned int)((uintptr_t)f >> 32), (unsigned int)(uintptr_t)f);
+#endif
+  }
+
+  ///take a stack from the pool or carve a new one out of a slab
+  Fiber *allocFiber()
+  {
+    size_t size = m_stack_size + (m_guard ? m_page : 0);
+
+    pthread_mutex_lock(&m_done_mutex);
+    Fiber *f = m_free_stacks;
+    if(f != NULL)
+      {
+	m_free_stacks = f->next;
+	pthread_mutex_unlock(&m_done_mutex);
+	return f;
+      }
+
+    if(m_slab_left == 0)
+      {
+	//one mapping for many stacks (unguarded slabs even merge)
+	void *p = mmap(NULL, SLAB_STACKS * size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(p == MAP_FAILED)
+	  {
+	    pthread_mutex_unlock(&m_done_mutex);
+	    return NULL;
+	  }
+	m_slabs.push_back((char *)p);
+	m_slab_next = (char *)p;
+	m_slab_left = SLAB_STACKS;
+      }
+
+    char *base = m_slab_next;
+    m_slab_next += size;
+    m_slab_left--;
+
+    if(m_guard && !guard(base))
+      m_stats.guard_failures++;
+    m_stats.stacks_mapped++;
+    pthread_mutex_unlock(&m_done_mutex);
+
+    f = new Fiber;
+    f->map_base = base;
+    f->map_size = size;
+    f->next = NULL;
+    return f;
+  }
+
+  ///put the guard page at the bottom of a new stack (m_done_mutex held)
+  bool guard(char *base)
+  {
+    /** \return false if the stack is left unguarded */
+    if(m_guard_mode == GUARD_MADVISE)
+      {
+	if(madvise(base, m_page, MADV_GUARD_INSTALL) == 0)
+	  return true;
+	m_guard_mode = GUARD_MPROTECT;	//older kernel
+      }
+    if(m_guard_mode == GUARD_MPROTECT)
+      {
+	if(mprotectBudget().fetch_sub(1) > 0 && mprotect(base, m_page, PROT_NONE) == 0)
+	  return true;
+	m_guard_mode = GUARD_NONE;	//out of mappings: the rest run unguarded
+      }
+    return false;
+  }
+
+  ///mprotect() guards the process may still make (two mappings each)
+  static std::atomic<long> &mprotectBudget()
+  {
+    static std::atomic<long> budget(mapLimit() / 4);
+    return budget;
+  }
+
+  ///vm.max_map_count
+  static long mapLimit()
+  {
+    long n = 65530;
+    FILE *fp = fopen("/proc/sys/vm/max_map_count", "r");
+    if(fp != NULL)
+      {
+	if(fscanf(fp, "%ld", &n) != 1)
+	  n = 65530;
+	fclose(fp);
+      }
+    return n;
+  }
+
+  ///make a fiber runnable
+  void schedule(Fiber *f)
+  {
+    pthread_mutex_lock(&m_run_mutex);
+    f->next = NULL;
+    if(m_run_tail != NULL)
+      m_run_tail->next = f;
+    else
+      m_run_head = f;
+    m_run_tail = f;
+
+    if(m_idle > 0)
+      pthread_cond_signal(&m_run_cond);
+    pthread_mutex_unlock(&m_run_mutex);
+  }
+
+  ///a fiber function returned: queue the result, keep the stack
+  void finished(Fiber *f)
+  {
+    /* the stack goes back to the pool right away; the Fiber header
+       rides the done FIFO until condWait() hands out the return
+       value, and a fresh header is kept with the stack.
+    */
+    Fiber *stack = new Fiber;
+    stack->map_base = f->map_base;
+    stack->map_size = f->map_size;
+
+    pthread_mutex_lock(&m_done_mutex);
+    stack->next = m_free_stacks;
+    m_free_stacks = stack;
+
+    f->next = NULL;
+    if(m_done_tail != NULL)
+      m_done_tail->next = f;
+    else
+      m_done_head = f;
+    m_done_tail = f;
+    m_done_count++;
+
+    m_stats.finished++;
+    m_stats.alive--;
+    pthread_cond_signal(&m_done_cond);
+    pthread_mutex_unlock(&m_done_mutex);
+  }
+
+  ///worker thread (a ThreadMgr thread): run fibers until shutdown
+  static void *workerMain(void *arg)
+  {
+    FiberMgr *mgr = (FiberMgr *)arg;
+    worker w;
+    w.current = NULL;
+    w.action = AFTER_NONE;
+    w.unlock_after = NULL;
+    w.mgr = mgr;
+    tls() = &w;
+
+    //a worker lives as long as the manager: not a stall, and not a
+    //turn that ordered output should wait for
+    ThreadWatchdog::exempt();
+    ThreadOutput::exempt();
+
+    for(;;)
+      {
+	pthread_mutex_lock(&mgr->m_run_mutex);
+	while(mgr->m_run_head == NULL && !mgr->m_shutdown)
+	  {
+	    mgr->m_idle++;
+	    pthread_cond_wait(&mgr->m_run_cond, &mgr->m_run_mutex);
+	    mgr->m_idle--;
+	  }
+
+	Fiber *f = mgr->m_run_head;
+	if(f == NULL)
+	  {
+	    //shutdown and nothing left to run
+	    pthread_mutex_unlock(&mgr->m_run_mutex);
+	    break;
+	  }
+
+	mgr->m_run_head = f->next;
+	if(mgr->m_run_head == NULL)
+	  mgr->m_run_tail = NULL;
+	pthread_mutex_unlock(&mgr->m_run_mutex);
+
+	//run it until it yields, parks or returns
+	w.current = f;
+	w.action = AFTER_NONE;
+#if defined(__x86_64__)
+	fiber_switch_x86_64(&w.sched_sp, f->sp);
+#else
+	swapcontext(&w.sched_ctx, &f->ctx);
+#endif
+	w.current = NULL;
+	mgr->m_switches.fetch_add(1, std::memory_order_relaxed);
+
+	switch(w.action)
+	  {
+	  case AFTER_REQUEUE:
+	    mgr->schedule(f);
+	    break;
+	  case AFTER_PARK:
+	    //now that f is off its stack a waker may resume it
+	    w.unlock_after->unlock();
+	    break;
+	  case AFTER_FINISH:
+	    mgr->finished(f);
+	    break;
+	  default:
+	    break;
+	  }
+      }
+
+    tls() = NULL;
+    return NULL;
+  }
+
+private:
+  ///the worker threads
+  ThreadMgr m_mgr;
+
+  ///usable stack bytes per fiber and the page size
+  size_t m_stack_size;
+  size_t m_page;
+
+  ///put a guard page below each stack, and how (see guard())
+  bool m_guard;
+  guard_mode m_guard_mode;
+
+  ///slabs mapped so far, and the part of the newest not handed out yet
+  std::vector<char *> m_slabs;
+  char *m_slab_next;
+  int m_slab_left;
+
+  ///run queue (intrusive FIFO)
+  pthread_mutex_t m_run_mutex;
+  pthread_cond_t m_run_cond;
+  bool m_shutdown;
+
+  ///id for the next fiber
+  unsigned long m_next_id;
+
+  Fiber *m_run_head;
+  Fiber *m_run_tail;
+
+  ///finished fibers waiting for condWait() and the stack pool
+  pthread_mutex_t m_done_mutex;
+  pthread_cond_t m_done_cond;
+  Fiber *m_done_head;
+  Fiber *m_done_tail;
+  unsigned long m_done_count;
+  Fiber *m_free_stacks;
+
+  ///workers waiting for the run queue
+  int m_idle;
+
+  ///counters
+  fiber_stats m_stats;
+  std::atomic<unsigned long> m_switches;
+};
+
+/**
+   \brief Mutex that parks the fiber instead of blocking the worker
+
+   \note
+   Ownership is handed straight to the first waiter on unlock() (FIFO,
+   no barging). Used from an ordinary thread it spins with
+   sched_yield().
+*/
+class FiberMutex {
+  friend class FiberCond;
+
+public:
+  FiberMutex() : m_locked(false), m_head(NULL), m_tail(NULL) {}
+
+  void lock()
+  {
+    m_spin.lock();
+    if(!m_locked)
+      {
+	m_locked = true;
+	m_spin.unlock();
+	return;
+      }
+
+    Fiber *self = FiberMgr::current();
+    if(self == NULL)
+      {
+	//not a fiber: poll
+	m_spin.unlock();
+	for(;;)
+	  {
+	    sched_yield();
+	    m_spin.lock();
+	    if(!m_locked)
+	      {
+		m_locked = true;
+		m_spin.unlock();
+		return;
+	      }
+	    m_spin.unlock();
+	  }
+      }
+
+    //wait in line; unlock() hands the mutex over and wakes us
+    self->next = NULL;
+    if(m_tail != NULL)
+      m_tail->next = self;
+    else
+      m_head = self;
+    m_tail = self;
+
+    FiberMgr::park(&m_spin);
+  }
+
+  void unlock()
+  {
+    m_spin.lock();
+    Fiber *f = m_head;
+    if(f != NULL)
+      {
+	m_head = f->next;
+	if(m_head == NULL)
+	  m_tail = NULL;
+      }
+    else
+      m_locked = false;
+    m_spin.unlock();
+
+    //still locked: the waiter owns it now
+    if(f != NULL)
+      f->mgr->schedule(f);
+  }
+
+private:
+  FiberSpin m_spin;
+  bool m_locked;
+  Fiber *m_head;
+  Fiber *m_tail;
+};
+
+/**
+   \brief Condition variable for fibers (paired with a FiberMutex)
+*/
+class FiberCond {
+public:
+  FiberCond() : m_head(NULL), m_tail(NULL) {}
+
+  ///release m, park until signaled, then take m back
+  void wait(FiberMutex &m)
+  {
+    Fiber *self = FiberMgr::current();
+
+    m_spin.lock();
+    if(self == NULL)
+      {
+	//not a fiber: degrade to an unlock / yield / lock cycle
+	m_spin.unlock();
+	m.unlock();
+	sched_yield();
+	m.lock();
+	return;
+      }
+
+    self->next = NULL;
+    if(m_tail != NULL)
+      m_tail->next = self;
+    else
+      m_head = self;
+    m_tail = self;
+
+    m.unlock();
+    FiberMgr::park(&m_spin);
+
+    m.lock();
+  }
+
+  ///wake the oldest waiter
+  void signal()
+  {
+    m_spin.lock();
+    Fiber *f = m_head;
+    if(f != NULL)
+      {
+	m_head = f->next;
+	if(m_head == NULL)
+	  m_tail = NULL;
+      }
+    m_spin.unlock();
+
+    if(f != NULL)
+      f->mgr->schedule(f);
+  }
+
+  ///wake every waiter
+  void broadcast()
+  {
+    m_spin.lock();
+    Fiber *f = m_head;
+    m_head = m_tail = NULL;
+    m_spin.unlock();
+
+    while(f != NULL)
+      {
+	Fiber *next = f->next;
+	f->mgr->schedule(f);
+	f = next;
+      }
+  }
+
+private:
+  FiberSpin m_spin;
+  Fiber *m_head;
+  Fiber *m_tail;
+};
+
+#endif //FIBER_H
@@ -0,0 +1,519 @@
+/** \file Pipeline.h
+
+\brief Staged (SEDA style) pipeline executor on top of ThreadMgr
+
+\par Purpose:
+A chain of processing stages (parse -> transform -> aggregate ->
+emit ...) where each stage runs on its own set of ThreadMgr threads
+and the stages are connected by bounded lock-free queues. Instead of
+main() waiting for every hop with condWait() the items flow from
+stage to stage on their own:
+<ul>
+<li>each stage has its own parallelism (number of worker threads)</li>
+<li>a full queue blocks the stage feeding it, so backpressure
+propagates upstream all the way to Pipeline::push()</li>
+<li>workers move items in batches to cut per-item queue traffic</li>
+<li>per-stage throughput and queue occupancy are kept for
+printStats()</li>
+</ul>
+The workers of a stage are a TaskGroup of the manager, so a pipeline
+shares the manager with any other threads it runs.
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <sched.h>
+#include <time.h>
+
+#include "ThreadMgr.h"
+
+/**
+   \brief Bounded multi-producer / multi-consumer lock-free queue
+
+   \par Purpose:
+   The classic sequence numbered ring (one sequence counter per
+   slot). Producers and consumers claim slots with a compare and
+   swap on a shared position counter and never take a lock.
+
+   \note
+   The capacity is rounded up to a power of two.
+*/
+class BoundedQueue {
+private:
+  ///one slot of the ring
+  struct cell
+  {
+    std::atomic<unsigned long> seq;
+    void *data;
+  };
+
+public:
+  ///constructor
+  BoundedQueue(unsigned long capacity)
+    : m_closed(false), m_max_occupancy(0)
+  {
+    unsigned long size = 2;
+    while(size < capacity)
+      size <<= 1;
+
+    m_mask = size - 1;
+    m_cells = new cell[size];
+    for(unsigned long i = 0; i < size; i++)
+      m_cells[i].seq.store(i, std::memory_order_relaxed);
+
+    m_enqueue.store(0, std::memory_order_relaxed);
+    m_dequeue.store(0, std::memory_order_relaxed);
+  }
+
+  ///destructor
+  ~BoundedQueue() { delete [] m_cells; }
+
+  ///try to add an item (false if the queue is full)
+  bool tryPush(void *data)
+  {
+    unsigned long pos = m_enqueue.load(std::memory_order_relaxed);
+
+    for(;;)
+      {
+	cell *c = &m_cells[pos & m_mask];
+	unsigned long seq = c->seq.load(std::memory_order_acquire);
+	long diff = (long)seq - (long)pos;
+
+	if(diff == 0)
+	  {
+	    if(m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+	      {
+		c->data = data;
+		c->seq.store(pos + 1, std::memory_order_release);
+		notePush(pos + 1);
+		return true;
+	      }
+	  }
+	else if(diff < 0)
+	  return false;
+	else
+	  pos = m_enqueue.load(std::memory_order_relaxed);
+      }
+  }
+
+  ///try to take an item (false if the queue is empty)
+  bool tryPop(void **data)
+  {
+    unsigned long pos = m_dequeue.load(std::memory_order_relaxed);
+
+    for(;;)
+      {
+	cell *c = &m_cells[pos & m_mask];
+	unsigned long seq = c->seq.load(std::memory_order_acquire);
+	long diff = (long)seq - (long)(pos + 1);
+
+	if(diff == 0)
+	  {
+	    if(m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+	      {
+		*data = c->data;
+		c->seq.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	      }
+	  }
+	else if(diff < 0)
+	  return false;
+	else
+	  pos = m_dequeue.load(std::memory_order_relaxed);
+      }
+  }
+
+  ///no more pushes will happen (consumers drain, then stop)
+  void close() { m_closed.store(true, std::memory_order_release); }
+
+  ///answers the question "was close() called?"
+  bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+  ///items in the queue right now (approximate while it is busy)
+  unsigned long occupancy() const
+  {
+    unsigned long e = m_enqueue.load(std::memory_order_relaxed);
+    unsigned long d = m_dequeue.load(std::memory_order_relaxed);
+    return e > d ? e - d : 0;
+  }
+
+  ///highest occupancy seen by a producer
+  unsigned long maxOccupancy() const { return m_max_occupancy.load(std::memory_order_relaxed); }
+
+  ///slots in the ring
+  unsigned long capacity() const { return m_mask + 1; }
+
+private:
+  ///keep track of the high water mark
+  void notePush(unsigned long enqueued)
+  {
+    unsigned long occ = enqueued - m_dequeue.load(std::memory_order_relaxed);
+    unsigned long max = m_max_occupancy.load(std::memory_order_relaxed);
+    while(occ > max && !m_max_occupancy.compare_exchange_weak(max, occ, std::memory_order_relaxed))
+      ;
+  }
+
+  ///ring of cells (size m_mask + 1)
+  cell *m_cells;
+  unsigned long m_mask;
+
+  ///producer / consumer positions on separate cache lines
+  alignas(64) std::atomic<unsigned long> m_enqueue;
+  alignas(64) std::atomic<unsigned long> m_dequeue;
+
+  ///set by close()
+  alignas(64) std::atomic<bool> m_closed;
+
+  ///high water mark
+  std::atomic<unsigned long> m_max_occupancy;
+};
+
+/**
+   \brief A chain of stages connected by BoundedQueue objects
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   Pipeline p(mgr);<br>
+   p.addStage("parse", parseFunc, 2);<br>
+   p.addStage("sum", sumFunc, 1);<br>
+   p.start();<br>
+   for(...) p.push(item);<br>
+   p.close();<br>
+   p.wait();<br>
+   p.printStats(std::cout);<br>
+
+   \note
+   A stage function takes an item and returns the item for the next
+   stage, or NULL to drop it. Whatever the last stage returns is
+   discarded (the last stage is the "emit" stage).
+*/
+class Pipeline {
+private:
+  ///one stage and the queue feeding it
+  struct stage
+  {
+    std::string name;
+    void *(*func)(void *);
+    int parallelism;
+    int batch;
+
+    ///input queue of this stage
+    BoundedQueue *in;
+
+    ///workers of this stage
+    TaskGroup *group;
+
+    ///workers still running (the last one out closes the next queue)
+    std::atomic<int> running;
+
+    ///counters
+    std::atomic<unsigned long> items_in;
+    std::atomic<unsigned long> items_out;
+    std::atomic<unsigned long> full_stalls;
+    std::atomic<unsigned long> empty_stalls;
+
+    ///occupancy of the input queue summed at every batch (for the average)
+    std::atomic<unsigned long> occupancy_sum;
+    std::atomic<unsigned long> occupancy_samples;
+
+    ///first item in / last item out (nsec) for throughput
+    std::atomic<long long> first_ns;
+    std::atomic<long long> last_ns;
+
+    ///next stage (NULL for the last)
+    stage *next;
+    Pipeline *pipeline;
+  };
+
+public:
+  ///constructor
+  Pipeline(ThreadMgr &mgr) : m_mgr(&mgr), m_started(false), m_push_stalls(0) {}
+
+  ///destructor -stops the pipeline if wait() was not called
+  ~Pipeline()
+  {
+    if(m_started)
+      {
+	close();
+	wait();
+      }
+
+    for(size_t i = 0; i < m_stages.size(); i++)
+      {
+	delete m_stages[i]->in;
+	delete m_stages[i];
+      }
+  }
+
+  ///append a stage (before start())
+  void addStage(const char *name, void *(*func)(void *), int parallelism = 1,
+		unsigned long queue_capacity = 1024, int batch = 32)
+  {
+    /**
+       \param name label for printStats()
+       \param func the stage function (item in, item or NULL out)
+       \param parallelism number of worker threads for the stage
+       \param queue_capacity size of the bounded queue feeding it
+       \param batch items moved per queue visit
+    */
+    stage *s = new stage;
+    s->name = name;
+    s->func = func;
+    s->parallelism = parallelism > 0 ? parallelism : 1;
+    s->batch = batch > 0 ? batch : 1;
+    s->in = new BoundedQueue(queue_capacity);
+    s->group = NULL;
+    s->running.store(0);
+    s->items_in.store(0);
+    s->items_out.store(0);
+    s->full_stalls.store(0);
+    s->empty_stalls.store(0);
+    s->occupancy_sum.store(0);
+    s->occupancy_samples.store(0);
+    s->first_ns.store(0);
+    s->last_ns.store(0);
+    s->next = NULL;
+    s->pipeline = this;
+
+    if(!m_stages.empty())
+      m_stages.back()->next = s;
+    m_stages.push_back(s);
+  }
+
+  ///start every stage's workers
+  int start()
+  {
+    /** \return number of worker threads started, -1 if there are no
+	stages or a stage got no worker (the workers that did start are
+	stopped again)
+    */
+    int count = 0;
+    if(m_stages.empty())
+      return -1;
+
+    for(size_t i = 0; i < m_stages.size(); i++)
+      {
+	stage *s = m_stages[i];
+	s->group = new TaskGroup(*m_mgr);
+	s->running.store(s->parallelism);
+
+	for(int w = 0; w < s->parallelism; w++)
+	  if(m_mgr->createThread(worker, (void *)s, s->group) != 0)
+	    count++;
+	  else
+	    s->running.fetch_sub(1);
+      }
+    m_started = true;
+
+    //a stage with no worker would hold its items, and never close the
+    //next stage's input: stop everything rather than hang
+    for(size_t i = 0; i < m_stages.size(); i++)
+      if(m_stages[i]->running.load() == 0)
+	{
+	  for(size_t k = 0; k < m_stages.size(); k++)
+	    m_stages[k]->in->close();
+	  wait();
+	  return -1;
+	}
+    return count;
+  }
+
+  ///feed an item into the first stage (blocks while it is full)
+  int push(void *item)
+  {
+    /** \return 0, -1 if the item was dropped: there are no stages, or
+	the queue is full and closed (after close() or a failed start()
+	nothing takes items out, so it does not block)
+    */
+    if(m_stages.empty())
+      return -1;
+    BoundedQueue *q = m_stages.front()->in;
+
+    for(int spins = 0; !q->tryPush(item); spins++)
+      {
+	if(q->closed())
+	  return -1;
+	if(spins == 0)
+	  m_push_stalls++;
+	backoff(spins);
+      }
+    return 0;
+  }
+
+  ///no more input: stages drain their queues and stop in order
+  int close()
+  {
+    /** \return 0, -1 if there are no stages */
+    if(m_stages.empty())
+      return -1;
+    m_stages.front()->in->close();
+    return 0;
+  }
+
+  ///wait for every stage to finish (call close() first)
+  void wait()
+  {
+    for(size_t i = 0; i < m_stages.size(); i++)
+      if(m_stages[i]->group != NULL)
+	{
+	  m_mgr->waitAll(m_stages[i]->group);
+	  delete m_stages[i]->group;
+	  m_stages[i]->group = NULL;
+	}
+
+    m_started = false;
+  }
+
+  ///print per stage throughput and queue occupancy
+  void printStats(std::ostream &os)
+  {
+    os << "push stalls (pipeline full)=" << m_push_stalls << std::endl;
+
+    for(size_t i = 0; i < m_stages.size(); i++)
+      {
+	stage *s = m_stages[i];
+	long long span = s->last_ns.load() - s->first_ns.load();
+	unsigned long samples = s->occupancy_samples.load();
+
+	os << "stage " << i << " " << s->name
+	   << "|threads=" << s->parallelism
+	   << "|in=" << s->items_in.load()
+	   << "|out=" << s->items_out.load()
+	   << "|items/s=" << (span > 0 ? (long long)(s->items_in.load() * 1e9 / span) : 0)
+	   << "|queue avg=" << (samples ? s->occupancy_sum.load() / samples : 0)
+	   << " max=" << s->in->maxOccupancy()
+	   << "/" << s->in->capacity()
+	   << "|stalls full=" << s->full_stalls.load()
+	   << " empty=" << s->empty_stalls.load()
+	   << std::endl;
+      }
+  }
+
+private:
+  ///spin, then yield, then sleep
+  static void backoff(int spins)
+  {
+    if(spins < 64)
+      return;
+    if(spins < 128)
+      {
+	sched_yield();
+	return;
+      }
+
+    struct timespec ts = {0, 50000};
+    nanosleep(&ts, NULL);
+  }
+
+  ///monotonic clock in nanoseconds
+  static long long now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  ///push a batch downstream (blocks while the next queue is full)
+  static void forward(stage *s, void **items, int n)
+  {
+    BoundedQueue *q = s->next->in;
+
+    for(int i = 0; i < n; i++)
+      for(int spins = 0; !q->tryPush(items[i]); spins++)
+	{
+	  //backpressure: this stage stops pulling until there is room
+	  if(spins == 0)
+	    s->full_stalls.fetch_add(1, std::memory_order_relaxed);
+	  backoff(spins);
+	}
+  }
+
+  ///stage worker: pull a batch, run the stage function, push results
+  static void *worker(void *arg)
+  {
+    stage *s = (stage *)arg;
+    std::vector<void *> in(s->batch);
+    std::vector<void *> out(s->batch);
+
+    //a stage worker lives as long as the pipeline: not a stall, and
+    //not a turn that ordered output should wait for
+    ThreadWatchdog::exempt();
+    ThreadOutput::exempt();
+
+    for(int spins = 0;;)
+      {
+	//take up to a batch
+	int n = 0;
+	while(n < s->batch && s->in->tryPop(&in[n]))
+	  n++;
+
+	if(n == 0)
+	  {
+	    //upstream is done and the queue is dry
+	    if(s->in->closed() && s->in->occupancy() == 0)
+	      {
+		void *last;
+		if(!s->in->tryPop(&last))
+		  break;
+		in[n++] = last;
+	      }
+	    else
+	      {
+		if(spins++ == 0)
+		  s->empty_stalls.fetch_add(1, std::memory_order_relaxed);
+		backoff(spins);
+		continue;
+	      }
+	  }
+	spins = 0;
+
+	long long t = now();
+	long long zero = 0;
+	s->first_ns.compare_exchange_strong(zero, t, std::memory_order_relaxed);
+	s->occupancy_sum.fetch_add(s->in->occupancy() + n, std::memory_order_relaxed);
+	s->occupancy_samples.fetch_add(1, std::memory_order_relaxed);
+
+	//run the stage over the batch
+	int m = 0;
+	for(int i = 0; i < n; i++)
+	  {
+	    void *r = s->func(in[i]);
+	    if(r != NULL)
+	      out[m++] = r;
+	  }
+
+	if(s->next != NULL && m > 0)
+	  forward(s, &out[0], m);
+
+	s->items_in.fetch_add(n, std::memory_order_relaxed);
+	s->items_out.fetch_add(m, std::memory_order_relaxed);
+	s->last_ns.store(now(), std::memory_order_relaxed);
+      }
+
+    //the last worker of a stage closes the next stage's input
+    if(s->running.fetch_sub(1) == 1 && s->next != NULL)
+      s->next->in->close();
+
+    return NULL;
+  }
+
+private:
+  ///manager running the workers
+  ThreadMgr *m_mgr;
+
+  ///stages in order
+  std::vector<stage *> m_stages;
+
+  ///start() was called
+  bool m_started;
+
+  ///times push() found the first queue full
+  unsigned long m_push_stalls;
+};
+
+#endif //PIPELINE_H
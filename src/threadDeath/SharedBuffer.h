@@ -0,0 +1,438 @@
+/** \file SharedBuffer.h
+
+\brief Immutable, reference counted buffers passed between threads
+without copying
+
+\par Purpose:
+threadDeath2.cc and threadDeath3.cc hand std::string pointers to their
+threads and get new heap strings back: every hop copies the payload,
+and who deletes what is up to each example. A SharedBuffer is a view
+(start and length) of one reference counted block. Copying the view
+copies a pointer and bumps the count, slice() makes a smaller view of
+the same block, and the block is freed when the last view goes. The
+bytes are written once, before the buffer is handed to anyone, and
+never change after that, so any number of threads read them without
+locking.
+<br>
+<br>
+A task gets its buffer as the createThread() argument (a pointer to a
+view the creator keeps alive, which the task copies) and gives a
+buffer back through condWait() with handOff(): the view goes into the
+thread's result arena and the waiter takes it with takeOver() before
+releaseResult(). A SharedRope strings views together without copying
+(rope style concatenation); flatten() copies only when the pieces are
+not already one contiguous slice.
+<br>
+<br>
+The block is a fixed header (an atomic count, the size, the kind)
+followed by the bytes, with no pointers in it, so it can be built in
+a shared memory segment with place() and used from every process that
+maps it (attach()). Such a block is never freed by the views: the
+segment owner reuses it once placedRefs() is back to 0.
+
+\par Example:
+SharedBuffer whole(data, 64 << 20);&nbsp;&nbsp;//the only copy<br>
+SharedBuffer half = whole.slice(0, 32 << 20);&nbsp;&nbsp;//no copy<br>
+m.createThread(task, &half);<br>
+*/
+
+#ifndef SHAREDBUFFER_H
+#define SHAREDBUFFER_H
+
+#include <new>
+#include <atomic>
+#include <vector>
+#include <string_view>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "ThreadArena.h"
+
+class SharedRope;
+
+/**
+   \brief View of an immutable, reference counted block of bytes
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \note
+   The count is updated atomically, so views of one block may be made
+   and dropped on any threads. A single view object is not itself
+   thread safe (like a std::shared_ptr).
+*/
+class SharedBuffer {
+  friend class SharedRope;
+
+public:
+  ///bytes before the data in a block (keeps the data cache line aligned)
+  static const size_t HEADER = 64;
+
+  ///constructor, empty
+  SharedBuffer() : m_block(NULL), m_data(NULL), m_size(0) {}
+
+  ///constructor, a new block holding a copy of n bytes of data
+  SharedBuffer(const void *data, size_t n) : m_block(NULL), m_data(NULL), m_size(0)
+  {
+    /** \note the only copy; empty if the allocation failed */
+    char *fill = NULL;
+    if(allocate(n, &fill) == 0)
+      memcpy(fill, data, n);
+  }
+
+  ///constructor, a new block of n bytes for the caller to fill
+  SharedBuffer(size_t n, char **fill) : m_block(NULL), m_data(NULL), m_size(0)
+  {
+    /**
+       \param fill set to the bytes (NULL if the allocation failed).
+       They must be written before the buffer is copied or handed on.
+    */
+    *fill = NULL;
+    allocate(n, fill);
+  }
+
+  SharedBuffer(const SharedBuffer &o) : m_block(o.m_block), m_data(o.m_data), m_size(o.m_size)
+  {
+    if(m_block != NULL)
+      m_block->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  SharedBuffer(SharedBuffer &&o) : m_block(o.m_block), m_data(o.m_data), m_size(o.m_size)
+  {
+    o.m_block = NULL;
+    o.m_data = NULL;
+    o.m_size = 0;
+  }
+
+  SharedBuffer &operator=(const SharedBuffer &o)
+  {
+    //o may be this view
+    block *k = o.m_block;
+    const char *d = o.m_data;
+    size_t n = o.m_size;
+    if(k != NULL)
+      k->refs.fetch_add(1, std::memory_order_relaxed);
+    drop();
+    m_block = k;
+    m_data = d;
+    m_size = n;
+    return *this;
+  }
+
+  SharedBuffer &operator=(SharedBuffer &&o)
+  {
+    if(this != &o)
+      {
+	drop();
+	m_block = o.m_block;
+	m_data = o.m_data;
+	m_size = o.m_size;
+	o.m_block = NULL;
+	o.m_data = NULL;
+	o.m_size = 0;
+      }
+    return *this;
+  }
+
+  ~SharedBuffer() { drop(); }
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  char operator[](size_t i) const { return m_data[i]; }
+  std::string_view view() const { return std::string_view(m_data, m_size); }
+
+  ///n bytes from off, sharing this block (both cut to this view)
+  SharedBuffer slice(size_t off, size_t n = (size_t)-1) const
+  {
+    SharedBuffer s(*this);
+    if(off > m_size)
+      off = m_size;
+    if(n > m_size - off)
+      n = m_size - off;
+    s.m_data += off;
+    s.m_size = n;
+    return s;
+  }
+
+  ///views (anywhere) of this block
+  long refs() const { return (m_block != NULL) ? m_block->refs.load(std::memory_order_relaxed) : 0; }
+
+  ///true if both are views of one block
+  bool sameBlock(const SharedBuffer &o) const { return m_block != NULL && m_block == o.m_block; }
+
+  ///copy the bytes out
+  void copyTo(void *dst) const { memcpy(dst, m_data, m_size); }
+
+  ///a thread return value carrying this view (see takeOver())
+  void *handOff()
+  {
+    /**
+       \par Purpose:
+       Moves the view (not the bytes) into a small record that a task
+       returns, so it comes back through condWait(). The record is in
+       the thread's result arena when the thread has one (a ThreadMgr
+       thread), else on the heap.
+
+       \return the record, NULL if it could not be allocated (the
+       view is then left as it was)
+    */
+    ThreadArena *a = ThreadArena::current();
+    handoff *h = (a != NULL) ? (handoff *)a->result(sizeof(handoff)) : NULL;
+    bool heap = (h == NULL);
+    if(heap && (h = new(std::nothrow) handoff) == NULL)
+      return NULL;
+    h->owner = m_block;
+    h->data = m_data;
+    h->size = m_size;
+    h->heap = heap;
+    m_block = NULL;
+    m_data = NULL;
+    m_size = 0;
+    return h;
+  }
+
+  ///the view handOff() put in a thread return value
+  static SharedBuffer takeOver(void *result)
+  {
+    /**
+       \note call before ThreadMgr::releaseResult(result) (which
+       recycles the arena the record is in)
+    */
+    handoff *h = (handoff *)result;
+    SharedBuffer b;
+    b.m_block = h->owner;
+    b.m_data = h->data;
+    b.m_size = h->size;
+    if(h->heap)
+      delete h;
+    return b;
+  }
+
+  ///bytes place() needs for n bytes of data
+  static size_t placeSize(size_t n) { return HEADER + n; }
+
+  ///build a block in caller memory (a shared memory segment) and view it
+  static SharedBuffer place(void *mem, const void *data, size_t n)
+  {
+    /**
+       \param mem placeSize(n) bytes, 64 byte aligned
+       \return a view holding the first reference, empty if mem is not
+       aligned. The views never free the block.
+    */
+    SharedBuffer b;
+    if((uintptr_t)mem % HEADER != 0)
+      return b;
+    block *k = new(mem) block;
+    k->size = n;
+    k->kind = PLACED;
+    memcpy((char *)mem + HEADER, data, n);
+
+    //published by the count (attach() reads it with acquire)
+    k->refs.store(1, std::memory_order_release);
+    b.m_block = k;
+    b.m_data = (char *)mem + HEADER;
+    b.m_size = n;
+    return b;
+  }
+
+  ///a view of a block place() built at mem (in this or another process)
+  static SharedBuffer attach(void *mem)
+  {
+    SharedBuffer b;
+    block *k = (block *)mem;
+    k->refs.fetch_add(1, std::memory_order_acquire);
+    b.m_block = k;
+    b.m_data = (char *)mem + HEADER;
+    b.m_size = k->size;
+    return b;
+  }
+
+  ///views left of the placed block at mem (0: free to reuse)
+  static long placedRefs(const void *mem)
+  {
+    return ((const block *)mem)->refs.load(std::memory_order_acquire);
+  }
+
+private:
+  ///who frees a block
+  enum kind
+  {
+    HEAP = 1,
+    PLACED
+  };
+
+  ///block header: plain data and an address free atomic, no pointers
+  struct block
+  {
+    std::atomic<long> refs;
+    uint64_t size;
+    uint32_t kind;
+  };
+
+  static_assert(std::atomic<long>::is_always_lock_free,
+		"the count must be lock free to work across processes");
+  static_assert(sizeof(block) <= HEADER, "block header too large");
+
+  ///what handOff() returns
+  struct handoff
+  {
+    block *owner;
+    const char *data;
+    size_t size;
+    bool heap;
+  };
+
+  ///a new heap block of n bytes
+  int allocate(size_t n, char **fill)
+  {
+    /** \return 0, -1 if out of memory */
+    block *k = (block *)aligned_alloc(HEADER, (HEADER + n + HEADER - 1) & ~(HEADER - 1));
+    if(k == NULL)
+      return -1;
+    new(k) block;
+    k->refs.store(1, std::memory_order_relaxed);
+    k->size = n;
+    k->kind = HEAP;
+    m_block = k;
+    m_data = (char *)k + HEADER;
+    m_size = n;
+    *fill = (char *)m_data;
+    return 0;
+  }
+
+  ///let go of the block, freeing it with the last heap view
+  void drop()
+  {
+    if(m_block != NULL && m_block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+       m_block->kind == HEAP)
+      free(m_block);
+    m_block = NULL;
+  }
+
+  block *m_block;
+  const char *m_data;
+  size_t m_size;
+};
+
+/**
+   \brief Concatenation of SharedBuffer views, without copying
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Purpose:
+   Holds the pieces in order. Appending a view that continues the last
+   piece in the same block extends that piece instead, so slices of
+   one buffer put back together in order are one piece again.
+*/
+class SharedRope {
+public:
+  ///constructor, empty
+  SharedRope() : m_size(0) {}
+
+  ///add a view to the end
+  void append(const SharedBuffer &b)
+  {
+    if(b.empty())
+      return;
+    m_size += b.size();
+    if(!m_pieces.empty())
+      {
+	SharedBuffer &last = m_pieces.back();
+	if(last.sameBlock(b) && last.m_data + last.m_size == b.m_data)
+	  {
+	    last.m_size += b.m_size;
+	    return;
+	  }
+      }
+    m_pieces.push_back(b);
+  }
+
+  void append(const SharedRope &r)
+  {
+    if(&r == this)
+      {
+	SharedRope copy(r);
+	append(copy);
+	return;
+      }
+    for(size_t i = 0; i < r.m_pieces.size(); i++)
+      append(r.m_pieces[i]);
+  }
+
+  ///a followed by b
+  static SharedRope concat(const SharedRope &a, const SharedRope &b)
+  {
+    SharedRope r(a);
+    r.append(b);
+    return r;
+  }
+
+  size_t size() const { return m_size; }
+  size_t pieces() const { return m_pieces.size(); }
+  const SharedBuffer &piece(size_t i) const { return m_pieces[i]; }
+
+  ///n bytes from off, as views of the same blocks
+  SharedRope slice(size_t off, size_t n = (size_t)-1) const
+  {
+    SharedRope r;
+    for(size_t i = 0; i < m_pieces.size() && n > 0; i++)
+      {
+	size_t s = m_pieces[i].size();
+	if(off >= s)
+	  {
+	    off -= s;
+	    continue;
+	  }
+	SharedBuffer p = m_pieces[i].slice(off, n);
+	n -= p.size();
+	off = 0;
+	r.append(p);
+      }
+    return r;
+  }
+
+  ///copy all the bytes out
+  void copyTo(void *dst) const
+  {
+    char *d = (char *)dst;
+    for(size_t i = 0; i < m_pieces.size(); i++)
+      {
+	m_pieces[i].copyTo(d);
+	d += m_pieces[i].size();
+      }
+  }
+
+  ///the whole rope as one view (a copy only if it is in several pieces)
+  SharedBuffer flatten() const
+  {
+    if(m_pieces.size() == 1)
+      return m_pieces[0];
+    char *fill;
+    SharedBuffer b(m_size, &fill);
+    if(fill != NULL)
+      copyTo(fill);
+    return b;
+  }
+
+  ///true if the rope holds the n bytes at p
+  bool equals(const void *p, size_t n) const
+  {
+    if(n != m_size)
+      return false;
+    const char *c = (const char *)p;
+    for(size_t i = 0; i < m_pieces.size(); i++)
+      {
+	if(memcmp(c, m_pieces[i].data(), m_pieces[i].size()) != 0)
+	  return false;
+	c += m_pieces[i].size();
+      }
+    return true;
+  }
+
+private:
+  std::vector<SharedBuffer> m_pieces;
+  size_t m_size;
+};
+
+#endif //SHAREDBUFFER_H
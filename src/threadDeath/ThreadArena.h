@@ -0,0 +1,297 @@
+/** \file ThreadArena.h
+
+\brief Resettable bump allocator owned by a managed thread
+
+\par Purpose:
+A ThreadArena hands out memory by bumping a pointer through large
+chunks obtained directly from mmap(). Nothing is ever freed
+individually; the memory is reclaimed in bulk by a reset. This keeps
+short lived task allocations away from the global allocator (and its
+locks) when many threads are running.
+<br>
+<br>
+Each arena has two regions:
+<ul>
+<li>scratch - temporary memory that is reclaimed as soon as the
+task function returns</li>
+<li>result - memory that survives the task so that a return value
+may be handed back through ThreadMgr::condWait(). It is reclaimed
+when the waiter calls ThreadMgr::releaseResult().</li>
+</ul>
+Tasks reach the arena of the thread they are running on through
+ThreadArena::current() which is a plain thread local pointer read.
+*/
+
+#ifndef THREADARENA_H
+#define THREADARENA_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/**
+   \brief A two region (scratch / result) bump allocator
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \note
+   An arena is used by one thread at a time. It is not thread safe
+   and is not meant to be. ThreadMgr passes arenas between threads
+   only while holding its data mutex.
+
+   \warning
+   Destructors of objects built in an arena are never called by the
+   arena. Only put objects in here that do not own other memory
+   (char arrays, PODs, etc.).
+*/
+class ThreadArena {
+private:
+  ///header placed at the start of every mmap'd chunk
+  struct chunk
+  {
+    ///next chunk in the region
+    chunk *next;
+
+    ///total mapped size of the chunk (including this header)
+    size_t size;
+
+    ///bytes handed out from this chunk (including this header)
+    size_t used;
+  };
+
+  ///a list of chunks and the chunk currently being bumped
+  struct region
+  {
+    ///first chunk (kept across resets)
+    chunk *head;
+
+    ///chunk allocations are currently coming from
+    chunk *cur;
+  };
+
+public:
+  ///default chunk size (bytes)
+  static const size_t DEFAULT_CHUNK = 64 * 1024;
+
+  ///size of a huge page on the platforms we care about
+  static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+  ///constructor
+  ThreadArena(size_t chunk_size = DEFAULT_CHUNK, bool huge = false)
+    : m_chunk_size(chunk_size), m_huge(huge)
+  {
+    /** \note no memory is mapped until the first allocation. An
+	arena that is never used costs only the object itself.
+    */
+    m_scratch.head = m_scratch.cur = NULL;
+    m_result.head = m_result.cur = NULL;
+
+    //huge pages are only useful if a chunk spans at least one
+    if(m_huge && m_chunk_size < HUGE_PAGE)
+      m_chunk_size = HUGE_PAGE;
+  }
+
+  ///destructor -unmap everything
+  ~ThreadArena()
+  {
+    release(m_scratch);
+    release(m_result);
+  }
+
+  ///allocate temporary memory for the running task
+  void *scratch(size_t n, size_t align = sizeof(void *) * 2)
+  {
+    /** \return pointer to n bytes or NULL if mmap() failed
+	\note reclaimed by resetScratch() when the task returns
+    */
+    return alloc(m_scratch, n, align);
+  }
+
+  ///allocate memory that outlives the task (return values)
+  void *result(size_t n, size_t align = sizeof(void *) * 2)
+  {
+    /** \return pointer to n bytes or NULL if mmap() failed
+	\note reclaimed by resetResults() (see ThreadMgr::releaseResult)
+    */
+    return alloc(m_result, n, align);
+  }
+
+  ///reclaim all scratch memory in one step
+  void resetScratch() { rewind(m_scratch); }
+
+  ///reclaim all result memory in one step
+  void resetResults() { rewind(m_result); }
+
+  ///reclaim everything
+  void reset()
+  {
+    rewind(m_scratch);
+    rewind(m_result);
+  }
+
+  ///answers the question "is any result memory handed out?"
+  bool resultsHeld() const
+  {
+    return m_result.head != NULL
+      && (m_result.cur != m_result.head || m_result.head->used > sizeof(chunk));
+  }
+
+  ///answers the question "does p point into the result region?"
+  bool owns(const void *p) const
+  {
+    const char *c = (const char *)p;
+
+    for(chunk *k = m_result.head; k != NULL; k = k->next)
+      {
+	if(c >= (const char *)k && c < (const char *)k + k->size)
+	  return true;
+
+	//chunks after cur are spare (nothing handed out)
+	if(k == m_result.cur)
+	  break;
+      }
+    return false;
+  }
+
+  ///total bytes mapped by this arena
+  size_t bytesReserved() const
+  {
+    return mapped(m_scratch) + mapped(m_result);
+  }
+
+  ///return the arena of the calling thread (NULL if unmanaged)
+  static ThreadArena *current() { return tls(); }
+
+  ///set the arena of the calling thread (used by ThreadMgr)
+  static void setCurrent(ThreadArena *a) { tls() = a; }
+
+private:
+  ///storage for the thread local handle
+  static ThreadArena *&tls()
+  {
+    static thread_local ThreadArena *arena = NULL;
+    return arena;
+  }
+
+  ///bump allocate from a region (grows the region as needed)
+  void *alloc(region &r, size_t n, size_t align)
+  {
+    for(;;)
+      {
+	if(r.cur != NULL)
+	  {
+	    uintptr_t base = (uintptr_t)r.cur;
+	    uintptr_t p = (base + r.cur->used + align - 1) & ~(uintptr_t)(align - 1);
+
+	    if(p + n <= base + r.cur->size)
+	      {
+		r.cur->used = p + n - base;
+		return (void *)p;
+	      }
+
+	    //reuse a chunk kept from before the last reset
+	    if(r.cur->next != NULL)
+	      {
+		r.cur = r.cur->next;
+		r.cur->used = sizeof(chunk);
+		continue;
+	      }
+	  }
+
+	//need a new chunk big enough for the request
+	chunk *k = map(n + align + sizeof(chunk));
+	if(k == NULL)
+	  return NULL;
+
+	if(r.cur == NULL)
+	  r.head = k;
+	else
+	  r.cur->next = k;
+	r.cur = k;
+      }
+  }
+
+  ///map a new chunk of at least n bytes
+  chunk *map(size_t n)
+  {
+    size_t size = m_chunk_size;
+    size_t page = m_huge ? HUGE_PAGE : 4096;
+
+    if(size < n)
+      size = (n + page - 1) & ~(page - 1);
+
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    //explicit huge pages first (only works if some are reserved)
+    if(m_huge)
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if(p == MAP_FAILED)
+      {
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+	  return NULL;
+
+#ifdef MADV_HUGEPAGE
+	//fall back to asking for transparent huge pages
+	if(m_huge)
+	  madvise(p, size, MADV_HUGEPAGE);
+#endif
+      }
+
+    chunk *k = (chunk *)p;
+    k->next = NULL;
+    k->size = size;
+    k->used = sizeof(chunk);
+    return k;
+  }
+
+  ///rewind a region to its first chunk (chunks are kept for reuse)
+  static void rewind(region &r)
+  {
+    if(r.head != NULL)
+      r.head->used = sizeof(chunk);
+    r.cur = r.head;
+  }
+
+  ///unmap every chunk of a region
+  static void release(region &r)
+  {
+    chunk *k = r.head;
+    while(k != NULL)
+      {
+	chunk *next = k->next;
+	munmap((void *)k, k->size);
+	k = next;
+      }
+    r.head = r.cur = NULL;
+  }
+
+  ///bytes mapped by a region
+  static size_t mapped(const region &r)
+  {
+    size_t total = 0;
+    for(chunk *k = r.head; k != NULL; k = k->next)
+      total += k->size;
+    return total;
+  }
+
+private:
+  ///size of a normal chunk
+  size_t m_chunk_size;
+
+  ///try to back chunks with huge pages
+  bool m_huge;
+
+  ///scratch region
+  region m_scratch;
+
+  ///result region
+  region m_result;
+};
+
+#endif //THREADARENA_H
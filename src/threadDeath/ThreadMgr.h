@@ -0,0 +1,1357 @@
+/** \file ThreadMgr.h
+
+\brief Thread Management Class
+
+\par Purpose:
+Declaration (and inline implementation) of the ThreadMgr class used
+by threadDeath3.cc and the other ThreadMgr examples. See
+threadDeath3.cc for a walk through of the basic usage.
+*/
+
+#ifndef THREADMGR_H
+#define THREADMGR_H
+
+#include <iostream>
+#include <stack>
+#include <map>
+#include <list>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+
+#include "ThreadArena.h"
+#include "ThreadTrace.h"
+#include "ThreadPerf.h"
+#include "ThreadWatchdog.h"
+#include "ThreadOutput.h"
+
+class TaskGroup;
+
+/** 
+    \brief A basic thread management class
+
+    \author Karl N. Redman (karl.redman@gmail.com)
+
+    \par Purpose:
+    This is an example class intended to be used as a guidline for the
+    work required to handle pthreads where the main process (the
+    parent of the initial threads) waits on a condition variable for
+    the threads to terminate. The functions that are specified for the
+    pthread_create are user defined. <br>
+    <br>
+    This class should be pretty fast and relatively easy to use for
+    most general purpose thread programming. In general, it's a good
+    place to start.
+    <br>
+    <br>
+    Basic pthread "voidness" has been retained for demonstration
+    purposes. It is concevable that this class could be instantiated
+    from and / or altered to make the user interface easier to work
+    with (in other words -we could get rid of much of the user end
+    casting through inheritance).
+
+    \note
+    This class is not intended for use by detached threads unless some
+    of the functions are overridden. Also, the use of long casting was
+    used in favor of readability in the interests of speed.
+*/
+class ThreadMgr {
+private:
+  struct func_arguments;
+
+  /**
+     \brief a parked waiter
+
+     Every waiter (condWait(), waitFor(), group waits) sleeps on its
+     own condition variable in a slot on its own stack. A completing
+     thread signals only the slot(s) interested in it instead of
+     broadcasting to everybody.
+  */
+  struct wait_slot
+  {
+    ///the waiter sleeps on this (paired with m_mutex)
+    pthread_cond_t cond;
+
+    ///the completion handed to this waiter (condWait / waitFor)
+    func_arguments *task;
+
+    ///set when there is something to look at (group waits)
+    bool woken;
+
+    ///FIFO / list links
+    wait_slot *prev;
+    wait_slot *next;
+  };
+
+  ///structure for static wrapper function arguments
+  struct func_arguments
+  {
+    ///pointer to user defined function
+    void *(*func)(void *);
+
+    ///function to call when we are canceled
+    void (*cancel_func)(void *);
+
+    ///user arguments for user function
+    void *arg;
+
+    ///the this object -one per thread...EEEEK!
+    ThreadMgr *thisObject;	//! probably redundant. 
+
+    ///scratch / result arena for the thread (see ThreadArena)
+    ThreadArena *arena;
+
+    ///group the thread was submitted into (NULL if none)
+    TaskGroup *group;
+
+    ///thread id (needed to join group members)
+    pthread_t tid;
+
+    ///submit sequence number (per manager, starts at 1)
+    unsigned long seq;
+
+    ///intrusive links for the group's running / done lists
+    func_arguments *group_prev;
+    func_arguments *group_next;
+
+    ///intrusive links for the manager's FIFO of terminated threads
+    func_arguments *done_prev;
+    func_arguments *done_next;
+
+    ///set by addTerminated()
+    bool terminated;
+
+    ///waitFor() waiter parked for this thread (NULL if none)
+    wait_slot *waiter;
+  };
+
+  ///one status counter on its own cache line
+  struct alignas(64) status_counter
+  {
+    std::atomic<long> value;
+  };
+
+  friend class TaskGroup;
+  
+public:
+  ///snapshot of the manager's status counters (see getCounts())
+  struct thread_counts
+  {
+    ///registered threads (running or terminated, not joined yet)
+    long active;
+
+    ///terminated ungrouped threads waiting in the condWait() FIFO
+    long queued;
+
+    ///terminated threads not joined yet (grouped ones included)
+    long terminated;
+
+    ///threads ever created / joined
+    long submitted;
+    long joined;
+  };
+
+  ///constructor
+  ThreadMgr() 
+  { 
+    /** \note each instance has its own data mutex. There is no
+	shared condition variable any more; waiters park on their own
+	wait_slot (see condWait()).
+    */
+
+    //the data mutex
+    pthread_mutex_init(&m_data_mutex, NULL);
+    m_mutex = &m_data_mutex; 
+
+    //nothing terminated, nobody waiting
+    m_done_head = m_done_tail = NULL;
+    m_any_head = m_any_tail = NULL;
+    m_next_seq = 1;
+
+    //status counters (read without the data mutex)
+    m_active.value.store(0, std::memory_order_relaxed);
+    m_queued.value.store(0, std::memory_order_relaxed);
+    m_terminated.value.store(0, std::memory_order_relaxed);
+    m_submitted.value.store(0, std::memory_order_relaxed);
+    m_joined.value.store(0, std::memory_order_relaxed);
+
+    //arena defaults (see setArenaOptions())
+    m_arena_chunk = ThreadArena::DEFAULT_CHUNK;
+    m_arena_huge = false;
+  }
+
+  ///destructor
+  ~ThreadMgr()
+  {
+    /** \note arenas still holding results that were never released
+	are unmapped here too. Pointers into them are invalid after
+	the manager is gone.
+    */
+    pthread_mutex_lock(m_mutex);
+
+    while(!m_free_arenas.empty())
+      {
+	delete m_free_arenas.top();
+	m_free_arenas.pop();
+      }
+
+    for(std::list<ThreadArena *>::iterator it = m_held_arenas.begin();
+	it != m_held_arenas.end(); ++it)
+      delete *it;
+    m_held_arenas.clear();
+
+    pthread_mutex_unlock(m_mutex);
+    pthread_mutex_destroy(m_mutex);
+
+    //ordered output numbers a new manager's tasks from 1 again
+    ThreadOutput::forget(this);
+  }
+
+  ///set the chunk size and huge page use of new arenas
+  void setArenaOptions(size_t chunk_size, bool huge_pages)
+  {
+    /**
+       \param chunk_size bytes mapped at a time by each arena
+       \param huge_pages try MAP_HUGETLB (then MADV_HUGEPAGE)
+
+       \note only affects arenas created after the call. Arenas
+       are recycled between threads so set this before the first
+       createThread().
+    */
+    pthread_mutex_lock(m_mutex);
+    m_arena_chunk = chunk_size;
+    m_arena_huge = huge_pages;
+    pthread_mutex_unlock(m_mutex);
+  }
+
+  ///give a result arena back after condWait() returned a pointer into it
+  int releaseResult(void *result)
+  {
+    /**
+       \par Purpose:
+       Tasks may return memory allocated with
+       ThreadArena::current()->result(). That memory stays valid after
+       the thread is joined and until the waiter calls this function,
+       at which point the whole arena is recycled for another thread.
+
+       \param result a pointer returned through condWait()
+       \return 0 on success, -1 if result is not in any held arena
+       (i.e. it was not allocated from a ThreadArena)
+    */
+    int ret = -1;
+
+    pthread_mutex_lock(m_mutex);
+
+    for(std::list<ThreadArena *>::iterator it = m_held_arenas.begin();
+	it != m_held_arenas.end(); ++it)
+      {
+	if((*it)->owns(result))
+	  {
+	    (*it)->reset();
+	    m_free_arenas.push(*it);
+	    m_held_arenas.erase(it);
+	    ret = 0;
+	    break;
+	  }
+      }
+
+    pthread_mutex_unlock(m_mutex);
+
+    return ret;
+  }
+
+  ///cancel a thread
+  int cancel_thread(pthread_t *tid)
+  {
+    /**
+       \return return value of a pthread_cancel() for parameter tid
+       \param tid pointer to the thread id to kill
+
+       \note the thread is still joined by whoever would have joined
+       it (condWait(), waitFor(), its group), with PTHREAD_CANCELED as
+       the return value if the cancel took effect
+    */
+    /** \warning
+	If the thread has allocated dynamic memory and has been canceled
+	this class does not compensate. In other words, never cancel a
+	thread (with this class) that allocates dynamic memory -you will
+	lose your pointer. This is because pthread_cancel does not allow
+	you to recieve anything back from a canceled thread. However,
+	you could delete your pointer before you retrurn from the thread
+	if that is your wish.
+    */
+
+    /** \warning
+	use of the function pthread_cancel() for threads managed by this
+	class may result in loss of dynamic memory pointers, or worse,
+	a race condition for m_mutex resulting in a deadlock of the
+	threads. Don not use pthread_cancel() for threads managed by
+	this class. Use ThreadMgr::cancel_thread() instead.
+    */
+
+    /** \todo add more robust thread canceling ability */
+
+    //cancel a thread
+    int ret = 0;
+    pthread_mutex_lock(m_mutex);	//lock the data mutex 
+
+    std::map<pthread_t, func_arguments *>::iterator it = m_ids.find(*tid);
+    func_arguments *task = (it != m_ids.end()) ? it->second : NULL;
+
+    //already past addTerminated(): there is nothing left to cancel
+    if(task != NULL && task->terminated)
+      {
+	/* Queued for condWait(): join it now, nobody else would. Handed
+	   to a waitFor() / parked condWait(), or grouped: that waiter
+	   joins it.
+	*/
+	if(task->group == NULL && inDone(task))
+	  {
+	    unlinkDone(task);
+	    removeTerminated(task, NULL);
+	  }
+	pthread_mutex_unlock(m_mutex);
+	return 0;
+      }
+
+    /* The thread stays registered: canceled, it terminates through
+       shutdown_thread() and is joined like any other (by its waitFor(),
+       group or a condWait()).
+    */
+
+    //cancel the thread
+    ret = pthread_cancel(*tid);
+    
+    pthread_mutex_unlock(m_mutex);	// unlock data mutex
+
+    return ret; 
+  }
+
+  ///wait on a condition variable for a thread to terminate
+  int condWait(void **thread_return_val)
+  {
+    /** 
+	\par Purpose: 
+	Act like a seamless condition variable. Allows a process to
+	block until a thread has terminated and returns the thread
+	functions return value through the parameter.
+
+	\param a pointer to the pointer of the threads return value.
+	\return pthread_join status from removeTerminated()
+
+	\note completions are handed out FIFO. If nothing has
+	terminated yet the caller parks on its own wait slot at the
+	end of a FIFO of waiters and the next completion is handed
+	directly to the first waiter in line -only that waiter wakes.
+    */
+
+    /** \note a thread stopped with cancel_thread() is handed out too,
+	its return value PTHREAD_CANCELED
+    */
+
+    int ret = 0;
+    func_arguments *task;
+    
+    //data mutex lock
+    pthread_mutex_lock(m_mutex);
+
+    //take the oldest completion or get in line for the next one
+    if((task = popDone()) == NULL)
+      {
+	wait_slot slot;
+	initSlot(&slot);
+
+	slot.next = NULL;
+	slot.prev = m_any_tail;
+	if(m_any_tail != NULL)
+	  m_any_tail->next = &slot;
+	else
+	  m_any_head = &slot;
+	m_any_tail = &slot;
+
+	//the completing thread unlinks us and fills in slot.task
+	while(slot.task == NULL)
+	  pthread_cond_wait(&slot.cond, m_mutex);
+
+	pthread_cond_destroy(&slot.cond);
+	task = slot.task;
+      }
+
+    //remove the thread from the terminated list (handle join)
+    ret = removeTerminated(task, thread_return_val);
+
+    //unlock
+    pthread_mutex_unlock(m_mutex);
+
+    //return join status
+    return ret;
+  }
+
+  ///wait for one particular thread to terminate
+  int waitFor(pthread_t tid, void **thread_return_val)
+  {
+    /**
+       \par Purpose:
+       Join by handle. Blocks until the thread tid (as returned by
+       createThread()) has terminated and returns its return value
+       through the parameter. Other waiters are not woken by it and
+       condWait() will never hand it out.
+
+       \param tid the thread to wait for
+       \param thread_return_val pointer to the pointer of the threads
+       return value
+
+       \return pthread_join status, ESRCH if tid is not managed (or
+       already joined), EINVAL if tid belongs to a TaskGroup, EBUSY
+       if another waitFor() (or a condWait() that was already handed
+       the completion) is waiting on tid, ECANCELED if the thread was
+       canceled (it is joined all the same)
+    */
+    int ret;
+
+    pthread_mutex_lock(m_mutex);
+
+    std::map<pthread_t, func_arguments *>::iterator it = m_ids.find(tid);
+    if(it == m_ids.end())
+      ret = ESRCH;
+    else if(it->second->group != NULL)
+      ret = EINVAL;
+    else if(it->second->waiter != NULL)
+      ret = EBUSY;
+    else
+      {
+	func_arguments *task = it->second;
+
+	if(task->terminated && !inDone(task))
+	  {
+	    //already handed to a parked condWait()
+	    pthread_mutex_unlock(m_mutex);
+	    return EBUSY;
+	  }
+
+	if(task->terminated)
+	  unlinkDone(task);
+	else
+	  {
+	    wait_slot slot;
+	    initSlot(&slot);
+	    task->waiter = &slot;
+
+	    //addTerminated() hands the thread straight to this slot
+	    while(slot.task == NULL)
+	      pthread_cond_wait(&slot.cond, m_mutex);
+
+	    pthread_cond_destroy(&slot.cond);
+	  }
+
+	void *return_val = NULL;
+	ret = removeTerminated(task, &return_val);
+	if(thread_return_val != NULL)
+	  *thread_return_val = return_val;
+	if(ret == 0 && return_val == PTHREAD_CANCELED)
+	  ret = ECANCELED;
+      }
+
+    pthread_mutex_unlock(m_mutex);
+
+    return ret;
+  }
+
+  ///attempt to create a new thread and register it
+  //int createThread( void *(*thread_func)(void *), void *arg)
+  pthread_t createThread( void *(*thread_func)(void *), void *arg,
+			  TaskGroup *group = NULL)
+  {
+    /** 
+	\par Purpose:
+	Create a new thread and register it for management by this
+	class.
+
+	\return 0 on error, pthread_t thread ID on success
+
+	\param pointer to function to run as thread, pointer to
+	argument. [i.e. createThread(myfunc, arg);]
+
+	\param group optional TaskGroup to submit the thread into. A
+	grouped thread is reaped by waitAny() / waitAll() on its group
+	(or an enclosing group), never by condWait(). Submitting into a
+	canceled group fails.
+
+	\note
+	This function works by building the an argument list from the
+	one provided by the user and some internal stuff in order to
+	call an internal function that sets things up for return
+	values, etc. and then calls the users function. This adds
+	about the size of 8 (roughly) pointers to the memory usage of
+	each thread being created -but that's the price for wanting to
+	keep track of this stuff generically i guess.
+    */
+    
+    pthread_t tid = 0;		// Id of thread
+    int ret_val;		// return value
+ 
+    //arguments for the function
+    struct func_arguments *arguments = new func_arguments;
+
+    arguments->func = thread_func;	// users function
+    arguments->cancel_func = NULL; 	// NOT IMPLIMENTED
+    arguments->arg = arg;		// users argument
+    arguments->arena = acquireArena();	// scratch / result memory
+    arguments->group = group;		// task group (or NULL)
+    arguments->group_prev = NULL;
+    arguments->group_next = NULL;
+    arguments->done_prev = NULL;
+    arguments->done_next = NULL;
+    arguments->terminated = false;
+    arguments->waiter = NULL;
+
+    //this is the this pointer (so far, every thread get's one -eek!)
+    arguments->thisObject = this;
+
+    /* hold the data mutex across pthread_create() so the new thread
+       cannot terminate (addTerminated() locks m_mutex) before it is
+       registered below.
+    */
+    ThreadTrace::lock(m_mutex, 0);
+
+    if(group != NULL && groupCancelled(group))
+      {
+	pthread_mutex_unlock(m_mutex);
+	recycleArena(arguments->arena);
+	delete arguments;
+	return 0;
+      }
+
+    //create a new thread
+    /*
+      default attributes (for now), 
+      internal function, func(), calls users function,
+      arguments contain other info + user's argument.
+    */
+    //the number is set before the thread can read it, and given back
+    //below if there is no thread (ordered ThreadOutput waits for each)
+    arguments->seq = m_next_seq++;
+    long long submit_ts = ThreadTrace::on() ? ThreadTrace::now() : 0;
+
+    ret_val = pthread_create(&tid, (pthread_attr_t *) NULL, func, (void *)arguments);
+
+    if(ret_val == 0)
+      {
+	if(submit_ts != 0)
+	  ThreadTrace::record(ThreadTrace::EV_SUBMIT, arguments->seq,
+			      (unsigned long)thread_func, submit_ts);
+
+	//register the thread and arguments in the ids map
+	arguments->tid = tid;
+	m_ids.insert(std::make_pair(tid, arguments));
+	count(m_active, 1);
+	count(m_submitted, 1);
+
+	//link into the group's running list
+	if(group != NULL)
+	  groupSubmitted(arguments);
+
+	pthread_mutex_unlock(m_mutex);
+    
+	//return thread id
+	return tid;
+      }
+    else
+      {
+	m_next_seq--;
+	pthread_mutex_unlock(m_mutex);
+	std::cout << "pthread_create FAIL" << std::endl;
+	recycleArena(arguments->arena);
+	delete arguments;
+      }
+
+
+    //return 0 on error
+    return 0;
+  }
+  
+  ///wait for any thread of a group (or its nested groups) to terminate
+  int waitAny(TaskGroup *group, void **thread_return_val);
+
+  ///wait for every thread of a group (and its nested groups)
+  int waitAll(TaskGroup *group, void (*reap)(void *) = NULL);
+
+  ///ask every thread of a group (and its nested groups) to stop
+  int cancelGroup(TaskGroup *group);
+
+  ///return the number of active threads
+  int threadsActive()
+  { 
+    /** \note grouped threads are counted too, but condWait() never
+	reaps them. Don't loop on threadsActive() / condWait() while
+	grouped threads are still pending.
+
+	\note lock free: the count is kept in an atomic updated under
+	the data mutex, so polling it does not contend with threads
+	terminating.
+    */
+    return (int)m_active.value.load(std::memory_order_acquire);
+  }
+    
+  ///answers the question "are there no theads terminated?"
+  bool no_threads_terminated()
+  {
+    /** \return boolean of terminated threads in terminate queue
+	\note lock free (see threadsActive())
+     */
+    return m_queued.value.load(std::memory_order_acquire) == 0;
+  }
+
+  ///copy out every status counter without taking the data mutex
+  void getCounts(thread_counts *out) const
+  {
+    /** \note each counter is exact on its own; the set may be torn
+	by a thread terminating between two loads.
+    */
+    out->active = m_active.value.load(std::memory_order_acquire);
+    out->queued = m_queued.value.load(std::memory_order_acquire);
+    out->terminated = m_terminated.value.load(std::memory_order_acquire);
+    out->submitted = m_submitted.value.load(std::memory_order_acquire);
+    out->joined = m_joined.value.load(std::memory_order_acquire);
+  }
+    
+
+
+protected:
+  ///internal thread function
+  static void *func(void *arg)
+  {
+    /** 
+	\par Purpose:
+	This function is called from the call to pthread_create()
+	within member function createThread. This function handles
+	basic thread management issues and is a wrapper around the
+	user function -which is called from here as well.
+
+	\return NONE -this function shouldn't return!!! it calls
+	pthread_exit().
+
+	\param arg shold be a pointer to a func_arguments structure.
+    */
+
+    //convenience this object
+    ThreadMgr *thisObject = ((struct func_arguments *)arg)->thisObject;
+
+    //return argument from user function
+    void *tmpArg = NULL;
+
+    //a cancel (cancel_thread()) terminates the thread through here
+    pthread_cleanup_push(shutdown_thread, arg);
+
+    //make the arena and group reachable from inside the user's function
+    ThreadArena *arena = ((struct func_arguments *)arg)->arena;
+    ThreadArena::setCurrent(arena);
+    setCurrentGroup(((struct func_arguments *)arg)->group);
+
+    //call the user's function (bracketed by trace events if tracing)
+    struct func_arguments *task = (struct func_arguments *)arg;
+    if(ThreadTrace::on())
+      ThreadTrace::record(ThreadTrace::EV_START, task->seq, (unsigned long)task->func);
+
+    //hardware counters around the user's function only (if enabled)
+    ThreadPerf::sample perf;
+    bool perf_on = ThreadPerf::on();
+    if(perf_on)
+      ThreadPerf::begin(&perf);
+
+    //start time / heartbeats for the stall watchdog (if running)
+    if(ThreadWatchdog::on())
+      ThreadWatchdog::begin(task->seq, task->func, thisObject);
+
+    //private output stream for ThreadOutput::out() (if running)
+    if(ThreadOutput::on())
+      ThreadOutput::begin(thisObject, task->seq);
+
+    tmpArg = task->func(task->arg);
+
+    //only the user's function may be canceled
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    ThreadOutput::end();
+    ThreadWatchdog::end();
+
+    if(perf_on)
+      ThreadPerf::end(&perf, task->func);
+
+    if(ThreadTrace::on())
+      ThreadTrace::record(ThreadTrace::EV_END, task->seq);
+
+    //scratch memory is reclaimed in bulk as soon as the task is done
+    if(arena != NULL)
+      arena->resetScratch();
+    ThreadArena::setCurrent(NULL);
+    setCurrentGroup(NULL);
+    //std::cout << "func() passing \"" << *(std::string *)tmpArg << "\" to pthread_exit()" << std::endl;
+
+    //delete (struct func_arguments *)arg;
+
+    //pop the cleanup handler off the cleanup stack (not run: not canceled)
+    pthread_cleanup_pop(0);
+    
+    //add this thread to the terminated list
+    thisObject->addTerminated(thisObject, (struct func_arguments *)arg);
+
+    //exit this thread
+    pthread_exit(tmpArg);
+
+    //we will never get here
+    return NULL;
+  }
+
+  ///hand a terminated thread to its waiter (or queue it FIFO)
+  static void *addTerminated(ThreadMgr *arg, func_arguments *task)
+  { 
+    //pthread_mutex_lock(((ThreadMgr *)arg)->m_mutex);
+    //(records the time spent blocked when tracing)
+    ThreadTrace::lock(arg->m_mutex, task->seq);
+
+    task->terminated = true;
+    arg->count(arg->m_terminated, 1);
+
+    if(task->group != NULL)
+      {
+	//grouped threads go to their group's done list instead and
+	//only the waiters of that group (and its parents) wake up
+	arg->groupTerminated(task);
+      }
+    else if(task->waiter != NULL)
+      {
+	//someone is in waitFor() on exactly this thread
+	task->waiter->task = task;
+	pthread_cond_signal(&task->waiter->cond);
+      }
+    else if(arg->m_any_head != NULL)
+      {
+	//hand the completion to the first condWait() in line
+	wait_slot *slot = arg->m_any_head;
+	arg->m_any_head = slot->next;
+	if(arg->m_any_head != NULL)
+	  arg->m_any_head->prev = NULL;
+	else
+	  arg->m_any_tail = NULL;
+
+	slot->task = task;
+	pthread_cond_signal(&slot->cond);
+      }
+    else
+      {
+	//nobody waiting: queue it for the next condWait() / waitFor()
+	task->done_next = NULL;
+	task->done_prev = arg->m_done_tail;
+	if(arg->m_done_tail != NULL)
+	  arg->m_done_tail->done_next = task;
+	else
+	  arg->m_done_head = task;
+	arg->m_done_tail = task;
+	arg->count(arg->m_queued, 1);
+      }
+
+    pthread_mutex_unlock(arg->m_mutex);
+
+    //return NULL -blah
+    return NULL;
+  }
+
+  ///join a terminated thread handed out by popDone() or a wait slot
+  int removeTerminated(func_arguments *task, void **return_val)
+  {
+    /**
+       \return result of pthread_join
+
+       \param task the terminated thread (m_mutex must be held)
+       \param pointer to user function return value pointer
+
+       \note the void **retrun_val is a result of the pthread_join.
+       Joining under m_mutex is fine: the thread is past
+       addTerminated() and never takes the mutex again.
+    **/
+    int ret = 0;
+
+    /** \warning the thread is unregistered only if the
+	pthread_join was successfull. This may be a problem down
+	the line (but VERY rare)
+    */
+
+    //join with the terminated thread
+    if( (ret = pthread_join(task->tid, return_val)) == 0)
+      {
+	if(ThreadTrace::on())
+	  ThreadTrace::record(ThreadTrace::EV_JOIN, task->seq);
+
+	//delete the arguments and unregister the thread
+	retireThread(task);
+      }
+    else
+      std::cout << "pthread_join() = " << ret << std::endl;
+
+    //return value of pthread_join
+    return ret;
+  }
+
+  ///take the oldest terminated thread off the FIFO (m_mutex held)
+  func_arguments *popDone()
+  {
+    func_arguments *task = m_done_head;
+    if(task != NULL)
+      unlinkDone(task);
+    return task;
+  }
+
+  ///take a terminated thread out of the FIFO (m_mutex held)
+  void unlinkDone(func_arguments *task)
+  {
+    if(task->done_prev != NULL)
+      task->done_prev->done_next = task->done_next;
+    else
+      m_done_head = task->done_next;
+
+    if(task->done_next != NULL)
+      task->done_next->done_prev = task->done_prev;
+    else
+      m_done_tail = task->done_prev;
+
+    task->done_prev = task->done_next = NULL;
+    count(m_queued, -1);
+  }
+
+  ///is a terminated thread still in the FIFO? (m_mutex held)
+  bool inDone(func_arguments *task)
+  {
+    return task->done_prev != NULL || m_done_head == task;
+  }
+
+  ///bump a status counter (m_mutex held: plain load / store is enough)
+  static void count(status_counter &c, long delta)
+  {
+    c.value.store(c.value.load(std::memory_order_relaxed) + delta,
+		  std::memory_order_release);
+  }
+
+  ///get a wait slot ready for parking
+  static void initSlot(wait_slot *slot)
+  {
+    pthread_cond_init(&slot->cond, NULL);
+    slot->task = NULL;
+    slot->woken = false;
+    slot->prev = slot->next = NULL;
+  }
+
+  ///unregister a joined thread and free its arguments (m_mutex held)
+  void retireThread(func_arguments *task)
+  {
+    //every thread stays registered until it is joined
+    if(m_ids.erase(task->tid) != 0)
+      count(m_active, -1);
+
+    //results in the arena live until releaseResult()
+    ThreadArena *arena = task->arena;
+    if(arena != NULL && arena->resultsHeld())
+      m_held_arenas.push_back(arena);
+    else if(arena != NULL)
+      {
+	arena->reset();
+	m_free_arenas.push(arena);
+      }
+
+    //delete the arguments (created in createThread)
+    delete task;
+
+    count(m_terminated, -1);
+    count(m_joined, 1);
+  }
+
+  //group bookkeeping (m_mutex must be held, see TaskGroup)
+  static bool groupCancelled(TaskGroup *group);
+  void groupSubmitted(func_arguments *task);
+  void groupTerminated(func_arguments *task);
+  func_arguments *groupTakeDone(TaskGroup *group);
+  int groupReap(TaskGroup *group, void **return_val);
+  static void setCurrentGroup(TaskGroup *group);
+
+  ///add a thread id to the id vector
+  void addID(pthread_t id, func_arguments *arg)
+  {
+    //lock the data mutex
+    pthread_mutex_lock(m_mutex);
+    
+    //add the thread to the std::map
+    if(m_ids.insert(std::make_pair(id, arg)).second)
+      count(m_active, 1);
+
+    //unlock the data mutex
+    pthread_mutex_unlock(m_mutex);
+  }
+  
+  ///get a recycled arena (or a new one) for a new thread
+  ThreadArena *acquireArena()
+  {
+    ThreadArena *arena = NULL;
+
+    pthread_mutex_lock(m_mutex);
+    if(!m_free_arenas.empty())
+      {
+	arena = m_free_arenas.top();
+	m_free_arenas.pop();
+      }
+    pthread_mutex_unlock(m_mutex);
+
+    //the arena maps nothing until it is first used
+    if(arena == NULL)
+      arena = new ThreadArena(m_arena_chunk, m_arena_huge);
+
+    return arena;
+  }
+
+  ///put an unused arena back on the free stack
+  void recycleArena(ThreadArena *arena)
+  {
+    if(arena == NULL)
+      return;
+
+    arena->reset();
+
+    pthread_mutex_lock(m_mutex);
+    m_free_arenas.push(arena);
+    pthread_mutex_unlock(m_mutex);
+  }
+
+  ///shutdown a canceled thread (run by pthread_cancel() unwinding)
+  static void shutdown_thread(void *arg)
+  {
+    /** \param arg the thread's func_arguments (void * per
+	pthread_cleanup_x())
+
+	\note the thread is terminated like any other, with
+	PTHREAD_CANCELED for its return value: its group's running
+	count drops and whoever would have joined it (group wait,
+	waitFor(), condWait()) still does.
+    */
+    func_arguments *task = (func_arguments *)arg;
+
+    //hand the output over (ordered mode would hold every later task's)
+    //and free the watchdog slot (it would be reported stalled forever)
+    ThreadOutput::end();
+    ThreadWatchdog::end();
+
+    if(ThreadTrace::on())
+      ThreadTrace::record(ThreadTrace::EV_END, task->seq);
+
+    if(task->arena != NULL)
+      task->arena->resetScratch();
+    ThreadArena::setCurrent(NULL);
+    setCurrentGroup(NULL);
+
+    task->thisObject->addTerminated(task->thisObject, task);
+  }
+
+
+private:
+  ///mutex for data access (m_ids, terminated FIFO, wait slots)
+  pthread_mutex_t *m_mutex;
+
+  ///storage for m_mutex (one per instance)
+  pthread_mutex_t m_data_mutex;
+
+  ///map of all thread ids and function attributes
+  std::map<pthread_t, ThreadMgr::func_arguments *> m_ids;
+
+  ///FIFO of terminated, not yet joined (ungrouped) threads
+  func_arguments *m_done_head;
+  func_arguments *m_done_tail;
+
+  ///next submit sequence number
+  unsigned long m_next_seq;
+
+  /* status counters, each on its own cache line so pollers don't
+     share a line with the data mutex or each other. Written only
+     with m_mutex held, read without it.
+  */
+  status_counter m_active;
+  status_counter m_queued;
+  status_counter m_terminated;
+  status_counter m_submitted;
+  status_counter m_joined;
+
+  ///FIFO of condWait() callers parked for the next completion
+  wait_slot *m_any_head;
+  wait_slot *m_any_tail;
+
+  ///chunk size for new arenas
+  size_t m_arena_chunk;
+
+  ///back new arenas with huge pages
+  bool m_arena_huge;
+
+  ///arenas ready to be handed to a new thread (LIFO keeps them warm)
+  std::stack<ThreadArena *> m_free_arenas;
+
+  ///arenas of joined threads whose results were not released yet
+  std::list<ThreadArena *> m_held_arenas;
+};
+
+/**
+   \brief A lightweight group of ThreadMgr threads
+
+   \par Purpose:
+   Lets a caller wait for "these tasks" rather than "any thread of
+   the manager". Threads are submitted into a group through
+   ThreadMgr::createThread(func, arg, &group) and are reaped with
+   ThreadMgr::waitAny() or ThreadMgr::waitAll(). Groups may be nested
+   by passing a parent: waiting on (or canceling) the parent covers
+   every nested group as well.
+   <br>
+   <br>
+   A group is only a couple of counters and intrusive list heads. It
+   owns no OS resources; everything is protected by the manager's
+   data mutex, so thousands may be created and thrown away cheaply.
+
+   \par Example:
+   TaskGroup g(m);<br>
+   m.createThread(myfunc, arg, &g);<br>
+   m.createThread(myfunc, arg, &g);<br>
+   m.waitAll(&g, reapFunc);<br>
+
+   \note
+   Canceling is cooperative. cancelGroup() marks the group; running
+   tasks see it through TaskGroup::cancelRequested() and new
+   submissions into the group fail. A member stopped with
+   ThreadMgr::cancel_thread() is still reaped, its return value
+   PTHREAD_CANCELED.
+
+   \warning
+   The destructor waits for (and joins) anything still pending in the
+   group, discarding the return values. Nested groups must go out of
+   scope before their parent.
+*/
+class TaskGroup {
+  friend class ThreadMgr;
+
+public:
+  ///constructor
+  TaskGroup(ThreadMgr &mgr, TaskGroup *parent = NULL)
+    : m_mgr(&mgr), m_parent(parent), m_first_child(NULL),
+      m_next_sibling(NULL), m_prev_sibling(NULL),
+      m_running(0), m_done(0), m_cancelled(false),
+      m_running_head(NULL), m_done_head(NULL), m_waiters(NULL)
+  {
+    if(m_parent == NULL)
+      return;
+
+    //link into the parent's list of nested groups
+    pthread_mutex_lock(m_mgr->m_mutex);
+    m_next_sibling = m_parent->m_first_child;
+    if(m_next_sibling != NULL)
+      m_next_sibling->m_prev_sibling = this;
+    m_parent->m_first_child = this;
+
+    //a group nested in a canceled group starts out canceled
+    m_cancelled.store(m_parent->m_cancelled.load());
+    pthread_mutex_unlock(m_mgr->m_mutex);
+  }
+
+  ///destructor -joins anything still pending
+  ~TaskGroup()
+  {
+    m_mgr->waitAll(this);
+
+    if(m_parent == NULL)
+      return;
+
+    pthread_mutex_lock(m_mgr->m_mutex);
+    if(m_prev_sibling != NULL)
+      m_prev_sibling->m_next_sibling = m_next_sibling;
+    else
+      m_parent->m_first_child = m_next_sibling;
+    if(m_next_sibling != NULL)
+      m_next_sibling->m_prev_sibling = m_prev_sibling;
+    pthread_mutex_unlock(m_mgr->m_mutex);
+  }
+
+  ///number of threads of this group (and nested groups) not yet reaped
+  int pending()
+  {
+    pthread_mutex_lock(m_mgr->m_mutex);
+    int ret = m_running + m_done;
+    pthread_mutex_unlock(m_mgr->m_mutex);
+    return ret;
+  }
+
+  ///answers the question "was this group canceled?"
+  bool cancelled() const { return m_cancelled.load(std::memory_order_acquire); }
+
+  ///group of the calling thread (NULL if not a grouped thread)
+  static TaskGroup *current() { return tls(); }
+
+  ///called from inside a task: should the task give up early?
+  static bool cancelRequested()
+  {
+    TaskGroup *g = tls();
+    return g != NULL && g->m_cancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  ///storage for the thread local handle
+  static TaskGroup *&tls()
+  {
+    static thread_local TaskGroup *group = NULL;
+    return group;
+  }
+
+  ///manager the group belongs to
+  ThreadMgr *m_mgr;
+
+  ///enclosing group (NULL for a top level group)
+  TaskGroup *m_parent;
+
+  ///intrusive list of nested groups
+  TaskGroup *m_first_child;
+  TaskGroup *m_next_sibling;
+  TaskGroup *m_prev_sibling;
+
+  ///running threads in this group and all nested groups
+  int m_running;
+
+  ///terminated, not yet joined threads in this group and nested groups
+  int m_done;
+
+  ///set by ThreadMgr::cancelGroup(), read by running tasks
+  std::atomic<bool> m_cancelled;
+
+  ///threads of this group still running
+  ThreadMgr::func_arguments *m_running_head;
+
+  ///threads of this group waiting to be joined
+  ThreadMgr::func_arguments *m_done_head;
+
+  ///waitAny() / waitAll() callers parked on this group
+  ThreadMgr::wait_slot *m_waiters;
+};
+
+//################## ThreadMgr / TaskGroup glue
+
+///answers the question "was this group canceled?" (m_mutex held)
+inline bool ThreadMgr::groupCancelled(TaskGroup *group)
+{
+  return group->m_cancelled.load(std::memory_order_relaxed);
+}
+
+///link a new thread into its group (m_mutex held)
+inline void ThreadMgr::groupSubmitted(func_arguments *task)
+{
+  TaskGroup *g = task->group;
+
+  task->group_prev = NULL;
+  task->group_next = g->m_running_head;
+  if(g->m_running_head != NULL)
+    g->m_running_head->group_prev = task;
+  g->m_running_head = task;
+
+  //the enclosing groups count the thread too
+  for(; g != NULL; g = g->m_parent)
+    g->m_running++;
+}
+
+///move a thread from its group's running list to the done list (m_mutex held)
+inline void ThreadMgr::groupTerminated(func_arguments *task)
+{
+  TaskGroup *g = task->group;
+
+  //unlink from running
+  if(task->group_prev != NULL)
+    task->group_prev->group_next = task->group_next;
+  else
+    g->m_running_head = task->group_next;
+  if(task->group_next != NULL)
+    task->group_next->group_prev = task->group_prev;
+
+  //push on done (singly linked is enough, it is only popped)
+  task->group_prev = NULL;
+  task->group_next = g->m_done_head;
+  g->m_done_head = task;
+
+  //wake only the waiters of this group and the groups around it
+  for(; g != NULL; g = g->m_parent)
+    {
+      g->m_running--;
+      g->m_done++;
+
+      for(wait_slot *w = g->m_waiters; w != NULL; w = w->next)
+	{
+	  w->woken = true;
+	  pthread_cond_signal(&w->cond);
+	}
+    }
+}
+
+///pop a terminated thread from a group or its nested groups (m_mutex held)
+inline ThreadMgr::func_arguments *ThreadMgr::groupTakeDone(TaskGroup *group)
+{
+  if(group->m_done == 0)
+    return NULL;
+
+  func_arguments *task = group->m_done_head;
+  if(task != NULL)
+    {
+      group->m_done_head = task->group_next;
+
+      for(TaskGroup *g = group; g != NULL; g = g->m_parent)
+	g->m_done--;
+
+      return task;
+    }
+
+  for(TaskGroup *c = group->m_first_child; c != NULL; c = c->m_next_sibling)
+    if((task = groupTakeDone(c)) != NULL)
+      return task;
+
+  return NULL;
+}
+
+///join one terminated thread of a group (m_mutex held)
+inline int ThreadMgr::groupReap(TaskGroup *group, void **return_val)
+{
+  /**
+     \return 1 if a thread was joined, 0 if threads are still
+     running but none terminated, -1 if nothing is pending
+  */
+  func_arguments *task = groupTakeDone(group);
+  if(task != NULL)
+    {
+      int j;
+      if((j = pthread_join(task->tid, return_val)) != 0)
+	std::cout << "pthread_join() = " << j << std::endl;
+
+      retireThread(task);
+      return 1;
+    }
+
+  return group->m_running == 0 ? -1 : 0;
+}
+
+///set the group of the calling thread (used by func())
+inline void ThreadMgr::setCurrentGroup(TaskGroup *group)
+{
+  TaskGroup::tls() = group;
+}
+
+///wait for any thread of a group (or its nested groups) to terminate
+inline int ThreadMgr::waitAny(TaskGroup *group, void **thread_return_val)
+{
+  /**
+     \par Purpose:
+     Like condWait() but only for threads submitted into group (or
+     a group nested in it).
+
+     \param group the group to wait on
+     \param thread_return_val pointer to the pointer of the threads
+     return value
+
+     \return 0 when a thread was joined, -1 if the group has nothing
+     pending (nothing to wait for)
+  */
+  int ret;
+
+  /* the wait slot is paired with the data mutex so a thread cannot
+     terminate between the check and the wait.
+  */
+  pthread_mutex_lock(m_mutex);
+
+  //reap or park on the group until one of its threads terminates
+  while((ret = groupReap(group, thread_return_val)) == 0)
+    {
+      wait_slot slot;
+      initSlot(&slot);
+
+      slot.next = group->m_waiters;
+      if(slot.next != NULL)
+	slot.next->prev = &slot;
+      group->m_waiters = &slot;
+
+      while(!slot.woken)
+	pthread_cond_wait(&slot.cond, m_mutex);
+
+      //unlink (the completing thread only signals)
+      if(slot.prev != NULL)
+	slot.prev->next = slot.next;
+      else
+	group->m_waiters = slot.next;
+      if(slot.next != NULL)
+	slot.next->prev = slot.prev;
+
+      pthread_cond_destroy(&slot.cond);
+    }
+
+  pthread_mutex_unlock(m_mutex);
+
+  return ret == 1 ? 0 : -1;
+}
+
+///wait for every thread of a group (and its nested groups)
+inline int ThreadMgr::waitAll(TaskGroup *group, void (*reap)(void *))
+{
+  /**
+     \param group the group to wait on
+     \param reap optional function called with each non NULL thread
+     return value (to print it, delete it, releaseResult() it...).
+     Canceled threads (PTHREAD_CANCELED) are joined without it.
+
+     \return the number of threads joined
+  */
+  int count = 0;
+  void *return_val = NULL;
+
+  while(waitAny(group, &return_val) == 0)
+    {
+      count++;
+      if(reap != NULL && return_val != NULL && return_val != PTHREAD_CANCELED)
+	reap(return_val);
+    }
+
+  return count;
+}
+
+///ask every thread of a group (and its nested groups) to stop
+inline int ThreadMgr::cancelGroup(TaskGroup *group)
+{
+  /**
+     \return the number of running threads that were told to stop
+
+     \note nothing is forced. Tasks that never check
+     TaskGroup::cancelRequested() run to completion and are still
+     reaped normally.
+  */
+  pthread_mutex_lock(m_mutex);
+
+  int ret = 0;
+  TaskGroup *g = group;
+
+  //walk the nested groups depth first (no recursion, no allocation)
+  while(g != NULL)
+    {
+      g->m_cancelled.store(true, std::memory_order_release);
+      for(func_arguments *t = g->m_running_head; t != NULL; t = t->group_next)
+	ret++;
+
+      if(g->m_first_child != NULL)
+	g = g->m_first_child;
+      else
+	{
+	  while(g != group && g->m_next_sibling == NULL)
+	    g = g->m_parent;
+	  g = (g == group) ? NULL : g->m_next_sibling;
+	}
+    }
+
+  pthread_mutex_unlock(m_mutex);
+
+  return ret;
+}
+
+#endif //THREADMGR_H
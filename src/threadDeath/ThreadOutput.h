@@ -0,0 +1,553 @@
+/** \file ThreadOutput.h
+
+\brief Per task output buffers with one merged writer
+
+\par Purpose:
+Tasks that all write std::cout take the stream lock on every << and
+their lines still come out mixed up. While ThreadOutput is running
+every ThreadMgr task writes to a private buffer stream
+(ThreadOutput::out()) instead. What it wrote is handed to a single
+writer thread as one piece when the task finishes (or at every
+std::endl / flush with PER_LINE), and the writer puts it out with as
+few write() calls as it can. So a task's output (or line) is never
+split by another task's.
+<br>
+<br>
+In ordered mode the writer holds output back so that it comes out in
+submit order (per ThreadMgr): task 3's output follows task 2's no
+matter which finished first. The task whose turn it is streams
+through as it is published.
+<br>
+<br>
+With ThreadOutput stopped out() is std::cout, so code written against
+out() behaves as before.
+*/
+
+#ifndef THREADOUTPUT_H
+#define THREADOUTPUT_H
+
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unistd.h>
+#include <pthread.h>
+
+/**
+   \brief Private output stream per task, merged by a writer thread
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   ThreadOutput::start();<br>
+   (in a task) ThreadOutput::out() << "got here" << std::endl;<br>
+   ... createThread() / condWait() ...<br>
+   ThreadOutput::stop();<br>
+
+   \note
+   Ordered mode expects each manager's tasks to be numbered from 1
+   (start() before the first createThread()). A task that never
+   finishes holds back the output of the tasks after it until stop().
+   A task stopped with ThreadMgr::cancel_thread() hands its output
+   over as it is canceled. Long lived worker threads (pool workers,
+   pipeline stages, fiber workers) never return to their manager and
+   call exempt() to give up their turn.
+*/
+class ThreadOutput {
+public:
+  ///when a task's buffer is handed to the writer
+  enum flush_mode
+  {
+    ///once, when the task returns
+    PER_TASK = 0,
+
+    ///also at every std::endl / std::flush
+    PER_LINE
+  };
+
+  ///observable state (see getStats())
+  struct output_stats
+  {
+    ///pieces handed to the writer and their bytes
+    unsigned long records;
+    unsigned long bytes;
+
+    ///write() calls and the largest one
+    unsigned long writes;
+    unsigned long max_write;
+
+    ///ordered mode: pieces waiting for an earlier task right now
+    unsigned long held;
+  };
+
+private:
+  ///one piece of output on its way to the writer
+  struct record
+  {
+    const void *owner;
+    unsigned long seq;
+    std::string data;
+
+    ///the task is done (nothing more will come for owner / seq)
+    bool last;
+
+    ///the owner is gone (see forget())
+    bool forget;
+  };
+
+  ///the stream a task writes to
+  class taskBuf : public std::streambuf
+  {
+  public:
+    taskBuf() : m_owner(NULL), m_seq(0) { setp(m_buf, m_buf + sizeof(m_buf)); }
+
+    ///new task on this thread
+    void begin(const void *owner, unsigned long seq)
+    {
+      m_owner = owner;
+      m_seq = seq;
+      m_data.clear();
+      setp(m_buf, m_buf + sizeof(m_buf));
+    }
+
+    ///what follows is not ordered (see ThreadOutput::exempt())
+    void unordered() { m_seq = 0; }
+
+    ///hand over what was written (last: the task is done)
+    void publish(bool last)
+    {
+      gather();
+      if(!m_data.empty() || last)
+	ThreadOutput::submit(m_owner, m_seq, m_data, last);
+      m_data.clear();
+    }
+
+  protected:
+    virtual int_type overflow(int_type c)
+    {
+      gather();
+      if(!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+	  *pptr() = traits_type::to_char_type(c);
+	  pbump(1);
+	}
+      return traits_type::not_eof(c);
+    }
+
+    virtual std::streamsize xsputn(const char *s, std::streamsize n)
+    {
+      if(n <= epptr() - pptr())
+	{
+	  memcpy(pptr(), s, n);
+	  pbump((int)n);
+	  return n;
+	}
+      gather();
+      m_data.append(s, n);
+      return n;
+    }
+
+    ///std::endl / std::flush
+    virtual int sync()
+    {
+      if(ThreadOutput::st().mode == PER_LINE || m_seq == 0)
+	publish(false);
+      return 0;
+    }
+
+  private:
+    ///move the put area into m_data
+    void gather()
+    {
+      m_data.append(pbase(), pptr() - pbase());
+      setp(m_buf, m_buf + sizeof(m_buf));
+    }
+
+  private:
+    const void *m_owner;
+    unsigned long m_seq;
+    std::string m_data;
+    char m_buf[1024];
+  };
+
+  ///a thread's stream (made on first use)
+  struct taskStream
+  {
+    taskBuf buf;
+    std::ostream os;
+    bool active;
+
+    taskStream() : os(&buf), active(false) {}
+  };
+
+public:
+  ///start the writer thread
+  static bool start(int fd = STDOUT_FILENO, flush_mode mode = PER_TASK, bool ordered = false)
+  {
+    /**
+       \param fd where the merged output goes
+       \param mode when tasks hand their output over
+       \param ordered put task output out in submit order
+       \return false if the writer thread could not be started
+    */
+    state &s = st();
+    if(s.running)
+      return true;
+
+    //whatever is still in std::cout's buffer comes first
+    std::cout.flush();
+
+    s.fd = fd;
+    s.mode = mode;
+    s.ordered = ordered;
+    s.stop = false;
+
+    if(pthread_create(&s.writer, NULL, writer, NULL) != 0)
+      return false;
+
+    s.running = true;
+    enabled().store(true, std::memory_order_release);
+    return true;
+  }
+
+  ///write out everything (held output too) and stop the writer
+  static void stop()
+  {
+    state &s = st();
+    if(!s.running)
+      return;
+
+    enabled().store(false, std::memory_order_release);
+
+    pthread_mutex_lock(&s.mutex);
+    s.stop = true;
+    pthread_cond_signal(&s.work);
+    pthread_mutex_unlock(&s.mutex);
+
+    pthread_join(s.writer, NULL);
+    s.running = false;
+  }
+
+  ///answers the question "is the merged output running?"
+  static bool on() { return enabled().load(std::memory_order_relaxed); }
+
+  ///the stream the calling task should write to
+  static std::ostream &out()
+  {
+    /** \return the task's buffer stream, or std::cout outside of a
+	task or with ThreadOutput stopped
+    */
+    taskStream *t = current();
+    return (t != NULL && t->active) ? t->os : std::cout;
+  }
+
+  ///a task starts on this thread (called by ThreadMgr)
+  static void begin(const void *owner, unsigned long seq)
+  {
+    taskStream *&t = current();
+    if(t == NULL)
+      t = &stream();
+    t->buf.begin(owner, seq);
+    t->active = true;
+  }
+
+  ///the task on this thread is done: hand its output over
+  static void end()
+  {
+    taskStream *t = current();
+    if(t == NULL || !t->active)
+      return;
+    t->os.flush();
+    t->buf.publish(true);
+    t->active = false;
+  }
+
+  ///barrier: wait until everything handed over so far is written
+  static void flush()
+  {
+    /** \note output held back for an unfinished earlier task (ordered
+	mode) is not waited for
+    */
+    state &s = st();
+    if(!s.running)
+      return;
+
+    pthread_mutex_lock(&s.mutex);
+    unsigned long target = s.submitted;
+    s.flush_waiters++;
+    pthread_cond_signal(&s.work);
+    while(s.handled < target && s.running)
+      pthread_cond_wait(&s.done, &s.mutex);
+    s.flush_waiters--;
+    pthread_mutex_unlock(&s.mutex);
+  }
+
+  ///the calling thread is a long lived worker: give up its turn
+  static void exempt()
+  {
+    /** \par Purpose:
+	In ordered mode the turn of a thread that never returns to its
+	manager would hold the output of every later task until stop().
+	What it wrote so far is handed over as finished, and what it
+	writes from now on goes out unordered, at every std::endl /
+	std::flush (whatever the flush_mode).
+    */
+    taskStream *t = current();
+    if(t == NULL || !t->active)
+      return;
+    t->os.flush();
+    t->buf.publish(true);
+    t->buf.unordered();
+  }
+
+  ///a manager is going away: forget its task numbering
+  static void forget(const void *owner)
+  {
+    /** \note called by ~ThreadMgr(). Output still held for it is
+	written out, and a new manager at the same address starts
+	from task 1 again.
+    */
+    if(!on())
+      return;
+    std::string none;
+    submit(owner, 0, none, true, true);
+  }
+
+  ///copy out the counters
+  static void getStats(output_stats *out)
+  {
+    state &s = st();
+    out->records = s.records.load(std::memory_order_relaxed);
+    out->bytes = s.bytes.load(std::memory_order_relaxed);
+    out->writes = s.writes.load(std::memory_order_relaxed);
+    out->max_write = s.max_write.load(std::memory_order_relaxed);
+    out->held = s.held.load(std::memory_order_relaxed);
+  }
+
+  ///zero the counters
+  static void reset()
+  {
+    state &s = st();
+    s.records.store(0, std::memory_order_relaxed);
+    s.bytes.store(0, std::memory_order_relaxed);
+    s.writes.store(0, std::memory_order_relaxed);
+    s.max_write.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  ///queue a piece for the writer (one lock per piece, not per <<)
+  static void submit(const void *owner, unsigned long seq, std::string &data, bool last,
+		     bool forget = false)
+  {
+    state &s = st();
+    record r;
+    r.owner = owner;
+    r.seq = seq;
+    r.last = last;
+    r.forget = forget;
+    r.data.swap(data);
+
+    s.records.fetch_add(1, std::memory_order_relaxed);
+    s.bytes.fetch_add(r.data.size(), std::memory_order_relaxed);
+
+    pthread_mutex_lock(&s.mutex);
+    bool idle = s.queue.empty();
+    s.queue.push_back(std::move(r));
+    s.submitted++;
+    if(idle)
+      pthread_cond_signal(&s.work);
+    pthread_mutex_unlock(&s.mutex);
+  }
+
+  ///write() all of buf
+  static void writeAll(const std::string &buf)
+  {
+    state &s = st();
+    size_t off = 0;
+    while(off < buf.size())
+      {
+	ssize_t w = write(s.fd, buf.data() + off, buf.size() - off);
+	if(w < 0)
+	  {
+	    if(errno == EINTR)
+	      continue;
+	    break;
+	  }
+	off += w;
+      }
+
+    s.writes.fetch_add(1, std::memory_order_relaxed);
+    if(buf.size() > s.max_write.load(std::memory_order_relaxed))
+      s.max_write.store(buf.size(), std::memory_order_relaxed);
+  }
+
+  ///ordered mode: per manager, the next task and the ones waiting
+  struct pending
+  {
+    std::string data;
+    bool last;
+
+    pending() : last(false) {}
+  };
+
+  struct sequence
+  {
+    unsigned long next;
+    std::map<unsigned long, pending> waiting;
+
+    sequence() : next(1) {}
+  };
+
+  ///ordered mode: add r, move whatever may go now into batch
+  static void order(std::map<const void *, sequence> &owners, record &r, std::string &batch)
+  {
+    if(r.forget)
+      {
+	//whatever is still held goes out in order, gaps or not
+	std::map<const void *, sequence>::iterator o = owners.find(r.owner);
+	if(o == owners.end())
+	  return;
+	for(std::map<unsigned long, pending>::iterator p = o->second.waiting.begin();
+	    p != o->second.waiting.end(); p++)
+	  batch += p->second.data;
+	owners.erase(o);
+	return;
+      }
+
+    sequence &q = owners[r.owner];
+    if(r.seq < q.next)
+      {
+	//an earlier turn (a task from before start()): let it through
+	batch += r.data;
+	return;
+      }
+
+    pending &p = q.waiting[r.seq];
+    p.data += r.data;
+    p.last = p.last || r.last;
+
+    //the task whose turn it is streams, finished ones let the next go
+    std::map<unsigned long, pending>::iterator it;
+    while((it = q.waiting.find(q.next)) != q.waiting.end())
+      {
+	batch += it->second.data;
+	it->second.data.clear();
+	if(!it->second.last)
+	  break;
+	q.waiting.erase(it);
+	q.next++;
+      }
+  }
+
+  ///the writer thread
+  static void *writer(void *arg)
+  {
+    state &s = st();
+    std::vector<record> work;
+    std::map<const void *, sequence> owners;
+    std::string batch;
+
+    pthread_mutex_lock(&s.mutex);
+    for(;;)
+      {
+	while(s.queue.empty() && !s.stop)
+	  pthread_cond_wait(&s.work, &s.mutex);
+	if(s.queue.empty() && s.stop)
+	  break;
+
+	work.swap(s.queue);
+	pthread_mutex_unlock(&s.mutex);
+
+	//one write() for everything that arrived meanwhile
+	batch.clear();
+	for(size_t i = 0; i < work.size(); i++)
+	  {
+	    if(s.ordered)
+	      order(owners, work[i], batch);
+	    else
+	      batch += work[i].data;
+	  }
+	if(!batch.empty())
+	  writeAll(batch);
+
+	if(s.ordered)
+	  {
+	    unsigned long held = 0;
+	    for(std::map<const void *, sequence>::iterator o = owners.begin(); o != owners.end(); o++)
+	      held += o->second.waiting.size();
+	    s.held.store(held, std::memory_order_relaxed);
+	  }
+
+	pthread_mutex_lock(&s.mutex);
+	s.handled += work.size();
+	work.clear();
+	if(s.flush_waiters > 0)
+	  pthread_cond_broadcast(&s.done);
+      }
+    pthread_mutex_unlock(&s.mutex);
+
+    //stopping: what is still held goes out in order, gaps or not
+    batch.clear();
+    for(std::map<const void *, sequence>::iterator o = owners.begin(); o != owners.end(); o++)
+      for(std::map<unsigned long, pending>::iterator p = o->second.waiting.begin();
+	  p != o->second.waiting.end(); p++)
+	batch += p->second.data;
+    if(!batch.empty())
+      writeAll(batch);
+    s.held.store(0, std::memory_order_relaxed);
+
+    pthread_mutex_lock(&s.mutex);
+    pthread_cond_broadcast(&s.done);
+    pthread_mutex_unlock(&s.mutex);
+    return NULL;
+  }
+
+  ///writer state and counters
+  struct state
+  {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t writer;
+    bool running;
+    bool stop;
+
+    int fd;
+    flush_mode mode;
+    bool ordered;
+
+    ///pieces waiting for the writer
+    std::vector<record> queue;
+
+    ///flush() bookkeeping
+    unsigned long submitted;
+    unsigned long handled;
+    int flush_waiters;
+
+    std::atomic<unsigned long> records;
+    std::atomic<unsigned long> bytes;
+    std::atomic<unsigned long> writes;
+    std::atomic<unsigned long> max_write;
+    std::atomic<unsigned long> held;
+
+    state() : running(false), stop(false), fd(STDOUT_FILENO), mode(PER_TASK),
+	      ordered(false), submitted(0), handled(0), flush_waiters(0),
+	      records(0), bytes(0), writes(0), max_write(0), held(0)
+    {
+      pthread_mutex_init(&mutex, NULL);
+      pthread_cond_init(&work, NULL);
+      pthread_cond_init(&done, NULL);
+    }
+  };
+
+  //function local statics keep this a header only class
+  static std::atomic<bool> &enabled() { static std::atomic<bool> e(false); return e; }
+  static state &st() { static state s; return s; }
+  static taskStream &stream() { static thread_local taskStream t; return t; }
+  static taskStream *&current() { static thread_local taskStream *t = NULL; return t; }
+};
+
+#endif //THREADOUTPUT_H
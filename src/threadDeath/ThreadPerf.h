@@ -0,0 +1,412 @@
+/** \file ThreadPerf.h
+
+\brief Optional hardware performance counters per ThreadMgr task
+
+\par Purpose:
+Timings say how long a task ran, not why. When ThreadPerf is enabled
+the ThreadMgr thread wrapper reads a group of perf_event counters
+(cycles, instructions, last level cache misses, branch misses and
+context switches) just before and just after the user function and
+adds the difference to a table keyed by the task's function pointer.
+ThreadPerf::report() prints the table with instructions per cycle
+and misses per thousand instructions so cache or branch heavy tasks
+stand out.
+<br>
+<br>
+Counters are opened once per OS thread (at its first task) and read
+with a single read() of the whole group. Counters the kernel or
+the hardware does not offer (virtual machines often have no PMU,
+perf_event_paranoid may forbid them) are left out and reported as
+n/a; if none can be opened enable() returns false and the hooks stay
+off.
+*/
+
+#ifndef THREADPERF_H
+#define THREADPERF_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ostream>
+#include <string>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "ThreadTrace.h"
+
+/**
+   \brief Per task perf_event counters aggregated by task function
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   if(!ThreadPerf::enable())<br>
+   &nbsp;&nbsp;std::cout << ThreadPerf::lastError() << std::endl;<br>
+   ... createThread() / condWait() ...<br>
+   ThreadPerf::report(std::cout);<br>
+
+   \note
+   Function names come from ThreadTrace::nameFunction().
+*/
+class ThreadPerf {
+public:
+  ///the counters
+  enum counter_id
+  {
+    PC_CYCLES = 0,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_BRANCH_MISSES,
+    PC_CONTEXT_SWITCHES,
+    PC_COUNT
+  };
+
+  ///counter values at the start of a task (see begin() / end())
+  struct sample
+  {
+    ///counters this thread has open (bit per counter_id)
+    unsigned int mask;
+
+    ///raw group values
+    unsigned long long value[PC_COUNT];
+
+    ///time the group was enabled / actually counting (multiplexing)
+    unsigned long long enabled;
+    unsigned long long running;
+  };
+
+private:
+  ///open counters of one OS thread (closed when the thread exits)
+  struct thread_group
+  {
+    ///group leader (-1 if nothing could be opened)
+    int leader;
+
+    ///every fd, -1 for counters that are not open
+    int fd[PC_COUNT];
+
+    ///position of each counter in the group read, -1 if not open
+    int slot[PC_COUNT];
+
+    ///number of counters in the group
+    int nr;
+
+    ///counters this thread has open
+    unsigned int mask;
+
+    ///set after the first open attempt
+    bool tried;
+
+    thread_group() : leader(-1), nr(0), mask(0), tried(false)
+    {
+      for(int i = 0; i < PC_COUNT; i++)
+	fd[i] = slot[i] = -1;
+    }
+
+    ~thread_group()
+    {
+      for(int i = 0; i < PC_COUNT; i++)
+	if(fd[i] >= 0)
+	  close(fd[i]);
+    }
+  };
+
+  ///summed counters of one task function
+  struct func_totals
+  {
+    void *(*func)(void *);
+    unsigned long tasks;
+    unsigned long long value[PC_COUNT];
+
+    ///tasks that had each counter (counters may differ per thread)
+    unsigned long counted[PC_COUNT];
+  };
+
+  ///size of the function table (one extra row collects the rest)
+  static const int MAX_FUNCS = 64;
+
+public:
+  ///probe the counters and turn the hooks on
+  static bool enable()
+  {
+    /**
+       \return true if at least one counter can be opened. Otherwise
+       the hooks stay off and lastError() says why.
+    */
+    thread_group probe;
+    error()[0] = '\0';
+    openGroup(probe, true);
+
+    available().store(probe.mask, std::memory_order_relaxed);
+    if(probe.mask == 0)
+      return false;
+
+    enabled().store(true, std::memory_order_release);
+    return true;
+  }
+
+  ///turn the hooks off (totals are kept)
+  static void disable() { enabled().store(false, std::memory_order_release); }
+
+  ///answers the question "are the counters on?"
+  static bool on() { return enabled().load(std::memory_order_relaxed); }
+
+  ///counters that could be opened by enable() (bit per counter_id)
+  static unsigned int availableMask() { return available().load(std::memory_order_relaxed); }
+
+  ///why the first counter that failed could not be opened
+  static const char *lastError() { return error(); }
+
+  ///read the counters before a task (callers check on() first)
+  static void begin(sample *s)
+  {
+    thread_group &g = group();
+    if(!g.tried)
+      openGroup(g, false);
+
+    s->mask = g.mask;
+    if(g.mask != 0 && !readGroup(g, s))
+      s->mask = 0;
+  }
+
+  ///read the counters after a task and add the difference to func's totals
+  static void end(sample *s, void *(*func)(void *))
+  {
+    if(s->mask == 0)
+      return;
+
+    thread_group &g = group();
+    sample e;
+    if(!readGroup(g, &e))
+      return;
+
+    unsigned long long delta[PC_COUNT];
+    unsigned long long en = e.enabled - s->enabled;
+    unsigned long long run = e.running - s->running;
+
+    for(int i = 0; i < PC_COUNT; i++)
+      {
+	delta[i] = 0;
+	if(!(s->mask & (1u << i)))
+	  continue;
+
+	delta[i] = e.value[i] - s->value[i];
+
+	//scale up when the kernel multiplexed the group
+	if(run != 0 && run < en)
+	  delta[i] = (unsigned long long)((double)delta[i] * en / run);
+      }
+
+    add(func, s->mask, delta);
+  }
+
+  ///throw away the totals
+  static void reset()
+  {
+    pthread_mutex_lock(&tableMutex());
+    table().count = 0;
+    memset(table().rows, 0, sizeof(table().rows));
+    pthread_mutex_unlock(&tableMutex());
+  }
+
+  ///print the totals per task function
+  static void report(std::ostream &os)
+  {
+    pthread_mutex_lock(&tableMutex());
+
+    os << "function|tasks|cycles/task|IPC|LLC miss/kinstr"
+       << "|branch miss/kinstr|ctx switches/task" << std::endl;
+
+    for(int r = 0; r <= MAX_FUNCS; r++)
+      {
+	func_totals &t = table().rows[r];
+	if(t.tasks == 0)
+	  continue;
+
+	std::string name = (r == MAX_FUNCS) ? "(other)"
+	  : ThreadTrace::functionName((unsigned long)t.func);
+	char buf[256];
+
+	os << name << "|" << t.tasks;
+
+	os << "|" << perTask(buf, sizeof(buf), t, PC_CYCLES);
+	os << "|" << ratio(buf, sizeof(buf), t, PC_INSTRUCTIONS, PC_CYCLES, 1.0);
+	os << "|" << ratio(buf, sizeof(buf), t, PC_LLC_MISSES, PC_INSTRUCTIONS, 1000.0);
+	os << "|" << ratio(buf, sizeof(buf), t, PC_BRANCH_MISSES, PC_INSTRUCTIONS, 1000.0);
+	os << "|" << perTask(buf, sizeof(buf), t, PC_CONTEXT_SWITCHES);
+	os << std::endl;
+      }
+
+    pthread_mutex_unlock(&tableMutex());
+  }
+
+private:
+  ///open every counter this thread can have as one group
+  static void openGroup(thread_group &g, bool probing)
+  {
+    g.tried = true;
+
+    for(int i = 0; i < PC_COUNT; i++)
+      {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+	  | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	switch(i)
+	  {
+	  case PC_CYCLES:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	    break;
+	  case PC_INSTRUCTIONS:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	    break;
+	  case PC_LLC_MISSES:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	    break;
+	  case PC_BRANCH_MISSES:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+	    break;
+	  case PC_CONTEXT_SWITCHES:
+	    attr.type = PERF_TYPE_SOFTWARE;
+	    attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+	    break;
+	  }
+
+	//user space only is what perf_event_paranoid = 2 allows for hardware
+	if(attr.type == PERF_TYPE_HARDWARE)
+	  {
+	    attr.exclude_kernel = 1;
+	    attr.exclude_hv = 1;
+	  }
+
+	//this thread, any cpu, in the leader's group
+	int fd = syscall(__NR_perf_event_open, &attr, 0, -1, g.leader, 0);
+	if(fd < 0)
+	  {
+	    if(probing)
+	      noteError(i, errno);
+	    continue;
+	  }
+
+	if(g.leader < 0)
+	  g.leader = fd;
+
+	g.fd[i] = fd;
+	g.slot[i] = g.nr++;
+	g.mask |= 1u << i;
+      }
+
+    if(g.leader >= 0)
+      {
+	ioctl(g.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(g.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      }
+  }
+
+  ///one read() of the whole group
+  static bool readGroup(thread_group &g, sample *s)
+  {
+    //nr, time enabled, time running, one value per counter
+    unsigned long long buf[3 + PC_COUNT];
+
+    if(read(g.leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(unsigned long long)))
+      return false;
+
+    s->mask = g.mask;
+    s->enabled = buf[1];
+    s->running = buf[2];
+    for(int i = 0; i < PC_COUNT; i++)
+      s->value[i] = (g.slot[i] >= 0) ? buf[3 + g.slot[i]] : 0;
+
+    return true;
+  }
+
+  ///add a task's counters to its function's row
+  static void add(void *(*func)(void *), unsigned int mask, unsigned long long *delta)
+  {
+    pthread_mutex_lock(&tableMutex());
+
+    func_table &tb = table();
+    int r;
+    for(r = 0; r < tb.count; r++)
+      if(tb.rows[r].func == func)
+	break;
+
+    if(r == tb.count)
+      {
+	if(tb.count < MAX_FUNCS)
+	  tb.rows[tb.count++].func = func;
+	else
+	  r = MAX_FUNCS;	//table full: the "(other)" row
+      }
+
+    func_totals &t = tb.rows[r];
+    t.tasks++;
+    for(int i = 0; i < PC_COUNT; i++)
+      if(mask & (1u << i))
+	{
+	  t.value[i] += delta[i];
+	  t.counted[i]++;
+	}
+
+    pthread_mutex_unlock(&tableMutex());
+  }
+
+  ///remember the first failure for lastError()
+  static void noteError(int counter, int err)
+  {
+    static const char *names[PC_COUNT] =
+      {"cycles", "instructions", "LLC misses", "branch misses", "context switches"};
+
+    if(error()[0] != '\0')
+      return;
+
+    snprintf(error(), 128, "%s: %s%s", names[counter], strerror(err),
+	     (err == EACCES || err == EPERM) ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+  }
+
+  ///average of a counter per task that had it
+  static const char *perTask(char *buf, size_t n, const func_totals &t, int c)
+  {
+    if(t.counted[c] == 0)
+      return "n/a";
+    snprintf(buf, n, "%.1f", (double)t.value[c] / t.counted[c]);
+    return buf;
+  }
+
+  ///num / den * scale, or n/a when either counter is missing
+  static const char *ratio(char *buf, size_t n, const func_totals &t, int num, int den, double scale)
+  {
+    if(t.counted[num] == 0 || t.counted[den] == 0 || t.value[den] == 0)
+      return "n/a";
+    snprintf(buf, n, "%.3f", scale * t.value[num] / t.value[den]);
+    return buf;
+  }
+
+  ///the rows plus the "(other)" row
+  struct func_table
+  {
+    func_totals rows[MAX_FUNCS + 1];
+    int count;
+  };
+
+  //function local statics keep this a header only class
+  static std::atomic<bool> &enabled() { static std::atomic<bool> e(false); return e; }
+  static std::atomic<unsigned int> &available() { static std::atomic<unsigned int> a(0); return a; }
+  static char *error() { static char e[128] = ""; return e; }
+  static func_table &table() { static func_table t; return t; }
+  static pthread_mutex_t &tableMutex() { static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER; return m; }
+  static thread_group &group() { static thread_local thread_group g; return g; }
+};
+
+#endif //THREADPERF_H
@@ -0,0 +1,601 @@
+/** \file ThreadPool.h
+
+\brief Elastic worker pool on top of ThreadMgr
+
+\par Purpose:
+ThreadMgr runs one OS thread per task. ThreadPool instead keeps a
+set of worker threads (created and reaped through a ThreadMgr) that
+pull tasks from a queue. The number of workers floats between a
+minimum and a maximum:
+<ul>
+<li>grow - when the oldest queued task has waited longer than the
+latency target and the process still has CPU to spare</li>
+<li>shrink - when a worker has been idle for the linger time</li>
+<li>hand off - with stall_handoff set and ThreadWatchdog running,
+one extra worker (past max_workers) per stalled task so stuck tasks
+don't starve the queue</li>
+</ul>
+Every resize decision and the inputs it was made from are kept in a
+ThreadPool::pool_stats structure (see getStats()) so the targets can
+be tuned.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ThreadMgr.h"
+
+/**
+   \brief Elastic pool of ThreadMgr worker threads
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   ThreadPool::pool_config cfg;<br>
+   cfg.min_workers = 2; cfg.max_workers = 32;<br>
+   ThreadPool pool(cfg);<br>
+   pool.submit(myfunc, arg);<br>
+   pool.condWait(&ret);<br>
+
+   \note
+   Setting min_workers == max_workers gives a plain fixed size pool.
+*/
+class ThreadPool {
+public:
+  ///tuning knobs (see defaults in the constructor)
+  struct pool_config
+  {
+    ///never run fewer workers than this
+    int min_workers;
+
+    ///never run more workers than this
+    int max_workers;
+
+    ///grow when the oldest queued task has waited longer (usec)
+    long target_latency_us;
+
+    ///an idle worker exits after this long (msec)
+    long linger_ms;
+
+    ///how often the controller looks at the queue (msec)
+    long sample_ms;
+
+    ///don't grow while process CPU use is above this (0.0 - 1.0)
+    double cpu_ceiling;
+
+    ///replace workers stuck in stalled tasks (needs ThreadWatchdog)
+    bool stall_handoff;
+
+    ///fill in the defaults
+    pool_config()
+      : min_workers(1), max_workers(sysconf(_SC_NPROCESSORS_ONLN) * 4),
+	target_latency_us(2000), linger_ms(1000), sample_ms(10),
+	cpu_ceiling(0.95), stall_handoff(false)
+    {}
+  };
+
+  ///why the last resize happened
+  enum resize_reason
+  {
+    RESIZE_NONE = 0,	///< nothing changed yet
+    RESIZE_MIN,		///< grew to reach min_workers
+    RESIZE_LATENCY,	///< grew because queue latency > target
+    RESIZE_LINGER,	///< shrank because a worker was idle too long
+    RESIZE_CPU_BOUND,	///< wanted to grow but CPU was saturated
+    RESIZE_STALL	///< grew past a worker stuck in a stalled task
+  };
+
+  ///observable state of the pool (see getStats())
+  struct pool_stats
+  {
+    ///worker threads alive
+    int workers;
+
+    ///workers waiting for work
+    int idle;
+
+    ///tasks waiting in the queue
+    int queued;
+
+    ///tasks ever submitted / completed
+    unsigned long submitted;
+    unsigned long completed;
+
+    ///resize counters
+    unsigned long grows;
+    unsigned long shrinks;
+
+    ///grows refused because of cpu_ceiling
+    unsigned long cpu_refusals;
+
+    ///workers added to stand in for stalled tasks
+    unsigned long stall_grows;
+
+    ///tasks flagged by ThreadWatchdog at the latest evaluation
+    int last_stalled;
+
+    ///last decision and the inputs of the latest evaluation
+    resize_reason last_reason;
+    int last_queued;
+    long last_latency_us;
+    double last_cpu;
+
+    ///average time a task spent queued (usec)
+    long avg_latency_us;
+
+    ///worst time a task spent queued (usec)
+    long max_latency_us;
+  };
+
+private:
+  ///one queued task
+  struct pool_task
+  {
+    void *(*func)(void *);
+    void *arg;
+    void *ret;
+    unsigned long id;
+
+    ///when submit() queued it (nsec, CLOCK_MONOTONIC)
+    long long queued_ns;
+  };
+
+public:
+  ///constructor -starts min_workers workers and the controller
+  ThreadPool(const pool_config &cfg = pool_config())
+    : m_cfg(cfg), m_shutdown(false), m_next_id(1), m_reaped(0),
+      m_exited(0), m_latency_total_us(0), m_cpu_wall_ns(0), m_cpu_used_ns(0)
+  {
+    if(m_cfg.min_workers < 1)
+      m_cfg.min_workers = 1;
+    if(m_cfg.max_workers < m_cfg.min_workers)
+      m_cfg.max_workers = m_cfg.min_workers;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_work_cond, NULL);
+    pthread_cond_init(&m_done_cond, NULL);
+    pthread_cond_init(&m_ctl_cond, NULL);
+
+    m_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if(m_ncpu < 1)
+      m_ncpu = 1;
+    cpuSample();
+
+    pthread_mutex_lock(&m_mutex);
+    while(m_stats.workers < m_cfg.min_workers)
+      grow(RESIZE_MIN);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_create(&m_controller, NULL, controller, (void *)this);
+  }
+
+  ///destructor -runs the queue dry, then stops every worker
+  ~ThreadPool()
+  {
+    pthread_mutex_lock(&m_mutex);
+    m_shutdown = true;
+    pthread_cond_broadcast(&m_work_cond);
+    pthread_cond_broadcast(&m_ctl_cond);
+    pthread_cond_broadcast(&m_done_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_controller, NULL);
+
+    //reap the workers (they exit once the queue is empty)
+    void *ret;
+    while(m_mgr.threadsActive())
+      m_mgr.condWait(&ret);
+
+    //results nobody waited for
+    while(!m_done.empty())
+      {
+	delete m_done.front();
+	m_done.pop_front();
+      }
+
+    pthread_cond_destroy(&m_ctl_cond);
+    pthread_cond_destroy(&m_done_cond);
+    pthread_cond_destroy(&m_work_cond);
+    pthread_mutex_destroy(&m_mutex);
+  }
+
+  ///queue a task
+  unsigned long submit(void *(*func)(void *), void *arg)
+  {
+    /**
+       \return task id (the same id is returned by condWait()), 0
+       if the pool is shutting down
+    */
+    pool_task *t = new pool_task;
+    t->func = func;
+    t->arg = arg;
+    t->ret = NULL;
+    t->queued_ns = now();
+
+    pthread_mutex_lock(&m_mutex);
+
+    if(m_shutdown)
+      {
+	pthread_mutex_unlock(&m_mutex);
+	delete t;
+	return 0;
+      }
+
+    t->id = m_next_id++;
+    m_queue.push_back(t);
+    m_stats.submitted++;
+
+    //wake one idle worker; the controller deals with growing
+    if(m_stats.idle > 0)
+      pthread_cond_signal(&m_work_cond);
+
+    unsigned long id = t->id;
+    pthread_mutex_unlock(&m_mutex);
+
+    return id;
+  }
+
+  ///wait for any task to complete (FIFO)
+  unsigned long condWait(void **task_return_val)
+  {
+    /**
+       \param task_return_val receives the task function's return value
+       \return id of the completed task, 0 if nothing is pending
+    */
+    pthread_mutex_lock(&m_mutex);
+
+    while(m_done.empty() && m_stats.submitted > m_reaped)
+      pthread_cond_wait(&m_done_cond, &m_mutex);
+
+    unsigned long id = takeDone(task_return_val);
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return id;
+  }
+
+  ///wait for the next completion, even if nothing is pending yet
+  unsigned long waitNext(void **task_return_val)
+  {
+    /**
+       \par Purpose:
+       condWait() returns at once when nothing is pending, so a thread
+       that reaps while another one submits would spin on it. This
+       sleeps until a task completes (submitted before or after the
+       call).
+
+       \return id of the completed task, 0 once the pool is shutting
+       down and no completion is left
+    */
+    pthread_mutex_lock(&m_mutex);
+
+    while(m_done.empty() && !m_shutdown)
+      pthread_cond_wait(&m_done_cond, &m_mutex);
+
+    unsigned long id = takeDone(task_return_val);
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return id;
+  }
+
+  ///number of tasks queued, running or completed but not yet waited for
+  int pending()
+  {
+    pthread_mutex_lock(&m_mutex);
+    int ret = (int)(m_stats.submitted - m_reaped);
+    pthread_mutex_unlock(&m_mutex);
+    return ret;
+  }
+
+  ///copy out the current statistics
+  void getStats(pool_stats *out)
+  {
+    pthread_mutex_lock(&m_mutex);
+    *out = m_stats;
+    out->queued = m_queue.size();
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  ///print the statistics (for examples and tuning)
+  static void printStats(std::ostream &os, const pool_stats &s)
+  {
+    static const char *reasons[] = {"none", "min", "latency", "linger", "cpu-bound", "stall"};
+
+    os << "workers=" << s.workers
+       << "|idle=" << s.idle
+       << "|queued=" << s.queued
+       << "|done=" << s.completed << "/" << s.submitted
+       << "|grows=" << s.grows
+       << "|shrinks=" << s.shrinks
+       << "|cpu_refusals=" << s.cpu_refusals
+       << "|stall_grows=" << s.stall_grows
+       << "|last=" << reasons[s.last_reason]
+       << "(q=" << s.last_queued
+       << ",lat=" << s.last_latency_us << "us"
+       << ",cpu=" << (int)(s.last_cpu * 100) << "%)"
+       << "|avg_lat=" << s.avg_latency_us << "us"
+       << "|max_lat=" << s.max_latency_us << "us"
+       << std::endl;
+  }
+
+private:
+  ///monotonic clock in nanoseconds
+  static long long now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  ///process CPU use since the last sample (0.0 - 1.0 of all CPUs)
+  double cpuSample()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    long long used = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    long long wall = now();
+
+    double util = 0.0;
+    if(m_cpu_wall_ns != 0 && wall > m_cpu_wall_ns)
+      util = (double)(used - m_cpu_used_ns) / ((double)(wall - m_cpu_wall_ns) * m_ncpu);
+
+    m_cpu_used_ns = used;
+    m_cpu_wall_ns = wall;
+
+    return util;
+  }
+
+  ///pop the oldest completion, 0 if there is none (m_mutex held)
+  unsigned long takeDone(void **task_return_val)
+  {
+    if(m_done.empty())
+      return 0;
+
+    pool_task *t = m_done.front();
+    m_done.pop_front();
+    m_reaped++;
+
+    unsigned long id = t->id;
+    if(task_return_val != NULL)
+      *task_return_val = t->ret;
+    delete t;
+    return id;
+  }
+
+  ///start one more worker (m_mutex held)
+  void grow(resize_reason why)
+  {
+    if(m_mgr.createThread(worker, (void *)this) == 0)
+      return;
+
+    m_stats.workers++;
+    m_stats.grows++;
+    m_stats.last_reason = why;
+  }
+
+  ///decide whether to grow (m_mutex held, called by the controller)
+  void evaluate()
+  {
+    double cpu = cpuSample();
+    long latency_us = 0;
+
+    if(!m_queue.empty())
+      latency_us = (now() - m_queue.front()->queued_ns) / 1000;
+
+    //keep the inputs around for getStats()
+    m_stats.last_queued = m_queue.size();
+    m_stats.last_latency_us = latency_us;
+    m_stats.last_cpu = cpu;
+
+    if(m_stats.workers < m_cfg.min_workers)
+      {
+	grow(RESIZE_MIN);
+	return;
+      }
+
+    /* a worker stuck in a stalled task is not a worker: stand in for
+       it, even past max_workers and whatever the CPU use (a spinning
+       task would always trip cpu_ceiling)
+    */
+    int stalled = 0;
+    if(m_cfg.stall_handoff && ThreadWatchdog::on())
+      stalled = ThreadWatchdog::stalledNow(this);
+    m_stats.last_stalled = stalled;
+
+    if(stalled > 0 && !m_queue.empty() && m_stats.idle == 0
+       && m_stats.workers < m_cfg.max_workers + stalled)
+      {
+	grow(RESIZE_STALL);
+	m_stats.stall_grows++;
+	return;
+      }
+
+    if(m_queue.empty() || m_stats.idle > 0 || latency_us <= m_cfg.target_latency_us
+       || m_stats.workers >= m_cfg.max_workers)
+      return;
+
+    //more threads don't help a CPU bound process
+    if(cpu >= m_cfg.cpu_ceiling)
+      {
+	m_stats.cpu_refusals++;
+	m_stats.last_reason = RESIZE_CPU_BOUND;
+	return;
+      }
+
+    //grow by up to one worker per queued task waiting past the target
+    int want = m_queue.size();
+    while(want-- > 0 && m_stats.workers < m_cfg.max_workers)
+      grow(RESIZE_LATENCY);
+  }
+
+  ///controller thread: periodic resize decisions and reaping
+  static void *controller(void *arg)
+  {
+    ThreadPool *pool = (ThreadPool *)arg;
+
+    pthread_mutex_lock(&pool->m_mutex);
+    while(!pool->m_shutdown)
+      {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += pool->m_cfg.sample_ms * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+
+	pthread_cond_timedwait(&pool->m_ctl_cond, &pool->m_mutex, &ts);
+	if(pool->m_shutdown)
+	  break;
+
+	pool->evaluate();
+
+	//join workers that lingered out (they are past their last
+	//lock of m_mutex, so condWait() returns almost at once)
+	while(pool->m_exited > 0)
+	  {
+	    pool->m_exited--;
+	    pthread_mutex_unlock(&pool->m_mutex);
+
+	    void *ret;
+	    pool->m_mgr.condWait(&ret);
+
+	    pthread_mutex_lock(&pool->m_mutex);
+	  }
+      }
+    pthread_mutex_unlock(&pool->m_mutex);
+
+    return NULL;
+  }
+
+  ///worker thread: run queued tasks, exit after lingering idle
+  static void *worker(void *arg)
+  {
+    ThreadPool *pool = (ThreadPool *)arg;
+
+    //the watchdog follows each task, not the worker waiting for them
+    //(and ordered output must not wait for the worker to return)
+    ThreadWatchdog::exempt();
+    ThreadOutput::exempt();
+
+    pthread_mutex_lock(&pool->m_mutex);
+    for(;;)
+      {
+	if(!pool->m_queue.empty())
+	  {
+	    pool_task *t = pool->m_queue.front();
+	    pool->m_queue.pop_front();
+
+	    long waited_us = (now() - t->queued_ns) / 1000;
+	    if(waited_us > pool->m_stats.max_latency_us)
+	      pool->m_stats.max_latency_us = waited_us;
+	    pool->m_latency_total_us += waited_us;
+
+	    pthread_mutex_unlock(&pool->m_mutex);
+
+	    //run the users function (its arena scratch is reset per task)
+	    if(ThreadWatchdog::on())
+	      ThreadWatchdog::begin(t->id, t->func, pool);
+
+	    t->ret = t->func(t->arg);
+
+	    ThreadWatchdog::end();
+	    if(ThreadArena::current() != NULL)
+	      ThreadArena::current()->resetScratch();
+
+	    pthread_mutex_lock(&pool->m_mutex);
+	    pool->m_done.push_back(t);
+	    pool->m_stats.completed++;
+	    pool->m_stats.avg_latency_us = pool->m_latency_total_us / pool->m_stats.completed;
+	    pthread_cond_signal(&pool->m_done_cond);
+	    continue;
+	  }
+
+	if(pool->m_shutdown)
+	  break;
+
+	//idle: wait for work at most linger_ms
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += pool->m_cfg.linger_ms / 1000;
+	ts.tv_nsec += (pool->m_cfg.linger_ms % 1000) * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+
+	pool->m_stats.idle++;
+	int rc = pthread_cond_timedwait(&pool->m_work_cond, &pool->m_mutex, &ts);
+	pool->m_stats.idle--;
+
+	if(rc == ETIMEDOUT && pool->m_queue.empty()
+	   && pool->m_stats.workers > pool->m_cfg.min_workers)
+	  {
+	    pool->m_stats.shrinks++;
+	    pool->m_stats.last_reason = RESIZE_LINGER;
+	    pool->m_exited++;
+	    break;
+	  }
+      }
+
+    pool->m_stats.workers--;
+    pthread_mutex_unlock(&pool->m_mutex);
+
+    return NULL;
+  }
+
+private:
+  ///configuration
+  pool_config m_cfg;
+
+  ///the workers are ordinary ThreadMgr threads
+  ThreadMgr m_mgr;
+
+  ///protects everything below
+  pthread_mutex_t m_mutex;
+
+  ///idle workers wait here
+  pthread_cond_t m_work_cond;
+
+  ///condWait() callers wait here
+  pthread_cond_t m_done_cond;
+
+  ///the controller sleeps here between samples
+  pthread_cond_t m_ctl_cond;
+
+  ///controller thread
+  pthread_t m_controller;
+
+  ///stop accepting work
+  bool m_shutdown;
+
+  ///queued and completed tasks
+  std::deque<pool_task *> m_queue;
+  std::deque<pool_task *> m_done;
+
+  ///id for the next submit()
+  unsigned long m_next_id;
+
+  ///completed tasks handed out by condWait()
+  unsigned long m_reaped;
+
+  ///workers that lingered out and need joining
+  int m_exited;
+
+  ///for avg_latency_us
+  long long m_latency_total_us;
+
+  ///cpu utilization sampling
+  long m_ncpu;
+  long long m_cpu_wall_ns;
+  long long m_cpu_used_ns;
+
+  ///statistics (see getStats())
+  pool_stats m_stats;
+};
+
+#endif //THREADPOOL_H
@@ -0,0 +1,383 @@
+/** \file ThreadTrace.h
+
+\brief Optional task lifecycle tracing in Chrome trace-event format
+
+\par Purpose:
+When tracing is enabled ThreadMgr records submit, start, end and join
+events for every task plus the time spent waiting for its data mutex.
+Each OS thread writes into its own ring buffer (single writer, no
+locks, no allocation after the first event) so recording an event
+costs a clock read and a few stores.
+<br>
+<br>
+ThreadTrace::write() renders every ring as Chrome trace-event JSON
+which can be loaded in chrome://tracing or https://ui.perfetto.dev.
+Passing a file name to ThreadTrace::enable() also writes it at exit.
+<br>
+<br>
+When tracing is disabled every hook is a single relaxed atomic load.
+*/
+
+#ifndef THREADTRACE_H
+#define THREADTRACE_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <fstream>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/**
+   \brief Per-thread ring buffers of task events
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \note
+   Rings are never freed while the program runs. A ring whose thread
+   exited is adopted by the next thread that records an event, so the
+   thread-per-task model of ThreadMgr does not grow one ring per task.
+   Each event carries the id of the thread that wrote it.
+*/
+class ThreadTrace {
+public:
+  ///kinds of events
+  enum event_type
+  {
+    EV_SUBMIT = 0,	///< createThread() (on the creating thread)
+    EV_START,		///< user function about to be called
+    EV_END,		///< user function returned
+    EV_JOIN,		///< waiter joined the thread
+    EV_LOCK_WAIT	///< blocked on the manager's data mutex
+  };
+
+  ///one recorded event (32 bytes)
+  struct event
+  {
+    ///CLOCK_MONOTONIC nanoseconds
+    long long ts;
+
+    ///task identity (flows link submit -> start -> end -> join)
+    unsigned long task;
+
+    ///user function (EV_SUBMIT / EV_START) or lock wait nanoseconds
+    unsigned long extra;
+
+    ///event_type
+    unsigned int type;
+
+    ///trace thread id of the writer
+    unsigned int tid;
+  };
+
+private:
+  ///a single writer ring
+  struct ring
+  {
+    ///next ring in the registry (never unlinked)
+    ring *next;
+
+    ///set while a live thread owns the ring
+    std::atomic<bool> owned;
+
+    ///total events ever written (write index = head % capacity)
+    std::atomic<unsigned long> head;
+
+    ///number of slots
+    unsigned long capacity;
+
+    ///event storage
+    event *events;
+  };
+
+  ///gives the ring back when a thread exits (thread_local destructor)
+  struct ring_handle
+  {
+    ring *r;
+    unsigned int tid;
+
+    ring_handle() : r(NULL), tid(0) {}
+    ~ring_handle()
+    {
+      if(r != NULL)
+	r->owned.store(false, std::memory_order_release);
+    }
+  };
+
+public:
+  ///turn tracing on
+  static void enable(unsigned long events_per_thread = 1 << 16,
+		     const char *dump_at_exit = NULL)
+  {
+    /**
+       \param events_per_thread ring size (older events are
+       overwritten when a ring wraps)
+       \param dump_at_exit write the trace to this file at exit()
+    */
+    capacity() = events_per_thread;
+
+    if(dump_at_exit != NULL)
+      {
+	exitPath() = dump_at_exit;
+	static bool registered = false;
+	if(!registered)
+	  {
+	    registered = true;
+	    atexit(dumpAtExit);
+	  }
+      }
+
+    enabled().store(true, std::memory_order_release);
+  }
+
+  ///turn tracing off (recorded events are kept)
+  static void disable() { enabled().store(false, std::memory_order_release); }
+
+  ///throw away everything recorded so far
+  static void clear()
+  {
+    /** \note only call while no other thread is recording */
+    for(ring *r = registry().load(std::memory_order_acquire); r != NULL; r = r->next)
+      r->head.store(0, std::memory_order_release);
+  }
+
+  ///answers the question "is tracing on?"
+  static bool on() { return enabled().load(std::memory_order_relaxed); }
+
+  ///monotonic clock in nanoseconds
+  static long long now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  ///record an event (callers check on() first)
+  static void record(event_type type, unsigned long task, unsigned long extra = 0,
+		     long long ts = 0)
+  {
+    ring_handle &h = handle();
+    if(h.r == NULL && !adopt(h))
+      return;
+
+    ring *r = h.r;
+    unsigned long n = r->head.load(std::memory_order_relaxed);
+    event *e = &r->events[n % r->capacity];
+
+    e->ts = ts ? ts : now();
+    e->task = task;
+    e->extra = extra;
+    e->type = type;
+    e->tid = h.tid;
+
+    //publish (the writer is the only one moving head)
+    r->head.store(n + 1, std::memory_order_release);
+  }
+
+  ///lock a mutex, recording an EV_LOCK_WAIT if it was contended
+  static void lock(pthread_mutex_t *mutex, unsigned long task)
+  {
+    if(!on() || pthread_mutex_trylock(mutex) != 0)
+      {
+	long long start = on() ? now() : 0;
+	pthread_mutex_lock(mutex);
+	if(start != 0)
+	  record(EV_LOCK_WAIT, task, (unsigned long)(now() - start), start);
+      }
+  }
+
+  ///give a name to a user function (shown instead of its address)
+  static void nameFunction(void *(*func)(void *), const char *name)
+  {
+    /** \note not thread safe -call before starting threads */
+    names().push(func, name);
+  }
+
+  ///write every ring as Chrome trace-event JSON
+  static void write(std::ostream &os)
+  {
+    /**
+       \note may be called while threads are running; events being
+       overwritten during the copy are skipped.
+    */
+    int pid = getpid();
+    bool first = true;
+
+    os << "{\"traceEvents\":[\n";
+
+    for(ring *r = registry().load(std::memory_order_acquire); r != NULL; r = r->next)
+      {
+	unsigned long head = r->head.load(std::memory_order_acquire);
+	unsigned long begin = head > r->capacity ? head - r->capacity : 0;
+
+	for(unsigned long i = begin; i < head; i++)
+	  {
+	    event e = r->events[i % r->capacity];
+
+	    //the writer lapped us while we copied: drop the event
+	    if(r->head.load(std::memory_order_acquire) - i > r->capacity)
+	      continue;
+
+	    writeEvent(os, e, pid, first);
+	    first = false;
+	  }
+      }
+
+    os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  }
+
+  ///write the trace to a file
+  static bool write(const char *path)
+  {
+    std::ofstream f(path);
+    if(!f)
+      return false;
+    write(f);
+    return f.good();
+  }
+
+  ///a registered name or the hex address of a user function
+  static std::string functionName(unsigned long func) { return funcName(func); }
+
+private:
+  ///one JSON event (plus the flow arrows tying a task together)
+  static void writeEvent(std::ostream &os, const event &e, int pid, bool first)
+  {
+    char buf[512];
+    double us = e.ts / 1000.0;
+    const char *sep = first ? "" : ",\n";
+    int n = 0;
+
+    switch(e.type)
+      {
+      case EV_SUBMIT:
+	n = snprintf(buf, sizeof(buf),
+		     "%s{\"name\":\"submit\",\"cat\":\"ThreadMgr\",\"ph\":\"i\",\"s\":\"t\","
+		     "\"ts\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"task\":%lu,\"func\":\"%s\"}},\n"
+		     "{\"name\":\"task\",\"cat\":\"ThreadMgr\",\"ph\":\"s\",\"id\":%lu,"
+		     "\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+		     sep, us, pid, e.tid, e.task, funcName(e.extra).c_str(),
+		     e.task, us, pid, e.tid);
+	break;
+      case EV_START:
+	n = snprintf(buf, sizeof(buf),
+		     "%s{\"name\":\"%s\",\"cat\":\"ThreadMgr\",\"ph\":\"B\","
+		     "\"ts\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"task\":%lu}},\n"
+		     "{\"name\":\"task\",\"cat\":\"ThreadMgr\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%lu,"
+		     "\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+		     sep, funcName(e.extra).c_str(), us, pid, e.tid, e.task,
+		     e.task, us, pid, e.tid);
+	break;
+      case EV_END:
+	n = snprintf(buf, sizeof(buf),
+		     "%s{\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+		     sep, us, pid, e.tid);
+	break;
+      case EV_JOIN:
+	n = snprintf(buf, sizeof(buf),
+		     "%s{\"name\":\"join\",\"cat\":\"ThreadMgr\",\"ph\":\"i\",\"s\":\"t\","
+		     "\"ts\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"task\":%lu}}",
+		     sep, us, pid, e.tid, e.task);
+	break;
+      case EV_LOCK_WAIT:
+	n = snprintf(buf, sizeof(buf),
+		     "%s{\"name\":\"lock wait\",\"cat\":\"ThreadMgr\",\"ph\":\"X\","
+		     "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"task\":%lu}}",
+		     sep, us, e.extra / 1000.0, pid, e.tid, e.task);
+	break;
+      }
+
+    if(n > 0)
+      os.write(buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+  }
+
+  ///a registered name or the hex address of a user function
+  static std::string funcName(unsigned long func)
+  {
+    const char *name = names().find((void *(*)(void *))func);
+    if(name != NULL)
+      return name;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "task %#lx", func);
+    return buf;
+  }
+
+  ///take over a free ring or make a new one for this thread
+  static bool adopt(ring_handle &h)
+  {
+    static std::atomic<unsigned int> next_tid(1);
+
+    ring *r;
+    for(r = registry().load(std::memory_order_acquire); r != NULL; r = r->next)
+      {
+	bool expected = false;
+	if(r->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+	  break;
+      }
+
+    if(r == NULL)
+      {
+	r = new ring;
+	r->owned.store(true, std::memory_order_relaxed);
+	r->head.store(0, std::memory_order_relaxed);
+	r->capacity = capacity();
+	r->events = new event[r->capacity];
+
+	//push on the registry (lock free)
+	r->next = registry().load(std::memory_order_relaxed);
+	while(!registry().compare_exchange_weak(r->next, r, std::memory_order_release))
+	  ;
+      }
+
+    h.r = r;
+    h.tid = next_tid.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  ///atexit() hook
+  static void dumpAtExit()
+  {
+    if(exitPath() != NULL)
+      write(exitPath());
+  }
+
+  ///small fixed table of function names
+  struct name_table
+  {
+    void *(*funcs[64])(void *);
+    const char *names[64];
+    int count;
+
+    void push(void *(*func)(void *), const char *name)
+    {
+      if(count < 64)
+	{
+	  funcs[count] = func;
+	  names[count] = name;
+	  count++;
+	}
+    }
+
+    const char *find(void *(*func)(void *)) const
+    {
+      for(int i = 0; i < count; i++)
+	if(funcs[i] == func)
+	  return names[i];
+      return NULL;
+    }
+  };
+
+  //function local statics keep this a header only class
+  static std::atomic<bool> &enabled() { static std::atomic<bool> e(false); return e; }
+  static std::atomic<ring *> &registry() { static std::atomic<ring *> r(NULL); return r; }
+  static unsigned long &capacity() { static unsigned long c = 1 << 16; return c; }
+  static const char *&exitPath() { static const char *p = NULL; return p; }
+  static name_table &names() { static name_table t = {{0}, {0}, 0}; return t; }
+  static ring_handle &handle() { static thread_local ring_handle h; return h; }
+};
+
+#endif //THREADTRACE_H
@@ -0,0 +1,528 @@
+/** \file ThreadWatchdog.h
+
+\brief Stalled task watchdog and task duration percentiles
+
+\par Purpose:
+condWait() only tells in which order tasks finished. A task that
+spins forever (or deadlocks) never finishes and nothing says so.
+While the watchdog is running every ThreadMgr task (and every
+ThreadPool task) publishes its start time into a shared table and may
+publish heartbeats with ThreadWatchdog::heartbeat(). A sampler thread
+scans the table and reports each task that has gone longer than its
+deadline without finishing or beating, once, with its function and
+age.
+<br>
+<br>
+Finished tasks add their run time to a log-linear histogram, which
+getStats() turns into p50 / p99 / p999 / max durations.
+<br>
+<br>
+Publishing is a few relaxed atomic stores into a slot of its own
+cache line; with the watchdog stopped every hook is a single relaxed
+load.
+*/
+
+#ifndef THREADWATCHDOG_H
+#define THREADWATCHDOG_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <time.h>
+#include <pthread.h>
+
+#include "ThreadTrace.h"
+
+/**
+   \brief Heartbeat table, sampler thread and duration histogram
+
+   \author Karl N. Redman (karl.redman@gmail.com)
+
+   \par Example:
+   ThreadWatchdog::setDeadline(myfunc, 500);<br>
+   ThreadWatchdog::start(1000);<br>
+   ... createThread() / condWait() ...<br>
+   ThreadWatchdog::getStats(&st);<br>
+   ThreadWatchdog::stop();<br>
+
+   \note
+   Long lived threads that loop waiting for work (pool workers,
+   pipeline stages, fiber workers) call exempt() so their idle time is
+   not mistaken for a stall, then bracket each unit of work with
+   begin() / end().
+*/
+class ThreadWatchdog {
+public:
+  ///what the sampler reports about a stalled task
+  struct stall_info
+  {
+    ///task id (ThreadMgr submit sequence or ThreadPool task id)
+    unsigned long task;
+
+    ///the task's function
+    void *(*func)(void *);
+
+    ///who runs it (ThreadMgr or ThreadPool instance)
+    const void *owner;
+
+    ///time since start and since the last heartbeat (nsec)
+    long long age_ns;
+    long long silent_ns;
+  };
+
+  ///called by the sampler thread for every newly stalled task
+  typedef void (*stall_handler)(const stall_info &info);
+
+  ///observable state (see getStats())
+  struct watchdog_stats
+  {
+    ///tasks that finished while the watchdog was on
+    unsigned long tasks;
+
+    ///tasks running right now (tracked ones)
+    unsigned long running;
+
+    ///stalls reported so far / still stalled at the last scan
+    unsigned long stalls;
+    unsigned long stalled_now;
+
+    ///tasks that found the table full (not watched)
+    unsigned long untracked;
+
+    ///task duration percentiles (usec, bucket upper bounds)
+    long long p50_us;
+    long long p99_us;
+    long long p999_us;
+    long long max_us;
+  };
+
+private:
+  ///one running task (a cache line of its own)
+  struct alignas(64) slot
+  {
+    ///task id, 0 while the slot is free
+    std::atomic<unsigned long> task;
+
+    std::atomic<void *(*)(void *)> func;
+    std::atomic<const void *> owner;
+
+    ///start and last heartbeat (nsec, CLOCK_MONOTONIC; beat is 0
+    ///until the rest of the slot is filled in)
+    std::atomic<long long> start;
+    std::atomic<long long> beat;
+
+    ///already reported by the sampler
+    std::atomic<bool> flagged;
+  };
+
+  ///number of slots (tasks beyond this are not watched)
+  static const int SLOTS = 4096;
+
+  ///histogram: 8 sub-buckets per power of two of nanoseconds
+  static const int SUB_BITS = 3;
+  static const int BUCKETS = 64 << SUB_BITS;
+
+  ///per function deadline table size
+  static const int MAX_DEADLINES = 64;
+
+public:
+  ///start the sampler thread
+  static bool start(long default_deadline_ms = 1000, long sample_ms = 100,
+		    stall_handler handler = NULL)
+  {
+    /**
+       \param default_deadline_ms a task running (or silent) longer
+       than this is stalled, unless setDeadline() says otherwise
+       \param sample_ms how often the table is scanned
+       \param handler called for each new stall (default prints to
+       std::cerr)
+       \return false if the sampler thread could not be started
+    */
+    state &s = st();
+    if(s.running)
+      return true;
+
+    s.default_deadline_ns = default_deadline_ms * 1000000LL;
+    s.sample_ns = sample_ms * 1000000LL;
+    s.handler = handler != NULL ? handler : printStall;
+    s.stop = false;
+
+    if(pthread_create(&s.sampler, NULL, sampler, NULL) != 0)
+      return false;
+
+    s.running = true;
+    enabled().store(true, std::memory_order_release);
+    return true;
+  }
+
+  ///stop the sampler thread (histogram and counters are kept)
+  static void stop()
+  {
+    state &s = st();
+    if(!s.running)
+      return;
+
+    enabled().store(false, std::memory_order_release);
+
+    pthread_mutex_lock(&s.mutex);
+    s.stop = true;
+    pthread_cond_signal(&s.cond);
+    pthread_mutex_unlock(&s.mutex);
+
+    pthread_join(s.sampler, NULL);
+    s.running = false;
+  }
+
+  ///answers the question "is the watchdog running?"
+  static bool on() { return enabled().load(std::memory_order_relaxed); }
+
+  ///give one task function its own deadline
+  static void setDeadline(void *(*func)(void *), long deadline_ms)
+  {
+    /** \note not thread safe -call before start() */
+    state &s = st();
+    for(int i = 0; i < s.deadlines; i++)
+      if(s.deadline_func[i] == func)
+	{
+	  s.deadline_ns[i] = deadline_ms * 1000000LL;
+	  return;
+	}
+
+    if(s.deadlines < MAX_DEADLINES)
+      {
+	s.deadline_func[s.deadlines] = func;
+	s.deadline_ns[s.deadlines] = deadline_ms * 1000000LL;
+	s.deadlines++;
+      }
+  }
+
+  ///publish a task start on the calling thread (callers check on() first)
+  static void begin(unsigned long task, void *(*func)(void *), const void *owner)
+  {
+    /** \note an outer task still published on this thread is
+	dropped without recording a duration (see exempt()).
+    */
+    exempt();
+
+    if(task == 0)
+      task = ~0UL;
+
+    //probe from a spot picked by the task id
+    slot *table = slots();
+    unsigned int i = (unsigned int)(task * 2654435761u) % SLOTS;
+    for(int n = 0; n < SLOTS; n++, i = (i + 1) % SLOTS)
+      {
+	unsigned long expected = 0;
+	if(table[i].task.load(std::memory_order_relaxed) == 0
+	   && table[i].task.compare_exchange_strong(expected, task, std::memory_order_acquire))
+	  {
+	    long long t = ThreadTrace::now();
+	    table[i].func.store(func, std::memory_order_relaxed);
+	    table[i].owner.store(owner, std::memory_order_relaxed);
+	    table[i].flagged.store(false, std::memory_order_relaxed);
+	    table[i].start.store(t, std::memory_order_relaxed);
+	    table[i].beat.store(t, std::memory_order_release);
+	    current() = &table[i];
+	    return;
+	  }
+      }
+
+    st().untracked.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ///the task on this thread finished: record its duration, free the slot
+  static void end()
+  {
+    slot *s = current();
+    if(s == NULL)
+      return;
+
+    long long d = ThreadTrace::now() - s->start.load(std::memory_order_relaxed);
+    histogram()[bucket(d)].fetch_add(1, std::memory_order_relaxed);
+    st().tasks.fetch_add(1, std::memory_order_relaxed);
+
+    //a stalled task that finished after all (until the next scan)
+    if(s->flagged.load(std::memory_order_relaxed)
+       && st().stalled_now.load(std::memory_order_relaxed) > 0)
+      st().stalled_now.fetch_sub(1, std::memory_order_relaxed);
+
+    release(s);
+  }
+
+  ///the task on this thread is still making progress
+  static void heartbeat()
+  {
+    slot *s = current();
+    if(s != NULL)
+      s->beat.store(ThreadTrace::now(), std::memory_order_relaxed);
+  }
+
+  ///stop watching the calling thread's task (long lived worker loops)
+  static void exempt()
+  {
+    slot *s = current();
+    if(s != NULL)
+      release(s);
+  }
+
+  ///tasks of one owner that were stalled at the last scan (NULL: all)
+  static int stalledNow(const void *owner = NULL)
+  {
+    /** \note reads the table, not a cached count -cheap enough for a
+	pool controller sampling every few milliseconds.
+    */
+    int n = 0;
+    slot *table = slots();
+    for(int i = 0; i < SLOTS; i++)
+      if(table[i].task.load(std::memory_order_relaxed) != 0
+	 && table[i].flagged.load(std::memory_order_relaxed)
+	 && (owner == NULL || table[i].owner.load(std::memory_order_relaxed) == owner))
+	n++;
+    return n;
+  }
+
+  ///copy out the counters and the duration percentiles
+  static void getStats(watchdog_stats *out)
+  {
+    state &s = st();
+    memset(out, 0, sizeof(*out));
+
+    out->tasks = s.tasks.load(std::memory_order_relaxed);
+    out->stalls = s.stalls.load(std::memory_order_relaxed);
+    out->stalled_now = s.stalled_now.load(std::memory_order_relaxed);
+    out->untracked = s.untracked.load(std::memory_order_relaxed);
+
+    slot *table = slots();
+    for(int i = 0; i < SLOTS; i++)
+      if(table[i].task.load(std::memory_order_relaxed) != 0)
+	out->running++;
+
+    //copy the histogram once so every percentile sees the same counts
+    unsigned long counts[BUCKETS];
+    unsigned long total = 0;
+    for(int b = 0; b < BUCKETS; b++)
+      {
+	counts[b] = histogram()[b].load(std::memory_order_relaxed);
+	total += counts[b];
+      }
+
+    out->p50_us = percentile(counts, total, 0.50) / 1000;
+    out->p99_us = percentile(counts, total, 0.99) / 1000;
+    out->p999_us = percentile(counts, total, 0.999) / 1000;
+    out->max_us = percentile(counts, total, 1.0) / 1000;
+  }
+
+  ///print the statistics (for examples and tuning)
+  static void printStats(std::ostream &os, const watchdog_stats &s)
+  {
+    os << "tasks=" << s.tasks
+       << "|running=" << s.running
+       << "|stalls=" << s.stalls
+       << "|stalled_now=" << s.stalled_now
+       << "|untracked=" << s.untracked
+       << "|p50=" << s.p50_us << "us"
+       << "|p99=" << s.p99_us << "us"
+       << "|p999=" << s.p999_us << "us"
+       << "|max=" << s.max_us << "us"
+       << std::endl;
+  }
+
+  ///throw away the histogram and counters
+  static void reset()
+  {
+    state &s = st();
+    for(int b = 0; b < BUCKETS; b++)
+      histogram()[b].store(0, std::memory_order_relaxed);
+    s.tasks.store(0, std::memory_order_relaxed);
+    s.stalls.store(0, std::memory_order_relaxed);
+    s.untracked.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  ///free a slot
+  static void release(slot *s)
+  {
+    s->beat.store(0, std::memory_order_relaxed);
+    s->task.store(0, std::memory_order_release);
+    current() = NULL;
+  }
+
+  ///deadline of a task function (nsec)
+  static long long deadlineOf(void *(*func)(void *))
+  {
+    state &s = st();
+    for(int i = 0; i < s.deadlines; i++)
+      if(s.deadline_func[i] == func)
+	return s.deadline_ns[i];
+    return s.default_deadline_ns;
+  }
+
+  ///sampler thread: scan the table every sample_ms
+  static void *sampler(void *arg)
+  {
+    state &s = st();
+
+    pthread_mutex_lock(&s.mutex);
+    while(!s.stop)
+      {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += s.sample_ns / 1000000000LL;
+	ts.tv_nsec += s.sample_ns % 1000000000LL;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+
+	pthread_cond_timedwait(&s.cond, &s.mutex, &ts);
+	if(s.stop)
+	  break;
+
+	pthread_mutex_unlock(&s.mutex);
+	scan();
+	pthread_mutex_lock(&s.mutex);
+      }
+    pthread_mutex_unlock(&s.mutex);
+
+    return NULL;
+  }
+
+  ///flag (and report once) every task past its deadline
+  static void scan()
+  {
+    state &s = st();
+    slot *table = slots();
+    long long now = ThreadTrace::now();
+    unsigned long stalled = 0;
+
+    for(int i = 0; i < SLOTS; i++)
+      {
+	unsigned long task = table[i].task.load(std::memory_order_acquire);
+	if(task == 0)
+	  continue;
+
+	//claimed but not filled in yet
+	long long beat = table[i].beat.load(std::memory_order_acquire);
+	if(beat == 0)
+	  continue;
+
+	stall_info info;
+	info.task = task;
+	info.func = table[i].func.load(std::memory_order_relaxed);
+	info.owner = table[i].owner.load(std::memory_order_relaxed);
+	info.age_ns = now - table[i].start.load(std::memory_order_relaxed);
+	info.silent_ns = now - beat;
+
+	//the slot was freed and reused while we read it
+	if(table[i].task.load(std::memory_order_acquire) != task || info.silent_ns < 0)
+	  continue;
+
+	if(info.silent_ns <= deadlineOf(info.func))
+	  {
+	    //beating again: it may stall (and be reported) once more
+	    table[i].flagged.store(false, std::memory_order_relaxed);
+	    continue;
+	  }
+
+	stalled++;
+	if(!table[i].flagged.exchange(true, std::memory_order_relaxed))
+	  {
+	    s.stalls.fetch_add(1, std::memory_order_relaxed);
+	    s.handler(info);
+	  }
+      }
+
+    s.stalled_now.store(stalled, std::memory_order_relaxed);
+  }
+
+  ///default stall handler
+  static void printStall(const stall_info &info)
+  {
+    std::cerr << "watchdog: task " << info.task << " ("
+	      << ThreadTrace::functionName((unsigned long)info.func)
+	      << ") running " << info.age_ns / 1000000 << "ms, silent "
+	      << info.silent_ns / 1000000 << "ms" << std::endl;
+  }
+
+  ///histogram bucket of a duration in nsec
+  static int bucket(long long ns)
+  {
+    if(ns < (1 << SUB_BITS))
+      return ns < 0 ? 0 : (int)ns;
+
+    int msb = 63 - __builtin_clzll((unsigned long long)ns);
+    int sub = (int)((ns >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+    return ((msb - SUB_BITS + 1) << SUB_BITS) + sub;
+  }
+
+  ///upper bound (nsec) of a histogram bucket
+  static long long bucketTop(int b)
+  {
+    if(b < (1 << SUB_BITS))
+      return b;
+
+    int msb = (b >> SUB_BITS) + SUB_BITS - 1;
+    long long sub = b & ((1 << SUB_BITS) - 1);
+    return ((((long long)1 << SUB_BITS) + sub + 1) << (msb - SUB_BITS)) - 1;
+  }
+
+  ///duration below which a fraction q of the tasks finished
+  static long long percentile(const unsigned long *counts, unsigned long total, double q)
+  {
+    if(total == 0)
+      return 0;
+
+    unsigned long want = (unsigned long)(q * total + 0.5);
+    if(want < 1)
+      want = 1;
+
+    unsigned long seen = 0;
+    for(int b = 0; b < BUCKETS; b++)
+      {
+	seen += counts[b];
+	if(seen >= want)
+	  return bucketTop(b);
+      }
+    return bucketTop(BUCKETS - 1);
+  }
+
+  ///sampler state and counters
+  struct state
+  {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t sampler;
+    bool running;
+    bool stop;
+
+    long long default_deadline_ns;
+    long long sample_ns;
+    stall_handler handler;
+
+    void *(*deadline_func[MAX_DEADLINES])(void *);
+    long long deadline_ns[MAX_DEADLINES];
+    int deadlines;
+
+    std::atomic<unsigned long> tasks;
+    std::atomic<unsigned long> stalls;
+    std::atomic<unsigned long> stalled_now;
+    std::atomic<unsigned long> untracked;
+
+    state() : running(false), stop(false), default_deadline_ns(1000000000LL),
+	      sample_ns(100000000LL), handler(NULL), deadlines(0),
+	      tasks(0), stalls(0), stalled_now(0), untracked(0)
+    {
+      pthread_mutex_init(&mutex, NULL);
+      pthread_cond_init(&cond, NULL);
+    }
+  };
+
+  //function local statics keep this a header only class
+  static std::atomic<bool> &enabled() { static std::atomic<bool> e(false); return e; }
+  static state &st() { static state s; return s; }
+  static slot *slots() { static slot t[SLOTS]; return t; }
+  static std::atomic<unsigned long> *histogram() { static std::atomic<unsigned long> h[BUCKETS]; return h; }
+  static slot *&current() { static thread_local slot *s = NULL; return s; }
+};
+
+#endif //THREADWATCHDOG_H
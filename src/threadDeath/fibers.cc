@@ -0,0 +1,255 @@
+/** \file fibers.cc
+
+\brief Fiber (M:N user mode thread) example
+
+\par Purpose:
+Starts a large number of fibers (see Fiber.h) on a few ThreadMgr
+worker threads, parks them all on a gate so they are alive together,
+and reaps them with condWait() the same way threadDeath3.cc reaps
+threads. A bounded producer / consumer queue built on FiberMutex
+and FiberCond shows fibers blocking without tying up a worker.
+<br>
+<br>
+The cost of one thread per task is measured for comparison.
+
+\par Usage:
+fibers [number of fibers]
+*/
+
+#include <iostream>
+#include <cstdlib>
+
+#include "Fiber.h"
+
+///default number of fibers
+#define FIBERS 100000
+
+///items passed through the producer / consumer queue
+#define ITEMS 200000
+
+///Example fiber function: wait for the gate, yield, return the argument
+void *gateFunc(void *arg);
+
+///Example fiber function: produce ITEMS / producers items
+void *producerFunc(void *arg);
+
+///Example fiber function: consume until the queue is closed
+void *consumerFunc(void *arg);
+
+///Example thread function (for the comparison)
+void *threadFunc(void *arg);
+
+///monotonic clock in nanoseconds
+long long now();
+
+///a small bounded queue shared by fibers
+struct bounded_queue
+{
+  FiberMutex mutex;
+  FiberCond not_empty;
+  FiberCond not_full;
+  long items[64];
+  int head, count;
+  int producers;
+  long consumed;
+  long sum;
+};
+
+///the queue used by the producer / consumer example
+bounded_queue q;
+
+///holds every fiber parked until main() opens it
+struct gate
+{
+  FiberMutex mutex;
+  FiberCond opened;
+  bool open;
+} g;
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  long fibers = (argc > 1) ? atol(argv[1]) : FIBERS;
+  void *ret;
+  long i;
+
+  //##########################################################
+  std::cout << "Fibers:" << std::endl;
+  //##########################################################
+
+  {
+    FiberMgr fm(4);
+    FiberMgr::fiber_stats st;
+
+    long long start = now();
+    for(i = 0; i < fibers; i++)
+      if(fm.createFiber(gateFunc, (void *)i) == 0)
+	{
+	  std::cout << "out of stacks at " << i << std::endl;
+	  break;
+	}
+
+    //every fiber is parked on the gate now (or about to be)
+    g.mutex.lock();
+    g.open = true;
+    g.opened.broadcast();
+    g.mutex.unlock();
+
+    long sum = 0;
+    while(fm.fibersActive())
+      if(fm.condWait(&ret))
+	sum += (long)ret;
+    long long elapsed = now() - start;
+
+    fm.getStats(&st);
+    std::cout << "fibers=" << st.created
+	      << "|peak alive=" << st.peak_alive
+	      << "|stacks mapped=" << st.stacks_mapped
+	      << "|unguarded=" << st.guard_failures
+	      << "|switches=" << st.switches
+	      << "|sum ok=" << (sum == fibers * (fibers - 1) / 2)
+	      << std::endl;
+    std::cout << "ns/fiber=" << (double)elapsed / fibers
+	      << "|ns/switch=" << (double)elapsed / st.switches
+	      << std::endl;
+
+    //##########################################################
+    std::cout << "\n" << "FiberMutex / FiberCond:" << std::endl;
+    //##########################################################
+
+    q.head = q.count = 0;
+    q.producers = 4;
+    q.consumed = q.sum = 0;
+
+    start = now();
+    for(i = 0; i < 4; i++)
+      fm.createFiber(producerFunc, (void *)i);
+    for(i = 0; i < 8; i++)
+      fm.createFiber(consumerFunc, NULL);
+
+    while(fm.fibersActive())
+      fm.condWait(&ret);
+    elapsed = now() - start;
+
+    std::cout << "consumed=" << q.consumed
+	      << "|sum ok=" << (q.sum == (long)ITEMS * (ITEMS - 1) / 2)
+	      << "|ns/item=" << (double)elapsed / ITEMS
+	      << std::endl;
+  }
+
+  //##########################################################
+  std::cout << "\n" << "Thread per task:" << std::endl;
+  //##########################################################
+
+  /* ThreadMgr threads for the same kind of work. Only a slice -one OS
+     thread per task does not go to 100000.
+  */
+  ThreadMgr m;
+  const long slice = 2000;
+
+  long long start = now();
+  for(i = 0; i < slice; i++)
+    m.createThread(threadFunc, (void *)i);
+  while(m.threadsActive())
+    m.condWait(&ret);
+  long long elapsed = now() - start;
+
+  std::cout << "threads=" << slice
+	    << "|ns/thread=" << (double)elapsed / slice
+	    << std::endl;
+
+  //exit normally
+  return(0);
+}
+
+/**
+   \brief park on the gate so every fiber is alive at once, then yield
+   \return the argument
+*/
+void *gateFunc(void *arg)
+{
+  g.mutex.lock();
+  while(!g.open)
+    g.opened.wait(g.mutex);
+  g.mutex.unlock();
+
+  FiberMgr::yield();
+  return arg;
+}
+
+/**
+   \brief push every producers'th value in [0, ITEMS)
+   \return NULL is returned
+*/
+void *producerFunc(void *arg)
+{
+  for(long v = (long)arg; v < ITEMS; v += 4)
+    {
+      q.mutex.lock();
+      while(q.count == 64)
+	q.not_full.wait(q.mutex);
+
+      q.items[(q.head + q.count) % 64] = v;
+      q.count++;
+
+      q.not_empty.signal();
+      q.mutex.unlock();
+    }
+
+  //the last producer out wakes everybody up
+  q.mutex.lock();
+  if(--q.producers == 0)
+    q.not_empty.broadcast();
+  q.mutex.unlock();
+
+  return NULL;
+}
+
+/**
+   \brief pop and add up values until the producers are done
+   \return NULL is returned
+*/
+void *consumerFunc(void *arg)
+{
+  for(;;)
+    {
+      q.mutex.lock();
+      while(q.count == 0 && q.producers > 0)
+	q.not_empty.wait(q.mutex);
+
+      if(q.count == 0)
+	{
+	  q.mutex.unlock();
+	  break;
+	}
+
+      long v = q.items[q.head];
+      q.head = (q.head + 1) % 64;
+      q.count--;
+      q.consumed++;
+      q.sum += v;
+
+      q.not_full.signal();
+      q.mutex.unlock();
+    }
+
+  return NULL;
+}
+
+/**
+   \brief trivial thread body
+   \return the argument
+*/
+void *threadFunc(void *arg)
+{
+  return arg;
+}
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,618 @@
+/** \file loadgen.cc
+
+\brief Synthetic workload generator and soak harness
+
+\par Purpose:
+myfunc0 / myfunc1 / myfunc2 in threadDeath3.cc are fixed loops; they
+say nothing about how a manager copes with a realistic mix of work.
+loadgen feeds a ThreadMgr (one thread per task) or a ThreadPool with
+tasks for as long as asked and reports, every interval:
+<ul>
+<li>achieved throughput</li>
+<li>latency percentiles -for open loop runs measured from the time
+the schedule said the task should start, so a stalled manager shows
+up as latency instead of as missing samples (coordinated omission)</li>
+<li>tasks in flight and resident set size (to spot growth over a long
+soak)</li>
+</ul>
+At the end every task record allocated must have been freed and the
+manager must be empty; anything else is reported as leaked.
+
+\par Usage:
+loadgen [options]
+<pre>
+  -m mgr|pool           manager to load (default mgr)
+  -a poisson|closed     open loop Poisson arrivals or closed loop (default poisson)
+  -r rate               Poisson arrivals per second (default 2000)
+  -c clients            closed loop tasks in flight (default 16)
+  -d fixed|exp|lognormal|bimodal   task duration distribution (default exp)
+  -u usec               mean task duration (default 200)
+  -k cpu|mem|alloc|mix  what tasks do (default mix)
+  -M mbytes             buffer size for mem tasks (default 64)
+  -t seconds            run time (default 10)
+  -i seconds            report interval (default 1)
+</pre>
+*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "ThreadPool.h"
+
+///arrival processes
+enum arrival_kind { ARRIVE_POISSON, ARRIVE_CLOSED };
+
+///task duration distributions
+enum duration_kind { DUR_FIXED, DUR_EXP, DUR_LOGNORMAL, DUR_BIMODAL };
+
+///what a task does while it runs
+enum work_kind { WORK_CPU, WORK_MEM, WORK_ALLOC, WORK_MIX };
+
+///command line settings
+struct load_config
+{
+  bool pool;
+  arrival_kind arrival;
+  double rate;
+  int clients;
+  duration_kind duration;
+  long mean_us;
+  work_kind work;
+  long mem_mb;
+  long seconds;
+  long interval;
+};
+
+///one task: scheduled, run, reaped
+struct task_record
+{
+  ///when the schedule wanted it started / when it was submitted / done
+  long long intended_ns;
+  long long submit_ns;
+  long long done_ns;
+
+  ///how long to work and doing what
+  long duration_us;
+  work_kind work;
+
+  ///rng seed for the task
+  unsigned long seed;
+
+  ///the generator's "stop now" marker
+  bool sentinel;
+};
+
+/**
+   \brief log-linear latency histogram (8 buckets per power of two)
+*/
+struct latency_histogram
+{
+  unsigned long counts[64 * 8];
+  unsigned long total;
+  long long max_ns;
+
+  void clear() { memset(this, 0, sizeof(*this)); }
+
+  void add(long long ns)
+  {
+    if(ns < 0)
+      ns = 0;
+    counts[bucket(ns)]++;
+    total++;
+    if(ns > max_ns)
+      max_ns = ns;
+  }
+
+  void merge(const latency_histogram &h)
+  {
+    for(int b = 0; b < 64 * 8; b++)
+      counts[b] += h.counts[b];
+    total += h.total;
+    if(h.max_ns > max_ns)
+      max_ns = h.max_ns;
+  }
+
+  ///upper bound (nsec) of the bucket holding the q'th sample
+  long long percentile(double q) const
+  {
+    if(total == 0)
+      return 0;
+    unsigned long want = (unsigned long)(q * total + 0.5);
+    if(want < 1)
+      want = 1;
+    unsigned long seen = 0;
+    for(int b = 0; b < 64 * 8; b++)
+      if((seen += counts[b]) >= want)
+	return top(b) < max_ns ? top(b) : max_ns;
+    return max_ns;
+  }
+
+  static int bucket(long long ns)
+  {
+    if(ns < 8)
+      return (int)ns;
+    int msb = 63 - __builtin_clzll((unsigned long long)ns);
+    return ((msb - 2) << 3) + (int)((ns >> (msb - 3)) & 7);
+  }
+
+  static long long top(int b)
+  {
+    if(b < 8)
+      return b;
+    int msb = (b >> 3) + 2;
+    return ((8LL + (b & 7) + 1) << (msb - 3)) - 1;
+  }
+};
+
+///the settings
+load_config cfg;
+
+///the managers (only one is used)
+ThreadMgr *mgr = NULL;
+ThreadPool *pool = NULL;
+
+///buffer the mem tasks scribble over
+long *mem_buf = NULL;
+size_t mem_words = 0;
+
+///task records allocated and not yet freed
+std::atomic<long> records_live(0);
+
+///submitted / reaped task counts
+std::atomic<long> submitted(0);
+std::atomic<long> reaped(0);
+
+///the generator is done (closed loop: stop resubmitting)
+std::atomic<bool> stopping(false);
+
+///latency samples since the last report (reaper writes, main swaps)
+pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+latency_histogram interval_hist;
+latency_histogram total_hist;
+
+///Example Thread function: work the way the record says
+void *loadTask(void *arg);
+
+///reaper thread: condWait() on the manager, record latencies
+void *reaper(void *arg);
+
+///hand a record to the manager in use
+bool submitRecord(task_record *r);
+
+///make a task record with a fresh duration and work kind
+task_record *newRecord(long long intended_ns, unsigned long *rng);
+
+///print one interval line (and fold it into the totals)
+void report(long long elapsed_ns, long long interval_ns);
+
+///resident set size in megabytes
+double rssMB();
+
+///monotonic clock in nanoseconds
+long long now();
+
+///xorshift random number in [0, 1)
+double uniform(unsigned long *s);
+
+///parse the command line into cfg
+bool parse(int argc, char *argv[]);
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  if(!parse(argc, argv))
+    return(1);
+
+  if(cfg.work == WORK_MEM || cfg.work == WORK_MIX)
+    {
+      mem_words = cfg.mem_mb * 1024 * 1024 / sizeof(long);
+      mem_buf = new long[mem_words];
+      memset(mem_buf, 0, mem_words * sizeof(long));
+    }
+
+  if(cfg.pool)
+    pool = new ThreadPool();
+  else
+    mgr = new ThreadMgr();
+
+  interval_hist.clear();
+  total_hist.clear();
+
+  pthread_t reaper_tid;
+  pthread_create(&reaper_tid, NULL, reaper, NULL);
+
+  unsigned long rng = 88172645463325252UL;
+  long long start = now();
+  long long end = start + cfg.seconds * 1000000000LL;
+  long long interval_ns = cfg.interval * 1000000000LL;
+  long long next_report = start + interval_ns;
+  long long next = start;
+  long behind = 0;
+
+  std::cout << (cfg.pool ? "pool" : "mgr")
+	    << (cfg.arrival == ARRIVE_POISSON ? " poisson" : " closed")
+	    << " for " << cfg.seconds << "s" << std::endl;
+
+  //closed loop: fill the clients, the reaper keeps them busy
+  if(cfg.arrival == ARRIVE_CLOSED)
+    for(int i = 0; i < cfg.clients; i++)
+      submitRecord(newRecord(now(), &rng));
+
+  for(;;)
+    {
+      long long t = now();
+      if(t >= end)
+	break;
+
+      if(t >= next_report)
+	{
+	  report(t - start, interval_ns);
+	  next_report += interval_ns;
+	  continue;
+	}
+
+      if(cfg.arrival == ARRIVE_CLOSED)
+	{
+	  usleep(10000);
+	  continue;
+	}
+
+      //open loop: exponential gaps, never skip a late arrival
+      next += (long long)(-log(1.0 - uniform(&rng)) / cfg.rate * 1e9);
+      if(next > next_report)
+	{
+	  //report on time even through a long gap
+	  struct timespec ts = {(time_t)(next_report / 1000000000LL), (long)(next_report % 1000000000LL)};
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	  report(now() - start, interval_ns);
+	  next_report += interval_ns;
+	}
+
+      if(next > now())
+	{
+	  struct timespec ts = {(time_t)(next / 1000000000LL), (long)(next % 1000000000LL)};
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+      else if(now() - next > 1000000)
+	behind++;
+
+      submitRecord(newRecord(next, &rng));
+    }
+
+  //stop resubmitting and tell the reaper when it has seen everything
+  stopping = true;
+  task_record *last = newRecord(now(), &rng);
+  last->sentinel = true;
+  last->duration_us = 0;
+  submitRecord(last);
+  pthread_join(reaper_tid, NULL);
+
+  long long elapsed = now() - start;
+
+  //##########################################################
+  std::cout << "\n" << "Totals:" << std::endl;
+  //##########################################################
+
+  total_hist.merge(interval_hist);
+  long tasks = reaped.load() - 1;
+  printf("tasks=%ld|tput=%.0f/s|p50=%lldus|p99=%lldus|p999=%lldus|max=%lldus"
+	 "|late arrivals=%ld|rss=%.1fMB\n",
+	 tasks, tasks * 1e9 / elapsed, total_hist.percentile(0.50) / 1000,
+	 total_hist.percentile(0.99) / 1000, total_hist.percentile(0.999) / 1000,
+	 total_hist.max_ns / 1000, behind, rssMB());
+  fflush(stdout);
+
+  //every record freed, nothing left in the manager
+  long leaked = records_live.load();
+  if(mgr != NULL)
+    {
+      ThreadMgr::thread_counts c;
+      mgr->getCounts(&c);
+      leaked += c.active + (c.submitted - c.joined);
+    }
+  else
+    leaked += pool->pending();
+
+  std::cout << "leaked task records=" << leaked << std::endl;
+
+  delete pool;
+  delete mgr;
+  delete [] mem_buf;
+
+  //exit normally (non zero if something leaked)
+  return(leaked == 0 ? 0 : 2);
+}
+
+/**
+   \brief run cpu, memory or allocation work for the record's duration
+   \return the record (freed by the reaper)
+*/
+void *loadTask(void *arg)
+{
+  task_record *r = (task_record *)arg;
+  long long end = now() + r->duration_us * 1000LL;
+  unsigned long s = r->seed | 1;
+  unsigned long x = 1;
+
+  work_kind w = r->work;
+  if(r->sentinel)
+    end = 0;
+
+  switch(w)
+    {
+    case WORK_CPU:
+      do
+	for(int i = 0; i < 1024; i++)
+	  x = x * 6364136223846793005UL + 1442695040888963407UL;
+      while(now() < end);
+      break;
+
+    case WORK_MEM:
+      //random read-modify-write over a buffer bigger than the caches
+      //(relaxed: plain loads and stores, lost updates don't matter)
+      do
+	for(int i = 0; i < 256; i++)
+	  {
+	    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+	    long *w = &mem_buf[s % mem_words];
+	    __atomic_store_n(w, __atomic_load_n(w, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	  }
+      while(now() < end);
+      break;
+
+    case WORK_ALLOC:
+      {
+	//a churn of short lived heap blocks, up to 64 alive at once
+	void *live[64] = {NULL};
+	int n = 0;
+	do
+	  for(int i = 0; i < 64; i++, n++)
+	    {
+	      s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+	      free(live[n % 64]);
+	      size_t size = 16 + (s % 65536);
+	      live[n % 64] = malloc(size);
+	      memset(live[n % 64], 0, size < 64 ? size : 64);
+	    }
+	while(now() < end);
+	for(int i = 0; i < 64; i++)
+	  free(live[i]);
+      }
+      break;
+
+    default:
+      break;
+    }
+
+  r->done_ns = now();
+
+  //keep the cpu loop from being optimized away
+  if(x == 0)
+    r->seed = s;
+
+  return r;
+}
+
+/**
+   \brief reap completions, record latency, resubmit in closed loop
+   \return NULL is returned
+*/
+void *reaper(void *arg)
+{
+  unsigned long rng = 0x9E3779B97F4A7C15UL;
+  bool seen_sentinel = false;
+  void *ret;
+
+  //the sentinel is submitted last; after it only stragglers remain
+  while(!seen_sentinel || reaped < submitted)
+    {
+      ret = NULL;
+      //both block while nothing is in flight (the pool's condWait()
+      //would return at once and spin)
+      if(mgr != NULL)
+	mgr->condWait(&ret);
+      else
+	pool->waitNext(&ret);
+
+      task_record *r = (task_record *)ret;
+      if(r == NULL)
+	continue;
+
+      reaped++;
+
+      if(r->sentinel)
+	seen_sentinel = true;
+      else
+	{
+	  //open loop: from the intended start (coordinated omission)
+	  pthread_mutex_lock(&stats_mutex);
+	  interval_hist.add(r->done_ns - r->intended_ns);
+	  pthread_mutex_unlock(&stats_mutex);
+	}
+
+      delete r;
+      records_live--;
+
+      //closed loop: every completion starts the next task
+      if(cfg.arrival == ARRIVE_CLOSED && !stopping)
+	submitRecord(newRecord(now(), &rng));
+    }
+
+  return NULL;
+}
+
+///hand a record to the manager in use
+bool submitRecord(task_record *r)
+{
+  r->submit_ns = now();
+  submitted++;
+
+  bool ok = (mgr != NULL) ? mgr->createThread(loadTask, r) != 0
+    : pool->submit(loadTask, r) != 0;
+
+  if(!ok)
+    {
+      submitted--;
+      delete r;
+      records_live--;
+    }
+  return ok;
+}
+
+///make a task record with a fresh duration and work kind
+task_record *newRecord(long long intended_ns, unsigned long *rng)
+{
+  task_record *r = new task_record;
+  records_live++;
+
+  r->intended_ns = intended_ns;
+  r->done_ns = 0;
+  r->sentinel = false;
+  r->seed = (unsigned long)(uniform(rng) * 4294967296.0) + 1;
+
+  double u = uniform(rng);
+  double mean = cfg.mean_us;
+  double d = mean;
+  switch(cfg.duration)
+    {
+    case DUR_FIXED:
+      break;
+    case DUR_EXP:
+      d = -log(1.0 - u) * mean;
+      break;
+    case DUR_LOGNORMAL:
+      {
+	//sigma 1, scaled so the mean stays mean_us
+	double z = sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * uniform(rng));
+	d = mean * exp(z - 0.5);
+      }
+      break;
+    case DUR_BIMODAL:
+      //90% short, 10% long, same mean
+      d = (u < 0.9) ? mean * 0.5 : mean * 5.5;
+      break;
+    }
+  r->duration_us = (long)d;
+
+  r->work = cfg.work;
+  if(r->work == WORK_MIX)
+    r->work = (work_kind)(int)(uniform(rng) * 3);
+
+  return r;
+}
+
+///print one interval line (and fold it into the totals)
+void report(long long elapsed_ns, long long interval_ns)
+{
+  latency_histogram h;
+
+  pthread_mutex_lock(&stats_mutex);
+  h = interval_hist;
+  interval_hist.clear();
+  pthread_mutex_unlock(&stats_mutex);
+
+  total_hist.merge(h);
+
+  long in_flight = submitted.load() - reaped.load();
+
+  printf("t=%llds|done=%lu|tput=%.0f/s|p50=%lldus|p99=%lldus|p999=%lldus"
+	 "|max=%lldus|inflight=%ld|rss=%.1fMB\n",
+	 elapsed_ns / 1000000000LL, h.total, h.total * 1e9 / interval_ns,
+	 h.percentile(0.50) / 1000, h.percentile(0.99) / 1000,
+	 h.percentile(0.999) / 1000, h.max_ns / 1000, in_flight, rssMB());
+  fflush(stdout);
+}
+
+///resident set size in megabytes
+double rssMB()
+{
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if(f != NULL)
+    {
+      if(fscanf(f, "%ld %ld", &pages, &resident) != 2)
+	resident = 0;
+      fclose(f);
+    }
+  return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+///xorshift random number in [0, 1)
+double uniform(unsigned long *s)
+{
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return (*s >> 11) * (1.0 / 9007199254740992.0);
+}
+
+///parse the command line into cfg
+bool parse(int argc, char *argv[])
+{
+  cfg.pool = false;
+  cfg.arrival = ARRIVE_POISSON;
+  cfg.rate = 2000;
+  cfg.clients = 16;
+  cfg.duration = DUR_EXP;
+  cfg.mean_us = 200;
+  cfg.work = WORK_MIX;
+  cfg.mem_mb = 64;
+  cfg.seconds = 10;
+  cfg.interval = 1;
+
+  int c;
+  while((c = getopt(argc, argv, "m:a:r:c:d:u:k:M:t:i:")) != -1)
+    {
+      switch(c)
+	{
+	case 'm': cfg.pool = !strcmp(optarg, "pool"); break;
+	case 'a': cfg.arrival = !strcmp(optarg, "closed") ? ARRIVE_CLOSED : ARRIVE_POISSON; break;
+	case 'r': cfg.rate = atof(optarg); break;
+	case 'c': cfg.clients = atoi(optarg); break;
+	case 'd':
+	  cfg.duration = !strcmp(optarg, "fixed") ? DUR_FIXED
+	    : !strcmp(optarg, "lognormal") ? DUR_LOGNORMAL
+	    : !strcmp(optarg, "bimodal") ? DUR_BIMODAL : DUR_EXP;
+	  break;
+	case 'u': cfg.mean_us = atol(optarg); break;
+	case 'k':
+	  cfg.work = !strcmp(optarg, "cpu") ? WORK_CPU
+	    : !strcmp(optarg, "mem") ? WORK_MEM
+	    : !strcmp(optarg, "alloc") ? WORK_ALLOC : WORK_MIX;
+	  break;
+	case 'M': cfg.mem_mb = atol(optarg); break;
+	case 't': cfg.seconds = atol(optarg); break;
+	case 'i': cfg.interval = atol(optarg); break;
+	default:
+	  std::cerr << "usage: loadgen [-m mgr|pool] [-a poisson|closed] [-r rate]"
+		    << " [-c clients] [-d fixed|exp|lognormal|bimodal] [-u usec]"
+		    << " [-k cpu|mem|alloc|mix] [-M mbytes] [-t seconds] [-i seconds]"
+		    << std::endl;
+	  return false;
+	}
+    }
+
+  if(cfg.rate <= 0 || cfg.clients < 1 || cfg.mean_us < 0 || cfg.mem_mb < 1
+     || cfg.seconds < 1 || cfg.interval < 1)
+    {
+      std::cerr << "loadgen: bad option value" << std::endl;
+      return false;
+    }
+
+  return true;
+}
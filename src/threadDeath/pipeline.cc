@@ -0,0 +1,181 @@
+/** \file pipeline.cc
+
+\brief Staged pipeline example
+
+\par Purpose:
+Runs a parse -> transform -> aggregate -> emit chain with the
+Pipeline class (see Pipeline.h). Each stage has its own worker
+threads and the stages hand items to each other through bounded
+queues, so main() only feeds the first stage.
+<br>
+<br>
+The same work is then done the threadDeath3.cc way (one
+createThread() / condWait() per item per hop) for comparison.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <atomic>
+
+#include "Pipeline.h"
+
+///number of records pushed through the pipeline
+#define RECORDS 200000
+
+///one record flowing through the stages
+struct record
+{
+  ///input text
+  char text[16];
+
+  ///parsed / transformed value
+  long value;
+};
+
+///running total built by the aggregate stage
+std::atomic<long> total(0);
+
+///records seen by the emit stage
+std::atomic<long> emitted(0);
+
+///Example stage: text -> value
+void *parseFunc(void *arg);
+
+///Example stage: value -> value * value % 1000
+void *transformFunc(void *arg);
+
+///Example stage: add to the running total
+void *aggregateFunc(void *arg);
+
+///Example stage: print every 50000th record
+void *emitFunc(void *arg);
+
+///monotonic clock in nanoseconds
+long long now();
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  ThreadMgr m;
+  record *records = new record[RECORDS];
+  long i;
+
+  for(i = 0; i < RECORDS; i++)
+    snprintf(records[i].text, sizeof(records[i].text), "%ld", i);
+
+  //##########################################################
+  std::cout << "Pipeline:" << std::endl;
+  //##########################################################
+
+  long long start = now();
+  {
+    Pipeline p(m);
+
+    p.addStage("parse", parseFunc, 2, 1024, 64);
+    p.addStage("transform", transformFunc, 2, 1024, 64);
+    p.addStage("aggregate", aggregateFunc, 1, 1024, 64);
+    p.addStage("emit", emitFunc, 1, 256, 64);
+
+    if(p.start() < 0)
+      {
+	std::cout << "pipeline start FAIL" << std::endl;
+	return(1);
+      }
+
+    for(i = 0; i < RECORDS; i++)
+      p.push(&records[i]);
+
+    p.close();
+    p.wait();
+
+    p.printStats(std::cout);
+  }
+  long long elapsed = now() - start;
+
+  std::cout << "total=" << total.load()
+	    << "|emitted=" << emitted.load()
+	    << "|records/s=" << (long long)(RECORDS * 1e9 / elapsed)
+	    << std::endl;
+
+  //##########################################################
+  std::cout << "\n" << "createThread / condWait per hop:" << std::endl;
+  //##########################################################
+
+  /* the old way: main() serializes every hand off. Only a slice of
+     the records -one thread per item per stage is slow.
+  */
+  total = 0;
+  emitted = 0;
+
+  void *(*stages[])(void *) = {parseFunc, transformFunc, aggregateFunc, emitFunc};
+  const long slice = 2000;
+  void *ret;
+
+  start = now();
+  for(i = 0; i < slice; i++)
+    {
+      void *item = &records[i];
+      for(int s = 0; s < 4 && item != NULL; s++)
+	{
+	  m.waitFor(m.createThread(stages[s], item), &ret);
+	  item = ret;
+	}
+    }
+  elapsed = now() - start;
+
+  std::cout << "total=" << total.load()
+	    << "|emitted=" << emitted.load()
+	    << "|records/s=" << (long long)(slice * 1e9 / elapsed)
+	    << std::endl;
+
+  delete [] records;
+
+  //exit normally
+  return(0);
+}
+
+///Example stage: text -> value
+void *parseFunc(void *arg)
+{
+  record *r = (record *)arg;
+  r->value = strtol(r->text, NULL, 10);
+  return r;
+}
+
+///Example stage: value -> value * value % 1000
+void *transformFunc(void *arg)
+{
+  record *r = (record *)arg;
+  r->value = (r->value * r->value) % 1000;
+  return r;
+}
+
+///Example stage: add to the running total
+void *aggregateFunc(void *arg)
+{
+  record *r = (record *)arg;
+  total.fetch_add(r->value, std::memory_order_relaxed);
+  return r;
+}
+
+///Example stage: print every 50000th record
+void *emitFunc(void *arg)
+{
+  record *r = (record *)arg;
+
+  if(emitted.fetch_add(1, std::memory_order_relaxed) % 50000 == 0)
+    std::cout << "emit:" << r->text << "->" << r->value << std::endl;
+
+  //last stage: nothing to pass on
+  return NULL;
+}
+
+///monotonic clock in nanoseconds
+long long now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -0,0 +1,255 @@
+/** \file sharedBuffer.cc
+
+\brief MB payloads to and from ThreadMgr tasks, copied and shared
+
+\par Purpose:
+A payload of [MB] (64 by default) lines is split between [tasks]
+tasks; each task counts the lines of its part and gives the part back.
+It is done twice:
+<ul>
+<li>the threadDeath3.cc way: each task is passed a new std::string
+holding its part and returns a new std::string that main prints from
+and deletes (two copies of the payload)</li>
+<li>with SharedBuffer (see SharedBuffer.h): each task is passed a
+slice of the payload and hands the same slice back through condWait();
+main strings the returned slices together in a SharedRope (no copy)</li>
+</ul>
+Both are timed and the line counts checked. The rope must be the
+payload, in one piece, and flatten() must give back the payload's own
+bytes. Last, a buffer is placed in a shared memory segment and a
+forked child attaches to it, checks it and drops its views.
+
+\par Usage:
+sharedBuffer [MB] [tasks]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ThreadMgr.h"
+#include "SharedBuffer.h"
+
+///one task's part, copied
+struct copy_part
+{
+  std::string *in;
+  long lines;
+};
+
+///one task's part, shared
+struct shared_part
+{
+  SharedBuffer in;
+  long lines;
+};
+
+///newlines in n bytes
+long countLines(const char *p, size_t n);
+
+///Example Thread function: count a copied part, return a copy of it
+void *copyTask(void *arg);
+
+///Example Thread function: count a shared part, hand it back
+void *sharedTask(void *arg);
+
+///print one pass
+void show(const char *label, long long ns, size_t bytes, size_t copied, long lines);
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  size_t size = (size_t)((argc > 1) ? atol(argv[1]) : 64) << 20;
+  int tasks = (argc > 2) ? atoi(argv[2]) : 8;
+  if(tasks < 1)
+    tasks = 1;
+
+  //storage for the thread return values (condWait() writes here)
+  void *ret_storage = NULL;
+  void **ret = &ret_storage;
+
+  //the payload, written straight into its buffer
+  char *fill;
+  SharedBuffer whole(size, &fill);
+  if(fill == NULL)
+    return 1;
+  static const char line[] = "a line of the payload, the same one over and over again\n";
+  long expect = 0;
+  for(size_t at = 0; at < size; at += sizeof(line) - 1, expect++)
+    memcpy(fill + at, line, (size - at < sizeof(line) - 1) ? size - at : sizeof(line) - 1);
+  if(size % (sizeof(line) - 1) != 0)
+    expect--;
+
+  ThreadMgr m;
+  size_t part = size / tasks;
+
+  //##########################################################
+  //copies: a std::string in, a new std::string out
+  //##########################################################
+  std::vector<copy_part> cp(tasks);
+  long long t0 = ThreadTrace::now();
+  for(int i = 0; i < tasks; i++)
+    {
+      size_t n = (i == tasks - 1) ? size - part * i : part;
+      cp[i].in = new std::string(whole.data() + part * i, n);
+      cp[i].lines = 0;
+      m.createThread(copyTask, &cp[i]);
+    }
+  size_t back = 0;
+  while(m.threadsActive())
+    {
+      m.condWait(ret);
+      if(*ret != NULL)
+	{
+	  back += ((std::string *)*ret)->size();
+	  delete (std::string *)*ret;
+	}
+    }
+  long lines = 0;
+  for(int i = 0; i < tasks; i++)
+    {
+      lines += cp[i].lines;
+      delete cp[i].in;
+    }
+  show("std::string", ThreadTrace::now() - t0, back, 2 * size, lines);
+  if(lines != expect || back != size)
+    {
+      std::cout << "FAILED: lines=" << lines << "|expected=" << expect << std::endl;
+      return 1;
+    }
+
+  //##########################################################
+  //shared: a slice in, the same slice back
+  //##########################################################
+  SharedRope rope;
+  {
+    std::vector<shared_part> sp(tasks);
+    std::vector<SharedBuffer> results(tasks);
+    t0 = ThreadTrace::now();
+    for(int i = 0; i < tasks; i++)
+      {
+	sp[i].in = whole.slice(part * i, (i == tasks - 1) ? (size_t)-1 : part);
+	sp[i].lines = 0;
+	m.createThread(sharedTask, &sp[i]);
+      }
+    while(m.threadsActive())
+      {
+	m.condWait(ret);
+	if(*ret == NULL)
+	  continue;
+
+	//the view comes out of the thread's result arena, then the
+	//arena goes back
+	SharedBuffer r = SharedBuffer::takeOver(*ret);
+	m.releaseResult(*ret);
+	for(int i = 0; i < tasks; i++)
+	  if(r.data() == sp[i].in.data())
+	    results[i] = std::move(r);
+      }
+    for(int i = 0; i < tasks; i++)
+      rope.append(results[i]);
+    lines = 0;
+    for(int i = 0; i < tasks; i++)
+      lines += sp[i].lines;
+    show("SharedBuffer", ThreadTrace::now() - t0, rope.size(), 0, lines);
+  }
+
+  SharedBuffer flat = rope.flatten();
+  std::cout << "rope: pieces=" << rope.pieces() << "|same bytes as the payload="
+	    << (rope.equals(whole.data(), size) ? "yes" : "no")
+	    << "|flatten copied=" << (flat.data() == whole.data() ? "no" : "yes")
+	    << "|refs=" << whole.refs() << std::endl;
+  if(lines != expect || !rope.equals(whole.data(), size) || rope.pieces() != 1 ||
+     flat.data() != whole.data())
+    {
+      std::cout << "FAILED: lines=" << lines << "|expected=" << expect << std::endl;
+      return 1;
+    }
+  rope = SharedRope();
+  flat = SharedBuffer();
+  std::cout << "refs once the rope is gone=" << whole.refs() << std::endl;
+
+  //##########################################################
+  //shared memory: the same block layout in a MAP_SHARED segment
+  //##########################################################
+  size_t n = (size < (1 << 20)) ? size : (1 << 20);
+  void *seg = mmap(NULL, SharedBuffer::placeSize(n), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(seg == MAP_FAILED)
+    return 1;
+  {
+    SharedBuffer placed = SharedBuffer::place(seg, whole.data(), n);
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0)
+      {
+	int bad;
+	{
+	  SharedBuffer b = SharedBuffer::attach(seg);
+	  SharedBuffer half = b.slice(n / 2);
+	  bad = (memcmp(half.data(), whole.data() + n / 2, n - n / 2) != 0 || b.refs() != 3);
+	}
+	_exit(bad);
+      }
+    int status = -1;
+    if(pid > 0)
+      waitpid(pid, &status, 0);
+    std::cout << "shared memory: child check=" << (status == 0 ? "OK" : "FAILED")
+	      << "|refs after the child=" << SharedBuffer::placedRefs(seg) << std::endl;
+    if(status != 0)
+      return 1;
+  }
+  std::cout << "shared memory: refs once dropped=" << SharedBuffer::placedRefs(seg)
+	    << " (the segment may be reused)" << std::endl;
+  munmap(seg, SharedBuffer::placeSize(n));
+
+  //exit normally
+  return(0);
+}
+
+long countLines(const char *p, size_t n)
+{
+  long lines = 0;
+  const char *end = p + n;
+  while((p = (const char *)memchr(p, '\n', end - p)) != NULL)
+    {
+      lines++;
+      p++;
+    }
+  return lines;
+}
+
+void *copyTask(void *arg)
+{
+  copy_part *p = (copy_part *)arg;
+  p->lines = countLines(p->in->data(), p->in->size());
+
+  /** \return a new std::string (as myStringFunc() does), deleted by main */
+  return new std::string(*p->in);
+}
+
+void *sharedTask(void *arg)
+{
+  shared_part *p = (shared_part *)arg;
+
+  //a reference of our own, not a copy of the bytes
+  SharedBuffer in(p->in);
+  p->lines = countLines(in.data(), in.size());
+
+  /** \return the view, taken back with SharedBuffer::takeOver() */
+  return in.handOff();
+}
+
+void show(const char *label, long long ns, size_t bytes, size_t copied, long lines)
+{
+  std::cout << std::setw(12) << label << ": ms=" << std::fixed << std::setprecision(2)
+	    << ns / 1e6 << "|MB back=" << (bytes >> 20) << "|MB copied=" << (copied >> 20)
+	    << "|lines=" << lines << std::endl;
+}
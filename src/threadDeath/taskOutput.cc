@@ -0,0 +1,162 @@
+/** \file taskOutput.cc
+
+\brief Merged per task output against std::cout
+
+\par Purpose:
+64 (by default) ThreadMgr tasks chatter: each writes a few hundred
+lines made of several << pieces. The run is done with the tasks
+writing straight to std::cout and then to ThreadOutput::out() (see
+ThreadOutput.h) per task, per line and in submit order. The output
+goes to a file; every line is checked to be whole, and in ordered mode
+the tasks are checked to come out one after the other in submit
+order. Times per line go to the terminal.
+
+\par Usage:
+taskOutput [tasks] [lines per task] [output file]
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <fcntl.h>
+
+#include "ThreadMgr.h"
+
+///lines each task writes
+long lines = 500;
+
+///Example Thread function: a chatty task
+void *chatter(void *arg);
+
+///run tasks chattering tasks, return elapsed nsec
+long long run(int tasks);
+
+///check file: whole lines, and (ordered) task order
+void check(const char *file, long *whole, long *torn, bool *in_order);
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  int tasks = (argc > 1) ? atoi(argv[1]) : 64;
+  lines = (argc > 2) ? atol(argv[2]) : 500;
+  const char *file = (argc > 3) ? argv[3] : "/tmp/taskOutput.out";
+  long whole, torn;
+  bool in_order;
+  long long base = 0;
+
+  std::cout << tasks << " tasks x " << lines << " lines -> " << file << std::endl;
+
+  for(int pass = 0; pass < 4; pass++)
+    {
+      static const char *label[] = {"std::cout", "ThreadOutput per task",
+				    "ThreadOutput per line", "ThreadOutput ordered"};
+      ThreadOutput::output_stats os;
+
+      //output to the file
+      std::cout.flush();
+      int saved = dup(STDOUT_FILENO);
+      int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      dup2(fd, STDOUT_FILENO);
+      close(fd);
+
+      ThreadOutput::reset();
+      if(pass == 1)
+	ThreadOutput::start(STDOUT_FILENO, ThreadOutput::PER_TASK);
+      else if(pass == 2)
+	ThreadOutput::start(STDOUT_FILENO, ThreadOutput::PER_LINE);
+      else if(pass == 3)
+	ThreadOutput::start(STDOUT_FILENO, ThreadOutput::PER_TASK, true);
+
+      long long ns = run(tasks);
+
+      ThreadOutput::stop();
+      ThreadOutput::getStats(&os);
+      std::cout.flush();
+      dup2(saved, STDOUT_FILENO);
+      close(saved);
+
+      check(file, &whole, &torn, &in_order);
+      if(pass == 0)
+	base = ns;
+
+      std::cout << label[pass] << ": ns/line=" << (double)ns / (tasks * lines);
+      if(pass > 0)
+	std::cout << "|speedup=" << (double)base / ns << "x";
+      std::cout << "|whole=" << whole << "|torn=" << torn;
+      if(pass == 3)
+	std::cout << "|submit order=" << (in_order ? "yes" : "NO");
+      if(pass > 0)
+	std::cout << "|writes=" << os.writes;
+      std::cout << std::endl;
+    }
+
+  //exit normally
+  return(0);
+}
+
+///run tasks chattering tasks, return elapsed nsec
+long long run(int tasks)
+{
+  void *ret;
+  long long start = ThreadTrace::now();
+  {
+    //a fresh manager: task numbers start at 1 for ordered mode
+    ThreadMgr m;
+    for(long t = 0; t < tasks; t++)
+      m.createThread(chatter, (void *)t);
+    while(m.threadsActive())
+      m.condWait(&ret);
+  }
+  std::cout.flush();
+  return ThreadTrace::now() - start;
+}
+
+/**
+   \brief write lines lines of several pieces each
+   \return NULL is returned
+*/
+void *chatter(void *arg)
+{
+  long id = (long)arg;
+  std::ostream &out = ThreadOutput::out();
+  for(long n = 0; n < lines; n++)
+    out << "task " << id << " line " << n << " state=" << (n & 3)
+	<< " value=" << n * 37 << " end" << std::endl;
+  return NULL;
+}
+
+///check file: whole lines, and (ordered) task order
+void check(const char *file, long *whole, long *torn, bool *in_order)
+{
+  std::ifstream in(file);
+  std::string line;
+  long task = -1, prev_task = -1, count = 0;
+  *whole = *torn = 0;
+  *in_order = true;
+
+  while(std::getline(in, line))
+    {
+      if(line.compare(0, 5, "task ") != 0 || line.size() < 4 ||
+	 line.compare(line.size() - 4, 4, " end") != 0 ||
+	 line.find("task ", 1) != std::string::npos)
+	{
+	  (*torn)++;
+	  *in_order = false;
+	  continue;
+	}
+      (*whole)++;
+
+      //each task's lines as one run, tasks in creation order
+      task = atol(line.c_str() + 5);
+      if(task != prev_task)
+	{
+	  if(task != prev_task + 1 || (prev_task >= 0 && count != lines))
+	    *in_order = false;
+	  prev_task = task;
+	  count = 0;
+	}
+      count++;
+    }
+}
@@ -13,8 +13,8 @@ For more fundamental examples see documentation for files
 threadDeath1.cc and threadDeath2.cc.
 <br>
 <br>
-The class ThreadMgr uses a map and a stack from the C++ STL to
-track thread IDs and their runtime status. While ThreadMgr does add
+The class ThreadMgr uses a map from the C++ STL and an intrusive
+FIFO to track thread IDs and their runtime status. While ThreadMgr does add
 some overhead to basic pthread management (in the form of some
 memory usage and slightly slower thread creation and destruction)
 the class offers a relatively easy to use interface to pthreads in
@@ -23,405 +23,11 @@ it a template) and the like.
 */
 
 #include <iostream>
-#include <stack>
-#include <map>
-#include <algorithm>
 #include <cstring>
 #include <pthread.h>
 
-/** 
-    \brief A basic thread management class
-
-    \author Karl N. Redman (karl.redman@gmail.com)
-
-    \par Purpose:
-    This is an example class intended to be used as a guidline for the
-    work required to handle pthreads where the main process (the
-    parent of the initial threads) waits on a condition variable for
-    the threads to terminate. The functions that are specified for the
-    pthread_create are user defined. <br>
-    <br>
-    This class should be pretty fast and relatively easy to use for
-    most general purpose thread programming. In general, it's a good
-    place to start.
-    <br>
-    <br>
-    Basic pthread "voidness" has been retained for demonstration
-    purposes. It is concevable that this class could be instantiated
-    from and / or altered to make the user interface easier to work
-    with (in other words -we could get rid of much of the user end
-    casting through inheritance).
-
-    \note
-    This class is not intended for use by detached threads unless some
-    of the functions are overridden. Also, the use of long casting was
-    used in favor of readability in the interests of speed.
-*/
-class ThreadMgr {
-private:
-  ///structure for static wrapper function arguments
-  struct func_arguments
-  {
-    ///pointer to user defined function
-    void *(*func)(void *);
-
-    ///function to call when we are canceled
-    void (*cancel_func)(void *);
-
-    ///user arguments for user function
-    void *arg;
-
-    ///the this object -one per thread...EEEEK!
-    ThreadMgr *thisObject;	//! probably redundant. 
-  };
-  
-public:
-  ///constructor
-  ThreadMgr() 
-  { 
-    /** \note this function instantiates static pthread_x_t variables
-	for mutexes and a condition variable
-    */
-
-    //the data mutex
-    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; 
-    m_mutex = &mutex; 
-
-    //the condition variable mutex
-    static pthread_mutex_t cond_mutex = PTHREAD_MUTEX_INITIALIZER;
-    m_cond_mutex = &cond_mutex;
-
-    //the condition variable
-    static pthread_cond_t cond_var = PTHREAD_COND_INITIALIZER;
-    m_cond_var = &cond_var;
-  }
-
-  ///cancel a thread
-  int cancel_thread(pthread_t *tid)
-  {
-    /**
-       \return return value of a pthread_cancel() for parameter tid
-       \param tid pointer to the thread id to kill
-    */
-    /** \warning
-	If the thread has allocated dynamic memory and has been canceled
-	this class does not compensate. In other words, never cancel a
-	thread (with this class) that allocates dynamic memory -you will
-	lose your pointer. This is because pthread_cancel does not allow
-	you to recieve anything back from a canceled thread. However,
-	you could delete your pointer before you retrurn from the thread
-	if that is your wish.
-    */
-
-    /** \warning
-	use of the function pthread_cancel() for threads managed by this
-	class may result in loss of dynamic memory pointers, or worse,
-	a race condition for m_mutex resulting in a deadlock of the
-	threads. Don not use pthread_cancel() for threads managed by
-	this class. Use ThreadMgr::cancel_thread() instead.
-    */
-
-    /** \todo add more robust thread canceling ability */
-
-    //cancel a thread
-    int ret = 0;
-    pthread_mutex_lock(m_mutex);	//lock the data mutex 
-    m_ids.erase(*tid);			//remove from id map
-
-    //cancel the thread
-    ret = pthread_cancel(*tid);
-    
-    pthread_mutex_unlock(m_mutex);	// unlock data mutex
-
-    return ret; 
-  }
-
-  ///wait on a condition variable for a thread to terminate
-  int condWait(void **thread_return_val)
-  {
-    /** 
-	\par Purpose: 
-	Act like a seamless condition variable. Allows a process to
-	block until a thread has terminated and returns the thread
-	functions return value through the parameter.
-
-	\param a pointer to the pointer of the threads return value.
-	\return pthread_join status from removeTerminated()
-    */
-
-    /** \warning
-	This function may not be safe for threads that are canceled
-    */
-
-    int ret = 0;
-    
-    //condition variable mutex lock
-    pthread_mutex_lock(m_cond_mutex);
-
-    //check predicate
-    while(no_threads_terminated())
-      {
-	//wait on condition variable
-	pthread_cond_wait(m_cond_var, m_cond_mutex);
-      }
-
-
-    //remove the thread from the terminated list (handle join)
-    ret = removeTerminated(thread_return_val);
-
-    //unlock
-    pthread_mutex_unlock(m_cond_mutex);
-
-    //return join status
-    return ret;
-  }
-
-  ///attempt to create a new thread and register it
-  //int createThread( void *(*thread_func)(void *), void *arg)
-  pthread_t createThread( void *(*thread_func)(void *), void *arg)
-  {
-    /** 
-	\par Purpose:
-	Create a new thread and register it for management by this
-	class.
-
-	\return 0 on error, pthread_t thread ID on success
-
-	\param pointer to function to run as thread, pointer to
-	argument. [i.e. createThread(myfunc, arg);]
-
-	\note
-	This function works by building the an argument list from the
-	one provided by the user and some internal stuff in order to
-	call an internal function that sets things up for return
-	values, etc. and then calls the users function. This adds
-	about the size of 8 (roughly) pointers to the memory usage of
-	each thread being created -but that's the price for wanting to
-	keep track of this stuff generically i guess.
-    */
-    
-    pthread_t tid = 0;		// Id of thread
-    int ret_val;		// return value
- 
-    //arguments for the function
-    struct func_arguments *arguments = new func_arguments;
-
-    arguments->func = thread_func;	// users function
-    arguments->cancel_func = NULL; 	// NOT IMPLIMENTED
-    arguments->arg = arg;		// users argument
-
-    //this is the this pointer (so far, every thread get's one -eek!)
-    arguments->thisObject = this;
-
-    //create a new thread
-    /*
-      default attributes (for now), 
-      internal function, func(), calls users function,
-      arguments contain other info + user's argument.
-    */
-    ret_val = pthread_create(&tid, (pthread_attr_t *) NULL, func, (void *)arguments);
-
-    if(ret_val == 0)
-      {
-	//register the thread and arguments in the ids map
-	addID(tid, arguments);
-    
-	//return thread id
-	return tid;
-      }
-    else
-      std::cout << "pthread_create FAIL" << std::endl;
-
-
-    //return 0 on error
-    return 0;
-  }
-  
-  ///return the number of active threads
-  int threadsActive()
-  { 
-    pthread_mutex_lock(m_mutex);
-    int ret =  m_ids.size(); 
-    pthread_mutex_unlock(m_mutex);
-    
-    return ret;
-  }
-    
-  ///answers the question "are there no theads terminated?"
-  bool no_threads_terminated()
-  {
-    /** \return boolean of terminated threads in terminate queue
-     */
-    pthread_mutex_lock(m_mutex);
-    bool ret = m_terminated.empty();
-    pthread_mutex_unlock(m_mutex);
-    return ret;
-  }
-    
-
-
-protected:
-  ///internal thread function
-  static void *func(void *arg)
-  {
-    /** 
-	\par Purpose:
-	This function is called from the call to pthread_create()
-	within member function createThread. This function handles
-	basic thread management issues and is a wrapper around the
-	user function -which is called from here as well.
-
-	\return NONE -this function shouldn't return!!! it calls
-	pthread_exit().
-
-	\param arg shold be a pointer to a func_arguments structure.
-    */
-
-    //convenience this object
-    ThreadMgr *thisObject = ((struct func_arguments *)arg)->thisObject;
-
-    //return argument from user function
-    void *tmpArg = NULL;
-
-    //basic cancel stuff -should be more robust
-    struct func_arguments *cancel_arg = new func_arguments;
-    cancel_arg->cancel_func = shutdown_thread;
-    cancel_arg->func = NULL;
-    cancel_arg->arg = NULL;
-    cancel_arg->thisObject = thisObject;
-
-    //set the cleanup function
-    pthread_cleanup_push(shutdown_thread, (void *)cancel_arg);
-
-    //call the user's function
-    tmpArg = ((struct func_arguments *)arg)->func( ((struct func_arguments *)arg)->arg );
-    //std::cout << "func() passing \"" << *(std::string *)tmpArg << "\" to pthread_exit()" << std::endl;
-
-    //delete (struct func_arguments *)arg;
-
-    //pop the cleanup handler off the cleanup stack
-    //delete the arg variable list from the createThread function.
-    pthread_cleanup_pop(1);
-    
-    //add this thread to the terminated list
-    thisObject->addTerminated(thisObject);
-
-    //exit this thread
-    pthread_exit(tmpArg);
-
-    //we will never get here
-    return NULL;
-  }
-
-  ///add a thread id to the m_terminated stack
-  static void *addTerminated(ThreadMgr *arg)
-  { 
-    //pthread_mutex_lock(((ThreadMgr *)arg)->m_mutex);
-    pthread_mutex_lock(arg->m_mutex);
-
-    //add self to list of stuff to be terminated (joined)
-    arg->m_terminated.push(pthread_self());
-
-    //broadcast to threads waiting on the condition variable to notify
-    //them to wake up
-    pthread_cond_broadcast(arg->m_cond_var);
-
-    pthread_mutex_unlock(arg->m_mutex);
-
-    //return NULL -blah
-    return NULL;
-  }
-
-  ///remove a terminated thread LIFO
-  int removeTerminated(void **return_val)
-  {
-    /**
-       \return result of pthread_join
-
-       \param pointer to user function return value pointer
-
-       \note the void **retrun_val is a result of the pthread_join.
-    **/
-    int ret = 0;
-    pthread_t tempID;
-
-    //lock critical section
-    pthread_mutex_lock(m_mutex);
-
-    //make sure we have something
-    if(!m_terminated.empty())
-      {
-	//get id from stack
-	tempID = m_terminated.top();
-
-	/** \warning the thread is unregistered only if the
-	    pthread_join was successfull. This may be a problem down
-	    the line (but VERY rare)
-	*/
-
-	//join with the terminated thread
-	if( (ret = pthread_join(tempID, return_val)) == 0)
-	  {
-	    //delete the arguments (created in createThread)
-	    //delete m_ids.find(tempID)->second;
-	    
-	    //get rid of the ID from active list
-	    m_ids.erase(tempID);
-	    
-	    //remove id from stack
-	    m_terminated.pop();
-	  }
-	else
-	  std::cout << "pthread_join() = " << ret << std::endl;
-      }
-
-    //unlock critical section
-    pthread_mutex_unlock(m_mutex);
-
-    //return value of pthread_join
-    return ret;
-  }
-
-  ///add a thread id to the id vector
-  void addID(pthread_t id, func_arguments *arg)
-  {
-    //lock the data mutex
-    pthread_mutex_lock(m_mutex);
-    
-    //add the thread to the std::map
-    m_ids.insert(std::make_pair(id, arg));
-
-    //unlock the data mutex
-    pthread_mutex_unlock(m_mutex);
-  }
-  
-  ///shutdown a thread from pthread_cleanup_pop().
-  static void shutdown_thread(void *arg)
-  {
-    /** \param arg must be void * per pthread_cleanup_x()
-     */
-    delete ((struct func_arguments *)arg);
-    return;
-  }
-
-
-private:
-  ///mutex for data access (m_ids, m_terminated)
-  pthread_mutex_t *m_mutex;
-
-  ///mutex for condition variable
-  pthread_mutex_t *m_cond_mutex;
-  
-  ///condition variable
-  pthread_cond_t *m_cond_var;
-
-  ///map of all thread ids and function attributes
-  std::map<pthread_t, ThreadMgr::func_arguments *> m_ids;
-
-  ///stack of terminated thread ids
-  std::stack<pthread_t> m_terminated;
-};
-
+#include "ThreadMgr.h"
+#include "SharedBuffer.h"
 
 //################## PROTOTYPES
 ///generic wait for string-centric threads
@@ -443,12 +49,25 @@ void *myStringFunc(void *arg);
 template <class T>
 void TwaitStringThreads(ThreadMgr *mgr, T return_value);
 
+///Example Thread function that gives up when its group is canceled
+void *myGroupFunc(void *arg);
+
+///print and delete a std::string return value (TaskGroup reaper)
+void reapString(void *return_value);
+
+///Example Thread function handing back a slice of a SharedBuffer
+void *mySliceFunc(void *arg);
+
 //################## MAIN
 ///the main function
 int main(int argc, char *argv[])
 {
-  void **return_val;
-  void **ret;
+  //storage for the thread return values (condWait() writes here)
+  void *return_storage = NULL;
+  void *ret_storage = NULL;
+
+  void **return_val = &return_storage;
+  void **ret = &ret_storage;
 
   //string literal for later use
   const char *pc = "987654321";
@@ -509,14 +128,14 @@ int main(int argc, char *argv[])
 	{
 	  //wait on the thread
 	  m.condWait(return_val);
-	  if(*return_val != NULL)
+	  if(*return_val != NULL && *return_val != PTHREAD_CANCELED)
 	    {
 	      std::cout << "#######################main:" << ((char *)(char *)*return_val) << std::endl;
 
-	      /* This cast is not entirely proper. See the next
-		 example for proper casting when deleting this pointer.
+	      /* myfunc2 allocates its return value from the thread's
+		 arena so we give the arena back rather than delete.
 	      */
-	      delete (char *)*return_val;
+	      m.releaseResult(*return_val);
 	    }
 	}
     }
@@ -558,8 +177,8 @@ int main(int argc, char *argv[])
 	     above */
 	  std::cout << "#######################main:" << ((char *)(char *)*return_val) << std::endl;
 
-	  //delete the pointer since it was valid (not NULL)
-	  delete ((char *)(char *)*return_val);
+	  //release the arena memory since it was valid (not NULL)
+	  m.releaseResult(*return_val);
 	}
     }
 
@@ -578,13 +197,11 @@ int main(int argc, char *argv[])
      cleaner example of returning an object
   */
 
-  /** \warning an attempt to declare void **ret after example 3
-   //yielded a consistant segmentation fault using "g++ (GCC) 3.3.3
-   20040125" this is considered to be a compler or linker error -I
-   didn't bother trying to figure it out (just be aware that these
-   things happen sometimes).
+  /** \note void **ret must point at real storage (ret_storage
+   above). condWait() writes the thread's return value through the
+   pointer, so an uninitialized void ** segfaults (with or without
+   optimization).
   */
-  //void **ret;
 
   //try to pass an object and get one back
   m.createThread(myStringFunc, (void *)str);
@@ -647,6 +264,147 @@ int main(int argc, char *argv[])
   //cleanup
   delete str1;
   delete str2;
+
+  //##########################################################
+  std::cout << "\n" << "Example 5:" << std::endl;
+  //##########################################################
+
+  /** \par Example 5:
+      Does what Example 4 does with a single manager by using
+      TaskGroup objects. Each group is waited on separately, a
+      nested group is covered by its parent, and a canceled group
+      lets its (cooperative) tasks stop early.
+  */
+  {
+    TaskGroup g1(m);
+    TaskGroup g2(m);
+    TaskGroup nested(m, &g2);
+
+    std::string s1("string1 for g1");
+    std::string s2("string2 for g2");
+    std::string s3("string3 for nested");
+
+    m.createThread(myStringFunc, (void *)&s1, &g1);
+    m.createThread(myStringFunc, (void *)&s2, &g2);
+    m.createThread(myStringFunc, (void *)&s3, &nested);
+
+    //wait for the first thread of g2 (or nested) to come back
+    if(m.waitAny(&g2, ret) == 0 && *ret != NULL)
+      reapString(*ret);
+
+    //then the rest of g2 (which includes nested) and all of g1
+    i = m.waitAll(&g2, reapString);
+    std::cout << "g2 reaped:" << i << std::endl;
+    i = m.waitAll(&g1, reapString);
+    std::cout << "g1 reaped:" << i << std::endl;
+
+    //cancel a group of long running tasks
+    TaskGroup g3(m);
+    for(i = 0; i < 4; i++)
+      m.createThread(myGroupFunc, NULL, &g3);
+
+    i = m.cancelGroup(&g3);
+    std::cout << "canceled:" << i << std::endl;
+    i = m.waitAll(&g3);
+    std::cout << "g3 reaped:" << i << std::endl;
+  }
+
+  //##########################################################
+  std::cout << "\n" << "Example 6:" << std::endl;
+  //##########################################################
+
+  /** \par Example 6:
+      Join by handle. waitFor() waits for one particular thread no
+      matter what else terminates first; condWait() hands the other
+      completions out in the order they happened.
+  */
+  {
+    std::string s1("string for waitFor");
+
+    m.createThread((void *(*)(void *))myfunc1, NULL);
+    pret = m.createThread(myStringFunc, (void *)&s1);
+    m.createThread((void *(*)(void *))myfunc1, NULL);
+
+    if(m.waitFor(pret, ret) == 0 && *ret != NULL)
+      reapString(*ret);
+
+    while(m.threadsActive())
+      m.condWait(ret);
+
+    std::cout << "threads Active:" << m.threadsActive() << std::endl;
+
+    //the status counters are read without locking the manager
+    ThreadMgr::thread_counts c;
+    m.getCounts(&c);
+    std::cout << "submitted:" << c.submitted << "|joined:" << c.joined
+	      << "|queued:" << c.queued << "|terminated:" << c.terminated
+	      << std::endl;
+  }
+  
+  //##########################################################
+  std::cout << "\n" << "Example 7:" << std::endl;
+  //##########################################################
+
+  /** \par Example 7:
+      Example 2 with ThreadOutput running in ordered mode. The task
+      functions write to ThreadOutput::out(): each task's lines come
+      out together, in the order the tasks were created, whichever
+      finishes first. (A new manager, so its tasks count from 1.)
+  */
+  {
+    ThreadMgr m2;
+
+    ThreadOutput::start(STDOUT_FILENO, ThreadOutput::PER_TASK, true);
+
+    m2.createThread((void *(*)(void *))myfunc0, NULL);
+    m2.createThread((void *(*)(void *))myfunc2, (void *)pc);
+    m2.createThread((void *(*)(void *))myfunc1, NULL);
+    m2.createThread((void *(*)(void *))myfunc1, NULL);
+
+    while(m2.threadsActive())
+      {
+	m2.condWait(return_val);
+	if(*return_val != NULL)
+	  m2.releaseResult(*return_val);
+      }
+
+    ThreadOutput::stop();
+  }
+
+  //##########################################################
+  std::cout << "\n" << "Example 8:" << std::endl;
+  //##########################################################
+
+  /** \par Example 8:
+      Example 3 without the copies. The threads get slices of one
+      SharedBuffer (see SharedBuffer.h) instead of new strings and
+      hand a slice back through condWait() instead of a new string.
+      Nothing is deleted by hand: the block goes with its last view.
+  */
+  {
+    SharedBuffer text("a string from main|another string from main", 43);
+    SharedBuffer halves[2] = {text.slice(0, 18), text.slice(19)};
+    SharedRope back;
+
+    for(i = 0; i < 2; i++)
+      m.createThread(mySliceFunc, (void *)&halves[i]);
+
+    while(m.threadsActive())
+      {
+	m.condWait(ret);
+	if(*ret != NULL)
+	  {
+	    //take the view out of the result arena, then give it back
+	    SharedBuffer b = SharedBuffer::takeOver(*ret);
+	    m.releaseResult(*ret);
+	    std::cout << "main got back:" << b.view() << std::endl;
+	    back.append(b);
+	  }
+      }
+
+    std::cout << "pieces:" << back.pieces() << "|bytes:" << back.size()
+	      << "|views of the block:" << text.refs() << std::endl;
+  }
   
   //exit normally
   return(0);
@@ -762,11 +520,11 @@ void *myStringFunc(void *arg)
   //std::cout << "myStringFunc printing:" << *a << std::endl;
 
   //print the contents of arg as an std::string pointer
-  std::cout << "myStringFunc printing:" << *(std::string *)arg << std::endl;
+  ThreadOutput::out() << "myStringFunc printing:" << *(std::string *)arg << std::endl;
   
   //create a new string to be returned to the calling thread
   std::string *s = new std::string("a string from myStringFunc");
-  std::cout << "myStringFunc returning:" << *s << std::endl;
+  ThreadOutput::out() << "myStringFunc returning:" << *s << std::endl;
 
   //cast the object as a void pointer and return
   return ((void *)s);
@@ -780,12 +538,12 @@ void *myStringFunc(void *arg)
 */
 void *myfunc0(void *arg)
 {
-  std::cout << "got here: myfunc0:BEGIN" << std::endl;
+  ThreadOutput::out() << "got here: myfunc0:BEGIN" << std::endl;
 
   for(int i=10000; i > 0; i--)
     for(int i=10000; i > 0; i--);
 
-  std::cout << "got here: myfunc0:END" << std::endl;
+  ThreadOutput::out() << "got here: myfunc0:END" << std::endl;
 
   return NULL; 
 }
@@ -797,12 +555,12 @@ void *myfunc0(void *arg)
    
 void *myfunc1(void *arg)
 {
-  std::cout << "got here: myfunc1:BEGIN" << std::endl;
+  ThreadOutput::out() << "got here: myfunc1:BEGIN" << std::endl;
 
   for(int i=1000; i > 0; i--)
     for(int i=10000; i > 0; i--);
 
-  std::cout << "got here: myfunc1:END" << std::endl;
+  ThreadOutput::out() << "got here: myfunc1:END" << std::endl;
 
   return NULL; 
 }
@@ -813,29 +571,34 @@ void *myfunc1(void *arg)
    some amount of time (in a for loop) and return a pointer to the
    allocated memory.
 
+   \note The memory comes from the result region of the thread's
+   ThreadArena (not from new) so the waiter must hand it back with
+   ThreadMgr::releaseResult().
+
    \param a void *
    \return a char * cast to a void *
 */
 void *myfunc2(void *arg)
 {
-  std::cout << "got here: myfunc2:BEGIN" << std::endl;
+  ThreadOutput::out() << "got here: myfunc2:BEGIN" << std::endl;
 
   //print the value of arg from main
-  std::cout << "|arg = " << (char *)arg << std::endl;
+  ThreadOutput::out() << "|arg = " << (char *)arg << std::endl;
 
-  //create a new char and add data to the memory area
-  char *tmp = new char[10];
+  //create a new char and add data to the memory area (arena memory
+  //outlives this thread until main calls releaseResult())
+  char *tmp = (char *)ThreadArena::current()->result(10);
   char x[10] = {"123456789"};
 
   //cheezy, but whatever...
   memcpy(tmp, x, 10);
 
-  std::cout << "myfunc2:" << tmp << std::endl;
+  ThreadOutput::out() << "myfunc2:" << tmp << std::endl;
 
   for(int i=10000; i > 0; i--)
     for(int i=10000; i > 0; i--);
 
-  std::cout << "got here: myfunc2:END" << std::endl;
+  ThreadOutput::out() << "got here: myfunc2:END" << std::endl;
 
   /**
      \return a pointer to the new memory memory area that was
@@ -843,3 +606,63 @@ void *myfunc2(void *arg)
   */
   return tmp;
 }
+
+/**
+   \par Purpose:
+   Count like myfunc0 but check TaskGroup::cancelRequested() every
+   outer iteration so that ThreadMgr::cancelGroup() can stop us.
+
+   \return NULL is returned
+*/
+void *myGroupFunc(void *arg)
+{
+  for(int i=10000; i > 0; i--)
+    {
+      if(TaskGroup::cancelRequested())
+	{
+	  ThreadOutput::out() << "got here: myGroupFunc:CANCELED" << std::endl;
+	  return NULL;
+	}
+
+      for(volatile int j=10000; j > 0; j--);
+    }
+
+  ThreadOutput::out() << "got here: myGroupFunc:END" << std::endl;
+
+  return NULL; 
+}
+
+/**
+   \par Purpose:
+   Print and delete a std::string returned by myStringFunc. Passed to
+   ThreadMgr::waitAll() for each return value of a group.
+
+   \param return_value a std::string pointer cast to a void pointer
+*/
+void reapString(void *return_value)
+{
+  std::cout << "reapString:" << *(std::string *)return_value << std::endl;
+  delete (std::string *)return_value;
+}
+
+/**
+   \par Purpose:
+   Example 3's myStringFunc() without copying: prints the SharedBuffer
+   arg points to and returns the part of it after its first word (a
+   slice of the same block).
+
+   \param arg a SharedBuffer pointer cast to a void pointer (the
+   creator keeps it alive until the thread is reaped)
+
+   \return a SharedBuffer::handOff() record, taken back with
+   SharedBuffer::takeOver()
+*/
+void *mySliceFunc(void *arg)
+{
+  //a view of our own (bumps the count, copies nothing)
+  SharedBuffer in(*(SharedBuffer *)arg);
+  ThreadOutput::out() << "mySliceFunc printing:" << in.view() << std::endl;
+
+  SharedBuffer rest = in.slice(in.view().find(' ') + 1);
+  return rest.handOff();
+}
@@ -0,0 +1,137 @@
+/** \file threadPerf.cc
+
+\brief Per task hardware counter example
+
+\par Purpose:
+Turns on ThreadPerf (see ThreadPerf.h) and runs three kinds of
+ThreadMgr tasks: one chasing pointers through a buffer much larger
+than the caches, one full of unpredictable branches and one plain
+arithmetic loop. The report shows which is which from the counters
+alone -the first has the LLC misses, the second the branch misses and
+the third the high IPC.
+<br>
+<br>
+Where perf events are not available (no PMU in a virtual machine,
+perf_event_paranoid too strict) the reason is printed and whatever
+counters could be opened are reported.
+*/
+
+#include <iostream>
+#include <cstdlib>
+
+#include "ThreadMgr.h"
+
+///pointer chase buffer size (elements)
+#define CHASE_SIZE (8 * 1024 * 1024)
+
+///steps per task
+#define STEPS 2000000
+
+///Example Thread function: random pointer chase (cache miss heavy)
+void *chaseFunc(void *arg);
+
+///Example Thread function: random branches (branch miss heavy)
+void *branchFunc(void *arg);
+
+///Example Thread function: arithmetic loop (high IPC)
+void *computeFunc(void *arg);
+
+///one random cycle through the whole buffer
+unsigned int *chase;
+
+///random bytes for branchFunc
+unsigned char *coins;
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  void *ret;
+  unsigned int i;
+
+  //a single random cycle (Sattolo's shuffle) defeats the prefetchers
+  chase = new unsigned int[CHASE_SIZE];
+  for(i = 0; i < CHASE_SIZE; i++)
+    chase[i] = i;
+  srand(1);
+  for(i = CHASE_SIZE - 1; i > 0; i--)
+    {
+      unsigned int j = ((unsigned int)rand() * 2654435761u) % i;
+      unsigned int t = chase[i];
+      chase[i] = chase[j];
+      chase[j] = t;
+    }
+
+  coins = new unsigned char[STEPS];
+  for(i = 0; i < STEPS; i++)
+    coins[i] = rand() & 0xff;
+
+  ThreadTrace::nameFunction(chaseFunc, "chaseFunc");
+  ThreadTrace::nameFunction(branchFunc, "branchFunc");
+  ThreadTrace::nameFunction(computeFunc, "computeFunc");
+
+  if(!ThreadPerf::enable())
+    std::cout << "perf events unavailable: " << ThreadPerf::lastError() << std::endl;
+  else if(ThreadPerf::lastError()[0] != '\0')
+    std::cout << "some counters unavailable: " << ThreadPerf::lastError() << std::endl;
+
+  ThreadMgr m;
+
+  for(i = 0; i < 12; i++)
+    {
+      void *(*f)(void *) = (i % 3 == 0) ? chaseFunc : (i % 3 == 1) ? branchFunc : computeFunc;
+      m.createThread(f, NULL);
+    }
+
+  while(m.threadsActive())
+    m.condWait(&ret);
+
+  ThreadPerf::report(std::cout);
+
+  delete [] coins;
+  delete [] chase;
+
+  //exit normally
+  return(0);
+}
+
+/**
+   \brief follow the random cycle STEPS times
+   \return the final index (keeps the loop alive)
+*/
+void *chaseFunc(void *arg)
+{
+  unsigned long p = 0;
+  for(long n = 0; n < STEPS; n++)
+    p = chase[p];
+  return (void *)p;
+}
+
+/**
+   \brief branch on random bits
+   \return a count (keeps the loop alive)
+*/
+void *branchFunc(void *arg)
+{
+  unsigned long c = 0;
+  for(long n = 0; n < STEPS; n++)
+    {
+      if(coins[n] & 1)
+	c += 3;
+      else
+	c ^= n;
+    }
+  return (void *)c;
+}
+
+/**
+   \brief multiply and add in registers
+   \return the result (keeps the loop alive)
+*/
+void *computeFunc(void *arg)
+{
+  unsigned long x = 1;
+  for(long n = 0; n < STEPS * 4; n++)
+    x = x * 6364136223846793005UL + 1442695040888963407UL;
+  return (void *)x;
+}
@@ -0,0 +1,134 @@
+/** \file threadPool.cc
+
+\brief Elastic worker pool example
+
+\par Purpose:
+Example program for the ThreadPool class (see ThreadPool.h). The
+load is swung between a burst, a quiet period and a second burst
+while the pool statistics are printed, so the pool can be watched
+growing on queue latency and shrinking again after the linger time.
+<br>
+<br>
+For the thread-per-task model the pool is built on see
+threadDeath3.cc and the ThreadMgr class.
+*/
+
+#include <iostream>
+#include <unistd.h>
+
+#include "ThreadPool.h"
+
+///Example task function: spin for roughly arg microseconds
+void *spinFunc(void *arg);
+
+///submit count tasks, printing the stats every few milliseconds
+void burst(ThreadPool *pool, int count, long task_us);
+
+///wait for everything submitted so far
+void drain(ThreadPool *pool);
+
+///print the pool statistics with a label
+void show(ThreadPool *pool, const char *label);
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  ThreadPool::pool_config cfg;
+
+  //short linger / latency target so the example runs quickly
+  cfg.min_workers = 2;
+  cfg.max_workers = 16;
+  cfg.target_latency_us = 1000;
+  cfg.linger_ms = 200;
+  cfg.sample_ms = 5;
+
+  ThreadPool pool(cfg);
+  show(&pool, "start");
+
+  //##########################################################
+  std::cout << "\n" << "Burst 1:" << std::endl;
+  //##########################################################
+  burst(&pool, 400, 2000);
+  drain(&pool);
+  show(&pool, "after burst 1");
+
+  //##########################################################
+  std::cout << "\n" << "Quiet:" << std::endl;
+  //##########################################################
+
+  //idle workers linger out back down to min_workers
+  usleep(600 * 1000);
+  show(&pool, "after quiet");
+
+  //##########################################################
+  std::cout << "\n" << "Burst 2 (trickle):" << std::endl;
+  //##########################################################
+
+  //a trickle the minimum workers keep up with: no growth
+  for(int i = 0; i < 50; i++)
+    {
+      pool.submit(spinFunc, (void *)200L);
+      usleep(2000);
+    }
+  drain(&pool);
+  show(&pool, "after trickle");
+
+  //exit normally
+  return(0);
+}
+
+/**
+   \par Purpose:
+   Busy loop for arg microseconds (a stand in for real work).
+
+   \param arg number of microseconds cast to a void *
+   \return NULL
+*/
+void *spinFunc(void *arg)
+{
+  struct timespec start, ts;
+  long us = (long)arg;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+  while((ts.tv_sec - start.tv_sec) * 1000000L
+	+ (ts.tv_nsec - start.tv_nsec) / 1000 < us);
+
+  return NULL;
+}
+
+///submit count tasks, printing the stats every few milliseconds
+void burst(ThreadPool *pool, int count, long task_us)
+{
+  for(int i = 0; i < count; i++)
+    {
+      pool->submit(spinFunc, (void *)task_us);
+
+      if(i % 100 == 99)
+	{
+	  usleep(20 * 1000);
+	  show(pool, "burst");
+	}
+    }
+}
+
+///wait for everything submitted so far
+void drain(ThreadPool *pool)
+{
+  void *ret;
+
+  while(pool->pending())
+    pool->condWait(&ret);
+}
+
+///print the pool statistics with a label
+void show(ThreadPool *pool, const char *label)
+{
+  ThreadPool::pool_stats s;
+  pool->getStats(&s);
+
+  std::cout << label << ": ";
+  ThreadPool::printStats(std::cout, s);
+}
@@ -0,0 +1,128 @@
+/** \file threadTrace.cc
+
+\brief ThreadMgr task tracing example
+
+\par Purpose:
+Turns on ThreadTrace (see ThreadTrace.h), runs a few batches of
+ThreadMgr threads and writes the recorded submit / start / end / join
+and lock wait events as Chrome trace-event JSON. Load the output file
+in chrome://tracing or https://ui.perfetto.dev to see which task ran
+where and when.
+<br>
+<br>
+The cost of recording a single event is measured first so the
+overhead of leaving tracing on can be judged.
+
+\par Usage:
+threadTrace [output.json]
+*/
+
+#include <iostream>
+
+#include "ThreadMgr.h"
+
+///Example Thread function (short)
+void *shortFunc(void *arg);
+
+///Example Thread function (long)
+void *longFunc(void *arg);
+
+///spin for roughly us microseconds
+void spin(long us);
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  const char *path = (argc > 1) ? argv[1] : "threadTrace.json";
+  void *ret;
+  int i;
+
+  ThreadTrace::enable(1 << 16);
+  ThreadTrace::nameFunction(shortFunc, "shortFunc");
+  ThreadTrace::nameFunction(longFunc, "longFunc");
+
+  //##########################################################
+  std::cout << "Event cost:" << std::endl;
+  //##########################################################
+
+  /* record into this thread's ring in a tight loop. The ring wraps
+     so this does not use more memory than a normal run.
+  */
+  const int loops = 1000000;
+  long long start = ThreadTrace::now();
+  for(i = 0; i < loops; i++)
+    ThreadTrace::record(ThreadTrace::EV_JOIN, i);
+  long long elapsed = ThreadTrace::now() - start;
+
+  std::cout << "ns/event=" << (double)elapsed / loops << std::endl;
+
+  ThreadTrace::disable();
+  start = ThreadTrace::now();
+  for(i = 0; i < loops; i++)
+    if(ThreadTrace::on())
+      ThreadTrace::record(ThreadTrace::EV_JOIN, i);
+  elapsed = ThreadTrace::now() - start;
+
+  std::cout << "ns/disabled hook=" << (double)elapsed / loops << std::endl;
+
+  //start the real trace with empty rings
+  ThreadTrace::clear();
+  ThreadTrace::enable(1 << 16);
+
+  //##########################################################
+  std::cout << "\n" << "Tasks:" << std::endl;
+  //##########################################################
+
+  ThreadMgr m;
+
+  //a batch of mixed tasks reaped in completion order
+  for(i = 0; i < 16; i++)
+    m.createThread(i % 4 ? shortFunc : longFunc, NULL);
+
+  while(m.threadsActive())
+    m.condWait(&ret);
+
+  //a batch joined by handle, oldest first
+  pthread_t ids[8];
+  for(i = 0; i < 8; i++)
+    ids[i] = m.createThread(shortFunc, NULL);
+  for(i = 0; i < 8; i++)
+    m.waitFor(ids[i], &ret);
+
+  if(ThreadTrace::write(path))
+    std::cout << "trace written to " << path << std::endl;
+  else
+    std::cout << "could not write " << path << std::endl;
+
+  //exit normally
+  return(0);
+}
+
+///spin for roughly us microseconds
+void spin(long us)
+{
+  long long end = ThreadTrace::now() + us * 1000LL;
+  while(ThreadTrace::now() < end)
+    ;
+}
+
+/**
+   \brief spin for 1ms
+   \return NULL is returned
+*/
+void *shortFunc(void *arg)
+{
+  spin(1000);
+  return NULL;
+}
+
+/**
+   \brief spin for 10ms
+   \return NULL is returned
+*/
+void *longFunc(void *arg)
+{
+  spin(10000);
+  return NULL;
+}
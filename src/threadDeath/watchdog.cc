@@ -0,0 +1,150 @@
+/** \file watchdog.cc
+
+\brief Stalled task watchdog example
+
+\par Purpose:
+Starts ThreadWatchdog (see ThreadWatchdog.h) and runs a batch of
+short ThreadMgr tasks next to one that hangs without ever reporting
+progress (as if deadlocked) and one that runs just as long but calls
+ThreadWatchdog::heartbeat(). Only the silent one is
+reported. The task duration percentiles are printed afterwards.
+<br>
+<br>
+A ThreadPool capped at two workers then gets two stuck tasks followed
+by a queue of short ones. With stall_handoff set the pool adds a
+worker for each stalled task and the short tasks still get through.
+*/
+
+#include <iostream>
+
+#include "ThreadPool.h"
+
+///Example Thread function: about 1ms of work
+void *shortFunc(void *arg);
+
+///Example Thread function: hang for 600ms without a heartbeat
+void *silentFunc(void *arg);
+
+///Example Thread function: work for 600ms with heartbeats
+void *beatingFunc(void *arg);
+
+///block for roughly us microseconds
+void block(long us);
+
+//################## MAIN
+///the main function
+int main(int argc, char *argv[])
+{
+  ThreadWatchdog::watchdog_stats ws;
+  void *ret;
+  int i;
+
+  ThreadTrace::nameFunction(shortFunc, "shortFunc");
+  ThreadTrace::nameFunction(silentFunc, "silentFunc");
+  ThreadTrace::nameFunction(beatingFunc, "beatingFunc");
+
+  //short tasks get a tighter deadline, everything else 200ms
+  ThreadWatchdog::setDeadline(shortFunc, 150);
+  ThreadWatchdog::start(200, 20);
+
+  //##########################################################
+  std::cout << "ThreadMgr:" << std::endl;
+  //##########################################################
+
+  {
+    ThreadMgr m;
+
+    m.createThread(silentFunc, NULL);
+    m.createThread(beatingFunc, NULL);
+    for(i = 0; i < 200; i++)
+      m.createThread(shortFunc, NULL);
+
+    while(m.threadsActive())
+      m.condWait(&ret);
+  }
+
+  ThreadWatchdog::getStats(&ws);
+  ThreadWatchdog::printStats(std::cout, ws);
+
+  //##########################################################
+  std::cout << "\n" << "ThreadPool with stall hand off:" << std::endl;
+  //##########################################################
+
+  ThreadWatchdog::reset();
+  {
+    ThreadPool::pool_config cfg;
+    cfg.min_workers = 2;
+    cfg.max_workers = 2;
+    cfg.stall_handoff = true;
+    ThreadPool pool(cfg);
+    ThreadPool::pool_stats ps;
+
+    long long start = ThreadTrace::now();
+    pool.submit(silentFunc, NULL);
+    pool.submit(silentFunc, NULL);
+    for(i = 0; i < 100; i++)
+      pool.submit(shortFunc, NULL);
+
+    //the short tasks finish long before the stuck ones
+    for(i = 0; i < 100; i++)
+      pool.condWait(&ret);
+    std::cout << "100 short tasks done after "
+	      << (ThreadTrace::now() - start) / 1000000 << "ms" << std::endl;
+
+    while(pool.pending())
+      pool.condWait(&ret);
+
+    pool.getStats(&ps);
+    ThreadPool::printStats(std::cout, ps);
+  }
+
+  ThreadWatchdog::getStats(&ws);
+  ThreadWatchdog::printStats(std::cout, ws);
+  ThreadWatchdog::stop();
+
+  //exit normally
+  return(0);
+}
+
+///block for roughly us microseconds
+void block(long us)
+{
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  nanosleep(&ts, NULL);
+}
+
+/**
+   \brief about 1ms of work
+   \return NULL is returned
+*/
+void *shortFunc(void *arg)
+{
+  block(1000);
+  return NULL;
+}
+
+/**
+   \brief hang for 600ms, never reporting progress
+   \return NULL is returned
+*/
+void *silentFunc(void *arg)
+{
+  block(600000);
+  return NULL;
+}
+
+/**
+   \brief work for 600ms, reporting progress every 50ms
+   \return NULL is returned
+*/
+void *beatingFunc(void *arg)
+{
+  for(int i = 0; i < 12; i++)
+    {
+      block(50000);
+      ThreadWatchdog::heartbeat();
+    }
+  return NULL;
+}